@@ -16,9 +16,12 @@
 #include "KBD.h"
 #include "DAP_config.h"
 #include "DAP.h"
+#include "UART.h"
+#include "semihost.h"
 #include "stdio.h"
 
 extern void usbd_hid_process ();
+extern void usbd_msc_process ();
 
 void MY_printf_num(int num)
 {
@@ -26,6 +29,18 @@ void MY_printf_num(int num)
  sprintf (NumStringBuf, "%d", (uint32_t)num);
  GLCD_DisplayString (3, 0, 1, NumStringBuf);
 }
+
+/* GPDMA interrupt, shared by the SWO capture (channel 0) and the target
+   UART bridge (channels 1 and 2)                                             */
+void DMA_IRQHandler (void) {
+#if (SWO_UART != 0)
+  SWO_DMA_Handler();
+#endif
+#if (UART_BRIDGE != 0)
+  UART_DMA_Handler();
+#endif
+}
+
 int main (void) {
   static U8 but_ex;
          U8 but;
@@ -49,12 +64,30 @@ int main (void) {
 
   usbd_init();                          /* USB Device Initialization          */
   usbd_connect(__TRUE);                 /* USB Device Connect                 */
+  semihost_init();
+  semihost_enable();                    /* Serve the target semihost calls    */
 
   while (1) {                           /* Loop forever                       */
    //  but = (U8)(KBD_GetKeys ());
    // if (but ^ but_ex) {
    // buf[0] = but;
     usbd_hid_process();
+#if (MSC_DRIVE != 0)
+    usbd_msc_process();                 /* Reinsert the drive after an image  */
+#endif
+#if (UART_BRIDGE != 0)
+    UART_Process();                     /* Move target UART data              */
+#endif
+#if (DATA_WATCH != 0)
+    Watch_Process();                    /* Sample watched target memory       */
+#endif
+    Stream_Process();                   /* Stream SWO trace and watch samples */
+#if (PC_SAMPLING != 0)
+    Profile_Process();                  /* Sample the target PC               */
+#endif
+#if (SEMIHOST != 0)
+    Semihost_Process();                 /* Serve semihost calls of the target */
+#endif
 //		LPC_GPIO_PORT->CLR[5] = (1<<3);
 //		LPC_GPIO_PORT->SET[5] = (1<<3);
 //	  LPC_GPIO_PORT->CLR[5] = (1<<4);
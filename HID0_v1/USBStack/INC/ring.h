@@ -0,0 +1,134 @@
+/* CMSIS-DAP Interface Firmware
+ * Copyright (c) 2009-2013 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef RING_H
+#define RING_H
+
+#include <stdint.h>
+#include <string.h>
+
+// Single producer, single consumer ring of 2^n elements
+//
+// The ring only keeps the indexes, the caller owns the element storage and
+// addresses it with the index returned by ring_reserve and ring_peek. Both
+// indexes run freely, so all size elements are usable and a full ring is
+// told from an empty one without a flag. Only the producer changes in, only
+// the consumer changes out, so one side may run in an interrupt handler and
+// the other in the main loop without locking.
+//
+// Producer: ring_reserve, fill the elements, ring_commit.
+// Consumer: ring_peek, use the elements, ring_release.
+
+#ifndef __DMB
+#define __DMB()     __dmb(0xF)          // armcc intrinsic, as in CMSIS core_cmInstr.h
+#endif
+
+typedef struct {
+    volatile uint32_t in;               // elements committed, changed by the producer only
+    volatile uint32_t out;              // elements released, changed by the consumer only
+    uint32_t size;                      // number of elements, power of 2
+} ring_t;
+
+// Empty the ring, neither side may use it meanwhile
+static __inline void ring_init(ring_t *ring, uint32_t size) {
+    ring->in = 0;
+    ring->out = 0;
+    ring->size = size;
+}
+
+// Number of elements the consumer may take
+static __inline uint32_t ring_count(const ring_t *ring) {
+    return ring->in - ring->out;
+}
+
+// Number of elements the producer may add
+static __inline uint32_t ring_space(const ring_t *ring) {
+    return ring->size - (ring->in - ring->out);
+}
+
+// Producer: get the free elements in one piece
+//   index: set to the storage index of the first free element
+//   return number of free elements up to the end of the storage
+static __inline uint32_t ring_reserve(ring_t *ring, uint32_t *index) {
+    uint32_t n, end;
+
+    n = ring->size - (ring->in - ring->out);
+    // the consumer is done with the elements before they are written again
+    __DMB();
+    *index = ring->in & (ring->size - 1);
+    end = ring->size - *index;
+    return (n < end) ? n : end;
+}
+
+// Producer: hand count filled elements to the consumer
+static __inline void ring_commit(ring_t *ring, uint32_t count) {
+    // the elements are written before the consumer can see them
+    __DMB();
+    ring->in += count;
+}
+
+// Consumer: get the filled elements in one piece
+//   index: set to the storage index of the first filled element
+//   return number of filled elements up to the end of the storage
+static __inline uint32_t ring_peek(ring_t *ring, uint32_t *index) {
+    uint32_t n, end;
+
+    n = ring->in - ring->out;
+    // the elements are read after the producer committed them
+    __DMB();
+    *index = ring->out & (ring->size - 1);
+    end = ring->size - *index;
+    return (n < end) ? n : end;
+}
+
+// Consumer: hand count used elements back to the producer
+static __inline void ring_release(ring_t *ring, uint32_t count) {
+    // the elements are read before the producer can reuse them
+    __DMB();
+    ring->out += count;
+}
+
+// Producer: copy up to len bytes into a ring of bytes
+//   return number of bytes copied
+static __inline uint32_t ring_write(ring_t *ring, uint8_t *buf, const uint8_t *data, uint32_t len) {
+    uint32_t index, n, done;
+
+    // at most two pieces, up to the end of the storage and from its start
+    for (done = 0; (done < len) && ((n = ring_reserve(ring, &index)) != 0); done += n) {
+        if (n > (len - done)) {
+            n = len - done;
+        }
+        memcpy(&buf[index], &data[done], n);
+        ring_commit(ring, n);
+    }
+    return done;
+}
+
+// Consumer: copy up to len bytes out of a ring of bytes
+//   return number of bytes copied
+static __inline uint32_t ring_read(ring_t *ring, const uint8_t *buf, uint8_t *data, uint32_t len) {
+    uint32_t index, n, done;
+
+    for (done = 0; (done < len) && ((n = ring_peek(ring, &index)) != 0); done += n) {
+        if (n > (len - done)) {
+            n = len - done;
+        }
+        memcpy(&data[done], &buf[index], n);
+        ring_release(ring, n);
+    }
+    return done;
+}
+
+#endif
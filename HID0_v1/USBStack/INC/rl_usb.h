@@ -44,6 +44,12 @@ extern void  usbd_msc_init              (void);
 extern void  usbd_msc_read_sect         (U32 block, U8 *buf, U32 num_of_blocks);
 extern void  usbd_msc_write_sect        (U32 block, U8 *buf, U32 num_of_blocks);
 extern void  usbd_msc_start_stop        (BOOL start);
+extern BOOL  usbd_msc_write_busy        (void);
+extern BOOL  usbd_msc_read_deferred     (void);
+
+/* USB Device Mass Storage Class functions called by the user                 */
+extern void  USBD_MSC_WriteResume       (void);
+extern void  USBD_MSC_ReadResume        (void);
 
 /* USB Device user functions imported to USB Audio Class module               */
 extern void  usbd_adc_init              (void);
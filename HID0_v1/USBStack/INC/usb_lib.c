@@ -33,6 +33,13 @@
 
 #if    (USBD_ENABLE)
 
+#ifndef USBD_SWO_ENABLE
+#define USBD_SWO_ENABLE                    0
+#endif
+#ifndef USBD_WATCH_ENABLE
+#define USBD_WATCH_ENABLE                  0
+#endif
+
         U8   USBD_AltSetting[USBD_IF_NUM];
         U8   USBD_EP0Buf    [USBD_MAX_PACKET0];
 const   U8   usbd_power                 =  USBD_POWER;
@@ -118,6 +125,7 @@ const   U16  usbd_cdc_acm_maxpacketsize [2] = {USBD_CDC_ACM_WMAXPACKETSIZE,  USB
 const   U16  usbd_cdc_acm_maxpacketsize1[2] = {USBD_CDC_ACM_WMAXPACKETSIZE1, USBD_CDC_ACM_HS_WMAXPACKETSIZE1};
         U8   USBD_CDC_ACM_SendBuf         [USBD_CDC_ACM_SENDBUF_SIZE];
         U8   USBD_CDC_ACM_ReceiveBuf      [USBD_CDC_ACM_RECEIVEBUF_SIZE];
+        U8   USBD_CDC_ACM_ReceivePckt     [USBD_CDC_ACM_MAX_PACKET1];
         U8   USBD_CDC_ACM_NotifyBuf       [10];
 #endif
 
@@ -1199,7 +1207,9 @@ void USBD_RTX_TaskInit (void) {
  *      USB Device Descriptors
  *----------------------------------------------------------------------------*/
 #define USBD_MSC_DESC_LEN                 (USB_INTERFACE_DESC_SIZE + 2*USB_ENDPOINT_DESC_SIZE)
-#define USBD_CDC_ACM_DESC_LEN             (USB_INTERFACE_DESC_SIZE + /*USBD_MULTI_IF * USB_INTERFACE_ASSOC_DESC_SIZE +*/ 0x0013                 + \
+#define USBD_SWO_DESC_LEN                 (USB_INTERFACE_DESC_SIZE +   USB_ENDPOINT_DESC_SIZE)
+#define USBD_WATCH_DESC_LEN               (USB_INTERFACE_DESC_SIZE +   USB_ENDPOINT_DESC_SIZE)
+#define USBD_CDC_ACM_DESC_LEN             (USB_INTERFACE_DESC_SIZE + USBD_MULTI_IF * USB_INTERFACE_ASSOC_DESC_SIZE + 0x0013                     + \
                                            USB_ENDPOINT_DESC_SIZE + USB_INTERFACE_DESC_SIZE + 2*USB_ENDPOINT_DESC_SIZE)
 #define USBD_HID_DESC_LEN                 (USB_INTERFACE_DESC_SIZE + USB_HID_DESC_SIZE                                                          + \
                                           (USB_ENDPOINT_DESC_SIZE*(1+(USBD_HID_EP_INTOUT != 0))))
@@ -1209,7 +1219,9 @@ void USBD_RTX_TaskInit (void) {
 #define USBD_WTOTALLENGTH                 (USB_CONFIGUARTION_DESC_SIZE +                 \
                                            USBD_CDC_ACM_DESC_LEN * USBD_CDC_ACM_ENABLE + \
                                            USBD_HID_DESC_LEN     * USBD_HID_ENABLE     + \
-                                           USBD_MSC_DESC_LEN     * USBD_MSC_ENABLE)
+                                           USBD_MSC_DESC_LEN     * USBD_MSC_ENABLE     + \
+                                           USBD_SWO_DESC_LEN     * USBD_SWO_ENABLE     + \
+                                           USBD_WATCH_DESC_LEN   * USBD_WATCH_ENABLE)
 
 /*------------------------------------------------------------------------------
   Default HID Report Descriptor
@@ -1454,6 +1466,66 @@ const U8 USBD_DeviceQualifier_HS[] = { 0 };
   WBVAL(USBD_MSC_HS_WMAXPACKETSIZE),    /* wMaxPacketSize */                                                \
   USBD_MSC_HS_BINTERVAL,                /* bInterval */
 
+#define SWO_DESC                                                                                            \
+/* Interface, Alternate Setting 0, Vendor Class (SWO Trace Stream) */                                       \
+  USB_INTERFACE_DESC_SIZE,              /* bLength */                                                       \
+  USB_INTERFACE_DESCRIPTOR_TYPE,        /* bDescriptorType */                                               \
+  USBD_SWO_IF_NUM,                      /* bInterfaceNumber */                                              \
+  0x00,                                 /* bAlternateSetting */                                             \
+  0x01,                                 /* bNumEndpoints */                                                 \
+  0xFF,                                 /* bInterfaceClass: Vendor Specific */                              \
+  0x00,                                 /* bInterfaceSubClass */                                            \
+  0x00,                                 /* bInterfaceProtocol */                                            \
+  USBD_SWO_IF_STR_NUM,                  /* iInterface */
+
+#define SWO_EP                          /* SWO Endpoint for Low-speed/Full-speed */                         \
+/* Endpoint, EP Bulk IN */                                                                                  \
+  USB_ENDPOINT_DESC_SIZE,               /* bLength */                                                       \
+  USB_ENDPOINT_DESCRIPTOR_TYPE,         /* bDescriptorType */                                               \
+  USB_ENDPOINT_IN(USBD_SWO_EP_BULKIN),  /* bEndpointAddress */                                              \
+  USB_ENDPOINT_TYPE_BULK,               /* bmAttributes */                                                  \
+  WBVAL(USBD_SWO_WMAXPACKETSIZE),       /* wMaxPacketSize */                                                \
+  0x00,                                 /* bInterval: ignore for Bulk transfer */
+
+#define SWO_EP_HS                       /* SWO Endpoint for High-speed */                                   \
+/* Endpoint, EP Bulk IN */                                                                                  \
+  USB_ENDPOINT_DESC_SIZE,               /* bLength */                                                       \
+  USB_ENDPOINT_DESCRIPTOR_TYPE,         /* bDescriptorType */                                               \
+  USB_ENDPOINT_IN(USBD_SWO_EP_BULKIN),  /* bEndpointAddress */                                              \
+  USB_ENDPOINT_TYPE_BULK,               /* bmAttributes */                                                  \
+  WBVAL(USBD_SWO_HS_WMAXPACKETSIZE),    /* wMaxPacketSize */                                                \
+  0x00,                                 /* bInterval: ignore for Bulk transfer */
+
+#define WATCH_DESC                                                                                          \
+/* Interface, Alternate Setting 0, Vendor Class (Data Watch Stream) */                                      \
+  USB_INTERFACE_DESC_SIZE,              /* bLength */                                                       \
+  USB_INTERFACE_DESCRIPTOR_TYPE,        /* bDescriptorType */                                               \
+  USBD_WATCH_IF_NUM,                    /* bInterfaceNumber */                                              \
+  0x00,                                 /* bAlternateSetting */                                             \
+  0x01,                                 /* bNumEndpoints */                                                 \
+  0xFF,                                 /* bInterfaceClass: Vendor Specific */                              \
+  0x00,                                 /* bInterfaceSubClass */                                            \
+  0x00,                                 /* bInterfaceProtocol */                                            \
+  USBD_WATCH_IF_STR_NUM,                /* iInterface */
+
+#define WATCH_EP                        /* Data Watch Endpoint for Low-speed/Full-speed */                  \
+/* Endpoint, EP Bulk IN */                                                                                  \
+  USB_ENDPOINT_DESC_SIZE,               /* bLength */                                                       \
+  USB_ENDPOINT_DESCRIPTOR_TYPE,         /* bDescriptorType */                                               \
+  USB_ENDPOINT_IN(USBD_WATCH_EP_BULKIN),/* bEndpointAddress */                                              \
+  USB_ENDPOINT_TYPE_BULK,               /* bmAttributes */                                                  \
+  WBVAL(USBD_WATCH_WMAXPACKETSIZE),     /* wMaxPacketSize */                                                \
+  0x00,                                 /* bInterval: ignore for Bulk transfer */
+
+#define WATCH_EP_HS                     /* Data Watch Endpoint for High-speed */                            \
+/* Endpoint, EP Bulk IN */                                                                                  \
+  USB_ENDPOINT_DESC_SIZE,               /* bLength */                                                       \
+  USB_ENDPOINT_DESCRIPTOR_TYPE,         /* bDescriptorType */                                               \
+  USB_ENDPOINT_IN(USBD_WATCH_EP_BULKIN),/* bEndpointAddress */                                              \
+  USB_ENDPOINT_TYPE_BULK,               /* bmAttributes */                                                  \
+  WBVAL(USBD_WATCH_HS_WMAXPACKETSIZE),  /* wMaxPacketSize */                                                \
+  0x00,                                 /* bInterval: ignore for Bulk transfer */
+
 #define ADC_DESC_IAD(first,num_of_ifs)  /* ADC: Interface Association Descriptor */                         \
   USB_INTERFACE_ASSOC_DESC_SIZE,        /* bLength */                                                       \
   USB_INTERFACE_ASSOCIATION_DESCRIPTOR_TYPE,  /* bDescriptorType */                                         \
@@ -1758,6 +1830,16 @@ const U8 USBD_ConfigDescriptor[] = {
 #endif
 #endif
 
+#if (USBD_SWO_ENABLE)
+  SWO_DESC
+  SWO_EP
+#endif
+
+#if (USBD_WATCH_ENABLE)
+  WATCH_DESC
+  WATCH_EP
+#endif
+
 /* Terminator */                                                                                            \
   0                                     /* bLength */                                                       \
 };
@@ -1818,6 +1900,16 @@ const U8 USBD_ConfigDescriptor_HS[] = {
   MSC_EP_HS
 #endif
 
+#if (USBD_SWO_ENABLE)
+  SWO_DESC
+  SWO_EP_HS
+#endif
+
+#if (USBD_WATCH_ENABLE)
+  WATCH_DESC
+  WATCH_EP_HS
+#endif
+
 /* Terminator */                                                                                            \
   0                                     /* bLength */                                                       \
 };
@@ -1869,6 +1961,16 @@ const U8 USBD_OtherSpeedConfigDescriptor[] = {
   MSC_EP_HS
 #endif
 
+#if (USBD_SWO_ENABLE)
+  SWO_DESC
+  SWO_EP_HS
+#endif
+
+#if (USBD_WATCH_ENABLE)
+  WATCH_DESC
+  WATCH_EP_HS
+#endif
+
 /* Terminator */
   0                                     /* bLength */
 };
@@ -1920,6 +2022,16 @@ const U8 USBD_OtherSpeedConfigDescriptor_HS[] = {
   MSC_EP
 #endif
 
+#if (USBD_SWO_ENABLE)
+  SWO_DESC
+  SWO_EP
+#endif
+
+#if (USBD_WATCH_ENABLE)
+  WATCH_DESC
+  WATCH_EP
+#endif
+
 /* Terminator */
   0                                     /* bLength */
 };
@@ -1963,6 +2075,12 @@ const struct {
 #if (USBD_MSC_ENABLE)
   USBD_STR_DEF(MSC_STRDESC);
 #endif
+#if (USBD_SWO_ENABLE)
+  USBD_STR_DEF(SWO_STRDESC);
+#endif
+#if (USBD_WATCH_ENABLE)
+  USBD_STR_DEF(WATCH_STRDESC);
+#endif
 } USBD_StringDescriptor
   =
 {
@@ -1987,6 +2105,12 @@ const struct {
 #if (USBD_MSC_ENABLE)
   USBD_STR_VAL(MSC_STRDESC),
 #endif
+#if (USBD_SWO_ENABLE)
+  USBD_STR_VAL(SWO_STRDESC),
+#endif
+#if (USBD_WATCH_ENABLE)
+  USBD_STR_VAL(WATCH_STRDESC),
+#endif
 };
 
 #endif
@@ -83,6 +83,7 @@ extern const U16  usbd_cdc_acm_maxpacketsize [2];
 extern const U16  usbd_cdc_acm_maxpacketsize1[2];
 extern        U8  USBD_CDC_ACM_SendBuf       [];
 extern        U8  USBD_CDC_ACM_ReceiveBuf    [];
+extern        U8  USBD_CDC_ACM_ReceivePckt   [];
 extern        U8  USBD_CDC_ACM_NotifyBuf     [10];
 
 extern       void usbd_os_evt_set       (U16 event_flags, U32 task);
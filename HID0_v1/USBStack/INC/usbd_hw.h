@@ -19,6 +19,7 @@
 
 /* USB Hardware Functions */
 extern void USBD_Init        (void);
+extern void USBD_Intr        (int  ena);
 extern void USBD_Connect     (BOOL con);
 extern void USBD_Reset       (void);
 extern void USBD_Suspend     (void);
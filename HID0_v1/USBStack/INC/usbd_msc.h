@@ -21,12 +21,15 @@
 
 /* USB Device Mass Storage Device Class Global Variables */
 extern       BOOL USBD_MSC_MediaReady;
+extern       BOOL USBD_MSC_MediaReadyEx;
 extern       BOOL USBD_MSC_ReadOnly;
 extern       U32  USBD_MSC_MemorySize;
 extern       U32  USBD_MSC_BlockSize;
 extern       U32  USBD_MSC_BlockGroup;
 extern       U32  USBD_MSC_BlockCount;
 extern       U8  *USBD_MSC_BlockBuf;
+extern       U8   USBD_MSC_SenseKey;
+extern       U16  USBD_MSC_SenseCode;
 
 
 /*--------------------------- Event handling routines ------------------------*/
@@ -17,6 +17,7 @@
 #include <rl_usb.h>
 #include <string.h>
 #include "usb_for_lib.h"
+#include "ring.h"
 
 
 /* Module global variables                                                    */
@@ -28,17 +29,13 @@
 int32_t  data_send_access;              /*!< Flag active while send data (in the send intermediate buffer) is being accessed */
 int32_t  data_send_active;              /*!< Flag active while data is being sent */
 int32_t  data_send_zlp;                 /*!< Flag active when ZLP needs to be sent */
-int32_t  data_to_send_wr;               /*!< Number of bytes written to the send intermediate buffer */
-int32_t  data_to_send_rd;               /*!< Number of bytes read from the send intermediate buffer */
-uint8_t *ptr_data_to_send;              /*!< Pointer to the send intermediate buffer to the data to be sent */
-uint8_t *ptr_data_sent;                 /*!< Pointer to the send intermediate buffer to the data already sent */
+int32_t  data_send_wait;                /*!< Number of SOFs a partial packet has been held back */
+ring_t   data_to_send;                  /*!< Indexes of the send intermediate buffer */
 
 int32_t  data_read_access;              /*!< Flag active while read data (in the receive intermediate buffer) is being accessed */
 int32_t  data_receive_int_access;       /*!< Flag active while read data (in the receive intermediate buffer) is being accessed from the IRQ function*/
 int32_t  data_received_pending_pckts;   /*!< Number of packets received but not handled (pending) */
-int32_t  data_no_space_for_receive;     /*!< Flag active while there is no more space for reception */
-uint8_t *ptr_data_received;             /*!< Pointer to the receive intermediate buffer to the received unread data */
-uint8_t *ptr_data_read;                 /*!< Pointer to the receive intermediate buffer to the received read data */
+ring_t   data_received;                 /*!< Indexes of the receive intermediate buffer */
 
 uint16_t control_line_state;            /*!< Control line state settings bitmap (0. bit - DTR state, 1. bit - RTS state) */
 
@@ -47,6 +44,16 @@ CDC_LINE_CODING line_coding;            /*!< Communication settings */
 /* end of group USBD_CDC_ACM_GLOBAL_VAR */
 
 
+/* The send and the receive intermediate buffers are rings of a power of 2
+   size (ring.h). The user API functions are the producer of the send ring
+   and the consumer of the receive ring, the endpoint handlers the other
+   side. The access flags only keep the SOF and the endpoint handlers of the
+   same side from running into each other.                                    */
+
+#define USBD_CDC_ACM_SEND_WAIT  1       /* Time in ms a partial packet waits
+                                           to be filled before it is sent     */
+
+
 /* Functions that should be provided by user to use standard Virtual COM port
    functionality                                                              */
 __weak int32_t USBD_CDC_ACM_PortInitialize          (void)                             { return (0); };
@@ -130,17 +137,13 @@ __weak int32_t USBD_CDC_ACM_Reset (void) {
   data_send_access            = 0;
   data_send_active            = 0;
   data_send_zlp               = 0;
-  data_to_send_wr             = 0;
-  data_to_send_rd             = 0;
-  ptr_data_to_send            = USBD_CDC_ACM_SendBuf;
-  ptr_data_sent               = USBD_CDC_ACM_SendBuf;
+  data_send_wait              = 0;
+  ring_init (&data_to_send,  usbd_cdc_acm_sendbuf_sz);
 
   data_read_access            = 0;
   data_receive_int_access     = 0;
   data_received_pending_pckts = 0;
-  data_no_space_for_receive   = 0;
-  ptr_data_received           = USBD_CDC_ACM_ReceiveBuf;
-  ptr_data_read               = USBD_CDC_ACM_ReceiveBuf;
+  ring_init (&data_received, usbd_cdc_acm_receivebuf_sz);
 
   control_line_state          = 0;
 
@@ -229,7 +232,7 @@ __weak int32_t USBD_CDC_ACM_SetControlLineState (uint16_t ctrl_bmp) {
 /** \brief Number of free bytes in the Send buffer
 */
 int32_t USBD_CDC_ACM_DataFree(void) {
-  return ((int32_t)usbd_cdc_acm_sendbuf_sz) - (data_to_send_wr - data_to_send_rd);
+  return (ring_space (&data_to_send));
 }
 
 /** \brief  Sends data over the USB CDC ACM Virtual COM Port
@@ -243,43 +246,11 @@ int32_t USBD_CDC_ACM_DataFree(void) {
  */
 
 int32_t USBD_CDC_ACM_DataSend (const uint8_t *buf, int32_t len) {
-  int32_t  len_data, len_available, len_before_wrap;
-  uint8_t *buf_loc;
-
-  buf_loc       = (uint8_t *)buf;       /* Pointer to buf                     */
-  len_data      = data_to_send_wr - data_to_send_rd;  /* Num of data in buffer*/
-  len_available = ((int32_t)usbd_cdc_acm_sendbuf_sz) - len_data;  /* Num of
-                                           bytes of space available           */
-  if (len_available <= 0)               /* If no space for data to send       */
-    return (0);
-
-  if (len > len_available)              /* If more data requested for sending
-                                           then available space               */
-    len = len_available;                /* Correct to maximum available       */
-
-  len_before_wrap = 0;                  /* Circular buffer size before wrap   */
-
-  if ((ptr_data_to_send>=ptr_data_sent) &&   /* If wrap is possible to happen */
-     ((ptr_data_to_send + len) >= (USBD_CDC_ACM_SendBuf + usbd_cdc_acm_sendbuf_sz))) {
-                                        /* If data wraps around end of buffer */
-    len_before_wrap   = USBD_CDC_ACM_SendBuf + usbd_cdc_acm_sendbuf_sz - ptr_data_to_send;
-    memcpy (ptr_data_to_send, buf_loc, len_before_wrap);/* Copy data till end */
-    buf_loc          += len_before_wrap;            /* Increment buf pointer  */
-    len              -= len_before_wrap;            /* Decrement bytes to send*/
-    ptr_data_to_send  = USBD_CDC_ACM_SendBuf;       /* Wrap send buffer
-                                                       pointer to beginning of
-                                                       the send buffer        */
-  }
 
-  if (len) {                            /* If there are bytes to send         */
-    memcpy (ptr_data_to_send, buf_loc, len);  /* Copy data to send buffer     */
-    ptr_data_to_send += len;            /* Correct position of write pointer  */
-  }
-  len += len_before_wrap;               /* Total number of bytes prepared for
-                                           send                               */
-  data_to_send_wr += len;               /* Bytes prepared to send counter     */
-
-  return (len);                         /* Number of bytes accepted for send  */
+  if (len <= 0)
+    return (0);
+                                        /* Copy as much as there is space for */
+  return (ring_write (&data_to_send, USBD_CDC_ACM_SendBuf, buf, len));
 }
 
 
@@ -313,21 +284,11 @@ int32_t USBD_CDC_ACM_PutChar (const uint8_t ch) {
  */
 
 int32_t USBD_CDC_ACM_DataRead (uint8_t *buf, int32_t len) {
-  int32_t len_data;
 
-  if (ptr_data_received>ptr_data_read) {/*If there is already received data   */
-    len_data = ptr_data_received - ptr_data_read; /* Available bytes of data  */
-
-    if (len > len_data)                 /* If more requested then available   */
-      len = len_data;                   /* correct to return maximum available*/
-
-    memcpy (buf, ptr_data_read, len);   /* Copy received data to provided buf */
-    ptr_data_read      += len;          /* Correct position of read pointer   */
-  } else {
-    len = 0;                            /* No data received                   */
-  }
-
-  return (len);                         /* Number of bytes actually read      */
+  if (len <= 0)
+    return (0);
+                                        /* Copy as much as was received       */
+  return (ring_read (&data_received, USBD_CDC_ACM_ReceiveBuf, buf, len));
 }
 
 
@@ -359,7 +320,7 @@ int32_t USBD_CDC_ACM_GetChar (void) {
  */
 
 int32_t USBD_CDC_ACM_DataAvailable (void) {
-  return (ptr_data_received - ptr_data_read);
+  return (ring_count (&data_received));
 }
 
 
@@ -425,49 +386,41 @@ void USBD_CDC_ACM_Reset_Event (void) {
     intermediate receive buffer and it calls received function callback
     (USBD_CDC_ACM_DataReceived) it also activates data send over the Bulk In
     endpoint if there is data to be sent (USBD_CDC_ACM_EP_BULKIN_HandleData).
+    Data of less than a maximum packet is held back for USBD_CDC_ACM_SEND_WAIT
+    ms, so a writer adding a few bytes at a time still fills whole packets.
  */
 
 void USBD_CDC_ACM_SOF_Event (void) {
+  int32_t len_to_send;
 
-  if ((!data_read_access)         &&    /* If not read active                 */
-      (ptr_data_received == ptr_data_read) &&     /* If received and read
-                                                     pointers point to same
-                                                     the location             */
-      (ptr_data_received != USBD_CDC_ACM_ReceiveBuf)) { /* and if receive
-                                                     pointer does not already
-                                                     point to the start of
-                                                     the receive buffer       */
-    data_read_access = 1;               /* Block access to read data          */
-    ptr_data_received = USBD_CDC_ACM_ReceiveBuf;  /* Correct received pointer
-                                                     to point to the start of
-                                                     the receive buffer       */
-    ptr_data_read     = USBD_CDC_ACM_ReceiveBuf;  /* Correct read pointer to
-                                                     point to the start of the
-                                                     receive buffer           */
-    data_no_space_for_receive  = 0;               /* There is space for
-                                                     reception available      */
-    data_read_access = 0;               /* Allow access to read data          */
-  }
   if (data_received_pending_pckts &&    /* If packets are pending             */
      (!data_read_access)          &&    /* and if not read active             */
-     (!data_no_space_for_receive)) {    /* and if there is space to receive   */
+     (ring_space (&data_received) >= usbd_cdc_acm_maxpacketsize1[USBD_HighSpeed])) {
+                                        /* and if there is space to receive   */
     data_read_access = 1;               /* Disable access to read data        */
     USBD_CDC_ACM_EP_BULKOUT_HandleData(); /* Handle received data             */
     data_read_access = 0;               /* Enable access to read data         */
-    if (ptr_data_received != ptr_data_read)
-      USBD_CDC_ACM_DataReceived (ptr_data_received - ptr_data_read);  /* Call
+    if (ring_count (&data_received))
+      USBD_CDC_ACM_DataReceived (ring_count (&data_received));  /* Call
                                            received callback                  */
   }
 
+  len_to_send = ring_count (&data_to_send);
   if ((!data_send_access)         &&    /* If send data is not being accessed */
       (!data_send_active)         &&    /* and send is not active             */
-      (data_to_send_wr-data_to_send_rd) /* and if there is data to be sent    */
+      (len_to_send)                     /* and if there is data to be sent    */
 //&& ((control_line_state & 3) == 3)    /* and if DTR and RTS is 1            */
      ) {
-    data_send_access = 1;               /* Block access to send data          */
-    data_send_active = 1;               /* Start data sending                 */
-    USBD_CDC_ACM_EP_BULKIN_HandleData();/* Handle data to send                */
-    data_send_access = 0;               /* Allow access to send data          */
+    if (data_send_wait < (USBD_CDC_ACM_SEND_WAIT * (USBD_HighSpeed ? 8 : 1)))
+      data_send_wait++;                 /* Count frames (microframes in high-
+                                           speed) a partial packet waits      */
+    if ((len_to_send >= usbd_cdc_acm_maxpacketsize1[USBD_HighSpeed]) ||
+        (data_send_wait >= (USBD_CDC_ACM_SEND_WAIT * (USBD_HighSpeed ? 8 : 1)))) {
+      data_send_access = 1;             /* Block access to send data          */
+      data_send_active = 1;             /* Start data sending                 */
+      USBD_CDC_ACM_EP_BULKIN_HandleData();/* Handle data to send              */
+      data_send_access = 0;             /* Allow access to send data          */
+    }
   }
 }
 
@@ -494,19 +447,23 @@ void USBD_CDC_ACM_EP_INTIN_Event (uint32_t event) {
  */
 
 static void USBD_CDC_ACM_EP_BULKOUT_HandleData () {
-  int32_t len_received;
+  uint32_t len_received, idx;
 
-  if ((usbd_cdc_acm_receivebuf_sz - (ptr_data_received - USBD_CDC_ACM_ReceiveBuf)) >= usbd_cdc_acm_maxpacketsize1[USBD_HighSpeed]) {
+  if (ring_space (&data_received) >= usbd_cdc_acm_maxpacketsize1[USBD_HighSpeed]) {
                                         /* If there is space for 1 max packet */
+    if (ring_reserve (&data_received, &idx) >= usbd_cdc_acm_maxpacketsize1[USBD_HighSpeed]) {
                                         /* Read received packet to receive buf*/
-    len_received       = USBD_ReadEP(usbd_cdc_acm_ep_bulkout, ptr_data_received);
-    ptr_data_received += len_received;  /* Correct pointer to received data   */
+      len_received = USBD_ReadEP(usbd_cdc_acm_ep_bulkout, &USBD_CDC_ACM_ReceiveBuf[idx]);
+      ring_commit (&data_received, len_received);
+    } else {                            /* Packet may wrap around end of buf  */
+      len_received = USBD_ReadEP(usbd_cdc_acm_ep_bulkout, USBD_CDC_ACM_ReceivePckt);
+      ring_write (&data_received, USBD_CDC_ACM_ReceiveBuf, USBD_CDC_ACM_ReceivePckt, len_received);
+    }
     if (data_received_pending_pckts &&  /* If packet was pending              */
        !data_receive_int_access) {      /* and not interrupt access           */
       data_received_pending_pckts--;    /* Decrement pending packets number   */
     }
-  } else {
-    data_no_space_for_receive = 1;      /* There is no space in receive buffer
+  } else {                              /* There is no space in receive buffer
                                            for the newly received data        */
     if (data_receive_int_access) {      /* If this access is from interrupt
                                            function                           */
@@ -525,12 +482,12 @@ static void USBD_CDC_ACM_EP_BULKOUT_HandleData () {
  */
 
 static void USBD_CDC_ACM_EP_BULKIN_HandleData (void) {
-  int32_t len_to_send, len_sent;
+  uint32_t len_to_send, len_sent, idx;
 
   if (!data_send_active)                /* If sending is not active           */
     return;
 
-  len_to_send = data_to_send_wr - data_to_send_rd;  /* Num of data to send    */
+  len_to_send = ring_count (&data_to_send); /* Num of data to send            */
 
   /* Check if sending is finished                                             */
   if (!len_to_send    &&                /* If all data was sent               */
@@ -539,40 +496,32 @@ static void USBD_CDC_ACM_EP_BULKIN_HandleData (void) {
     return;
   }
 
-  /* Check if data needs to be sent                                           */
-  if (len_to_send) {                    /* If there is data available do be
-                                           sent                               */
-    if ((ptr_data_sent>=ptr_data_to_send) &&/* If data before end of buf avail*/
-        ((ptr_data_sent + len_to_send) >= (USBD_CDC_ACM_SendBuf + usbd_cdc_acm_sendbuf_sz))) {
-                                        /* and if available data wraps around
-                                           the end of the send buffer         */
-                                        /* Correct bytes to send to data
-                                           available untill end of send buf   */
-      len_to_send = USBD_CDC_ACM_SendBuf + usbd_cdc_acm_sendbuf_sz - ptr_data_sent;
-    }
+  /* Check if a partial packet should wait for more data                      */
+  if ((len_to_send > 0) &&
+      (len_to_send < usbd_cdc_acm_maxpacketsize1[USBD_HighSpeed]) &&
+      (data_send_wait < (USBD_CDC_ACM_SEND_WAIT * (USBD_HighSpeed ? 8 : 1)))) {
+    data_send_active = 0;               /* SOF restarts sending when the wait
+                                           is over or the packet is full      */
+    return;
+  }
 
-    if (len_to_send > usbd_cdc_acm_maxpacketsize1[USBD_HighSpeed]) {  /* If
+  len_to_send = ring_peek (&data_to_send, &idx);  /* Data available untill end
+                                           of send buffer                     */
+  if (len_to_send > usbd_cdc_acm_maxpacketsize1[USBD_HighSpeed]) {  /* If
                                            there is more data to be sent then
                                            can be sent in a single packet     */
                                         /* Correct to send maximum pckt size  */
-      len_to_send = usbd_cdc_acm_maxpacketsize1[USBD_HighSpeed];
-    }
-  } else if (data_send_zlp) {           /* or if ZLP should be sent           */
-    len_to_send = 0;
+    len_to_send = usbd_cdc_acm_maxpacketsize1[USBD_HighSpeed];
   }
 
-  data_send_zlp = 0;
+  data_send_zlp  = 0;
+  data_send_wait = 0;
 
-                                        /* Send data                          */
-  len_sent = USBD_WriteEP(usbd_cdc_acm_ep_bulkin | 0x80, ptr_data_sent, len_to_send);
+                                        /* Send data (or ZLP if len is 0)     */
+  len_sent = USBD_WriteEP(usbd_cdc_acm_ep_bulkin | 0x80, &USBD_CDC_ACM_SendBuf[idx], len_to_send);
 
-  ptr_data_sent    += len_sent;         /* Correct position of sent pointer   */
-  data_to_send_rd  += len_sent;         /* Correct num of bytes left to send  */
-  if (ptr_data_sent == USBD_CDC_ACM_SendBuf + usbd_cdc_acm_sendbuf_sz)
-                                        /* If pointer to sent data wraps      */
-    ptr_data_sent = USBD_CDC_ACM_SendBuf; /* Correct it to beginning of send
-                                           buffer                             */
-  if ((data_to_send_wr == data_to_send_rd) &&   /* If there are no more
+  ring_release (&data_to_send, len_sent); /* Correct num of bytes left to send*/
+  if ((ring_count (&data_to_send) == 0) &&  /* If there are no more
                                            bytes available to be sent         */
       (len_sent == usbd_cdc_acm_maxpacketsize1[USBD_HighSpeed])) {
                                         /* If last packet size was same as
@@ -608,8 +557,8 @@ void USBD_CDC_ACM_EP_BULKOUT_Event (uint32_t event) {
   USBD_CDC_ACM_EP_BULKOUT_HandleData ();/* Handle received data               */
   data_receive_int_access = 0;          /* Read access from interrupt func end*/
   data_read_access = 0;                 /* Allow access to read data          */
-  if (ptr_data_received != ptr_data_read)
-    USBD_CDC_ACM_DataReceived (ptr_data_received - ptr_data_read);    /* Call
+  if (ring_count (&data_received))
+    USBD_CDC_ACM_DataReceived (ring_count (&data_received));  /* Call
                                            received callback                  */
 }
 
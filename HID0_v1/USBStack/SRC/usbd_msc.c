@@ -30,6 +30,8 @@ MSC_CBW     USBD_MSC_CBW;                  /* Command Block Wrapper */
 MSC_CSW     USBD_MSC_CSW;                  /* Command Status Wrapper */
 
 BOOL        USBD_MSC_MediaReadyEx = __FALSE; /* Previous state of Media ready */
+U8          USBD_MSC_SenseKey;             /* Sense Key of a failed read, set by usbd_msc_read_sect */
+U16         USBD_MSC_SenseCode;            /* Additional Sense Code and Qualifier of a failed read */
 BOOL        MemOK;                         /* Memory OK */
 
 U32         Block;                         /* R/W Block  */
@@ -38,6 +40,10 @@ U32         Length;                        /* R/W Length */
 
 U8          BulkStage;                     /* Bulk Stage */
 U32         BulkLen;                       /* Bulk In/Out Length */
+BOOL        BulkDirect;                    /* Bulk Out data is in Block Buffer */
+BOOL        BulkHeld;                      /* Bulk Out write data left in the Endpoint */
+BOOL        BulkInHeld;                    /* Bulk In read waits for USBD_MSC_ReadResume */
+BOOL        BulkInRead;                    /* Block Buffer read by USBD_MSC_ReadResume */
 
 
 /* Dummy Weak Functions that need to be provided by user */
@@ -45,6 +51,8 @@ __weak void usbd_msc_init       ()                                      {};
 __weak void usbd_msc_read_sect  (U32 block, U8 *buf, U32 num_of_blocks) {};
 __weak void usbd_msc_write_sect (U32 block, U8 *buf, U32 num_of_blocks) {};
 __weak void usbd_msc_start_stop (BOOL start)                            {};
+__weak BOOL usbd_msc_write_busy (void)                                  { return (__FALSE); };
+__weak BOOL usbd_msc_read_deferred (void)                               { return (__FALSE); };
 
 
 /*
@@ -94,6 +102,8 @@ BOOL USBD_MSC_Reset (void) {
 
   USBD_EndPointStall = 0x00000000;         /* EP must stay stalled */
   USBD_MSC_CSW.dSignature = 0;             /* invalid signature */
+  BulkInHeld = __FALSE;                    /* a held back read is dropped */
+  BulkInRead = __FALSE;
 
   BulkStage = MSC_BS_CBW;
 
@@ -140,6 +150,23 @@ BOOL USBD_MSC_CheckMedia (void) {
 }
 
 
+/*
+ *  USB Device MSC Blocks of the next Read
+ *    Parameters:      None
+ *    Return Value:    Number of blocks read into the Block Buffer at Block
+ */
+
+static U32 USBD_MSC_ReadBlocks (void) {
+  U32 n;
+
+  n = (Length + (USBD_MSC_BlockSize-1)) / USBD_MSC_BlockSize;
+  if (n > USBD_MSC_BlockGroup) {
+    n = USBD_MSC_BlockGroup;
+  }
+  return (n);
+}
+
+
 /*
  *  USB Device MSC Memory Read Callback
  *   Called automatically on USB Device Memory Read Event
@@ -148,7 +175,7 @@ BOOL USBD_MSC_CheckMedia (void) {
  */
 
 void USBD_MSC_MemoryRead (void) {
-  U32 n, m;
+  U32 n;
 
   if (Block >= USBD_MSC_BlockCount) {
     n = 0;
@@ -168,11 +195,21 @@ void USBD_MSC_MemoryRead (void) {
   }
 
   if ((Offset == 0) && (n != 0)) {
-    m = (Length + (USBD_MSC_BlockSize-1)) / USBD_MSC_BlockSize;
-    if (m > USBD_MSC_BlockGroup) {
-      m = USBD_MSC_BlockGroup;
+    if (BulkInRead) {                      /* read by USBD_MSC_ReadResume */
+      BulkInRead = __FALSE;
+    } else if (usbd_msc_read_deferred()) { /* host is NAKed until it is read */
+      BulkInHeld = __TRUE;
+      return;
+    } else {
+      USBD_MSC_SenseKey = 0;
+      usbd_msc_read_sect(Block, USBD_MSC_BlockBuf, USBD_MSC_ReadBlocks());
+    }
+    if (USBD_MSC_SenseKey) {               /* read failed, host gets the sense */
+      USBD_MSC_SetStallEP(usbd_msc_ep_bulkin | 0x80);
+      USBD_MSC_CSW.bStatus = CSW_CMD_FAILED;
+      USBD_MSC_SetCSW();
+      return;
     }
-    usbd_msc_read_sect(Block, USBD_MSC_BlockBuf, m);
   }
 
   if (n) {
@@ -221,8 +258,8 @@ void USBD_MSC_MemoryWrite (void) {
     BulkLen = 0;
   }
 
-  for (n = 0; n < BulkLen; n++) {
-    USBD_MSC_BlockBuf[Offset + n] = USBD_MSC_BulkBuf[n];
+  if (!BulkDirect) {
+    memcpy(&USBD_MSC_BlockBuf[Offset], USBD_MSC_BulkBuf, BulkLen);
   }
 
   Offset += BulkLen;
@@ -276,7 +313,9 @@ void USBD_MSC_MemoryVerify (void) {
     BulkLen = 0;
   }
 
-  if (BulkLen) {
+  if (BulkLen && usbd_msc_read_deferred()) {
+    MemOK = __FALSE;                       /* no reads in the interrupt */
+  } else if (BulkLen) {
     if ((Offset == 0) && (BulkLen != 0)) {
       n = (Length + (USBD_MSC_BlockSize-1)) / USBD_MSC_BlockSize;
       if (n > USBD_MSC_BlockGroup) {
@@ -459,7 +498,12 @@ void USBD_MSC_RequestSense (void) {
 
   USBD_MSC_BulkBuf[ 0] = 0x70;             /* Response Code */
   USBD_MSC_BulkBuf[ 1] = 0x00;
-  if ((USBD_MSC_MediaReadyEx ^ USBD_MSC_MediaReady) & USBD_MSC_MediaReady) {  /* If media state changed to ready */
+  if (USBD_MSC_SenseKey) {                 /* If a read failed */
+    USBD_MSC_BulkBuf[ 2] = USBD_MSC_SenseKey;
+    USBD_MSC_BulkBuf[12] = (U8)(USBD_MSC_SenseCode >> 8);
+    USBD_MSC_BulkBuf[13] = (U8)(USBD_MSC_SenseCode);
+    USBD_MSC_SenseKey    = 0;
+  } else if ((USBD_MSC_MediaReadyEx ^ USBD_MSC_MediaReady) & USBD_MSC_MediaReady) {  /* If media state changed to ready */
     USBD_MSC_BulkBuf[ 2] = 0x06;           /* UNIT ATTENTION */
     USBD_MSC_BulkBuf[12] = 0x28;           /* Additional Sense Code: Not ready to ready transition */
     USBD_MSC_BulkBuf[13] = 0x00;           /* Additional Sense Code Qualifier */
@@ -994,11 +1038,70 @@ void USBD_MSC_EP_BULKIN_Event (U32 event) {
  */
 
 void USBD_MSC_EP_BULKOUT_Event (U32 event) {
-  BulkLen = USBD_ReadEP(usbd_msc_ep_bulkout, USBD_MSC_BulkBuf);
+  U8 *buf;
+
+  /* Write data stays in the Endpoint (host is NAKed) while the user is busy */
+  if ((BulkStage == MSC_BS_DATA_OUT) &&
+      ((USBD_MSC_CBW.CB[0] == SCSI_WRITE10) || (USBD_MSC_CBW.CB[0] == SCSI_WRITE12)) &&
+      usbd_msc_write_busy()) {
+    BulkHeld = __TRUE;
+    return;
+  }
+
+  /* Write data is received straight into the Block Buffer while it fits */
+  buf = USBD_MSC_BulkBuf;
+  if ((BulkStage == MSC_BS_DATA_OUT) &&
+      ((USBD_MSC_CBW.CB[0] == SCSI_WRITE10) || (USBD_MSC_CBW.CB[0] == SCSI_WRITE12)) &&
+      ((Offset + usbd_msc_maxpacketsize[USBD_HighSpeed]) <= (USBD_MSC_BlockGroup * USBD_MSC_BlockSize))) {
+    buf = &USBD_MSC_BlockBuf[Offset];
+  }
+  BulkDirect = (buf != USBD_MSC_BulkBuf);
+  BulkLen = USBD_ReadEP(usbd_msc_ep_bulkout, buf);
   USBD_MSC_BulkOut();
 }
 
 
+/*
+ *  USB Device MSC Write Resume
+ *   Receive the write data held back by usbd_msc_write_busy
+ *   Called by the user with the USB interrupt disabled
+ *    Parameters:      None
+ *    Return Value:    None
+ */
+
+void USBD_MSC_WriteResume (void) {
+  if (!BulkHeld || usbd_msc_write_busy()) return;
+  BulkHeld = __FALSE;
+  USBD_MSC_EP_BULKOUT_Event(0);
+}
+
+
+/*
+ *  USB Device MSC Read Resume
+ *   Read the blocks held back by usbd_msc_read_deferred and send them
+ *   Called by the user from the main loop with the USB interrupt enabled,
+ *   the read itself may take long
+ *    Parameters:      None
+ *    Return Value:    None
+ */
+
+void USBD_MSC_ReadResume (void) {
+  U32 block;
+
+  if (!BulkInHeld) return;
+  block = Block;
+  USBD_MSC_SenseKey = 0;
+  usbd_msc_read_sect(block, USBD_MSC_BlockBuf, USBD_MSC_ReadBlocks());
+  USBD_Intr(0);
+  if (BulkInHeld && (Block == block)) {    /* not reset meanwhile */
+    BulkInHeld = __FALSE;
+    BulkInRead = __TRUE;
+    USBD_MSC_MemoryRead();
+  }
+  USBD_Intr(1);
+}
+
+
 /*
  *  USB Device MSC Bulk In/Out Endpoint Event Callback
  *    Parameters:      event: USB Device Event
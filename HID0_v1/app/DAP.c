@@ -23,6 +23,7 @@
 #include <string.h>
 #include "DAP_config.h"
 #include "DAP.h"
+#include "DAP_perf.h"
 //#include "led.h"
 
 #define DAP_FW_VER      "1.0"   // Firmware Version
@@ -54,6 +55,12 @@
          DAP_Data_t DAP_Data;           // DAP Data
 volatile uint8_t    DAP_TransferAbort;  // Trasfer Abort Flag
 
+#if (DAP_SWD != 0)
+         DAP_Retry_t DAP_Retry[DAP_RETRY_AP_NUM];  // WAIT Retry Statistics
+static   uint32_t    DAP_RetryAP;                  // AP selected in DP SELECT
+         uint32_t    DAP_Select = DAP_SELECT_UNKNOWN;  // DP SELECT written last
+#endif
+
 
 #ifdef DAP_VENDOR
 const char DAP_Vendor [] = DAP_VENDOR;
@@ -115,10 +122,22 @@ static uint8_t DAP_Info(uint8_t id, uint8_t *info) {
 #endif
       break;
     case DAP_ID_CAPABILITIES:
-      info[0] = ((DAP_SWD  != 0) ? (1 << 0) : 0) |
-                ((DAP_JTAG != 0) ? (1 << 1) : 0);
+      info[0] = ((DAP_SWD        != 0) ? (1 << 0) : 0) |
+                ((DAP_JTAG       != 0) ? (1 << 1) : 0) |
+                ((SWO_UART       != 0) ? (1 << 2) : 0) |
+                ((SWO_MANCHESTER != 0) ? (1 << 3) : 0) |
+                ((SWO_STREAM     != 0) ? (1 << 6) : 0);
       length = 1;
       break;
+    case DAP_ID_SWO_BUFFER_SIZE:
+#if ((SWO_UART != 0) || (SWO_MANCHESTER != 0))
+      info[0] = (uint8_t)(SWO_BUFFER_SIZE >>  0);
+      info[1] = (uint8_t)(SWO_BUFFER_SIZE >>  8);
+      info[2] = (uint8_t)(SWO_BUFFER_SIZE >> 16);
+      info[3] = (uint8_t)(SWO_BUFFER_SIZE >> 24);
+      length = 4;
+#endif
+      break;
     case DAP_ID_PACKET_SIZE:
       info[0] = (uint8_t)(DAP_PACKET_SIZE >> 0);
       info[1] = (uint8_t)(DAP_PACKET_SIZE >> 8);
@@ -609,6 +628,94 @@ static uint32_t DAP_TransferConfigure(uint8_t *request, uint8_t *response) {
 }
 
 
+// WAIT retry engine
+//   At most the configured retry count, as for JTAG. Back-to-back retries
+//   first, then with an exponential back-off in between, which also ends the
+//   retries once DAP_RETRY_TIMEOUT has been spent waiting. Every WAIT raises
+//   the idle cycles learned for the selected AP so the following transfers
+//   give it more time; a run of DAP_RETRY_DECAY responses without WAIT
+//   lowers them again.
+//   WAIT is caused by the AP selected in DP SELECT, so DP accesses (RDBUFF)
+//   are accounted to that AP as well.
+#if (DAP_SWD != 0)
+
+#define DAP_RETRY_FAST          8       // Back-to-back retries before back-off
+#define DAP_RETRY_BACKOFF_MAX   64      // Maximum back-off step in us
+#define DAP_RETRY_TIMEOUT       100000  // Maximum total back-off in us
+#define DAP_RETRY_IDLE_MAX      64      // Maximum learned idle cycles
+#define DAP_RETRY_DECAY         64      // WAIT-free responses to lower idle cycles
+
+// SWD Transfer with WAIT retry
+//   request: A[3:2] RnW APnDP
+//   data:    DATA[31:0]
+//   return:  ACK[2:0]
+uint8_t SWD_TransferRetry(uint32_t request, uint32_t *data) {
+  DAP_Retry_t *stat;
+  uint32_t     idle_cycles;
+  uint32_t     waits;
+  uint32_t     delay;
+  uint32_t     waited;
+  uint8_t      ack;
+
+  stat = &DAP_Retry[DAP_RetryAP];
+  stat->transfers++;
+
+  // Learned idle cycles take effect if above the configured ones
+  idle_cycles = DAP_Data.transfer.idle_cycles;
+  if (stat->idle_cycles > idle_cycles) {
+    DAP_Data.transfer.idle_cycles = stat->idle_cycles;
+  }
+
+  waits  = 0;
+  delay  = 1;
+  waited = 0;
+  while (1) {
+    ack = SWD_Transfer(request, data);
+    if (ack != DAP_TRANSFER_WAIT) break;
+    waits++;
+    if ((waits > DAP_Data.transfer.retry_count) || DAP_TransferAbort) break;
+    if (waits > DAP_RETRY_FAST) {
+      // Back-off
+      if (waited >= DAP_RETRY_TIMEOUT) break;
+      PIN_DELAY_SLOW(delay * ((CPU_CLOCK/1000000 + (DELAY_SLOW_CYCLES-1)) / DELAY_SLOW_CYCLES));
+      waited += delay;
+      if (delay < DAP_RETRY_BACKOFF_MAX) delay <<= 1;
+      stat->backoffs++;
+    }
+  }
+
+  DAP_Data.transfer.idle_cycles = idle_cycles;
+
+  if (waits) {
+    stat->waits += waits;
+    stat->ok_count = 0;
+    idle_cycles = stat->idle_cycles + (stat->idle_cycles >> 1) + 1;
+    stat->idle_cycles = (idle_cycles > DAP_RETRY_IDLE_MAX) ? DAP_RETRY_IDLE_MAX : idle_cycles;
+  } else if (ack == DAP_TRANSFER_OK) {
+    if (++stat->ok_count >= DAP_RETRY_DECAY) {
+      stat->ok_count = 0;
+      if (stat->idle_cycles) stat->idle_cycles--;
+    }
+  }
+  if (ack == DAP_TRANSFER_FAULT) {
+    stat->faults++;
+  }
+
+  // Track AP selection (DP SELECT write)
+  if ((ack == DAP_TRANSFER_OK) && ((request & 0x0F) == DP_SELECT)) {
+    DAP_Select  = *data;
+    DAP_RetryAP = *data >> 24;
+    if (DAP_RetryAP >= DAP_RETRY_AP_NUM) {
+      DAP_RetryAP = DAP_RETRY_AP_NUM - 1;
+    }
+  }
+
+  return (ack);
+}
+
+#endif
+
+
 // Process SWD Transfer command and prepare response
 //   request:  pointer to request data
 //   response: pointer to response data
@@ -624,7 +731,6 @@ static uint32_t DAP_SWD_Transfer(uint8_t *request, uint8_t *response) {
   uint32_t  check_write;
   uint32_t  match_value;
   uint32_t  match_retry;
-  uint32_t  retry;
   uint32_t  data;
 
   response_count = 0;
@@ -646,17 +752,12 @@ static uint32_t DAP_SWD_Transfer(uint8_t *request, uint8_t *response) {
       // Read register
       if (post_read) {
         // Read was posted before
-        retry = DAP_Data.transfer.retry_count;
         if ((request_value & (DAP_TRANSFER_APnDP | DAP_TRANSFER_MATCH_VALUE)) == DAP_TRANSFER_APnDP) {
           // Read previous AP data and post next AP read
-          do {
-            response_value = SWD_Transfer(request_value, &data);
-          } while ((response_value == DAP_TRANSFER_WAIT) && retry-- && !DAP_TransferAbort);
+          response_value = SWD_TransferRetry(request_value, &data);
         } else {
           // Read previous AP data
-          do {
-            response_value = SWD_Transfer(DP_RDBUFF | DAP_TRANSFER_RnW, &data);
-          } while ((response_value == DAP_TRANSFER_WAIT) && retry-- && !DAP_TransferAbort);
+          response_value = SWD_TransferRetry(DP_RDBUFF | DAP_TRANSFER_RnW, &data);
           post_read = 0;
         }
         if (response_value != DAP_TRANSFER_OK) break;
@@ -676,18 +777,12 @@ static uint32_t DAP_SWD_Transfer(uint8_t *request, uint8_t *response) {
         match_retry = DAP_Data.transfer.match_retry;
         if (request_value & DAP_TRANSFER_APnDP) {
           // Post AP read
-          retry = DAP_Data.transfer.retry_count;
-          do {
-            response_value = SWD_Transfer(request_value, NULL);
-          } while ((response_value == DAP_TRANSFER_WAIT) && retry-- && !DAP_TransferAbort);
+          response_value = SWD_TransferRetry(request_value, NULL);
           if (response_value != DAP_TRANSFER_OK) break;
         }
         do {
           // Read register until its value matches or retry counter expires
-          retry = DAP_Data.transfer.retry_count;
-          do {
-            response_value = SWD_Transfer(request_value, &data);
-          } while ((response_value == DAP_TRANSFER_WAIT) && retry-- && !DAP_TransferAbort);
+          response_value = SWD_TransferRetry(request_value, &data);
           if (response_value != DAP_TRANSFER_OK) break;
         } while (((data & DAP_Data.transfer.match_mask) != match_value) && match_retry-- && !DAP_TransferAbort);
         if ((data & DAP_Data.transfer.match_mask) != match_value) {
@@ -696,22 +791,17 @@ static uint32_t DAP_SWD_Transfer(uint8_t *request, uint8_t *response) {
         if (response_value != DAP_TRANSFER_OK) break;
       } else {
         // Normal read
-        retry = DAP_Data.transfer.retry_count;
         if (request_value & DAP_TRANSFER_APnDP) {
           // Read AP register
           if (post_read == 0) {
             // Post AP read
-            do {
-              response_value = SWD_Transfer(request_value, NULL);
-            } while ((response_value == DAP_TRANSFER_WAIT) && retry-- && !DAP_TransferAbort);
+            response_value = SWD_TransferRetry(request_value, NULL);
             if (response_value != DAP_TRANSFER_OK) break;
             post_read = 1;
           }
         } else {
           // Read DP register
-          do {
-            response_value = SWD_Transfer(request_value, &data);
-          } while ((response_value == DAP_TRANSFER_WAIT) && retry-- && !DAP_TransferAbort);
+          response_value = SWD_TransferRetry(request_value, &data);
           if (response_value != DAP_TRANSFER_OK) break;
           // Store data
           *response++ = (uint8_t) data;
@@ -725,10 +815,7 @@ static uint32_t DAP_SWD_Transfer(uint8_t *request, uint8_t *response) {
       // Write register
       if (post_read) {
         // Read previous data
-        retry = DAP_Data.transfer.retry_count;
-        do {
-          response_value = SWD_Transfer(DP_RDBUFF | DAP_TRANSFER_RnW, &data);
-        } while ((response_value == DAP_TRANSFER_WAIT) && retry-- && !DAP_TransferAbort);
+        response_value = SWD_TransferRetry(DP_RDBUFF | DAP_TRANSFER_RnW, &data);
         if (response_value != DAP_TRANSFER_OK) break;
         // Store previous data
         *response++ = (uint8_t) data;
@@ -749,10 +836,7 @@ static uint32_t DAP_SWD_Transfer(uint8_t *request, uint8_t *response) {
         response_value = DAP_TRANSFER_OK;
       } else {
         // Write DP/AP register
-        retry = DAP_Data.transfer.retry_count;
-        do {
-          response_value = SWD_Transfer(request_value, &data);
-        } while ((response_value == DAP_TRANSFER_WAIT) && retry-- && !DAP_TransferAbort);
+        response_value = SWD_TransferRetry(request_value, &data);
         if (response_value != DAP_TRANSFER_OK) break;
         check_write = 1;
       }
@@ -764,10 +848,7 @@ static uint32_t DAP_SWD_Transfer(uint8_t *request, uint8_t *response) {
   if (response_value == DAP_TRANSFER_OK) {
     if (post_read) {
       // Read previous data
-      retry = DAP_Data.transfer.retry_count;
-      do {
-        response_value = SWD_Transfer(DP_RDBUFF | DAP_TRANSFER_RnW, &data);
-      } while ((response_value == DAP_TRANSFER_WAIT) && retry-- && !DAP_TransferAbort);
+      response_value = SWD_TransferRetry(DP_RDBUFF | DAP_TRANSFER_RnW, &data);
       if (response_value != DAP_TRANSFER_OK) goto end;
       // Store previous data
       *response++ = (uint8_t) data;
@@ -776,10 +857,7 @@ static uint32_t DAP_SWD_Transfer(uint8_t *request, uint8_t *response) {
       *response++ = (uint8_t)(data >> 24);
     } else if (check_write) {
       // Check last write
-      retry = DAP_Data.transfer.retry_count;
-      do {
-        response_value = SWD_Transfer(DP_RDBUFF | DAP_TRANSFER_RnW, NULL);
-      } while ((response_value == DAP_TRANSFER_WAIT) && retry-- && !DAP_TransferAbort);
+      response_value = SWD_TransferRetry(DP_RDBUFF | DAP_TRANSFER_RnW, NULL);
     }
   }
 
@@ -1002,7 +1080,6 @@ static uint32_t DAP_SWD_TransferBlock(uint8_t *request, uint8_t *response) {
   uint32_t  response_count;
   uint32_t  response_value;
   uint8_t  *response_head;
-  uint32_t  retry;
   uint32_t  data;
 
   response_count = 0;
@@ -1023,10 +1100,7 @@ static uint32_t DAP_SWD_TransferBlock(uint8_t *request, uint8_t *response) {
     // Read register block
     if (request_value & DAP_TRANSFER_APnDP) {
       // Post AP read
-      retry = DAP_Data.transfer.retry_count;
-      do {
-        response_value = SWD_Transfer(request_value, NULL);
-      } while ((response_value == DAP_TRANSFER_WAIT) && retry-- && !DAP_TransferAbort);
+      response_value = SWD_TransferRetry(request_value, NULL);
       if (response_value != DAP_TRANSFER_OK) goto end;
     }
     while (request_count--) {
@@ -1035,10 +1109,7 @@ static uint32_t DAP_SWD_TransferBlock(uint8_t *request, uint8_t *response) {
         // Last AP read
         request_value = DP_RDBUFF | DAP_TRANSFER_RnW;
       }
-      retry = DAP_Data.transfer.retry_count;
-      do {
-        response_value = SWD_Transfer(request_value, &data);
-      } while ((response_value == DAP_TRANSFER_WAIT) && retry-- && !DAP_TransferAbort);
+      response_value = SWD_TransferRetry(request_value, &data);
       if (response_value != DAP_TRANSFER_OK) goto end;
       // Store data
       *response++ = (uint8_t) data;
@@ -1057,18 +1128,12 @@ static uint32_t DAP_SWD_TransferBlock(uint8_t *request, uint8_t *response) {
              (*(request+3) << 24);
       request += 4;
       // Write DP/AP register
-      retry = DAP_Data.transfer.retry_count;
-      do {
-        response_value = SWD_Transfer(request_value, &data);
-      } while ((response_value == DAP_TRANSFER_WAIT) && retry-- && !DAP_TransferAbort);
+      response_value = SWD_TransferRetry(request_value, &data);
       if (response_value != DAP_TRANSFER_OK) goto end;
       response_count++;
     }
     // Check last write
-    retry = DAP_Data.transfer.retry_count;
-    do {
-      response_value = SWD_Transfer(DP_RDBUFF | DAP_TRANSFER_RnW, NULL);
-    } while ((response_value == DAP_TRANSFER_WAIT) && retry-- && !DAP_TransferAbort);
+    response_value = SWD_TransferRetry(DP_RDBUFF | DAP_TRANSFER_RnW, NULL);
   }
 
 end:
@@ -1183,6 +1248,158 @@ end:
 #endif
 
 
+// Get DAP command length
+//   request:  pointer to request data
+//   size:     number of valid bytes in request buffer
+//   response: pointer to worst case number of bytes in response
+//   return:   number of bytes in request (0 = unknown or truncated command)
+uint32_t DAP_CommandLength(uint8_t *request, uint32_t size, uint32_t *response) {
+  uint8_t   info[DAP_PACKET_SIZE];
+  uint32_t  request_count;
+  uint32_t  request_value;
+  uint32_t  request_length;
+  uint32_t  response_length;
+  uint32_t  count;
+
+  if (size == 0) return (0);
+
+  switch (*request) {
+    case ID_DAP_Info:
+      if (size < 2) return (0);
+      request_length  = 2;
+      response_length = 2 + DAP_Info(*(request+1), info);
+      break;
+    case ID_DAP_LED:
+      request_length  = 3;
+      response_length = 2;
+      break;
+    case ID_DAP_Connect:
+    case ID_DAP_SWD_Configure:
+      request_length  = 2;
+      response_length = 2;
+      break;
+    case ID_DAP_Disconnect:
+      request_length  = 1;
+      response_length = 2;
+      break;
+    case ID_DAP_TransferConfigure:
+    case ID_DAP_WriteABORT:
+      request_length  = 6;
+      response_length = 2;
+      break;
+    case ID_DAP_Delay:
+      request_length  = 3;
+      response_length = 2;
+      break;
+    case ID_DAP_ResetTarget:
+      request_length  = 1;
+      response_length = 3;
+      break;
+    case ID_DAP_SWJ_Pins:
+      request_length  = 7;
+      response_length = 2;
+      break;
+    case ID_DAP_SWJ_Clock:
+      request_length  = 5;
+      response_length = 2;
+      break;
+    case ID_DAP_SWJ_Sequence:
+      if (size < 2) return (0);
+      count = *(request+1);
+      if (count == 0) count = 256;
+      request_length  = 2 + ((count + 7) / 8);
+      response_length = 2;
+      break;
+    case ID_DAP_JTAG_Sequence:
+      if (size < 2) return (0);
+      request_count   = *(request+1);
+      request_length  = 2;
+      response_length = 2;
+      while (request_count--) {
+        if (request_length >= size) return (0);
+        request_value = *(request+request_length);
+        count = request_value & JTAG_SEQUENCE_TCK;
+        if (count == 0) count = 64;
+        count = (count + 7) / 8;
+        request_length += 1 + count;
+        if (request_value & JTAG_SEQUENCE_TDO) {
+          response_length += count;
+        }
+      }
+      break;
+    case ID_DAP_JTAG_Configure:
+      if (size < 2) return (0);
+      request_length  = 2 + *(request+1);
+      response_length = 2;
+      break;
+    case ID_DAP_JTAG_IDCODE:
+      request_length  = 2;
+      response_length = 1 + 1+4;
+      break;
+    case ID_DAP_Transfer:
+      if (size < 3) return (0);
+      request_count   = *(request+2);
+      request_length  = 3;
+      response_length = 1 + 2;
+      while (request_count--) {
+        if (request_length >= size) return (0);
+        request_value = *(request+request_length);
+        request_length++;
+        if (request_value & DAP_TRANSFER_RnW) {
+          if (request_value & DAP_TRANSFER_MATCH_VALUE) {
+            request_length  += 4;
+          } else {
+            response_length += 4;
+          }
+        } else {
+          request_length += 4;
+        }
+      }
+      break;
+    case ID_DAP_SWO_Transport:
+    case ID_DAP_SWO_Mode:
+    case ID_DAP_SWO_Control:
+      request_length  = 2;
+      response_length = 2;
+      break;
+    case ID_DAP_SWO_Baudrate:
+      request_length  = 5;
+      response_length = 5;
+      break;
+    case ID_DAP_SWO_Status:
+      request_length  = 1;
+      response_length = 6;
+      break;
+    case ID_DAP_SWO_Data:
+      if (size < 3) return (0);
+      count = *(request+1) | (*(request+2) << 8);
+      if (count > (DAP_PACKET_SIZE - 4)) count = DAP_PACKET_SIZE - 4;
+      request_length  = 3;
+      response_length = 4 + count;
+      break;
+    case ID_DAP_TransferBlock:
+      if (size < 5) return (0);
+      request_count   = *(request+2) | (*(request+3) << 8);
+      request_value   = *(request+4);
+      request_length  = 5;
+      response_length = 1 + 3;
+      if (request_value & DAP_TRANSFER_RnW) {
+        response_length += 4 * request_count;
+      } else {
+        request_length  += 4 * request_count;
+      }
+      break;
+    default:
+      return (0);
+  }
+
+  if (request_length > size) return (0);
+
+  *response = response_length;
+  return (request_length);
+}
+
+
 // Process DAP Vendor command and prepare response
 // Default function (can be overridden)
 //   request:  pointer to request data
@@ -1278,6 +1495,39 @@ uint32_t DAP_ProcessCommand(uint8_t *request, uint8_t *response) {
       return (2);
 #endif
 
+#if (SWO_UART != 0)
+    case ID_DAP_SWO_Transport:
+      num = SWO_Transport(request, response);
+      break;
+    case ID_DAP_SWO_Mode:
+      num = SWO_Mode(request, response);
+      break;
+    case ID_DAP_SWO_Baudrate:
+      num = SWO_Baudrate(request, response);
+      break;
+    case ID_DAP_SWO_Control:
+      num = SWO_Control(request, response);
+      break;
+    case ID_DAP_SWO_Status:
+      num = SWO_Status(response);
+      break;
+    case ID_DAP_SWO_Data:
+      num = SWO_Data(request, response);
+      break;
+#else
+    case ID_DAP_SWO_Transport:
+    case ID_DAP_SWO_Mode:
+    case ID_DAP_SWO_Control:
+      *response = DAP_ERROR;
+      return (2);
+    case ID_DAP_SWO_Baudrate:
+      *(response+0) = 0;    // Baudrate not supported
+      *(response+1) = 0;
+      *(response+2) = 0;
+      *(response+3) = 0;
+      return (5);
+#endif
+
     case ID_DAP_TransferConfigure:
       num = DAP_TransferConfigure(request, response);
       break;
@@ -1362,6 +1612,9 @@ void DAP_Setup(void) {
 #if (DAP_SWD != 0)
   DAP_Data.swd_conf.turnaround  = 1;
 //DAP_Data.swd_conf.data_phase  = 0;
+  // DAP_Retry statistics and learned idle cycles are kept across connects,
+  // they are cleared by ID_DAP_RetryStatistics only
+  DAP_RetryAP = 0;
 #endif
 #if (DAP_JTAG != 0)
 //DAP_Data.jtag_dev.count = 0;
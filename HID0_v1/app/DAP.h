@@ -43,6 +43,12 @@
 #define ID_DAP_JTAG_Sequence            0x14
 #define ID_DAP_JTAG_Configure           0x15
 #define ID_DAP_JTAG_IDCODE              0x16
+#define ID_DAP_SWO_Transport            0x17
+#define ID_DAP_SWO_Mode                 0x18
+#define ID_DAP_SWO_Baudrate             0x19
+#define ID_DAP_SWO_Control              0x1A
+#define ID_DAP_SWO_Status               0x1B
+#define ID_DAP_SWO_Data                 0x1C
 
 // DAP Vendor Command IDs
 #define ID_DAP_Vendor0                  0x80
@@ -78,6 +84,21 @@
 #define ID_DAP_Vendor30                 0x9E
 #define ID_DAP_Vendor31                 0x9F
 
+// DAP Vendor Command usage (see DAP_vendor.c)
+#define ID_DAP_ExecuteCommands          ID_DAP_Vendor0  // Execute list of commands
+#define ID_DAP_QueueCommands            ID_DAP_Vendor1  // Execute list of commands, defer response
+#define ID_DAP_ReadMemory               ID_DAP_Vendor2  // Read target memory
+#define ID_DAP_WriteMemory              ID_DAP_Vendor3  // Write target memory
+#define ID_DAP_RetryStatistics          ID_DAP_Vendor4  // Read WAIT retry statistics
+#define ID_DAP_PerfDump                 ID_DAP_Vendor5  // Read performance counters (see DAP_perf.c)
+#define ID_DAP_WatchConfig              ID_DAP_Vendor6  // Configure data watch items (see Watch.c)
+#define ID_DAP_WatchControl             ID_DAP_Vendor7  // Start/stop data watch sampling
+#define ID_DAP_WatchStatus              ID_DAP_Vendor8  // Read data watch status
+#define ID_DAP_ProfileConfig            ID_DAP_Vendor9  // Configure PC sampling histogram (see Profile.c)
+#define ID_DAP_ProfileControl           ID_DAP_Vendor10 // Start/stop/clear PC sampling
+#define ID_DAP_ProfileRead              ID_DAP_Vendor11 // Read PC sampling histogram
+#define ID_DAP_WatchData                ID_DAP_Vendor12 // Read data watch samples (no stream endpoint)
+
 #define ID_DAP_Invalid                  0xFF
 
 // DAP Status Code
@@ -92,6 +113,7 @@
 #define DAP_ID_DEVICE_VENDOR            5
 #define DAP_ID_DEVICE_NAME              6
 #define DAP_ID_CAPABILITIES             0xF0
+#define DAP_ID_SWO_BUFFER_SIZE          0xFD
 #define DAP_ID_PACKET_COUNT             0xFE
 #define DAP_ID_PACKET_SIZE              0xFF
 
@@ -128,6 +150,35 @@
 #define DAP_TRANSFER_ERROR              (1<<3)
 #define DAP_TRANSFER_MISMATCH           (1<<4)
 
+// DAP SWO Trace Mode
+#define DAP_SWO_OFF                     0
+#define DAP_SWO_UART                    1
+#define DAP_SWO_MANCHESTER              2
+
+// DAP SWO Trace Transport
+#define DAP_SWO_TRANSPORT_NONE          0
+#define DAP_SWO_TRANSPORT_DATA          1       // Read with DAP_SWO_Data command
+#define DAP_SWO_TRANSPORT_STREAM        2       // Sent on the stream endpoint
+
+// DAP SWO Trace Status
+#define DAP_SWO_CAPTURE_ACTIVE          (1<<0)
+#define DAP_SWO_STREAM_ERROR            (1<<6)
+#define DAP_SWO_BUFFER_OVERRUN          (1<<7)
+
+// DAP Stream Packet Tag (first byte of every stream endpoint packet)
+#define DAP_STREAM_SWO                  1       // SWO trace data
+#define DAP_STREAM_WATCH                2       // Data watch sample records
+
+// DAP Data Watch Status
+#define DAP_WATCH_ACTIVE                (1<<0)
+#define DAP_WATCH_READ_ERROR            (1<<6)
+#define DAP_WATCH_BUFFER_OVERRUN        (1<<7)
+
+// DAP PC Sampling Status
+#define DAP_PROFILE_ACTIVE              (1<<0)
+#define DAP_PROFILE_CLEAR               (1<<1)
+#define DAP_PROFILE_READ_ERROR          (1<<6)
+
 
 // Debug Port Register Addresses
 #define DP_IDCODE                       0x00    // IDCODE Register (SW Read only)
@@ -188,6 +239,23 @@ typedef struct {
 extern          DAP_Data_t DAP_Data;            // DAP Data
 extern volatile uint8_t    DAP_TransferAbort;   // Transfer Abort Flag
 
+// WAIT Retry Statistics (per AP)
+#define DAP_RETRY_AP_NUM        4               // APs with own statistics (last one shared)
+typedef struct {
+  uint32_t    transfers;                        // Number of transfers
+  uint32_t    waits;                            // Number of WAIT responses
+  uint32_t    faults;                           // Number of FAULT responses
+  uint32_t    backoffs;                         // Number of back-off delays
+  uint8_t     idle_cycles;                      // Learned idle cycles after transfer
+  uint8_t     ok_count;                         // WAIT-free responses since last change
+} DAP_Retry_t;
+
+extern          DAP_Retry_t DAP_Retry[DAP_RETRY_AP_NUM];
+
+// DP SELECT written last through SWD_TransferRetry, by the host or the probe
+#define DAP_SELECT_UNKNOWN      0xFFFFFFFF      // No SELECT write seen yet
+extern          uint32_t    DAP_Select;
+
 
 // Functions
 extern void     SWJ_Sequence    (uint32_t count, uint8_t *data);
@@ -197,11 +265,37 @@ extern uint32_t JTAG_ReadIDCode (void);
 extern void     JTAG_WriteAbort (uint32_t data);
 extern uint8_t  JTAG_Transfer   (uint32_t request, uint32_t *data);
 extern uint8_t  SWD_Transfer    (uint32_t request, uint32_t *data);
+extern uint8_t  SWD_TransferRetry (uint32_t request, uint32_t *data);
 
 extern void     Delayms         (uint32_t delay);
 
+extern uint32_t SWO_Transport   (uint8_t *request, uint8_t *response);
+extern uint32_t SWO_Mode        (uint8_t *request, uint8_t *response);
+extern uint32_t SWO_Baudrate    (uint8_t *request, uint8_t *response);
+extern uint32_t SWO_Control     (uint8_t *request, uint8_t *response);
+extern uint32_t SWO_Status      (uint8_t *response);
+extern uint32_t SWO_Data        (uint8_t *request, uint8_t *response);
+extern uint32_t SWO_StreamRead  (uint8_t *buf, uint32_t count);
+extern void     SWO_DMA_Handler (void);
+
+extern uint32_t Watch_Config    (uint8_t *request, uint8_t *response);
+extern uint32_t Watch_Control   (uint8_t *request, uint8_t *response);
+extern uint32_t Watch_Status    (uint8_t *response);
+extern uint32_t Watch_Data      (uint8_t *request, uint8_t *response);
+extern uint32_t Watch_StreamRead(uint8_t *buf, uint32_t count);
+extern void     Watch_Process   (void);
+
+extern void     Stream_Process  (void);
+
+extern uint32_t Profile_Config  (uint8_t *request, uint8_t *response);
+extern uint32_t Profile_Control (uint8_t *request, uint8_t *response);
+extern uint32_t Profile_Read    (uint8_t *request, uint8_t *response);
+extern void     Profile_Process (void);
+
 extern uint32_t DAP_ProcessVendorCommand (uint8_t *request, uint8_t *response);
 
+extern uint32_t DAP_CommandLength  (uint8_t *request, uint32_t size, uint32_t *response);
+
 extern uint32_t DAP_ProcessCommand (uint8_t *request, uint8_t *response);
 extern void     DAP_Setup (void);
 
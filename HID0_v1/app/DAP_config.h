@@ -84,6 +84,75 @@ Provides definitions about:
 /// setting can be reduced (valid range is 1 .. 255). Change setting to 4 for High-Speed USB.
 #define DAP_PACKET_COUNT        64             ///< Buffers: 64 = Full-Speed, 4 = High-Speed.
 
+/// Indicate that the probe performance counters and trace ring are available.
+/// The counters use the DWT cycle counter of the Debug Unit and are read with the
+/// vendor command ID_DAP_PerfDump. Set to 0 to remove all instrumentation.
+#define DAP_PERF                1               ///< Perf Counters: 1 = available, 0 = not available.
+
+/// Indicate that UART Serial Wire Output (SWO) trace is available.
+/// This information is returned by the command \ref DAP_Info as part of <b>Capabilities</b>.
+/// The SWO pin is received with USART0 (P2_1), GPDMA channel 0 fills the trace buffer.
+#define SWO_UART                1               ///< SWO UART:  1 = available, 0 = not available
+
+/// Maximum SWO UART Baudrate (USART0 clock / 16).
+#define SWO_UART_MAX_BAUDRATE   (CPU_CLOCK/16U) ///< SWO UART Maximum Baudrate in Hz
+
+/// Indicate that Manchester Serial Wire Output (SWO) trace is available.
+/// This information is returned by the command \ref DAP_Info as part of <b>Capabilities</b>.
+#define SWO_MANCHESTER          0               ///< SWO Manchester:  1 = available, 0 = not available
+
+/// SWO Trace Buffer Size.
+#define SWO_BUFFER_SIZE         8192U           ///< SWO Trace Buffer Size in bytes (must be 2^n)
+
+/// Indicate that SWO Streaming Trace is available.
+/// Trace data is sent on the bulk IN endpoint of the SWO interface (USBD_SWO_ENABLE),
+/// in packets tagged DAP_STREAM_SWO (Stream.c).
+#define SWO_STREAM              1               ///< SWO Streaming Trace: 1 = available, 0 = not available.
+
+/// Indicate that the virtual COM port is bridged to the UART of the target.
+/// USART2 (P1_15 TXD, P1_16 RXD) with GPDMA channel 1 (receive) and 2 (transmit).
+/// The host selects the semihosting console and RTT instead by setting CONSOLE_BAUDRATE,
+/// any other baud rate selects the bridge again. Without the bridge the console is always used.
+#define UART_BRIDGE             1               ///< UART Bridge: 1 = available, 0 = not available.
+
+/// Baud rate set by the host on the virtual COM port to connect to the semihosting console and RTT.
+#define CONSOLE_BAUDRATE        1200U           ///< Console Baud Rate (not applied to the target UART).
+
+/// UART Bridge Buffer Size.
+#define UART_BUFFER_SIZE        4096U           ///< UART receive and transmit buffer size in bytes (must be 2^n)
+
+/// Indicate that semihost calls and the RTT buffers of the target are serviced.
+/// The core halts on BKPT 0xAB, the console calls and RTT go to the virtual COM port (semihost.c, rtt.c).
+/// Calls are served only while no debugger is connected, RTT also between the commands of one.
+#define SEMIHOST                1               ///< Semihosting: 1 = available, 0 = not available.
+
+/// Indicate that data watch sampling is available.
+/// Target memory is sampled periodically into a sample buffer, see vendor command
+/// ID_DAP_WatchConfig and DATA_WATCH_STREAM.
+#define DATA_WATCH              1               ///< Data Watch: 1 = available, 0 = not available.
+
+/// Data Watch Sample Buffer Size.
+#define DATA_WATCH_BUFFER_SIZE  4096U           ///< Data Watch sample buffer size in bytes (must be 2^n)
+
+/// Indicate that the data watch samples are streamed.
+/// Samples share the bulk IN endpoint of the SWO interface (USBD_SWO_ENABLE) with the SWO
+/// trace, in packets tagged DAP_STREAM_WATCH (Stream.c), otherwise the host reads them with
+/// vendor command ID_DAP_WatchData.
+#define DATA_WATCH_STREAM       1               ///< Data Watch Stream: 1 = available, 0 = not available.
+
+/// Indicate that the drag-and-drop programming drive is available.
+/// Image files copied to the MSC drive are programmed into the target (msc_flash.c).
+/// The drive uses the bulk endpoints of the MSC interface (USBD_MSC_ENABLE).
+#define MSC_DRIVE               1               ///< MSC Drive: 1 = available, 0 = not available.
+
+/// Indicate that PC sampling is available.
+/// The PC of the running target is read from DWT_PCSR over SWD and counted into a
+/// histogram of address ranges, see vendor command ID_DAP_ProfileConfig.
+#define PC_SAMPLING             1               ///< PC Sampling: 1 = available, 0 = not available.
+
+/// PC Sampling Histogram Size.
+#define PC_SAMPLING_BUCKETS     1024U           ///< Maximum number of histogram buckets (4 bytes each)
+
 
 /// Debug Unit is connected to fixed Target Device.
 /// The Debug Unit may be part of an evaluation board and always connected to a fixed
@@ -0,0 +1,321 @@
+/******************************************************************************
+ * @file     DAP_perf.c
+ * @brief    CMSIS-DAP Probe Performance Counters and Trace
+ * @version  V1.00
+ * @date     31. May 2012
+ *
+ * @note
+ * Copyright (C) 2012 ARM Limited. All rights reserved.
+ *
+ * @par
+ * ARM Limited (ARM) is supplying this software for use with Cortex-M
+ * processor based microcontrollers.
+ *
+ * @par
+ * THIS SOFTWARE IS PROVIDED "AS IS".  NO WARRANTIES, WHETHER EXPRESS, IMPLIED
+ * OR STATUTORY, INCLUDING, BUT NOT LIMITED TO, IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE APPLY TO THIS SOFTWARE.
+ * ARM SHALL NOT, IN ANY CIRCUMSTANCES, BE LIABLE FOR SPECIAL, INCIDENTAL, OR
+ * CONSEQUENTIAL DAMAGES, FOR ANY REASON WHATSOEVER.
+ *
+ ******************************************************************************/
+
+#include <string.h>
+#include "DAP_config.h"
+#include "DAP.h"
+#include "DAP_perf.h"
+
+#if (DAP_PERF != 0)
+
+#if ((PERF_TRACE_NUM & (PERF_TRACE_NUM - 1)) != 0)
+#error "Trace Entry Count must be a power of 2"
+#endif
+
+// Time stamps are taken from the DWT cycle counter of the probe (CPU_CLOCK)
+#define PERF_TIMESTAMP()        (DWT->CYCCNT)
+
+// Counters and the trace ring are updated from the main loop and from the USB
+// interrupt. Updates mask interrupts, so an increment in the main loop does
+// not overwrite one the interrupt made in between; the previous mask is kept
+// for callers that have interrupts disabled already.
+#define PERF_LOCK(primask)      do { primask = __get_PRIMASK(); __disable_irq(); } while (0)
+#define PERF_UNLOCK(primask)    __set_PRIMASK(primask)
+
+typedef struct {
+  uint32_t time;                        // Cycle counter at end of event
+  uint32_t value;                       // Event value
+  uint8_t  event;                       // Event ID
+  uint8_t  arg;                         // Event argument
+} Perf_Trace_t;
+
+typedef struct {
+  uint32_t count;                       // Number of commands
+  uint32_t cycles;                      // Cycles spent in commands
+} Perf_Command_t;
+
+static volatile uint32_t Perf_Counter [PERF_CNT_NUM];        // Event Counters
+static   uint32_t       Perf_Histogram[PERF_HISTOGRAM_NUM];  // Command Cycle Histogram
+static   Perf_Command_t Perf_Command  [PERF_COMMAND_NUM];    // Per Command Statistics
+static   Perf_Trace_t   Perf_Trace    [PERF_TRACE_NUM];      // Trace Ring
+static volatile uint32_t Perf_TraceIn;                       // Trace Ring In Index (free running)
+static   uint32_t       Perf_CommandStart;                   // Command Start Time
+static   uint32_t       Perf_MSCStart;                       // MSC Access Start Time
+
+
+// Record trace event
+//   Can be called from thread and interrupt level.
+static void Perf_Event(uint8_t event, uint8_t arg, uint32_t value) {
+  Perf_Trace_t *trace;
+  uint32_t      n;
+  uint32_t      primask;
+
+  PERF_LOCK(primask);
+  n = Perf_TraceIn++;
+  PERF_UNLOCK(primask);
+
+  trace = &Perf_Trace[n & (PERF_TRACE_NUM - 1)];
+  trace->time  = PERF_TIMESTAMP();
+  trace->value = value;
+  trace->event = event;
+  trace->arg   = arg;
+}
+
+
+// Add to event counter
+//   Can be called from thread and interrupt level.
+static void Perf_Add(uint32_t counter, uint32_t n) {
+  uint32_t primask;
+
+  PERF_LOCK(primask);
+  Perf_Counter[counter] += n;
+  PERF_UNLOCK(primask);
+}
+
+
+// Count event
+//   counter: PERF_CNT_x
+void Perf_Count(uint32_t counter) {
+  Perf_Add(counter, 1);
+}
+
+
+// Initialize cycle counter and clear statistics
+void Perf_Init(void) {
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CTRL        |= DWT_CTRL_CYCCNTENA_Msk;
+
+  memset((void *)Perf_Counter, 0, sizeof(Perf_Counter));
+  memset(Perf_Histogram, 0, sizeof(Perf_Histogram));
+  memset(Perf_Command,   0, sizeof(Perf_Command));
+  Perf_TraceIn = 0;
+}
+
+
+// Start of DAP command
+void Perf_CommandBegin(void) {
+  Perf_CommandStart = PERF_TIMESTAMP();
+}
+
+
+// End of DAP command
+//   id: command ID
+void Perf_CommandEnd(uint8_t id) {
+  uint32_t cycles;
+  uint32_t n;
+
+  cycles = PERF_TIMESTAMP() - Perf_CommandStart;
+
+  Perf_Add(PERF_CNT_DAP_COMMAND, 1);
+
+  for (n = 0; (n < (PERF_HISTOGRAM_NUM - 1)) && (cycles >> (n + 1)); n++);
+  Perf_Histogram[n]++;
+
+  if (id < 0x20) {
+    n = id;
+  } else if ((id >= ID_DAP_Vendor0) && (id <= ID_DAP_Vendor31)) {
+    n = 0x20 + (id - ID_DAP_Vendor0);
+  } else {
+    n = 0x20 - 1;                       // Invalid commands (0x1F is not used)
+  }
+  Perf_Command[n].count++;
+  Perf_Command[n].cycles += cycles;
+
+  Perf_Event(PERF_EVENT_COMMAND, id, cycles);
+}
+
+
+// SWD transfer completed
+//   request: A[3:2] RnW APnDP
+//   ack:     ACK[2:0]
+void Perf_SWDTransfer(uint32_t request, uint8_t ack) {
+
+  Perf_Add(PERF_CNT_SWD_TRANSFER, 1);
+
+  switch (ack) {
+    case DAP_TRANSFER_OK:
+      break;
+    case DAP_TRANSFER_WAIT:
+      Perf_Add(PERF_CNT_SWD_WAIT, 1);
+      break;
+    case DAP_TRANSFER_FAULT:
+      Perf_Add(PERF_CNT_SWD_FAULT, 1);
+      Perf_Event(PERF_EVENT_SWD_FAULT, ack, request);
+      break;
+    default:
+      Perf_Add(PERF_CNT_SWD_ERROR, 1);
+      Perf_Event(PERF_EVENT_SWD_FAULT, ack, request);
+      break;
+  }
+}
+
+
+// HID report discarded (called from USB interrupt)
+//   id:  command ID
+//   len: report length
+void Perf_USBDrop(uint8_t id, uint32_t len) {
+  Perf_Add(PERF_CNT_USB_DROP, 1);
+  Perf_Event(PERF_EVENT_USB_DROP, id, len);
+}
+
+
+// Start of MSC block access
+void Perf_MSCBegin(void) {
+  Perf_MSCStart = PERF_TIMESTAMP();
+}
+
+
+// End of MSC block access
+//   event: PERF_EVENT_MSC_READ or PERF_EVENT_MSC_WRITE
+//   block: first block
+//   num:   number of blocks
+void Perf_MSCEnd(uint8_t event, uint32_t block, uint32_t num) {
+
+  Perf_Add(PERF_CNT_MSC_CYCLES, PERF_TIMESTAMP() - Perf_MSCStart);
+  if (event == PERF_EVENT_MSC_WRITE) {
+    Perf_Add(PERF_CNT_MSC_WRITE, num);
+  } else {
+    Perf_Add(PERF_CNT_MSC_READ,  num);
+  }
+  Perf_Event(event, (uint8_t)num, block);
+}
+
+
+// Store 32-bit value in little endian
+static uint8_t * Perf_Put(uint8_t *response, uint32_t value) {
+  *response++ = (uint8_t)(value >>  0);
+  *response++ = (uint8_t)(value >>  8);
+  *response++ = (uint8_t)(value >> 16);
+  *response++ = (uint8_t)(value >> 24);
+  return (response);
+}
+
+
+// Process Perf Dump command and prepare response
+//   request:  pointer to request data
+//   response: pointer to response data
+//   return:   number of bytes in response
+//
+// Request:  table (PERF_TABLE_x), first entry, flags (bit 0: clear table).
+// Response: status, entry count, followed by the entries in little endian:
+//   PERF_TABLE_COUNTER:   uint32_t counter, index PERF_CNT_x
+//   PERF_TABLE_HISTOGRAM: uint32_t commands, bucket n counts commands taking
+//                         2^n .. 2^(n+1)-1 cycles (bucket 0 also 0 cycles)
+//   PERF_TABLE_COMMAND:   uint32_t count, uint32_t cycles; entry n is command
+//                         ID n for n < 0x20 and ID_DAP_Vendor0 + n - 0x20 else
+//   PERF_TABLE_TRACE:     uint32_t cycles, uint32_t value, uint8_t event,
+//                         uint8_t arg; entry 0 is the oldest one retained
+// A response holds as many entries as fit into DAP_PACKET_SIZE, the host
+// reads on with the next first entry until the entry count is 0. Cycles are
+// CPU_CLOCK cycles of the probe. Clearing takes effect after the entries are
+// copied, so a table can be read and cleared with the last request.
+uint32_t Perf_Dump(uint8_t *request, uint8_t *response) {
+  uint8_t *response_head;
+  uint32_t first;
+  uint32_t total;
+  uint32_t size;
+  uint32_t num;
+  uint32_t n;
+  uint32_t oldest;
+  uint32_t primask;
+
+  response_head = response;
+  first = *(request+1);
+
+  switch (*request) {
+    case PERF_TABLE_COUNTER:
+      total = PERF_CNT_NUM;
+      size  = 4;
+      break;
+    case PERF_TABLE_HISTOGRAM:
+      total = PERF_HISTOGRAM_NUM;
+      size  = 4;
+      break;
+    case PERF_TABLE_COMMAND:
+      total = PERF_COMMAND_NUM;
+      size  = 8;
+      break;
+    case PERF_TABLE_TRACE:
+      total = (Perf_TraceIn < PERF_TRACE_NUM) ? Perf_TraceIn : PERF_TRACE_NUM;
+      size  = 10;
+      break;
+    default:
+      *response = DAP_ERROR;
+      return (1);
+  }
+
+  // Room left after command ID, status and entry count
+  num = (DAP_PACKET_SIZE - 3) / size;
+  if (first >= total) {
+    num = 0;
+  } else if (num > (total - first)) {
+    num = total - first;
+  }
+
+  *response++ = DAP_OK;
+  *response++ = (uint8_t)num;
+
+  oldest = Perf_TraceIn - total;
+  for (n = first; n < (first + num); n++) {
+    switch (*request) {
+      case PERF_TABLE_COUNTER:
+        response = Perf_Put(response, Perf_Counter[n]);
+        break;
+      case PERF_TABLE_HISTOGRAM:
+        response = Perf_Put(response, Perf_Histogram[n]);
+        break;
+      case PERF_TABLE_COMMAND:
+        response = Perf_Put(response, Perf_Command[n].count);
+        response = Perf_Put(response, Perf_Command[n].cycles);
+        break;
+      case PERF_TABLE_TRACE:
+        response = Perf_Put(response, Perf_Trace[(oldest + n) & (PERF_TRACE_NUM - 1)].time);
+        response = Perf_Put(response, Perf_Trace[(oldest + n) & (PERF_TRACE_NUM - 1)].value);
+        *response++ = Perf_Trace[(oldest + n) & (PERF_TRACE_NUM - 1)].event;
+        *response++ = Perf_Trace[(oldest + n) & (PERF_TRACE_NUM - 1)].arg;
+        break;
+    }
+  }
+
+  if (*(request+2) & 0x01) {
+    PERF_LOCK(primask);
+    switch (*request) {
+      case PERF_TABLE_COUNTER:
+        memset((void *)Perf_Counter, 0, sizeof(Perf_Counter));
+        break;
+      case PERF_TABLE_HISTOGRAM:
+        memset(Perf_Histogram, 0, sizeof(Perf_Histogram));
+        break;
+      case PERF_TABLE_COMMAND:
+        memset(Perf_Command, 0, sizeof(Perf_Command));
+        break;
+      case PERF_TABLE_TRACE:
+        Perf_TraceIn = 0;
+        break;
+    }
+    PERF_UNLOCK(primask);
+  }
+
+  return (response - response_head);
+}
+
+#endif  /* (DAP_PERF != 0) */
@@ -0,0 +1,94 @@
+/******************************************************************************
+ * @file     DAP_perf.h
+ * @brief    CMSIS-DAP Probe Performance Counters and Trace
+ * @version  V1.00
+ * @date     31. May 2012
+ *
+ * @note
+ * Copyright (C) 2012 ARM Limited. All rights reserved.
+ *
+ * @par
+ * ARM Limited (ARM) is supplying this software for use with Cortex-M
+ * processor based microcontrollers.
+ *
+ * @par
+ * THIS SOFTWARE IS PROVIDED "AS IS".  NO WARRANTIES, WHETHER EXPRESS, IMPLIED
+ * OR STATUTORY, INCLUDING, BUT NOT LIMITED TO, IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE APPLY TO THIS SOFTWARE.
+ * ARM SHALL NOT, IN ANY CIRCUMSTANCES, BE LIABLE FOR SPECIAL, INCIDENTAL, OR
+ * CONSEQUENTIAL DAMAGES, FOR ANY REASON WHATSOEVER.
+ *
+ ******************************************************************************/
+
+#ifndef __DAP_PERF_H__
+#define __DAP_PERF_H__
+
+#include "DAP_config.h"
+
+// Performance Tables (read with ID_DAP_PerfDump)
+#define PERF_TABLE_COUNTER      0       // Event counters, uint32_t each
+#define PERF_TABLE_HISTOGRAM    1       // Command cycles, log2 buckets, uint32_t each
+#define PERF_TABLE_COMMAND      2       // Per command: count (4), cycles (4)
+#define PERF_TABLE_TRACE        3       // Trace ring: cycles (4), value (4), event (1), arg (1)
+
+// Event Counters
+#define PERF_CNT_DAP_COMMAND    0       // DAP commands processed
+#define PERF_CNT_SWD_TRANSFER   1       // SWD transfers (including retries)
+#define PERF_CNT_SWD_WAIT       2       // SWD WAIT responses
+#define PERF_CNT_SWD_FAULT      3       // SWD FAULT responses
+#define PERF_CNT_SWD_ERROR      4       // SWD protocol and parity errors
+#define PERF_CNT_USB_REPORT     5       // HID reports received
+#define PERF_CNT_USB_DROP       6       // HID reports discarded (request buffer full)
+#define PERF_CNT_USB_RESPONSE   7       // HID response packets sent
+#define PERF_CNT_MSC_READ       8       // MSC blocks read
+#define PERF_CNT_MSC_WRITE      9       // MSC blocks written
+#define PERF_CNT_MSC_CYCLES     10      // Cycles spent in MSC read/write
+#define PERF_CNT_NUM            11
+
+// Trace Events
+#define PERF_EVENT_COMMAND      1       // arg: command ID,  value: cycles
+#define PERF_EVENT_SWD_FAULT    2       // arg: ACK,         value: request
+#define PERF_EVENT_USB_DROP     3       // arg: command ID,  value: report length
+#define PERF_EVENT_MSC_READ     4       // arg: block count, value: block
+#define PERF_EVENT_MSC_WRITE    5       // arg: block count, value: block
+
+#define PERF_HISTOGRAM_NUM      16      // Buckets: [0] < 2 cycles, [n] < 2^(n+1), last open
+#define PERF_COMMAND_NUM        64      // Standard commands 0x00..0x1F, Vendor 0x80..0x9F
+#define PERF_TRACE_NUM          64      // Trace entries (power of 2)
+
+
+#if (DAP_PERF != 0)
+
+extern void     Perf_Init           (void);
+extern void     Perf_Count          (uint32_t counter);
+extern void     Perf_CommandBegin   (void);
+extern void     Perf_CommandEnd     (uint8_t id);
+extern void     Perf_SWDTransfer    (uint32_t request, uint8_t ack);
+extern void     Perf_USBDrop        (uint8_t id, uint32_t len);
+extern void     Perf_MSCBegin       (void);
+extern void     Perf_MSCEnd         (uint8_t event, uint32_t block, uint32_t num);
+extern uint32_t Perf_Dump           (uint8_t *request, uint8_t *response);
+
+#define PERF_INIT()                     Perf_Init()
+#define PERF_COUNT(counter)             Perf_Count(counter)
+#define PERF_COMMAND_BEGIN()            Perf_CommandBegin()
+#define PERF_COMMAND_END(id)            Perf_CommandEnd(id)
+#define PERF_SWD_TRANSFER(request, ack) Perf_SWDTransfer(request, ack)
+#define PERF_USB_DROP(id, len)          Perf_USBDrop(id, len)
+#define PERF_MSC_BEGIN()                Perf_MSCBegin()
+#define PERF_MSC_END(event, block, num) Perf_MSCEnd(event, block, num)
+
+#else
+
+#define PERF_INIT()
+#define PERF_COUNT(counter)
+#define PERF_COMMAND_BEGIN()
+#define PERF_COMMAND_END(id)
+#define PERF_SWD_TRANSFER(request, ack)
+#define PERF_USB_DROP(id, len)
+#define PERF_MSC_BEGIN()
+#define PERF_MSC_END(event, block, num)
+
+#endif
+
+#endif  /* __DAP_PERF_H__ */
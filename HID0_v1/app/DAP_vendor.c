@@ -0,0 +1,276 @@
+/******************************************************************************
+ * @file     DAP_vendor.c
+ * @brief    CMSIS-DAP Vendor Commands
+ * @version  V1.00
+ * @date     31. May 2012
+ *
+ * @note
+ * Copyright (C) 2012 ARM Limited. All rights reserved.
+ *
+ * @par
+ * ARM Limited (ARM) is supplying this software for use with Cortex-M
+ * processor based microcontrollers.
+ *
+ * @par
+ * THIS SOFTWARE IS PROVIDED "AS IS".  NO WARRANTIES, WHETHER EXPRESS, IMPLIED
+ * OR STATUTORY, INCLUDING, BUT NOT LIMITED TO, IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE APPLY TO THIS SOFTWARE.
+ * ARM SHALL NOT, IN ANY CIRCUMSTANCES, BE LIABLE FOR SPECIAL, INCIDENTAL, OR
+ * CONSEQUENTIAL DAMAGES, FOR ANY REASON WHATSOEVER.
+ *
+ ******************************************************************************/
+
+#include "DAP_config.h"
+#include "DAP.h"
+#include "swd_host.h"
+#include "DAP_perf.h"
+
+
+// Process Execute Commands command and prepare response
+//   request:  pointer to request data
+//   response: pointer to response data
+//   return:   number of bytes in response
+//
+// Request:  command count, followed by the nested commands back to back.
+// Response: number of executed commands, followed by the nested responses.
+// Execution stops at the first unknown or truncated command and at the first
+// command whose worst case response would not fit into DAP_PACKET_SIZE.
+// ID_DAP_QueueCommands uses the same format; usbd_hid_process packs its
+// response together with the following ones instead of sending it at once.
+static uint32_t DAP_ExecuteCommands(uint8_t *request, uint8_t *response) {
+  uint32_t  command_count;
+  uint32_t  execute_count;
+  uint32_t  request_size;
+  uint32_t  request_length;
+  uint32_t  response_size;
+  uint32_t  response_length;
+  uint8_t  *response_head;
+
+  response_head = response;
+  response     += 1;
+
+  // Room left after command ID and command count
+  request_size  = DAP_PACKET_SIZE - 2;
+  response_size = DAP_PACKET_SIZE - 2;
+
+  execute_count = 0;
+  command_count = *request++;
+  while (command_count--) {
+    request_length = DAP_CommandLength(request, request_size, &response_length);
+    if (request_length == 0) break;
+    if (response_length > response_size) break;
+
+    response_length = DAP_ProcessCommand(request, response);
+
+    request       += request_length;
+    request_size  -= request_length;
+    response      += response_length;
+    response_size -= response_length;
+    execute_count++;
+  }
+
+  *response_head = (uint8_t)execute_count;
+
+  return (response - response_head);
+}
+
+
+// Process Read Memory command and prepare response
+//   request:  pointer to request data
+//   response: pointer to response data
+//   return:   number of bytes in response
+//
+// Request:  address (4), byte count (2), access size (1: 1, 2 or 4 bytes).
+// Response: status, followed by byte count bytes of data.
+// Up to DAP_PACKET_SIZE-2 bytes are read with one command. TAR auto increment
+// page boundaries and unaligned edges are handled by swd_read_memory_access.
+static uint32_t DAP_ReadMemory(uint8_t *request, uint8_t *response) {
+  uint32_t address;
+  uint32_t count;
+  uint32_t access;
+
+  address = (*(request+0) <<  0) |
+            (*(request+1) <<  8) |
+            (*(request+2) << 16) |
+            (*(request+3) << 24);
+  count   = (*(request+4) <<  0) |
+            (*(request+5) <<  8);
+  access  =  *(request+6);
+
+  if ((DAP_Data.debug_port != DAP_PORT_SWD) || (count > (DAP_PACKET_SIZE - 2))) {
+    *response = DAP_ERROR;
+    return (1);
+  }
+
+  // The host may have changed SELECT/CSW through DAP_Transfer
+  swd_clear_state();
+
+  if (!swd_read_memory_access(address, response+1, count, access)) {
+    *response = DAP_ERROR;
+    return (1);
+  }
+
+  *response = DAP_OK;
+  return (1 + count);
+}
+
+
+// Process Write Memory command and prepare response
+//   request:  pointer to request data
+//   response: pointer to response data
+//   return:   number of bytes in response
+//
+// Request:  address (4), byte count (2), access size (1), followed by data.
+// Response: status.
+static uint32_t DAP_WriteMemory(uint8_t *request, uint8_t *response) {
+  uint32_t address;
+  uint32_t count;
+  uint32_t access;
+
+  address = (*(request+0) <<  0) |
+            (*(request+1) <<  8) |
+            (*(request+2) << 16) |
+            (*(request+3) << 24);
+  count   = (*(request+4) <<  0) |
+            (*(request+5) <<  8);
+  access  =  *(request+6);
+
+  if ((DAP_Data.debug_port != DAP_PORT_SWD) || (count > (DAP_PACKET_SIZE - 8))) {
+    *response = DAP_ERROR;
+    return (1);
+  }
+
+  // The host may have changed SELECT/CSW through DAP_Transfer
+  swd_clear_state();
+
+  if (!swd_write_memory_access(address, request+7, count, access)) {
+    *response = DAP_ERROR;
+    return (1);
+  }
+
+  *response = DAP_OK;
+  return (1);
+}
+
+
+// Process Retry Statistics command and prepare response
+//   request:  pointer to request data
+//   response: pointer to response data
+//   return:   number of bytes in response
+//
+// Request:  AP index, clear flag (1 = clear statistics after reading).
+// Response: status, transfers (4), WAITs (4), FAULTs (4), back-offs (4),
+//           learned idle cycles (1).
+static uint32_t DAP_RetryStatistics(uint8_t *request, uint8_t *response) {
+  DAP_Retry_t *stat;
+  uint32_t     ap;
+
+  ap = *request;
+  if (ap >= DAP_RETRY_AP_NUM) {
+    *response = DAP_ERROR;
+    return (1);
+  }
+  stat = &DAP_Retry[ap];
+
+  *response++ = DAP_OK;
+  *response++ = (uint8_t) stat->transfers;
+  *response++ = (uint8_t)(stat->transfers >>  8);
+  *response++ = (uint8_t)(stat->transfers >> 16);
+  *response++ = (uint8_t)(stat->transfers >> 24);
+  *response++ = (uint8_t) stat->waits;
+  *response++ = (uint8_t)(stat->waits >>  8);
+  *response++ = (uint8_t)(stat->waits >> 16);
+  *response++ = (uint8_t)(stat->waits >> 24);
+  *response++ = (uint8_t) stat->faults;
+  *response++ = (uint8_t)(stat->faults >>  8);
+  *response++ = (uint8_t)(stat->faults >> 16);
+  *response++ = (uint8_t)(stat->faults >> 24);
+  *response++ = (uint8_t) stat->backoffs;
+  *response++ = (uint8_t)(stat->backoffs >>  8);
+  *response++ = (uint8_t)(stat->backoffs >> 16);
+  *response++ = (uint8_t)(stat->backoffs >> 24);
+  *response++ = stat->idle_cycles;
+
+  if (*(request+1)) {
+    stat->transfers = 0;
+    stat->waits     = 0;
+    stat->faults    = 0;
+    stat->backoffs  = 0;
+  }
+
+  return (1 + 16 + 1);
+}
+
+
+// Process DAP Vendor command and prepare response
+//   request:  pointer to request data
+//   response: pointer to response data
+//   return:   number of bytes in response
+uint32_t DAP_ProcessVendorCommand(uint8_t *request, uint8_t *response) {
+  uint32_t num;
+
+  *response++ = *request;
+
+  switch (*request++) {
+    case ID_DAP_ExecuteCommands:
+    case ID_DAP_QueueCommands:
+      num = DAP_ExecuteCommands(request, response);
+      break;
+
+    case ID_DAP_ReadMemory:
+      num = DAP_ReadMemory(request, response);
+      break;
+
+    case ID_DAP_WriteMemory:
+      num = DAP_WriteMemory(request, response);
+      break;
+
+    case ID_DAP_RetryStatistics:
+      num = DAP_RetryStatistics(request, response);
+      break;
+
+#if (DAP_PERF != 0)
+    case ID_DAP_PerfDump:
+      num = Perf_Dump(request, response);
+      break;
+#endif
+
+#if (DATA_WATCH != 0)
+    case ID_DAP_WatchConfig:
+      num = Watch_Config(request, response);
+      break;
+
+    case ID_DAP_WatchControl:
+      num = Watch_Control(request, response);
+      break;
+
+    case ID_DAP_WatchStatus:
+      num = Watch_Status(response);
+      break;
+
+    case ID_DAP_WatchData:
+      num = Watch_Data(request, response);
+      break;
+#endif
+
+#if (PC_SAMPLING != 0)
+    case ID_DAP_ProfileConfig:
+      num = Profile_Config(request, response);
+      break;
+
+    case ID_DAP_ProfileControl:
+      num = Profile_Control(request, response);
+      break;
+
+    case ID_DAP_ProfileRead:
+      num = Profile_Read(request, response);
+      break;
+#endif
+
+    default:
+      *(response-1) = ID_DAP_Invalid;
+      return (1);
+  }
+
+  return (1 + num);
+}
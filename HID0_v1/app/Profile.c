@@ -0,0 +1,267 @@
+/******************************************************************************
+ * @file     Profile.c
+ * @brief    CMSIS-DAP PC Sampling Profiler (DWT_PCSR histogram)
+ * @version  V1.00
+ * @date     31. May 2012
+ *
+ * @note
+ * Copyright (C) 2012 ARM Limited. All rights reserved.
+ *
+ * @par
+ * ARM Limited (ARM) is supplying this software for use with Cortex-M
+ * processor based microcontrollers.
+ *
+ * @par
+ * THIS SOFTWARE IS PROVIDED "AS IS".  NO WARRANTIES, WHETHER EXPRESS, IMPLIED
+ * OR STATUTORY, INCLUDING, BUT NOT LIMITED TO, IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE APPLY TO THIS SOFTWARE.
+ * ARM SHALL NOT, IN ANY CIRCUMSTANCES, BE LIABLE FOR SPECIAL, INCIDENTAL, OR
+ * CONSEQUENTIAL DAMAGES, FOR ANY REASON WHATSOEVER.
+ *
+ ******************************************************************************/
+
+#include "DAP_config.h"
+#include "DAP.h"
+#include "swd_host.h"
+#include "debug_cm.h"
+
+#if (PC_SAMPLING != 0)
+
+// The PC of the running core is sampled from DWT_PCSR without halting it.
+// Bursts of back to back reads are taken from the main loop, between DAP
+// commands, and counted into a histogram of equal sized address ranges.
+// The host reads the histogram in a sparse form instead of every sample.
+
+#define DBG_Addr                0xE000EDF0                      // Core debug base (as in swd_host.c)
+
+#define PROFILE_BURST           32                              // PCSR reads per Profile_Process call
+#define PROFILE_HALTED          0xFFFFFFFF                      // PCSR value while the core is halted
+
+static   uint32_t ProfileHist[PC_SAMPLING_BUCKETS];  // Sample count per bucket
+static   uint32_t ProfilePC[PROFILE_BURST];          // PC samples of one burst
+static   uint32_t ProfileBase;                       // Address of bucket 0
+static   uint32_t ProfileShift;                      // Bucket size: 2^ProfileShift bytes
+static   uint32_t ProfileBuckets;                    // Number of buckets in use
+static   uint32_t ProfileSamples;                    // PC samples taken
+static   uint32_t ProfileOutside;                    // PC samples outside of the buckets
+static   uint32_t ProfileHalted;                     // Samples while the core was halted
+static   uint8_t  ProfileStatus;                     // Profile Status (active and error flags)
+
+
+// Clear the histogram and the sample counts
+static void Profile_Clear(void) {
+  uint32_t n;
+
+  for (n = 0; n < PC_SAMPLING_BUCKETS; n++) {
+    ProfileHist[n] = 0;
+  }
+  ProfileSamples = 0;
+  ProfileOutside = 0;
+  ProfileHalted  = 0;
+}
+
+
+// Store val as variable length integer: 7 bits per byte, low bits first,
+// bit 7 set in all bytes but the last
+//   return: number of bytes stored (1 to 5)
+static uint32_t Profile_PutVarint(uint8_t *buf, uint32_t val) {
+  uint32_t n;
+
+  n = 0;
+  while (val >= 0x80) {
+    buf[n++] = (uint8_t)val | 0x80;
+    val >>= 7;
+  }
+  buf[n++] = (uint8_t)val;
+  return (n);
+}
+
+
+// Sample the PC and count the samples into the histogram
+//   Called periodically from the main loop.
+void Profile_Process(void) {
+  uint32_t n, pc, bucket;
+  uint32_t ok;
+
+  if (!(ProfileStatus & DAP_PROFILE_ACTIVE)) return;
+
+  if (DAP_Data.debug_port != DAP_PORT_SWD) {
+    ProfileStatus |= DAP_PROFILE_READ_ERROR;
+    return;
+  }
+
+  // the host may use SELECT/CSW/TAR across its DAP_Transfer commands
+  if (!swd_save_state()) {
+    ProfileStatus |= DAP_PROFILE_READ_ERROR;
+    return;
+  }
+  ok = swd_read_word_repeat(DWT_PCSR, ProfilePC, PROFILE_BURST);
+  if (!swd_restore_state() || !ok) {
+    ProfileStatus |= DAP_PROFILE_READ_ERROR;
+    return;
+  }
+
+  for (n = 0; n < PROFILE_BURST; n++) {
+    pc = ProfilePC[n];
+    if (pc == PROFILE_HALTED) {
+      ProfileHalted++;
+    } else {
+      bucket = (pc - ProfileBase) >> ProfileShift;
+      if ((pc >= ProfileBase) && (bucket < ProfileBuckets)) {
+        ProfileHist[bucket]++;
+      } else {
+        ProfileOutside++;
+      }
+    }
+  }
+  ProfileSamples += PROFILE_BURST;
+}
+
+
+// Process Profile Configure command and prepare response
+//   request:  pointer to request data
+//   response: pointer to response data
+//   return:   number of bytes in response
+//
+// Request:  base address (4), bucket size (1: log2 of the size in bytes),
+//           bucket count (2).
+// Response: status.
+// Sampling is stopped and the histogram is cleared.
+uint32_t Profile_Config(uint8_t *request, uint8_t *response) {
+  uint32_t base;
+  uint32_t shift;
+  uint32_t buckets;
+
+  base    = (*(request+0) <<  0) |
+            (*(request+1) <<  8) |
+            (*(request+2) << 16) |
+            (*(request+3) << 24);
+  shift   =  *(request+4);
+  buckets = (*(request+5) <<  0) |
+            (*(request+6) <<  8);
+
+  ProfileStatus  = 0;
+  ProfileBuckets = 0;
+  Profile_Clear();
+
+  if ((shift > 31) || (buckets == 0) || (buckets > PC_SAMPLING_BUCKETS)) {
+    *response = DAP_ERROR;
+    return (1);
+  }
+
+  ProfileBase    = base;
+  ProfileShift   = shift;
+  ProfileBuckets = buckets;
+
+  *response = DAP_OK;
+  return (1);
+}
+
+
+// Process Profile Control command and prepare response
+//   request:  pointer to request data
+//   response: pointer to response data
+//   return:   number of bytes in response
+//
+// Request:  control (1: bit 0 = sampling active, bit 1 = clear histogram).
+// Response: status.
+// Starting sets DEMCR.TRCENA of the target, DWT_PCSR reads as 0 without it.
+uint32_t Profile_Control(uint8_t *request, uint8_t *response) {
+  uint32_t demcr;
+  uint8_t  active;
+  uint8_t  result;
+
+  active = *request & DAP_PROFILE_ACTIVE;
+  result = DAP_OK;
+
+  if (*request & DAP_PROFILE_CLEAR) {
+    Profile_Clear();
+  }
+
+  if (!active) {
+    ProfileStatus &= ~DAP_PROFILE_ACTIVE;
+  } else if ((ProfileBuckets == 0) || (DAP_Data.debug_port != DAP_PORT_SWD)) {
+    result = DAP_ERROR;
+  } else if (!(ProfileStatus & DAP_PROFILE_ACTIVE)) {
+    result = DAP_ERROR;
+    if (swd_save_state()) {
+      if (swd_read_memory(DBG_EMCR, (uint8_t *)&demcr, 4)) {
+        demcr |= TRCENA;
+        if (swd_write_memory(DBG_EMCR, (uint8_t *)&demcr, 4)) {
+          ProfileStatus = DAP_PROFILE_ACTIVE;
+          result = DAP_OK;
+        }
+      }
+      if (!swd_restore_state()) {
+        ProfileStatus &= ~DAP_PROFILE_ACTIVE;
+        result = DAP_ERROR;
+      }
+    }
+  }
+
+  *response = result;
+  return (1);
+}
+
+
+// Process Profile Read command and prepare response
+//   request:  pointer to request data
+//   response: pointer to response data
+//   return:   number of bytes in response
+//
+// Request:  first bucket (2).
+// Response: status (active and error flags), samples (4), samples outside of
+//           the buckets (4), samples while halted (4), next bucket (2),
+//           followed by one entry per non-zero bucket up to the next bucket:
+//           zero buckets skipped before it and its count, each as variable
+//           length integer (see Profile_PutVarint).
+// The host repeats the command from the next bucket until it equals the
+// bucket count. Errors are reported once.
+uint32_t Profile_Read(uint8_t *request, uint8_t *response) {
+  uint32_t index, skip, n;
+  uint8_t *entry;
+
+  index = (*(request+0) <<  0) |
+          (*(request+1) <<  8);
+
+  *(response+0)  = ProfileStatus;
+  *(response+1)  = (uint8_t)(ProfileSamples >>  0);
+  *(response+2)  = (uint8_t)(ProfileSamples >>  8);
+  *(response+3)  = (uint8_t)(ProfileSamples >> 16);
+  *(response+4)  = (uint8_t)(ProfileSamples >> 24);
+  *(response+5)  = (uint8_t)(ProfileOutside >>  0);
+  *(response+6)  = (uint8_t)(ProfileOutside >>  8);
+  *(response+7)  = (uint8_t)(ProfileOutside >> 16);
+  *(response+8)  = (uint8_t)(ProfileOutside >> 24);
+  *(response+9)  = (uint8_t)(ProfileHalted  >>  0);
+  *(response+10) = (uint8_t)(ProfileHalted  >>  8);
+  *(response+11) = (uint8_t)(ProfileHalted  >> 16);
+  *(response+12) = (uint8_t)(ProfileHalted  >> 24);
+  ProfileStatus &= DAP_PROFILE_ACTIVE;      // Errors are reported once
+
+  // Room left after command ID and the fixed part, two 5 byte integers per entry
+  entry = response + 15;
+  n     = DAP_PACKET_SIZE - 1 - 15;
+  skip  = 0;
+  for (; index < ProfileBuckets; index++) {
+    if (ProfileHist[index] == 0) {
+      skip++;
+      continue;
+    }
+    if (n < 10) break;
+    skip   = Profile_PutVarint(entry, skip);
+    skip  += Profile_PutVarint(entry + skip, ProfileHist[index]);
+    entry += skip;
+    n     -= skip;
+    skip   = 0;
+  }
+  if (index > ProfileBuckets) {
+    index = ProfileBuckets;
+  }
+
+  *(response+13) = (uint8_t)(index >> 0);
+  *(response+14) = (uint8_t)(index >> 8);
+  return (entry - response);
+}
+
+#endif  /* (PC_SAMPLING != 0) */
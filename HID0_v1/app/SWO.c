@@ -0,0 +1,447 @@
+/******************************************************************************
+ * @file     SWO.c
+ * @brief    CMSIS-DAP SWO Trace (UART/NRZ capture)
+ * @version  V1.00
+ * @date     31. May 2012
+ *
+ * @note
+ * Copyright (C) 2012 ARM Limited. All rights reserved.
+ *
+ * @par
+ * ARM Limited (ARM) is supplying this software for use with Cortex-M
+ * processor based microcontrollers.
+ *
+ * @par
+ * THIS SOFTWARE IS PROVIDED "AS IS".  NO WARRANTIES, WHETHER EXPRESS, IMPLIED
+ * OR STATUTORY, INCLUDING, BUT NOT LIMITED TO, IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE APPLY TO THIS SOFTWARE.
+ * ARM SHALL NOT, IN ANY CIRCUMSTANCES, BE LIABLE FOR SPECIAL, INCIDENTAL, OR
+ * CONSEQUENTIAL DAMAGES, FOR ANY REASON WHATSOEVER.
+ *
+ ******************************************************************************/
+
+#include <string.h>
+#include <RTL.h>
+#include <rl_usb.h>
+#include "DAP_config.h"
+#include "DAP.h"
+
+#if (SWO_UART != 0)
+
+// USART0 receives the SWO pin of the target, GPDMA channel 0 copies every
+// character into the trace buffer. The channel runs through a circular list
+// of descriptors and never stops while the capture is active. The terminal
+// count interrupt at the end of each block keeps the input index up to date,
+// in between the index is taken from the channel destination address.
+
+#if ((SWO_BUFFER_SIZE & (SWO_BUFFER_SIZE - 1)) != 0)
+#error "SWO Trace Buffer Size must be a power of 2"
+#endif
+
+#define SWO_DMA_BLOCKS          4                               // Descriptors in the circular list
+#define SWO_DMA_BLOCK_SIZE      (SWO_BUFFER_SIZE / SWO_DMA_BLOCKS)
+
+#if (SWO_DMA_BLOCK_SIZE > 4095)
+#error "SWO DMA Block Size exceeds the GPDMA transfer size"
+#endif
+
+#define SWO_UART_CLOCK          CPU_CLOCK                       // USART0 clocked from PLL1
+#define SWO_CLK_SEL_PLL1        (0x09 << 24)                    // BASE_UART0_CLK source
+#define SWO_CLK_AUTOBLOCK       (1UL << 11)
+
+// USART0 RX on P2_1 (FUNC1), glitch filter off for high baudrates
+#define SWO_PIN_SETUP()         (LPC_SCU->SFSP2_1 = FUNC_1 | SCU_SFS_EZI | SCU_SFS_ZIF)
+
+// GPDMA request line: peripheral 2, DMAMUX function 1 = USART0 RX
+#define SWO_DMA_PERIPHERAL      2
+#define SWO_DMAMUX_SHIFT        (SWO_DMA_PERIPHERAL * 2)
+#define SWO_DMAMUX_FUNC         1
+
+#define SWO_DMA_CONTROL         (SWO_DMA_BLOCK_SIZE   |         /* Transfer size          */  \
+                                 (0UL << 12)          |         /* Source burst 1         */  \
+                                 (0UL << 15)          |         /* Destination burst 1    */  \
+                                 (0UL << 18)          |         /* Source width byte      */  \
+                                 (0UL << 21)          |         /* Destination width byte */  \
+                                 (1UL << 25)          |         /* Destination AHB master 1 */\
+                                 (1UL << 27)          |         /* Destination increment  */  \
+                                 (1UL << 31))                   /* Terminal count interrupt */
+
+#define SWO_DMA_CONFIG          (1UL                  |         /* Channel enable         */  \
+                                 (SWO_DMA_PERIPHERAL << 1) |    /* Source peripheral      */  \
+                                 (2UL << 11)          |         /* Peripheral to memory   */  \
+                                 (1UL << 14)          |         /* Error interrupt        */  \
+                                 (1UL << 15))                   /* Terminal count interrupt */
+
+// GPDMA linked list item
+typedef struct {
+  uint32_t src;                         // Source address
+  uint32_t dst;                         // Destination address
+  uint32_t next;                        // Next linked list item
+  uint32_t ctrl;                        // Channel control
+} SWO_LLI_t;
+
+static   uint8_t  TraceBuf[SWO_BUFFER_SIZE];        // Trace Buffer
+static   SWO_LLI_t TraceLLI[SWO_DMA_BLOCKS];        // Circular DMA Descriptor List
+static volatile uint32_t TraceIndexI;               // Incoming Trace Index (free running)
+static volatile uint32_t TraceIndexO;               // Outgoing Trace Index (free running)
+static volatile uint8_t  TraceStatus;               // Trace Status (active and error flags)
+static   uint8_t  TraceTransport;                   // Trace Transport
+static   uint8_t  TraceMode;                        // Trace Mode
+static   uint32_t TraceBaudrate;                    // Trace Baudrate
+
+
+// Move the input index on to the DMA destination address
+//   Called from the DMA interrupt and with the DMA interrupt disabled.
+static void SWO_UpdateIndex(void) {
+  uint32_t n;
+
+  n = (LPC_GPDMA->C0DESTADDR - (uint32_t)TraceBuf) & (SWO_BUFFER_SIZE - 1);
+  TraceIndexI += (n - TraceIndexI) & (SWO_BUFFER_SIZE - 1);
+
+  if ((TraceIndexI - TraceIndexO) > SWO_BUFFER_SIZE) {
+    // the block being written is lost, keep the rest
+    TraceIndexO  = TraceIndexI - SWO_BUFFER_SIZE + SWO_DMA_BLOCK_SIZE;
+    TraceStatus |= DAP_SWO_BUFFER_OVERRUN;
+  }
+}
+
+
+// Get number of bytes in the trace buffer
+static uint32_t SWO_Count(void) {
+  uint32_t count;
+
+  NVIC_DisableIRQ(DMA_IRQn);
+  if (TraceStatus & DAP_SWO_CAPTURE_ACTIVE) {
+    SWO_UpdateIndex();
+  }
+  count = TraceIndexI - TraceIndexO;
+  NVIC_EnableIRQ(DMA_IRQn);
+
+  return (count);
+}
+
+
+// Take bytes read from the trace buffer
+//   index: output index the data was read at
+//   count: number of bytes read
+//   Nothing is taken if an overrun moved the output index in the meantime.
+static void SWO_Consume(uint32_t index, uint32_t count) {
+  NVIC_DisableIRQ(DMA_IRQn);
+  if (TraceIndexO == index) {
+    TraceIndexO = index + count;
+  }
+  NVIC_EnableIRQ(DMA_IRQn);
+}
+
+
+// GPDMA interrupt part of the SWO capture (channel 0):
+// end of a trace block or transfer error
+void SWO_DMA_Handler(void) {
+  if (LPC_GPDMA->INTTCSTAT & 1) {
+    LPC_GPDMA->INTTCCLEAR = 1;
+    SWO_UpdateIndex();
+  }
+  if (LPC_GPDMA->INTERRSTAT & 1) {
+    LPC_GPDMA->INTERRCLR = 1;
+    TraceStatus |= DAP_SWO_STREAM_ERROR;
+  }
+}
+
+
+// Enable USART0 and GPDMA for SWO capture
+static void SWO_UART_Init(void) {
+  LPC_CGU->BASE_UART0_CLK = SWO_CLK_SEL_PLL1 | SWO_CLK_AUTOBLOCK;
+  LPC_CCU1->CLK_M3_USART0_CFG  = CCU_CLK_CFG_AUTO | CCU_CLK_CFG_RUN;
+  while (!(LPC_CCU1->CLK_M3_USART0_STAT  & CCU_CLK_STAT_RUN));
+  LPC_CCU2->CLK_APB0_USART0_CFG = CCU_CLK_CFG_AUTO | CCU_CLK_CFG_RUN;
+  while (!(LPC_CCU2->CLK_APB0_USART0_STAT & CCU_CLK_STAT_RUN));
+  LPC_CCU1->CLK_M3_DMA_CFG     = CCU_CLK_CFG_AUTO | CCU_CLK_CFG_RUN;
+  while (!(LPC_CCU1->CLK_M3_DMA_STAT     & CCU_CLK_STAT_RUN));
+
+  SWO_PIN_SETUP();
+
+  LPC_USART0->LCR = 0x03;               // 8 data bits, no parity, 1 stop bit
+  LPC_USART0->FDR = 0x10;               // No fractional divider
+  LPC_USART0->IER = 0;
+  LPC_USART0->FCR = (1 << 0) |          // FIFO enable
+                    (1 << 1) |          // RX FIFO reset
+                    (1 << 3);           // DMA mode, request on each character
+
+  LPC_CREG->DMAMUX = (LPC_CREG->DMAMUX & ~(3UL << SWO_DMAMUX_SHIFT)) |
+                     (SWO_DMAMUX_FUNC << SWO_DMAMUX_SHIFT);
+  LPC_GPDMA->CONFIG = 1;                // GPDMA enable, little endian
+  NVIC_EnableIRQ(DMA_IRQn);
+}
+
+
+// Set USART0 baudrate
+//   baudrate: requested baudrate
+//   return:   actual baudrate, 0 if not possible
+static uint32_t SWO_UART_Baudrate(uint32_t baudrate) {
+  uint32_t div;
+
+  if (baudrate == 0) return (0);
+  if (baudrate > SWO_UART_MAX_BAUDRATE) {
+    baudrate = SWO_UART_MAX_BAUDRATE;
+  }
+
+  div = ((SWO_UART_CLOCK / 16) + (baudrate / 2)) / baudrate;
+  if (div == 0)      div = 1;
+  if (div > 0xFFFF)  div = 0xFFFF;
+
+  LPC_USART0->LCR = 0x83;               // Divisor latch access
+  LPC_USART0->DLL = div & 0xFF;
+  LPC_USART0->DLM = div >> 8;
+  LPC_USART0->LCR = 0x03;
+
+  return ((SWO_UART_CLOCK / 16) / div);
+}
+
+
+// Start SWO capture into the trace buffer
+static void SWO_Start(void) {
+  uint32_t n;
+
+  for (n = 0; n < SWO_DMA_BLOCKS; n++) {
+    TraceLLI[n].src  = (uint32_t)&LPC_USART0->RBR;
+    TraceLLI[n].dst  = (uint32_t)&TraceBuf[n * SWO_DMA_BLOCK_SIZE];
+    TraceLLI[n].next = (uint32_t)&TraceLLI[(n + 1) % SWO_DMA_BLOCKS];
+    TraceLLI[n].ctrl = SWO_DMA_CONTROL;
+  }
+
+  TraceIndexI = 0;
+  TraceIndexO = 0;
+
+  LPC_USART0->FCR = (1 << 0) | (1 << 1) | (1 << 3);   // Drop stale characters
+  LPC_GPDMA->INTTCCLEAR = 1;
+  LPC_GPDMA->INTERRCLR  = 1;
+  LPC_GPDMA->C0SRCADDR  = TraceLLI[0].src;
+  LPC_GPDMA->C0DESTADDR = TraceLLI[0].dst;
+  LPC_GPDMA->C0LLI      = TraceLLI[0].next;
+  LPC_GPDMA->C0CONTROL  = TraceLLI[0].ctrl;
+  LPC_GPDMA->C0CONFIG   = SWO_DMA_CONFIG;
+}
+
+
+// Stop SWO capture, captured data stays readable
+static void SWO_Stop(void) {
+  LPC_GPDMA->C0CONFIG &= ~1UL;
+  while (LPC_GPDMA->ENBLDCHNS & 1);
+
+  NVIC_DisableIRQ(DMA_IRQn);
+  SWO_UpdateIndex();
+  NVIC_EnableIRQ(DMA_IRQn);
+}
+
+
+#if (SWO_STREAM != 0)
+
+// Read trace data for the stream endpoint (Stream.c)
+//   Called from the endpoint IN event and from Stream_Process with the USB
+//   interrupt disabled.
+//   buf:    packet payload
+//   count:  maximum number of bytes
+//   return: number of bytes read
+uint32_t SWO_StreamRead(uint8_t *buf, uint32_t count) {
+  uint32_t index, n;
+
+  if (TraceTransport != DAP_SWO_TRANSPORT_STREAM) return (0);
+
+  n     = SWO_Count();
+  index = TraceIndexO;
+  if (count > n) {
+    count = n;
+  }
+
+  // copy in up to two pieces around the end of the buffer
+  n = SWO_BUFFER_SIZE - (index & (SWO_BUFFER_SIZE - 1));
+  if (n > count) {
+    n = count;
+  }
+  memcpy(buf, &TraceBuf[index & (SWO_BUFFER_SIZE - 1)], n);
+  memcpy(buf + n, TraceBuf, count - n);
+  SWO_Consume(index, count);
+  return (count);
+}
+
+#endif
+
+
+// Process SWO Transport command and prepare response
+//   request:  pointer to request data
+//   response: pointer to response data
+//   return:   number of bytes in response
+uint32_t SWO_Transport(uint8_t *request, uint8_t *response) {
+  uint8_t transport;
+  uint8_t result;
+
+  transport = *request;
+  if (!(TraceStatus & DAP_SWO_CAPTURE_ACTIVE) &&
+      ((transport <= DAP_SWO_TRANSPORT_DATA) ||
+       ((transport == DAP_SWO_TRANSPORT_STREAM) && (SWO_STREAM != 0)))) {
+    TraceTransport = transport;
+    result = DAP_OK;
+  } else {
+    result = DAP_ERROR;
+  }
+
+  *response = result;
+  return (1);
+}
+
+
+// Process SWO Mode command and prepare response
+//   request:  pointer to request data
+//   response: pointer to response data
+//   return:   number of bytes in response
+uint32_t SWO_Mode(uint8_t *request, uint8_t *response) {
+  uint8_t mode;
+  uint8_t result;
+
+  mode = *request;
+  if (TraceStatus & DAP_SWO_CAPTURE_ACTIVE) {
+    result = DAP_ERROR;
+  } else {
+    switch (mode) {
+      case DAP_SWO_OFF:
+        TraceMode = mode;
+        result = DAP_OK;
+        break;
+      case DAP_SWO_UART:
+        SWO_UART_Init();
+        if (TraceBaudrate != 0) {
+          SWO_UART_Baudrate(TraceBaudrate);
+        }
+        TraceMode = mode;
+        result = DAP_OK;
+        break;
+      default:
+        TraceMode = DAP_SWO_OFF;
+        result = DAP_ERROR;
+        break;
+    }
+  }
+
+  *response = result;
+  return (1);
+}
+
+
+// Process SWO Baudrate command and prepare response
+//   request:  pointer to request data
+//   response: pointer to response data
+//   return:   number of bytes in response
+uint32_t SWO_Baudrate(uint8_t *request, uint8_t *response) {
+  uint32_t baudrate;
+
+  baudrate = (*(request+0) <<  0) |
+             (*(request+1) <<  8) |
+             (*(request+2) << 16) |
+             (*(request+3) << 24);
+
+  if (TraceStatus & DAP_SWO_CAPTURE_ACTIVE) {
+    baudrate = 0;
+  } else {
+    baudrate = SWO_UART_Baudrate(baudrate);
+    TraceBaudrate = baudrate;
+  }
+
+  *response++ = (uint8_t)(baudrate >>  0);
+  *response++ = (uint8_t)(baudrate >>  8);
+  *response++ = (uint8_t)(baudrate >> 16);
+  *response   = (uint8_t)(baudrate >> 24);
+  return (4);
+}
+
+
+// Process SWO Control command and prepare response
+//   request:  pointer to request data
+//   response: pointer to response data
+//   return:   number of bytes in response
+uint32_t SWO_Control(uint8_t *request, uint8_t *response) {
+  uint8_t active;
+  uint8_t result;
+
+  active = *request & DAP_SWO_CAPTURE_ACTIVE;
+  result = DAP_OK;
+
+  if (active != (TraceStatus & DAP_SWO_CAPTURE_ACTIVE)) {
+    if (active) {
+      if ((TraceMode == DAP_SWO_UART) && (TraceBaudrate != 0)) {
+        TraceStatus = 0;
+        SWO_Start();
+        TraceStatus = DAP_SWO_CAPTURE_ACTIVE;
+      } else {
+        result = DAP_ERROR;
+      }
+    } else {
+      SWO_Stop();
+      TraceStatus &= ~DAP_SWO_CAPTURE_ACTIVE;
+    }
+  }
+
+  *response = result;
+  return (1);
+}
+
+
+// Process SWO Status command and prepare response
+//   response: pointer to response data
+//   return:   number of bytes in response
+uint32_t SWO_Status(uint8_t *response) {
+  uint32_t count;
+  uint8_t  status;
+
+  count  = SWO_Count();
+  status = TraceStatus;
+  TraceStatus &= DAP_SWO_CAPTURE_ACTIVE;    // Errors are reported once
+
+  *response++ = status;
+  *response++ = (uint8_t)(count >>  0);
+  *response++ = (uint8_t)(count >>  8);
+  *response++ = (uint8_t)(count >> 16);
+  *response   = (uint8_t)(count >> 24);
+  return (5);
+}
+
+
+// Process SWO Data command and prepare response
+//   request:  pointer to request data
+//   response: pointer to response data
+//   return:   number of bytes in response
+uint32_t SWO_Data(uint8_t *request, uint8_t *response) {
+  uint32_t index, count, n;
+  uint8_t  status;
+
+  count = *(request+0) | (*(request+1) << 8);
+  if (count > (DAP_PACKET_SIZE - 4)) {
+    count = DAP_PACKET_SIZE - 4;
+  }
+
+  n      = SWO_Count();
+  index  = TraceIndexO;
+  status = TraceStatus;
+  TraceStatus &= DAP_SWO_CAPTURE_ACTIVE;    // Errors are reported once
+
+  if (TraceTransport != DAP_SWO_TRANSPORT_DATA) {
+    count = 0;                              // Data goes to the stream endpoint
+  } else if (count > n) {
+    count = n;
+  }
+
+  // copy in up to two pieces around the end of the buffer
+  n = SWO_BUFFER_SIZE - (index & (SWO_BUFFER_SIZE - 1));
+  if (n > count) {
+    n = count;
+  }
+  memcpy(response + 3, &TraceBuf[index & (SWO_BUFFER_SIZE - 1)], n);
+  memcpy(response + 3 + n, TraceBuf, count - n);
+  SWO_Consume(index, count);
+
+  *(response+0) = status;
+  *(response+1) = (uint8_t)(count >> 0);
+  *(response+2) = (uint8_t)(count >> 8);
+  return (3 + count);
+}
+
+#endif  /* (SWO_UART != 0) */
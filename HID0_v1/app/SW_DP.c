@@ -22,6 +22,7 @@
 
 #include "DAP_config.h"
 #include "DAP.h"
+#include "DAP_perf.h"
 //#include "led.h"
 
 
@@ -226,11 +227,15 @@ SWD_TransferFunction(Slow);
 //   data:    DATA[31:0]
 //   return:  ACK[2:0]
 uint8_t  SWD_Transfer(uint32_t request, uint32_t *data) {
+  uint8_t ack;
+
   if (DAP_Data.fast_clock) {
-    return SWD_TransferFast(request, data);
+    ack = SWD_TransferFast(request, data);
   } else {
-    return SWD_TransferSlow(request, data);
+    ack = SWD_TransferSlow(request, data);
   }
+  PERF_SWD_TRANSFER(request, ack);
+  return (ack);
 }
 
 
@@ -0,0 +1,134 @@
+/******************************************************************************
+ * @file     Stream.c
+ * @brief    CMSIS-DAP Stream Endpoint (SWO trace and data watch samples)
+ * @version  V1.00
+ * @date     31. May 2012
+ *
+ * @note
+ * Copyright (C) 2012 ARM Limited. All rights reserved.
+ *
+ * @par
+ * ARM Limited (ARM) is supplying this software for use with Cortex-M
+ * processor based microcontrollers.
+ *
+ * @par
+ * THIS SOFTWARE IS PROVIDED "AS IS".  NO WARRANTIES, WHETHER EXPRESS, IMPLIED
+ * OR STATUTORY, INCLUDING, BUT NOT LIMITED TO, IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE APPLY TO THIS SOFTWARE.
+ * ARM SHALL NOT, IN ANY CIRCUMSTANCES, BE LIABLE FOR SPECIAL, INCIDENTAL, OR
+ * CONSEQUENTIAL DAMAGES, FOR ANY REASON WHATSOEVER.
+ *
+ ******************************************************************************/
+
+#include <RTL.h>
+#include <rl_usb.h>
+#include "DAP_config.h"
+#include "DAP.h"
+
+#define STREAM_SWO      ((SWO_UART   != 0) && (SWO_STREAM        != 0))
+#define STREAM_WATCH    ((DATA_WATCH != 0) && (DATA_WATCH_STREAM != 0))
+
+#if (STREAM_SWO || STREAM_WATCH)
+
+// The SWO trace and the data watch samples share the bulk IN endpoint of the
+// SWO interface, USB0 has no endpoint left for a second one. Every packet
+// starts with a tag byte telling its source (DAP_STREAM_SWO or
+// DAP_STREAM_WATCH), the rest is the next piece of that source's byte
+// stream. The host appends each packet to the stream its tag names. The
+// sources take turns, so a busy trace does not hold back the samples.
+
+// Stream endpoint, USBD_SWO_EP_BULKIN in usb_config_USB0.c
+#define STREAM_EP               (0x80 | 5)
+#define STREAM_PACKET           64                              // USBD_SWO_WMAXPACKETSIZE
+#define STREAM_PACKET_HS        512                             // USBD_SWO_HS_WMAXPACKETSIZE
+
+static   uint8_t  StreamBuf[STREAM_PACKET_HS];      // Packet in transfer
+static volatile uint8_t  StreamBusy;                // Packet in transfer
+static   uint8_t  StreamFullPacket;                 // Last packet was full size
+static   uint8_t  StreamNext = DAP_STREAM_SWO;      // Tag of the source asked first
+
+
+// Fill the packet from a source
+//   tag:    source tag
+//   size:   packet size
+//   return: number of payload bytes
+static uint32_t Stream_Fill(uint8_t tag, uint32_t size) {
+  uint32_t count = 0;
+
+  switch (tag) {
+#if (STREAM_SWO)
+    case DAP_STREAM_SWO:
+      count = SWO_StreamRead(&StreamBuf[1], size - 1);
+      break;
+#endif
+#if (STREAM_WATCH)
+    case DAP_STREAM_WATCH:
+      count = Watch_StreamRead(&StreamBuf[1], size - 1);
+      break;
+#endif
+  }
+  StreamBuf[0] = tag;
+  return (count);
+}
+
+
+// Send the next packet on the stream endpoint
+//   Called from the endpoint IN event and from Stream_Process with the USB
+//   interrupt disabled, only while no packet is in transfer.
+static void Stream_Send(void) {
+  uint32_t count, size;
+  uint8_t  tag;
+
+  size = USBD_HighSpeed ? STREAM_PACKET_HS : STREAM_PACKET;
+  tag  = StreamNext;
+  StreamNext = (tag == DAP_STREAM_SWO) ? DAP_STREAM_WATCH : DAP_STREAM_SWO;
+
+  count = Stream_Fill(tag, size);
+  if (count == 0) {
+    tag   = StreamNext;
+    count = Stream_Fill(tag, size);
+  }
+
+  if (count == 0) {
+    // a short packet ends the host transfer
+    if (StreamFullPacket) {
+      StreamFullPacket = 0;
+      StreamBusy = 1;
+      USBD_WriteEP(STREAM_EP, StreamBuf, 0);
+    }
+    return;
+  }
+
+  StreamFullPacket = ((1 + count) == size);
+  StreamBusy = 1;
+  USBD_WriteEP(STREAM_EP, StreamBuf, 1 + count);
+}
+
+
+// Stream endpoint event
+void USBD_EndPoint5(U32 event) {
+  if (event & USBD_EVT_IN) {
+    StreamBusy = 0;
+    Stream_Send();
+  }
+}
+
+
+// Move SWO trace and data watch samples to the stream endpoint
+//   Called periodically from the main loop.
+void Stream_Process(void) {
+  if (StreamBusy || !usbd_configured()) return;
+
+  NVIC_DisableIRQ(USB0_IRQn);
+  if (!StreamBusy) {
+    Stream_Send();
+  }
+  NVIC_EnableIRQ(USB0_IRQn);
+}
+
+#else
+
+void Stream_Process(void) {
+}
+
+#endif  /* (STREAM_SWO || STREAM_WATCH) */
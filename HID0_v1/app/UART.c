@@ -0,0 +1,439 @@
+/******************************************************************************
+ * @file     UART.c
+ * @brief    CMSIS-DAP Target UART Bridge (virtual COM port)
+ * @version  V1.00
+ * @date     31. May 2012
+ *
+ * @note
+ * Copyright (C) 2012 ARM Limited. All rights reserved.
+ *
+ * @par
+ * ARM Limited (ARM) is supplying this software for use with Cortex-M
+ * processor based microcontrollers.
+ *
+ * @par
+ * THIS SOFTWARE IS PROVIDED "AS IS".  NO WARRANTIES, WHETHER EXPRESS, IMPLIED
+ * OR STATUTORY, INCLUDING, BUT NOT LIMITED TO, IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE APPLY TO THIS SOFTWARE.
+ * ARM SHALL NOT, IN ANY CIRCUMSTANCES, BE LIABLE FOR SPECIAL, INCIDENTAL, OR
+ * CONSEQUENTIAL DAMAGES, FOR ANY REASON WHATSOEVER.
+ *
+ ******************************************************************************/
+
+#include <RTL.h>
+#include <rl_usb.h>
+#include "DAP_config.h"
+#include "UART.h"
+#include "ring.h"
+
+#if (UART_BRIDGE != 0)
+
+// USART2 is connected to the UART of the target. GPDMA channel 1 receives
+// into the receive buffer through a circular list of descriptors, in the same
+// way as the SWO capture. GPDMA channel 2 transmits the transmit buffer in
+// contiguous pieces. UART_Process moves the data between these buffers and
+// the virtual COM port buffers, the CPU never touches single characters.
+//
+// Both buffers are rings with free running indexes, the buffer position is
+// the index masked with the buffer size.
+
+#if ((UART_BUFFER_SIZE & (UART_BUFFER_SIZE - 1)) != 0)
+#error "UART Buffer Size must be a power of 2"
+#endif
+
+#define UART_DMA_BLOCKS         4                               // Descriptors in the circular list
+#define UART_DMA_BLOCK_SIZE     (UART_BUFFER_SIZE / UART_DMA_BLOCKS)
+
+#if (UART_DMA_BLOCK_SIZE > 4095)
+#error "UART DMA Block Size exceeds the GPDMA transfer size"
+#endif
+
+#define UART_CLOCK              CPU_CLOCK                       // USART2 clocked from PLL1
+#define UART_CLK_SEL_PLL1       (0x09 << 24)                    // BASE_UART2_CLK source
+#define UART_CLK_AUTOBLOCK      (1UL << 11)
+
+// USART2 TXD on P1_15 and RXD on P1_16 (FUNC1), glitch filter off for high baudrates
+#define UART_PIN_SETUP()        (LPC_SCU->SFSP1_15 = FUNC_1,                              \
+                                 LPC_SCU->SFSP1_16 = FUNC_1 | SCU_SFS_EZI | SCU_SFS_ZIF)
+
+// GPDMA request lines: peripheral 5 and 6, DMAMUX function 1 = USART2 TX and RX
+#define UART_DMA_TX_PERIPHERAL  5
+#define UART_DMA_RX_PERIPHERAL  6
+#define UART_DMAMUX_MASK        ((3UL << (UART_DMA_TX_PERIPHERAL * 2)) | (3UL << (UART_DMA_RX_PERIPHERAL * 2)))
+#define UART_DMAMUX_FUNC        ((1UL << (UART_DMA_TX_PERIPHERAL * 2)) | (1UL << (UART_DMA_RX_PERIPHERAL * 2)))
+
+#define UART_DMA_RX_CH          (1UL << 1)                      // GPDMA channel 1
+#define UART_DMA_TX_CH          (1UL << 2)                      // GPDMA channel 2
+
+#define UART_DMA_RX_CONTROL     (UART_DMA_BLOCK_SIZE  |         /* Transfer size          */  \
+                                 (0UL << 12)          |         /* Source burst 1         */  \
+                                 (0UL << 15)          |         /* Destination burst 1    */  \
+                                 (0UL << 18)          |         /* Source width byte      */  \
+                                 (0UL << 21)          |         /* Destination width byte */  \
+                                 (1UL << 25)          |         /* Destination AHB master 1 */\
+                                 (1UL << 27)          |         /* Destination increment  */  \
+                                 (1UL << 31))                   /* Terminal count interrupt */
+
+#define UART_DMA_RX_CONFIG      (1UL                  |         /* Channel enable         */  \
+                                 (UART_DMA_RX_PERIPHERAL << 1) |/* Source peripheral      */  \
+                                 (2UL << 11)          |         /* Peripheral to memory   */  \
+                                 (1UL << 14)          |         /* Error interrupt        */  \
+                                 (1UL << 15))                   /* Terminal count interrupt */
+
+#define UART_DMA_TX_CONTROL     ((0UL << 12)          |         /* Source burst 1         */  \
+                                 (0UL << 15)          |         /* Destination burst 1    */  \
+                                 (0UL << 18)          |         /* Source width byte      */  \
+                                 (0UL << 21)          |         /* Destination width byte */  \
+                                 (1UL << 24)          |         /* Source AHB master 1    */  \
+                                 (1UL << 26)          |         /* Source increment       */  \
+                                 (1UL << 31))                   /* Terminal count interrupt */
+
+#define UART_DMA_TX_CONFIG      (1UL                  |         /* Channel enable         */  \
+                                 (UART_DMA_TX_PERIPHERAL << 6) |/* Destination peripheral */  \
+                                 (1UL << 11)          |         /* Memory to peripheral   */  \
+                                 (1UL << 14)          |         /* Error interrupt        */  \
+                                 (1UL << 15))                   /* Terminal count interrupt */
+
+// USART2 line status errors, reported as CDC serial state (usb_cdc.h)
+#define UART_LSR_OE             (1UL << 1)
+#define UART_LSR_PE             (1UL << 2)
+#define UART_LSR_FE             (1UL << 3)
+#define UART_LSR_BI             (1UL << 4)
+
+// GPDMA linked list item
+typedef struct {
+  uint32_t src;                         // Source address
+  uint32_t dst;                         // Destination address
+  uint32_t next;                        // Next linked list item
+  uint32_t ctrl;                        // Channel control
+} UART_LLI_t;
+
+static   uint8_t  RxBuf[UART_BUFFER_SIZE];          // Receive Buffer
+static   uint8_t  TxBuf[UART_BUFFER_SIZE];          // Transmit Buffer
+static   UART_LLI_t RxLLI[UART_DMA_BLOCKS];         // Circular Receive DMA Descriptor List
+static volatile uint32_t RxIndexI;                  // Incoming Receive Index (free running)
+static volatile uint32_t RxIndexO;                  // Outgoing Receive Index (free running)
+static   ring_t   TxRing;                           // Transmit Buffer Indexes
+static volatile uint32_t TxCount;                   // Bytes in the running transmit transfer, 0 if idle
+static volatile uint16_t SerialState;               // CDC serial state bits not reported yet
+static   uint8_t  UartActive;                       // USART2 and its DMA channels running
+static   CDC_LINE_CODING UartLineCoding;            // Line coding applied to USART2
+
+extern BOOL usbd_cdc_acm_port_open(void);
+
+
+// Move the receive input index on to the DMA destination address
+//   Called from the DMA interrupt and with the DMA interrupt disabled.
+static void UART_RxUpdateIndex(void) {
+  uint32_t n;
+
+  n = (LPC_GPDMA->C1DESTADDR - (uint32_t)RxBuf) & (UART_BUFFER_SIZE - 1);
+  RxIndexI += (n - RxIndexI) & (UART_BUFFER_SIZE - 1);
+
+  if ((RxIndexI - RxIndexO) > UART_BUFFER_SIZE) {
+    // the block being written is lost, keep the rest
+    RxIndexO     = RxIndexI - UART_BUFFER_SIZE + UART_DMA_BLOCK_SIZE;
+    SerialState |= CDC_SERIAL_STATE_OVERRUN;
+  }
+}
+
+
+// Start transmitting the next contiguous piece of the transmit buffer
+//   Called from the DMA interrupt and with the DMA interrupt disabled.
+static void UART_TxStart(void) {
+  uint32_t count, index;
+
+  count = ring_peek(&TxRing, &index);
+  if (count > 4095) count = 4095;
+  TxCount = count;
+  if (count == 0) return;
+
+  LPC_GPDMA->C2SRCADDR  = (uint32_t)&TxBuf[index];
+  LPC_GPDMA->C2DESTADDR = (uint32_t)&LPC_USART2->THR;
+  LPC_GPDMA->C2LLI      = 0;
+  LPC_GPDMA->C2CONTROL  = UART_DMA_TX_CONTROL | count;
+  LPC_GPDMA->C2CONFIG   = UART_DMA_TX_CONFIG;
+}
+
+
+// GPDMA interrupt part of the UART bridge (channels 1 and 2)
+void UART_DMA_Handler(void) {
+  if (LPC_GPDMA->INTTCSTAT & UART_DMA_RX_CH) {
+    LPC_GPDMA->INTTCCLEAR = UART_DMA_RX_CH;
+    UART_RxUpdateIndex();
+  }
+  if (LPC_GPDMA->INTTCSTAT & UART_DMA_TX_CH) {
+    LPC_GPDMA->INTTCCLEAR = UART_DMA_TX_CH;
+    ring_release(&TxRing, TxCount);
+    UART_TxStart();
+  }
+  if (LPC_GPDMA->INTERRSTAT & UART_DMA_TX_CH) {
+    LPC_GPDMA->INTERRCLR = UART_DMA_TX_CH;
+    ring_release(&TxRing, TxCount);     // the piece is lost, go on with the next
+    UART_TxStart();
+  }
+  if (LPC_GPDMA->INTERRSTAT & UART_DMA_RX_CH) {
+    LPC_GPDMA->INTERRCLR = UART_DMA_RX_CH;
+    SerialState |= CDC_SERIAL_STATE_OVERRUN;
+  }
+}
+
+
+// Set USART2 baudrate with the best divisor and fractional divider
+//   baudrate = UART_CLOCK / (16 * div * (1 + add / mul))
+//   return:   actual baudrate, 0 if not possible
+static uint32_t UART_Baudrate(uint32_t baudrate) {
+  uint32_t mul, add, div, n, rate, err;
+  uint32_t best_mul, best_add, best_div, best_err;
+
+  if ((baudrate == 0) || (baudrate > (UART_CLOCK / 16))) return (0);
+
+  best_mul = 1;
+  best_add = 0;
+  best_div = 0;
+  best_err = 0xFFFFFFFF;
+  for (mul = 1; mul <= 15; mul++) {
+    for (add = 0; add < mul; add++) {
+      n   = baudrate * (mul + add);
+      div = ((UART_CLOCK / 16) * mul + (n / 2)) / n;
+      if ((div == 0) || (div > 0xFFFF) || ((add != 0) && (div < 3))) continue;
+      rate = ((UART_CLOCK / 16) * mul) / (div * (mul + add));
+      err  = (rate > baudrate) ? (rate - baudrate) : (baudrate - rate);
+      if (err < best_err) {
+        best_mul = mul;
+        best_add = add;
+        best_div = div;
+        best_err = err;
+      }
+    }
+  }
+  if (best_div == 0) return (0);
+
+  LPC_USART2->LCR |= 0x80;              // Divisor latch access
+  LPC_USART2->DLL  = best_div & 0xFF;
+  LPC_USART2->DLM  = best_div >> 8;
+  LPC_USART2->LCR &= ~0x80;
+  LPC_USART2->FDR  = (best_mul << 4) | best_add;
+
+  return (((UART_CLOCK / 16) * best_mul) / (best_div * (best_mul + best_add)));
+}
+
+
+// Start reception and transmission with empty buffers
+static void UART_Start(void) {
+  uint32_t n;
+
+  for (n = 0; n < UART_DMA_BLOCKS; n++) {
+    RxLLI[n].src  = (uint32_t)&LPC_USART2->RBR;
+    RxLLI[n].dst  = (uint32_t)&RxBuf[n * UART_DMA_BLOCK_SIZE];
+    RxLLI[n].next = (uint32_t)&RxLLI[(n + 1) % UART_DMA_BLOCKS];
+    RxLLI[n].ctrl = UART_DMA_RX_CONTROL;
+  }
+
+  RxIndexI = 0;
+  RxIndexO = 0;
+  ring_init(&TxRing, UART_BUFFER_SIZE);
+  TxCount  = 0;
+  SerialState = 0;
+
+  LPC_USART2->FCR = (1 << 0) |          // FIFO enable
+                    (1 << 1) |          // RX FIFO reset
+                    (1 << 2) |          // TX FIFO reset
+                    (1 << 3);           // DMA mode, request on each character
+  LPC_GPDMA->INTTCCLEAR = UART_DMA_RX_CH | UART_DMA_TX_CH;
+  LPC_GPDMA->INTERRCLR  = UART_DMA_RX_CH | UART_DMA_TX_CH;
+  LPC_GPDMA->C1SRCADDR  = RxLLI[0].src;
+  LPC_GPDMA->C1DESTADDR = RxLLI[0].dst;
+  LPC_GPDMA->C1LLI      = RxLLI[0].next;
+  LPC_GPDMA->C1CONTROL  = RxLLI[0].ctrl;
+  LPC_GPDMA->C1CONFIG   = UART_DMA_RX_CONFIG;
+
+  UartActive = 1;
+}
+
+
+// Stop reception and transmission, pending data is dropped
+static void UART_Stop(void) {
+  UartActive = 0;
+
+  LPC_GPDMA->C1CONFIG &= ~1UL;
+  LPC_GPDMA->C2CONFIG &= ~1UL;
+  while (LPC_GPDMA->ENBLDCHNS & (UART_DMA_RX_CH | UART_DMA_TX_CH));
+  TxCount = 0;
+}
+
+
+// Enable USART2 and GPDMA for the UART bridge
+//   return: 1 = succeeded
+int32_t UART_Initialize(void) {
+  LPC_CGU->BASE_UART2_CLK = UART_CLK_SEL_PLL1 | UART_CLK_AUTOBLOCK;
+  LPC_CCU1->CLK_M3_USART2_CFG  = CCU_CLK_CFG_AUTO | CCU_CLK_CFG_RUN;
+  while (!(LPC_CCU1->CLK_M3_USART2_STAT  & CCU_CLK_STAT_RUN));
+  LPC_CCU2->CLK_APB2_USART2_CFG = CCU_CLK_CFG_AUTO | CCU_CLK_CFG_RUN;
+  while (!(LPC_CCU2->CLK_APB2_USART2_STAT & CCU_CLK_STAT_RUN));
+  LPC_CCU1->CLK_M3_DMA_CFG     = CCU_CLK_CFG_AUTO | CCU_CLK_CFG_RUN;
+  while (!(LPC_CCU1->CLK_M3_DMA_STAT     & CCU_CLK_STAT_RUN));
+
+  UART_PIN_SETUP();
+
+  LPC_USART2->LCR = 0x03;               // 8 data bits, no parity, 1 stop bit
+  LPC_USART2->IER = 0;
+  LPC_USART2->TER = 0x01;               // Transmit enable
+
+  LPC_CREG->DMAMUX = (LPC_CREG->DMAMUX & ~UART_DMAMUX_MASK) | UART_DMAMUX_FUNC;
+  LPC_GPDMA->CONFIG = 1;                // GPDMA enable, little endian
+  NVIC_EnableIRQ(DMA_IRQn);
+
+  UartActive = 0;
+  return (1);
+}
+
+
+// Disable the UART bridge
+//   return: 1 = succeeded
+int32_t UART_Uninitialize(void) {
+  UART_Stop();
+  return (1);
+}
+
+
+// Drop all buffered data on USB bus reset
+//   return: 1 = succeeded
+int32_t UART_Reset(void) {
+  UART_Stop();
+  return (1);
+}
+
+
+// Apply line coding from the host to USART2
+//   Buffered data is dropped, the DMA channels are restarted.
+//   return: 1 = succeeded, 0 = line coding not supported
+int32_t UART_SetConfiguration(CDC_LINE_CODING *line_coding) {
+  uint32_t lcr, baudrate;
+
+  if ((line_coding->bDataBits < 5) || (line_coding->bDataBits > 8)) return (0);
+  lcr = line_coding->bDataBits - 5;
+
+  switch (line_coding->bCharFormat) {
+    case 0:                             // 1 stop bit
+      break;
+    case 1:                             // 1.5 stop bits (5 data bits)
+    case 2:                             // 2 stop bits
+      lcr |= (1 << 2);
+      break;
+    default:
+      return (0);
+  }
+
+  switch (line_coding->bParityType) {
+    case 0:                             // None
+      break;
+    case 1:                             // Odd
+      lcr |= (1 << 3) | (0 << 4);
+      break;
+    case 2:                             // Even
+      lcr |= (1 << 3) | (1 << 4);
+      break;
+    case 3:                             // Mark (forced 1)
+      lcr |= (1 << 3) | (2 << 4);
+      break;
+    case 4:                             // Space (forced 0)
+      lcr |= (1 << 3) | (3 << 4);
+      break;
+    default:
+      return (0);
+  }
+
+  // DMA reads RBR, which is DLL while the divisor latch is accessed
+  UART_Stop();
+  LPC_USART2->LCR = lcr;
+  baudrate = UART_Baudrate(line_coding->dwDTERate);
+  if (baudrate == 0) return (0);
+
+  UartLineCoding = *line_coding;
+  UartLineCoding.dwDTERate = baudrate;
+  UART_Start();
+  return (1);
+}
+
+
+// Report line coding applied to USART2
+//   return: 1 = succeeded
+int32_t UART_GetConfiguration(CDC_LINE_CODING *line_coding) {
+  *line_coding = UartLineCoding;
+  return (1);
+}
+
+
+// Move data between the UART buffers and the virtual COM port buffers
+static void UART_Move(void) {
+  uint32_t index, count, n;
+  uint16_t state;
+  uint8_t  lsr;
+
+  // Target to host, dropped while no terminal is connected
+  NVIC_DisableIRQ(DMA_IRQn);
+  UART_RxUpdateIndex();
+  index = RxIndexO;
+  count = RxIndexI - index;
+  NVIC_EnableIRQ(DMA_IRQn);
+
+  n = UART_BUFFER_SIZE - (index & (UART_BUFFER_SIZE - 1));
+  if (count > n) {
+    count = n;
+  }
+  if (count && usbd_cdc_acm_port_open()) {
+    count = USBD_CDC_ACM_DataSend(&RxBuf[index & (UART_BUFFER_SIZE - 1)], count);
+  }
+  if (count) {
+    // nothing is taken if an overrun moved the output index in the meantime
+    NVIC_DisableIRQ(DMA_IRQn);
+    if (RxIndexO == index) {
+      RxIndexO = index + count;
+    }
+    NVIC_EnableIRQ(DMA_IRQn);
+  }
+
+  // Host to target
+  count = ring_reserve(&TxRing, &index);
+  if (count) {
+    n = USBD_CDC_ACM_DataRead(&TxBuf[index], count);
+    if (n) {
+      NVIC_DisableIRQ(DMA_IRQn);
+      ring_commit(&TxRing, n);
+      if (TxCount == 0) {
+        UART_TxStart();
+      }
+      NVIC_EnableIRQ(DMA_IRQn);
+    }
+  }
+
+  // Line errors are reported once with the serial state notification
+  lsr = LPC_USART2->LSR;
+  if (lsr & UART_LSR_OE) SerialState |= CDC_SERIAL_STATE_OVERRUN;
+  if (lsr & UART_LSR_PE) SerialState |= CDC_SERIAL_STATE_PARITY;
+  if (lsr & UART_LSR_FE) SerialState |= CDC_SERIAL_STATE_FRAMING;
+  if (lsr & UART_LSR_BI) SerialState |= CDC_SERIAL_STATE_BREAK;
+  if (SerialState && usbd_cdc_acm_port_open()) {
+    NVIC_DisableIRQ(DMA_IRQn);
+    state = SerialState;
+    SerialState = 0;
+    NVIC_EnableIRQ(DMA_IRQn);
+
+    USBD_CDC_ACM_Notify(state);
+  }
+}
+
+
+// Move data between the UART buffers and the virtual COM port
+//   Called periodically from the main loop. The USB interrupt is disabled,
+//   so the host cannot change the line coding while data is being moved.
+void UART_Process(void) {
+  NVIC_DisableIRQ(USB0_IRQn);
+  if (UartActive) {
+    UART_Move();
+  }
+  NVIC_EnableIRQ(USB0_IRQn);
+}
+
+#endif  /* (UART_BRIDGE != 0) */
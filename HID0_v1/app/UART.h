@@ -0,0 +1,37 @@
+/******************************************************************************
+ * @file     UART.h
+ * @brief    CMSIS-DAP Target UART Bridge
+ * @version  V1.00
+ * @date     31. May 2012
+ *
+ * @note
+ * Copyright (C) 2012 ARM Limited. All rights reserved.
+ *
+ * @par
+ * ARM Limited (ARM) is supplying this software for use with Cortex-M
+ * processor based microcontrollers.
+ *
+ * @par
+ * THIS SOFTWARE IS PROVIDED "AS IS".  NO WARRANTIES, WHETHER EXPRESS, IMPLIED
+ * OR STATUTORY, INCLUDING, BUT NOT LIMITED TO, IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE APPLY TO THIS SOFTWARE.
+ * ARM SHALL NOT, IN ANY CIRCUMSTANCES, BE LIABLE FOR SPECIAL, INCIDENTAL, OR
+ * CONSEQUENTIAL DAMAGES, FOR ANY REASON WHATSOEVER.
+ *
+ ******************************************************************************/
+
+#ifndef __UART_H__
+#define __UART_H__
+
+#include <stdint.h>
+#include <rl_usb.h>
+
+extern int32_t  UART_Initialize       (void);
+extern int32_t  UART_Uninitialize     (void);
+extern int32_t  UART_Reset            (void);
+extern int32_t  UART_SetConfiguration (CDC_LINE_CODING *line_coding);
+extern int32_t  UART_GetConfiguration (CDC_LINE_CODING *line_coding);
+extern void     UART_DMA_Handler      (void);
+extern void     UART_Process          (void);
+
+#endif  /* __UART_H__ */
@@ -0,0 +1,336 @@
+/******************************************************************************
+ * @file     Watch.c
+ * @brief    CMSIS-DAP Data Watch (periodic target memory sampling)
+ * @version  V1.00
+ * @date     31. May 2012
+ *
+ * @note
+ * Copyright (C) 2012 ARM Limited. All rights reserved.
+ *
+ * @par
+ * ARM Limited (ARM) is supplying this software for use with Cortex-M
+ * processor based microcontrollers.
+ *
+ * @par
+ * THIS SOFTWARE IS PROVIDED "AS IS".  NO WARRANTIES, WHETHER EXPRESS, IMPLIED
+ * OR STATUTORY, INCLUDING, BUT NOT LIMITED TO, IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE APPLY TO THIS SOFTWARE.
+ * ARM SHALL NOT, IN ANY CIRCUMSTANCES, BE LIABLE FOR SPECIAL, INCIDENTAL, OR
+ * CONSEQUENTIAL DAMAGES, FOR ANY REASON WHATSOEVER.
+ *
+ ******************************************************************************/
+
+#include <string.h>
+#include <RTL.h>
+#include <rl_usb.h>
+#include "DAP_config.h"
+#include "DAP.h"
+#include "swd_host.h"
+#include "ring.h"
+
+#if (DATA_WATCH != 0)
+
+// A list of target addresses is read every sampling period from the main
+// loop, between DAP commands. Each sample is a record of a time stamp (4 bytes,
+// microseconds) followed by the data of all items in list order; the records
+// are sent back to back on the stream endpoint, which they share with the SWO
+// trace (Stream.c), or read by the host with Watch Data commands without it.
+
+#if ((DATA_WATCH_BUFFER_SIZE & (DATA_WATCH_BUFFER_SIZE - 1)) != 0)
+#error "Data Watch Buffer Size must be a power of 2"
+#endif
+
+#define WATCH_ITEMS             8                               // Items per list
+#define WATCH_SAMPLE_SIZE       256                             // Data bytes per sample
+#define WATCH_RECORD_SIZE       (4 + WATCH_SAMPLE_SIZE)         // Time stamp and data
+
+#define WATCH_CYCLES_PER_US     (CPU_CLOCK / 1000000U)          // DWT cycle counter ticks
+
+// Watched memory item
+typedef struct {
+  uint32_t address;                     // Target address
+  uint32_t count;                       // Number of bytes
+  uint32_t access;                      // Access size (1, 2 or 4 bytes)
+} Watch_Item_t;
+
+static   Watch_Item_t WatchItem[WATCH_ITEMS];       // Item List
+static   uint32_t WatchItems;                       // Number of items in the list
+static   uint32_t WatchSize;                        // Data bytes per sample
+static   uint32_t WatchPeriod;                      // Sampling period in DWT cycles
+static   uint32_t WatchNext;                        // DWT cycle count of the next sample
+static   uint32_t WatchLast;                        // DWT cycle count of the last time stamp
+static   uint64_t WatchCycles;                      // DWT cycles since start (no wrap)
+static   uint32_t WatchSamples;                     // Samples taken since start
+static   uint32_t WatchDropped;                     // Samples lost since start
+static volatile uint8_t  WatchStatus;               // Watch Status (active and error flags)
+static   uint8_t  WatchRecord[WATCH_RECORD_SIZE];   // Sample being read
+static   uint8_t  WatchBuf[DATA_WATCH_BUFFER_SIZE]; // Sample Buffer
+static   ring_t   WatchRing;                        // Sample Buffer Indexes
+
+
+#if (DATA_WATCH_STREAM != 0)
+
+// Read sample data for the stream endpoint (Stream.c)
+//   Called from the endpoint IN event and from Stream_Process with the USB
+//   interrupt disabled. Records may be split across packets.
+//   buf:    packet payload
+//   count:  maximum number of bytes
+//   return: number of bytes read
+uint32_t Watch_StreamRead(uint8_t *buf, uint32_t count) {
+  return (ring_read(&WatchRing, WatchBuf, buf, count));
+}
+
+#endif
+
+
+// Read all items into the sample record
+//   return: 1 = all items read
+static uint32_t Watch_Read(void) {
+  uint8_t *data;
+  uint32_t n, ok;
+
+  // the host may use SELECT/CSW/TAR across its DAP_Transfer commands
+  if (!swd_save_state()) {
+    return (0);
+  }
+
+  ok = 1;
+  data = &WatchRecord[4];
+  for (n = 0; n < WatchItems; n++) {
+    if (!swd_read_memory_access(WatchItem[n].address, data, WatchItem[n].count, WatchItem[n].access)) {
+      ok = 0;
+      break;
+    }
+    data += WatchItem[n].count;
+  }
+
+  if (!swd_restore_state()) {
+    ok = 0;
+  }
+  return (ok);
+}
+
+
+// Take a sample when the period has elapsed
+static void Watch_Sample(void) {
+  uint32_t now, time;
+
+  now = DWT->CYCCNT;
+  if ((int32_t)(now - WatchNext) < 0) return;
+
+  // a late sample moves the following ones, missed periods are skipped
+  WatchNext += WatchPeriod;
+  if ((int32_t)(now - WatchNext) >= 0) {
+    WatchNext = now + WatchPeriod;
+  }
+
+  if (DAP_Data.debug_port != DAP_PORT_SWD) {
+    WatchStatus |= DAP_WATCH_READ_ERROR;
+    WatchDropped++;
+    return;
+  }
+
+  WatchCycles += now - WatchLast;
+  WatchLast    = now;
+  time = (uint32_t)(WatchCycles / WATCH_CYCLES_PER_US);
+  WatchRecord[0] = (uint8_t)(time >>  0);
+  WatchRecord[1] = (uint8_t)(time >>  8);
+  WatchRecord[2] = (uint8_t)(time >> 16);
+  WatchRecord[3] = (uint8_t)(time >> 24);
+
+  if (!Watch_Read()) {
+    WatchStatus |= DAP_WATCH_READ_ERROR;
+    WatchDropped++;
+    return;
+  }
+
+  // records are kept whole, a record that does not fit is dropped
+  if (ring_space(&WatchRing) < (4 + WatchSize)) {
+    WatchStatus |= DAP_WATCH_BUFFER_OVERRUN;
+    WatchDropped++;
+    return;
+  }
+  ring_write(&WatchRing, WatchBuf, WatchRecord, 4 + WatchSize);
+  WatchSamples++;
+}
+
+
+// Sample the watched items
+//   Called periodically from the main loop.
+void Watch_Process(void) {
+  if (WatchStatus & DAP_WATCH_ACTIVE) {
+    Watch_Sample();
+  }
+}
+
+
+// Process Watch Configure command and prepare response
+//   request:  pointer to request data
+//   response: pointer to response data
+//   return:   number of bytes in response
+//
+// Request:  period (4, microseconds), item count (1), followed by the items:
+//           address (4), byte count (1), access size (1: 1, 2 or 4 bytes).
+// Response: status.
+// Sampling is stopped. Adjacent word items are merged, so that they are read
+// with one block transfer.
+uint32_t Watch_Config(uint8_t *request, uint8_t *response) {
+  Watch_Item_t *item;
+  uint32_t period;
+  uint32_t items;
+  uint32_t address, count, access;
+  uint32_t size;
+
+  WatchStatus = 0;
+  WatchItems  = 0;
+  WatchSize   = 0;
+
+  period = (*(request+0) <<  0) |
+           (*(request+1) <<  8) |
+           (*(request+2) << 16) |
+           (*(request+3) << 24);
+  items  =  *(request+4);
+  request += 5;
+
+  if ((period == 0) || (period > (0x7FFFFFFFU / WATCH_CYCLES_PER_US)) ||
+      (items  == 0) || (items > WATCH_ITEMS) ||
+      ((1 + 5 + 6 * items) > DAP_PACKET_SIZE)) {
+    *response = DAP_ERROR;
+    return (1);
+  }
+
+  item = NULL;
+  size = 0;
+  while (items--) {
+    address = (*(request+0) <<  0) |
+              (*(request+1) <<  8) |
+              (*(request+2) << 16) |
+              (*(request+3) << 24);
+    count   =  *(request+4);
+    access  =  *(request+5);
+    request += 6;
+
+    if ((count == 0) || ((size + count) > WATCH_SAMPLE_SIZE) ||
+        ((access != 1) && (access != 2) && (access != 4)) ||
+        ((access == 2) && ((address | count) & 0x1))) {
+      WatchItems = 0;
+      *response = DAP_ERROR;
+      return (1);
+    }
+    size += count;
+
+    if ((item != NULL) && (access == 4) && (item->access == 4) &&
+        ((item->address + item->count) == address)) {
+      item->count += count;
+      continue;
+    }
+    item = &WatchItem[WatchItems++];
+    item->address = address;
+    item->count   = count;
+    item->access  = access;
+  }
+
+  WatchSize   = size;
+  WatchPeriod = period * WATCH_CYCLES_PER_US;
+
+  *response = DAP_OK;
+  return (1);
+}
+
+
+// Process Watch Control command and prepare response
+//   request:  pointer to request data
+//   response: pointer to response data
+//   return:   number of bytes in response
+//
+// Request:  control (1: 0 = stop, 1 = start).
+// Response: status.
+// Starting drops samples not sent yet.
+uint32_t Watch_Control(uint8_t *request, uint8_t *response) {
+  uint8_t active;
+  uint8_t result;
+
+  active = *request & DAP_WATCH_ACTIVE;
+  result = DAP_OK;
+
+  if (!active) {
+    WatchStatus &= ~DAP_WATCH_ACTIVE;
+  } else if (WatchItems == 0) {
+    result = DAP_ERROR;
+  } else if (!(WatchStatus & DAP_WATCH_ACTIVE)) {
+    // time stamps and the sampling period use the DWT cycle counter
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL        |= DWT_CTRL_CYCCNTENA_Msk;
+
+    NVIC_DisableIRQ(USB0_IRQn);
+    ring_init(&WatchRing, DATA_WATCH_BUFFER_SIZE);
+    NVIC_EnableIRQ(USB0_IRQn);
+
+    WatchSamples = 0;
+    WatchDropped = 0;
+    WatchCycles  = 0;
+    WatchLast    = DWT->CYCCNT;
+    WatchNext    = WatchLast;
+    WatchStatus  = DAP_WATCH_ACTIVE;
+  }
+
+  *response = result;
+  return (1);
+}
+
+
+// Process Watch Status command and prepare response
+//   response: pointer to response data
+//   return:   number of bytes in response
+//
+// Response: status (active and error flags), samples taken (4),
+//           samples dropped (4).
+uint32_t Watch_Status(uint8_t *response) {
+  uint8_t status;
+
+  status = WatchStatus;
+  WatchStatus &= DAP_WATCH_ACTIVE;          // Errors are reported once
+
+  *response++ = status;
+  *response++ = (uint8_t)(WatchSamples >>  0);
+  *response++ = (uint8_t)(WatchSamples >>  8);
+  *response++ = (uint8_t)(WatchSamples >> 16);
+  *response++ = (uint8_t)(WatchSamples >> 24);
+  *response++ = (uint8_t)(WatchDropped >>  0);
+  *response++ = (uint8_t)(WatchDropped >>  8);
+  *response++ = (uint8_t)(WatchDropped >> 16);
+  *response   = (uint8_t)(WatchDropped >> 24);
+  return (9);
+}
+
+
+// Process Watch Data command and prepare response
+//   request:  pointer to request data
+//   response: pointer to response data
+//   return:   number of bytes in response
+//
+// Request:  maximum byte count (2).
+// Response: status (active and error flags), byte count (2), sample data.
+// Records may be split across responses, the host knows their size from the
+// configuration. With the stream endpoint the byte count is always 0.
+uint32_t Watch_Data(uint8_t *request, uint8_t *response) {
+  uint32_t count;
+
+  count = *(request+0) | (*(request+1) << 8);
+  if (count > (DAP_PACKET_SIZE - 4)) {
+    count = DAP_PACKET_SIZE - 4;
+  }
+
+#if (DATA_WATCH_STREAM != 0)
+  count = 0;                                // Samples go to the stream endpoint
+#else
+  count = ring_read(&WatchRing, WatchBuf, response + 3, count);
+#endif
+
+  *(response+0) = WatchStatus;
+  *(response+1) = (uint8_t)(count >> 0);
+  *(response+2) = (uint8_t)(count >> 8);
+  return (3 + count);
+}
+
+#endif  /* (DATA_WATCH != 0) */
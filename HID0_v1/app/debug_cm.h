@@ -142,6 +142,9 @@
 #define CPUID_REVISION 0x0000000F  // Revision Mask
 #define CPUID_VARIANT  0x00F00000  // Variant Mask
 
+// NVIC: Vector Table Offset Register
+#define NVIC_VTOR      (NVIC_Addr + 0x0D08)
+
 // NVIC: Application Interrupt/Reset Control Register
 #define NVIC_AIRCR     (NVIC_Addr + 0x0D0C)
 #define VECTRESET      0x00000001  // Reset Cortex-M (except Debug)
@@ -157,4 +160,7 @@
 #define VCATCH         0x00000008  // Vector Catch Flag
 #define EXTERNAL       0x00000010  // External Debug Request
 
+// DWT: Program Counter Sample Register (needs TRCENA)
+#define DWT_PCSR       0xE000101C  // Sampled PC, 0xFFFFFFFF while halted
+
 #endif
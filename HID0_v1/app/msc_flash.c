@@ -16,10 +16,13 @@
 #include <string.h>
 
 #include "DAP_config.h"
-#include "dap.h"
+#include "DAP.h"
 //#include "hid_callback.h"
-#include "led.h"
 #include "target_flash.h"
+#include "semihost.h"
+#include "virtual_fs.h"
+#include "msc_flash.h"
+#include "ring.h"
 
 #define DBG_LPC1768
 #if defined(DBG_LPC1768)
@@ -61,105 +64,98 @@
 #endif
 
 //------------------------------------------------------------------- CONSTANTS
-#define WANTED_SIZE_IN_BYTES        ((WANTED_SIZE_IN_KB + 16 + 8)*1024)
-#define WANTED_SECTORS_PER_CLUSTER  (8)
+/* Target memory shown as FLASH.BIN and RAM.BIN */
+#define TARGET_FLASH_START          (0x00000000)
+#define TARGET_FLASH_SIZE           (WANTED_SIZE_IN_KB*1024)
+#define TARGET_RAM_START            (0x10000000)
+#define TARGET_RAM_SIZE             (32*1024)
 
-#define FLASH_PROGRAM_PAGE_SIZE         (512)
-#define MBR_BYTES_PER_SECTOR            (512)
+/* Free space of the drive: an image as large as the target flash and the
+   small files hosts write along with it */
+#define VOLUME_FREE_SIZE            (TARGET_FLASH_SIZE + (16 + 8)*1024)
 
-//--------------------------------------------------------------------- DERIVED
+#define READ_AHEAD_SECTORS          (8)     /* Sectors read from the target at once */
 
-#define MBR_NUM_NEEDED_SECTORS  (WANTED_SIZE_IN_BYTES / MBR_BYTES_PER_SECTOR)
-#define MBR_NUM_NEEDED_CLUSTERS (MBR_NUM_NEEDED_SECTORS / WANTED_SECTORS_PER_CLUSTER)
-
-/* Need 3 sectors/FAT for every 1024 clusters */
-#define MBR_SECTORS_PER_FAT     1//(3*((MBR_NUM_NEEDED_CLUSTERS + 1023)/1024))
-
-/* Macro to help fill the two FAT tables with the empty sectors without
-   adding a lot of test #ifs inside the sectors[] declaration below */
-#if (MBR_SECTORS_PER_FAT == 1)
-#   define EMPTY_FAT_SECTORS
-#elif (MBR_SECTORS_PER_FAT == 2)
-#   define EMPTY_FAT_SECTORS  {fat2,0},
-#elif (MBR_SECTORS_PER_FAT == 3)
-#   define EMPTY_FAT_SECTORS  {fat2,0},{fat2,0},
-#elif (MBR_SECTORS_PER_FAT == 6)
-#   define EMPTY_FAT_SECTORS  {fat2,0},{fat2,0},{fat2,0},{fat2,0},{fat2,0},
-#elif (MBR_SECTORS_PER_FAT == 9)
-#   define EMPTY_FAT_SECTORS  {fat2,0},{fat2,0},{fat2,0},{fat2,0},{fat2,0},{fat2,0},{fat2,0},{fat2,0},
-#elif (MBR_SECTORS_PER_FAT == 12)
-#   define EMPTY_FAT_SECTORS  {fat2,0},{fat2,0},{fat2,0},{fat2,0},{fat2,0},{fat2,0},{fat2,0},{fat2,0},{fat2,0},{fat2,0},{fat2,0},
+#define FLASH_PROGRAM_PAGE_SIZE         (512)
+#define FLASH_PAGE_BUFFERS              (8)     /* Pages buffered ahead of programming (an MSC block group), power of 2 */
+#define FLASH_AP                        (0)     /* AP of the core running the flash algorithms */
+
+/* Sectors received ahead of the next one to program are held back until the
+   gap is filled, in the slot of their offset in the data region. Define
+   FLASH_REORDER_SDRAM as the base address of external SDRAM (set up by the
+   board code) to hold back a whole image instead. */
+#if defined(FLASH_REORDER_SDRAM)
+#   define FLASH_REORDER_PAGES          (MBR_NUM_NEEDED_SECTORS)
 #else
-#   error "Unsupported number of sectors per FAT table"
+#   define FLASH_REORDER_PAGES          (8)
 #endif
+#define MBR_BYTES_PER_SECTOR            (512)
+#define RECORD_MAX                      (255 + 5)   /* HEX: count, address (2), type, data, checksum */
+#define ELF_SEGMENT_MAX                 (8)         /* PT_LOAD segments with data */
+#define LZ_RING_SIZE                    (4096)      /* decompression history, power of 2 */
+#define LZ_BLOCK_MAX                    (LZ_RING_SIZE / 2)  /* uncompressed bytes per block */
+#define LZ_WINDOW                       (LZ_RING_SIZE - LZ_BLOCK_MAX)  /* farthest match offset */
+#define LZ_HEADER_SIZE                  (16)
+#define LZ_BLOCK_HEADER_SIZE            (8)
+
+//--------------------------------------------------------------------- DERIVED
 
-#define DIRENTS_PER_SECTOR  (MBR_BYTES_PER_SECTOR / sizeof(FatDirectoryEntry_t))
+#define MBR_NUM_NEEDED_SECTORS  (VOLUME_FREE_SIZE / MBR_BYTES_PER_SECTOR)
 
-#define SECTORS_ROOT_IDX        (1 + mbr.num_fats*MBR_SECTORS_PER_FAT)
-#define SECTORS_FIRST_FILE_IDX  (SECTORS_ROOT_IDX + 2)
-#define SECTORS_SYSTEM_VOLUME_INFORMATION (SECTORS_FIRST_FILE_IDX  + WANTED_SECTORS_PER_CLUSTER)
-#define SECTORS_INDEXER_VOLUME_GUID       (SECTORS_SYSTEM_VOLUME_INFORMATION + WANTED_SECTORS_PER_CLUSTER)
-#define SECTORS_MBED_HTML_IDX   (SECTORS_INDEXER_VOLUME_GUID + WANTED_SECTORS_PER_CLUSTER)
-#define SECTORS_ERROR_FILE_IDX  (SECTORS_MBED_HTML_IDX + WANTED_SECTORS_PER_CLUSTER)
+/* Disk layout, computed by virtual_fs.c from VOLUME_FREE_SIZE */
+#define SECTORS_ROOT_IDX        (vfs_root_sector())
+#define SECTORS_FIRST_FILE_IDX  (vfs_data_sector())
+#define SECTORS_PER_CLUSTER     (vfs_sectors_per_cluster())
 
 //---------------------------------------------------------------- VERIFICATION
 
-/* Sanity check */
-#if (MBR_NUM_NEEDED_CLUSTERS > 4084)
-  /* Limited by 12 bit cluster addresses, i.e. 2^12 but only 0x002..0xff5 can be used */
-#   error Too many needed clusters, increase WANTED_SECTORS_PER_CLUSTER
-#endif
-
-#if ((WANTED_SECTORS_PER_CLUSTER * MBR_BYTES_PER_SECTOR) > 32768)
-#   error Cluster size too large, must be <= 32KB
+#if (FLASH_PROGRAM_PAGE_SIZE != MBR_BYTES_PER_SECTOR)
+#   error Page buffers hold exactly one sector
 #endif
 
 //-------------------------------------------------------------------- TYPEDEFS
 
-typedef struct {
-    uint8_t boot_sector[11];
-
-    /* DOS 2.0 BPB - Bios Parameter Block, 13 bytes */
-    uint16_t bytes_per_sector;
-    uint8_t  sectors_per_cluster;
-    uint16_t reserved_logical_sectors;
-    uint8_t  num_fats;
-    uint16_t max_root_dir_entries;
-    uint16_t total_logical_sectors;            /* If num is too large for 16 bits, set to 0 and use big_sectors_on_drive */
-    uint8_t  media_descriptor;
-    uint16_t logical_sectors_per_fat;          /* Need 3 sectors/FAT for every 1024 clusters */
-
-    /* DOS 3.31 BPB - Bios Parameter Block, 12 bytes */
-    uint16_t physical_sectors_per_track;
-    uint16_t heads;
-    uint32_t hidden_sectors;
-    uint32_t big_sectors_on_drive;             /* Use if total_logical_sectors=0, needed for large number of sectors */
-
-    /* Extended BIOS Parameter Block, 26 bytes */
-    uint8_t  physical_drive_number;
-    uint8_t  not_used;
-    uint8_t  boot_record_signature;
-    uint32_t volume_id;
-    char     volume_label[11];
-    char     file_system_type[8];
-
-    /* bootstrap data in bytes 62-509 */
-    uint8_t  bootstrap[448];
-
-    /* Mandatory value at bytes 510-511, must be 0xaa55 */
-    uint16_t signature;
-} __attribute__((packed))mbr_t;
-
 typedef enum {
     BIN_FILE,
     PAR_FILE,
     DOW_FILE,
     CRD_FILE,
     SPI_FILE,
+    HEX_FILE,   /* Intel HEX */
+    SREC_FILE,  /* Motorola S-record */
+    ELF_FILE,   /* ELF32 little endian, PT_LOAD segments are programmed */
+    LZ_FILE,    /* Compressed image, see lz_decode */
     UNSUP_FILE, /* Valid extension, but not supported */
     SKIP_FILE,  /* Unknown extension, typically Long File Name entries */
 } FILE_TYPE;
 
+typedef enum {
+    RECORD_IDLE,    /* between records */
+    RECORD_TYPE,    /* 'S' received, type digit next */
+    RECORD_DATA,    /* hex digits of a record */
+    RECORD_END,     /* end record decoded, the rest of the file is ignored */
+    RECORD_ERROR,   /* bad character or checksum */
+} RECORD_STATE;
+
+typedef struct {
+    uint32_t offset;    /* p_offset, position in the file */
+    uint32_t size;      /* p_filesz */
+    uint32_t addr;      /* p_paddr, target address */
+} ELF_SEGMENT;
+
+typedef enum {
+    LZ_HEADER,      /* file header */
+    LZ_BLOCK,       /* block header */
+    LZ_TOKEN,       /* sequence token */
+    LZ_LITERAL_LEN, /* literal length bytes after 15 */
+    LZ_LITERAL,     /* literals */
+    LZ_OFFSET_LO,   /* match offset */
+    LZ_OFFSET_HI,
+    LZ_MATCH_LEN,   /* match length bytes after 15 */
+    LZ_END,         /* end block decoded, the rest of the file is ignored */
+    LZ_ERROR,       /* bad header, sequence or checksum */
+} LZ_STATE;
+
 typedef struct {
     FILE_TYPE type;
     char extension[3];
@@ -184,213 +180,6 @@ typedef struct FatDirectoryEntry {
 //------------------------------------------------------------------------- END
 
 
-typedef struct sector {
-    const uint8_t * sect;
-    unsigned int length;
-} SECTOR;
-
-#define MEDIA_DESCRIPTOR        (0xF0)
-
-static const mbr_t mbr = {
-    .boot_sector = {
-        0xEB,0x3C, // x86 Jump
-        0x90,      // NOP
-        'M','S','W','I','N','4','.','1' // OEM Name in text
-    },
-
-    .bytes_per_sector         = MBR_BYTES_PER_SECTOR,
-    .sectors_per_cluster      = WANTED_SECTORS_PER_CLUSTER,
-    .reserved_logical_sectors = 1,
-    .num_fats                 = 2,
-    .max_root_dir_entries     = 32,
-    .total_logical_sectors    = ((MBR_NUM_NEEDED_SECTORS > 32768) ? 0 : MBR_NUM_NEEDED_SECTORS),
-    .media_descriptor         = MEDIA_DESCRIPTOR,
-    .logical_sectors_per_fat  = MBR_SECTORS_PER_FAT, /* Need 3 sectors/FAT for every 1024 clusters */
-
-    .physical_sectors_per_track = 1,
-    .heads = 1,
-    .hidden_sectors = 0,
-    .big_sectors_on_drive = ((MBR_NUM_NEEDED_SECTORS > 32768) ? MBR_NUM_NEEDED_SECTORS : 0),
-
-    .physical_drive_number = 0,
-    .not_used = 0,
-    .boot_record_signature = 0x29,
-    .volume_id = 0x27021974,
-    .volume_label = {'M','b','e','d',' ','U','S','B',' ',' ',' '},
-    .file_system_type = {'F','A','T','1','2',' ',' ',' '},
-
-    /* Executable boot code that starts the operating system */
-    .bootstrap = {
-        0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
-        0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
-        0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
-        0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
-        0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
-        0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
-        0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
-        0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
-        0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
-        0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
-        0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
-        0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
-        0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
-        0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
-        0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
-        0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
-        0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
-        0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
-        0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
-        0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
-        0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
-        0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
-        0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
-        0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
-        0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
-        0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
-        0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
-        0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00
-    },
-    .signature = 0xAA55,
-};
-
-
-static const uint8_t fat1[] = {
-    MEDIA_DESCRIPTOR, 0xFF,
-    0xFF, 0xFF,
-    0xFF, 0xFF,
-    0xFF, 0xFF,
-    0xFF, 0x00,
-    0x00, 0x00,
-    0x00, 0x00,
-    0x00, 0x00,
-};
-
-static const uint8_t fat2[] = {0};
-
-static const uint8_t fail[] = {
-//    'F','A','I','L',' ',' ',' ',' ',                   // Filename
-//    'T','X','T',                                       // Filename extension
-//    0x20,                                              // File attributes
-//    0x18,0xB1,0x74,0x76,0x8E,0x41,0x8E,0x41,0x00,0x00, // Reserved
-//    0x8E,0x76,                                         // Time created or last updated
-//    0x8E,0x41,                                         // Date created or last updated
-//    0x06,0x00,                                         // Starting cluster number for file
-//    0x07,0x00,0x00,0x0                                 // File size in bytes
-};
-
-// first 16 of the max 32 (mbr.max_root_dir_entries) root dir entries
-static const uint8_t root_dir1[] = {
-    // volume label "MBED"
-    'M', 'B', 'E', 'D', 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x28, 0x0, 0x0, 0x0, 0x0,
-    0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x85, 0x75, 0x8E, 0x41, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0,
-
-    // Hidden files to keep mac happy
-
-    // .fseventsd (LFN + normal entry)  (folder, size 0, cluster 2)
-//    0x41, 0x2E, 0x0, 0x66, 0x0, 0x73, 0x0, 0x65, 0x0, 0x76, 0x0, 0xF, 0x0, 0xDA, 0x65, 0x0,
-//    0x6E, 0x0, 0x74, 0x0, 0x73, 0x0, 0x64, 0x0, 0x0, 0x0, 0x0, 0x0, 0xFF, 0xFF, 0xFF, 0xFF,
-//
-//    0x46, 0x53, 0x45, 0x56, 0x45, 0x4E, 0x7E, 0x31, 0x20, 0x20, 0x20, 0x12, 0x0, 0x47, 0x7D, 0x75,
-//    0x8E, 0x41, 0x8E, 0x41, 0x0, 0x0, 0x7D, 0x75, 0x8E, 0x41, 0x2, 0x0, 0x0, 0x0, 0x0, 0x0,
-//
-//    // .metadata_never_index (LFN + LFN + normal entry)  (size 0, cluster 0)
-//    0x42, 0x65, 0x0, 0x72, 0x0, 0x5F, 0x0, 0x69, 0x0, 0x6E, 0x0, 0xF, 0x0, 0xA8, 0x64, 0x0,
-//    0x65, 0x0, 0x78, 0x0, 0x0, 0x0, 0xFF, 0xFF, 0xFF, 0xFF, 0x0, 0x0, 0xFF, 0xFF, 0xFF, 0xFF,
-//
-//    0x1, 0x2E, 0x0, 0x6D, 0x0, 0x65, 0x0, 0x74, 0x0, 0x61, 0x0, 0xF, 0x0, 0xA8, 0x64, 0x0,
-//    0x61, 0x0, 0x74, 0x0, 0x61, 0x0, 0x5F, 0x0, 0x6E, 0x0, 0x0, 0x0, 0x65, 0x0, 0x76, 0x0,
-//
-//    0x4D, 0x45, 0x54, 0x41, 0x44, 0x41, 0x7E, 0x31, 0x20, 0x20, 0x20, 0x22, 0x0, 0x32, 0x85, 0x75,
-//    0x8E, 0x41, 0x8E, 0x41, 0x0, 0x0, 0x85, 0x75, 0x8E, 0x41, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0,
-//
-//    // .Trashes (LFN + normal entry)  (size 0, cluster 0)
-//    0x41, 0x2E, 0x0, 0x54, 0x0, 0x72, 0x0, 0x61, 0x0, 0x73, 0x0, 0xF, 0x0, 0x25, 0x68, 0x0,
-//    0x65, 0x0, 0x73, 0x0, 0x0, 0x0, 0xFF, 0xFF, 0xFF, 0xFF, 0x0, 0x0, 0xFF, 0xFF, 0xFF, 0xFF,
-//
-//    0x54, 0x52, 0x41, 0x53, 0x48, 0x45, 0x7E, 0x31, 0x20, 0x20, 0x20, 0x22, 0x0, 0x32, 0x85, 0x75,
-//    0x8E, 0x41, 0x8E, 0x41, 0x0, 0x0, 0x85, 0x75, 0x8E, 0x41, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0,
-//
-//    // Hidden files to keep windows 8.1 happy
-//    0x42, 0x20, 0x00, 0x49, 0x00, 0x6E, 0x00, 0x66, 0x00, 0x6F, 0x00, 0x0F, 0x00, 0x72, 0x72, 0x00,
-//    0x6D, 0x00, 0x61, 0x00, 0x74, 0x00, 0x69, 0x00, 0x6F, 0x00, 0x00, 0x00, 0x6E, 0x00, 0x00, 0x00,
-//
-//    0x01, 0x53, 0x00, 0x79, 0x00, 0x73, 0x00, 0x74, 0x00, 0x65, 0x00, 0x0F, 0x00, 0x72, 0x6D, 0x00,
-//    0x20, 0x00, 0x56, 0x00, 0x6F, 0x00, 0x6C, 0x00, 0x75, 0x00, 0x00, 0x00, 0x6D, 0x00, 0x65, 0x00,
-//
-//    0x53, 0x59, 0x53, 0x54, 0x45, 0x4D, 0x7E, 0x31, 0x20, 0x20, 0x20, 0x16, 0x00, 0xA5, 0x85, 0x8A,
-//    0x73, 0x43, 0x73, 0x43, 0x00, 0x00, 0x86, 0x8A, 0x73, 0x43, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00,
-//
-//    // mbed html file (size 512, cluster 3)
-//    'M', 'B', 'E', 'D', 0x20, 0x20, 0x20, 0x20, 'H', 'T', 'M', 0x20, 0x18, 0xB1, 0x74, 0x76,
-//    0x8E, 0x41, 0x8E, 0x41, 0x0, 0x0, 0x8E, 0x76, 0x8E, 0x41, 0x05, 0x0, 0x00, 0x02, 0x0, 0x0,
-};
-
-// last 16 of the max 32 (mbr.max_root_dir_entries) root dir entries
-static const uint8_t root_dir2[] = {0};
-
-static const uint8_t sect5[] = {
-    // .   (folder, size 0, cluster 2)
-//    0x2E, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x32, 0x0, 0x47, 0x7D, 0x75,
-//    0x8E, 0x41, 0x8E, 0x41, 0x0, 0x0, 0x88, 0x75, 0x8E, 0x41, 0x2, 0x0, 0x0, 0x0, 0x0, 0x0,
-//
-//    // ..   (folder, size 0, cluster 0)
-//    0x2E, 0x2E, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x10, 0x0, 0x47, 0x7D, 0x75,
-//    0x8E, 0x41, 0x8E, 0x41, 0x0, 0x0, 0x7D, 0x75, 0x8E, 0x41, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0,
-//
-//    // NO_LOG  (size 0, cluster 0)
-//    0x4E, 0x4F, 0x5F, 0x4C, 0x4F, 0x47, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x8, 0x32, 0x85, 0x75,
-//    0x8E, 0x41, 0x8E, 0x41, 0x0, 0x0, 0x85, 0x75, 0x8E, 0x41, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0,
-};
-
-static const uint8_t sect6[] = {
-//    0x2E, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x10, 0x00, 0xA5, 0x85, 0x8A,
-//    0x73, 0x43, 0x73, 0x43, 0x00, 0x00, 0x86, 0x8A, 0x73, 0x43, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00,
-//
-//    0x2E, 0x2E, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x10, 0x00, 0xA5, 0x85, 0x8A,
-//    0x73, 0x43, 0x73, 0x43, 0x00, 0x00, 0x86, 0x8A, 0x73, 0x43, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-//
-//    // IndexerVolumeGuid (size0, cluster 0)
-//    0x42, 0x47, 0x00, 0x75, 0x00, 0x69, 0x00, 0x64, 0x00, 0x00, 0x00, 0x0F, 0x00, 0xFF, 0xFF, 0xFF,
-//    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x00, 0x00, 0xFF, 0xFF, 0xFF, 0xFF,
-//
-//    0x01, 0x49, 0x00, 0x6E, 0x00, 0x64, 0x00, 0x65, 0x00, 0x78, 0x00, 0x0F, 0x00, 0xFF, 0x65, 0x00,
-//    0x72, 0x00, 0x56, 0x00, 0x6F, 0x00, 0x6C, 0x00, 0x75, 0x00, 0x00, 0x00, 0x6D, 0x00, 0x65, 0x00,
-//
-//    0x49, 0x4E, 0x44, 0x45, 0x58, 0x45, 0x7E, 0x31, 0x20, 0x20, 0x20, 0x20, 0x00, 0xA7, 0x85, 0x8A,
-//    0x73, 0x43, 0x73, 0x43, 0x00, 0x00, 0x86, 0x8A, 0x73, 0x43, 0x04, 0x00, 0x4C, 0x00, 0x00, 0x00
-};
-
-static const uint8_t sect7[] = {
-//	0x7B, 0x00, 0x39, 0x00, 0x36, 0x00, 0x36, 0x00, 0x31, 0x00, 0x39, 0x00, 0x38, 0x00, 0x32, 0x00,
-//	0x30, 0x00, 0x2D, 0x00, 0x37, 0x00, 0x37, 0x00, 0x44, 0x00, 0x31, 0x00, 0x2D, 0x00, 0x34, 0x00,
-//	0x46, 0x00, 0x38, 0x00, 0x38, 0x00, 0x2D, 0x00, 0x38, 0x00, 0x46, 0x00, 0x35, 0x00, 0x33, 0x00,
-//	0x2D, 0x00, 0x36, 0x00, 0x32, 0x00, 0x44, 0x00, 0x39, 0x00, 0x37, 0x00, 0x46, 0x00, 0x35, 0x00,
-//	0x46, 0x00, 0x34, 0x00, 0x46, 0x00, 0x46, 0x00, 0x39, 0x00, 0x7D, 0x00, 0x00, 0x00, 0x00, 0x00
-};
-
-SECTOR sectors[] = {
-    /* Reserved Sectors: Master Boot Record */
-    {(const uint8_t *)&mbr , 512},
-
-    /* FAT Region: FAT1 */
-    {fat1, sizeof(fat1)},   // fat1, sect1
-    EMPTY_FAT_SECTORS
-
-    /* FAT Region: FAT2 */
-    {fat2, 0},              // fat2, sect1
-    EMPTY_FAT_SECTORS
-
-    /* Root Directory Region */
-    {root_dir1, sizeof(root_dir1)}, // first 16 of the max 32 (mbr.max_root_dir_entries) root dir entries
-    {root_dir2, sizeof(root_dir2)}, // last 16 of the max 32 (mbr.max_root_dir_entries) root dir entries
-
-    /* Data Region */
-
-    // Section for mac compatibility
-    {sect5, sizeof(sect5)},
-
-};
-
 
 uint32_t InitOffset;
 uint32_t TotalLength;
@@ -403,8 +192,13 @@ uint32_t TotalLength;
 #define RESERVED_BITS           4
 #define BAD_START_SECTOR        5
 #define TIMEOUT                 6
+#define BAD_RECORD              7
+#define BAD_ELF_FILE            8
+#define BAD_COMPRESSED_FILE     9
+#define BAD_ADDRESS             10
+#define SECTOR_REWRITTEN        11
 
-static uint8_t * reason_array[] = {
+static const char * const reason_array[] = {
     "SWD ERROR",
     "BAD EXTENSION FILE",
     "NOT CONSECUTIVE SECTORS",
@@ -412,8 +206,48 @@ static uint8_t * reason_array[] = {
     "RESERVED BITS",
     "BAD START SECTOR",
     "TIMEOUT",
+    "BAD RECORD",
+    "BAD ELF FILE",
+    "BAD COMPRESSED FILE",
+    "BAD ADDRESS",
+    "SECTOR REWRITTEN",
 };
 
+static uint8_t read_buffer[MBR_BYTES_PER_SECTOR];
+static uint32_t read_sector = 0xFFFFFFFF;  /* sector held in read_buffer */
+static uint32_t read_status;    /* MSC_READ_xxx of the sector read */
+
+static void flash_bin_read(uint32_t offset, uint8_t *buf, uint32_t len);
+static void ram_bin_read(uint32_t offset, uint8_t *buf, uint32_t len);
+static void fail_txt_read(uint32_t offset, uint8_t *buf, uint32_t len);
+static void init(int i);
+
+static const vfs_file_t flash_bin = { {'F','L','A','S','H',' ',' ',' ','B','I','N'}, 0x01, TARGET_FLASH_SIZE, flash_bin_read };
+static const vfs_file_t ram_bin   = { {'R','A','M',' ',' ',' ',' ',' ','B','I','N'}, 0x01, TARGET_RAM_SIZE,   ram_bin_read   };
+static vfs_file_t fail_txt        = { {'F','A','I','L',' ',' ',' ',' ','T','X','T'}, 0x01, 0,                 fail_txt_read  };
+
+static uint8_t fail_reason = 0xFF;      /* reason of the last failed image, 0xFF if none */
+
+extern uint32_t SystemCoreClock;
+
+// Describe the drive: FLASH.BIN, RAM.BIN and FAIL.TXT after a failed image
+static void msc_vfs_build(void)
+{
+  vfs_init("MBED       ", VOLUME_FREE_SIZE);
+  vfs_add_file(&flash_bin);
+  vfs_add_file(&ram_bin);
+  if (fail_reason != 0xFF) {
+      fail_txt.size = strlen(reason_array[fail_reason]);
+      vfs_add_file(&fail_txt);
+  }
+  read_sector = 0xFFFFFFFF;
+}
+
+static void fail_txt_read(uint32_t offset, uint8_t *buf, uint32_t len)
+{
+  memcpy(buf, &reason_array[fail_reason][offset], len);
+}
+
 /********************************************************************************************************//**
  * @brief     MSC_Flash_Init : Initialization of flash
  * @param[in] dev  : flash device
@@ -422,43 +256,65 @@ static uint8_t * reason_array[] = {
 uint32_t MSC_Flash_Init(void *dev)
 {
 //  int i;
-  MSC_MemorySize = MBR_NUM_NEEDED_SECTORS * MBR_BYTES_PER_SECTOR;
-  MSC_BlockSize = 512;
-  MSC_BlockCount = MSC_MemorySize/MSC_BlockSize;
+  // the page ring has no size before init
+  init(0);
+  msc_vfs_build();
 
 //  memcpy(DiskImage, sectors[0].sect, 512);
         return 0;
 }
 
 
+/********************************************************************************************************//**
+ * @brief     MSC_Flash_SectorCount : size of the drive
+ * @return    Number of 512 byte sectors, changes when FAIL.TXT is added or removed
+************************************************************************************************************/
+uint32_t MSC_Flash_SectorCount(void)
+{
+  return vfs_sector_count();
+}
+
+
 /********************************************************************************************************//**
  * @brief     MSC_Flash_Read : read data to memory
  * @param[in] dev  : flash device
  *            addr : flash address
  *            wbuf : buffer for read
  *            wlen : length for read
- * @return    None
+ * @return    MSC_READ_OK, MSC_READ_BUSY or MSC_READ_FAILED when FLASH.BIN or RAM.BIN
+ *            can not be read from the target
 ************************************************************************************************************/
 uint32_t MSC_Flash_Read(void *dev, uint32_t addr, uint8_t *rbuf, uint32_t rlen)
 {
-  int i;
   uint32_t block = addr/512;
   uint32_t offset = addr%512;
-  if (1) {
-       // blink led not permanently
-       //main_blink_msd_led(0);
-       memset(rbuf, 0, rlen);
-
-       // Handle MBR, FAT1 sectors, FAT2 sectors, root1, root2 and mac file
-       if (block <= SECTORS_FIRST_FILE_IDX) {
-           if(sectors[block].length >= offset+rlen){
-           memcpy(rbuf, &sectors[block].sect[offset], rlen);
-           }
-           else {
-//               memcpy(rbuf, &sectors[block].sect[offset], rlen);
+  uint32_t n;
+
+  // blink led not permanently
+  //main_blink_msd_led(0);
+
+  // every sector is computed by virtual_fs.c, the last one is kept
+  // for reads split into several transfers
+  while (rlen) {
+      if ((offset == 0) || (block != read_sector)) {
+          read_status = MSC_READ_OK;
+          vfs_read_sector(block, read_buffer);
+          if (read_status != MSC_READ_OK) {
+              read_sector = 0xFFFFFFFF;
+              return read_status;
           }
-       }
-   }
+          read_sector = block;
+      }
+      n = MBR_BYTES_PER_SECTOR - offset;
+      if (n > rlen) {
+          n = rlen;
+      }
+      memcpy(rbuf, &read_buffer[offset], n);
+      rbuf += n;
+      rlen -= n;
+      block++;
+      offset = 0;
+  }
 //  if(addr<512)
 //  {
 ////      for (i = 0; i < rlen; i++) {
@@ -470,7 +326,7 @@ uint32_t MSC_Flash_Read(void *dev, uint32_t addr, uint8_t *rbuf, uint32_t rlen)
 //  else {
 ////      memcpy(rbuf, 0, rlen);
 //  }
-        return 0;
+        return MSC_READ_OK;
 }
 
 static uint8_t reason = 0;
@@ -479,13 +335,56 @@ static uint32_t begin_sector;
 static uint32_t nb_sector;
 static uint8_t good_file =0;
 static uint32_t flash_addr_offset = 0;
-static uint8_t sector_received_first=0;
-static uint8_t root_dir_received_first=0;
-static uint8_t erase_chip = 0;
-static uint8_t usb_buffer[512];
-static uint32_t usb_buffer_len = 0;
-static uint8_t flash_flag = 0;
-static uint32_t flash_offset = 0;
+static uint8_t image_known = 0;                 /* image_sector from the directory entry */
+static uint8_t image_guessed = 0;               /* image_sector from the data, before the directory entry */
+static uint32_t guess_offset = 0;               /* flash_addr_offset of a guessed binary */
+static uint8_t flash_buffer[FLASH_PAGE_BUFFERS][FLASH_PROGRAM_PAGE_SIZE];
+static ring_t flash_pages;                      /* filled by MSC_Flash_Write, programmed by MSC_Flash_Process */
+static uint32_t page_index = 0;                 /* flash_buffer page reserved for page_addr */
+static uint32_t flash_page_addr[FLASH_PAGE_BUFFERS];  /* target address of each page */
+static uint32_t page_addr = 0;                  /* target address of the page at page_index */
+static uint8_t page_open = 0;                   /* page at page_index holds data */
+static uint32_t image_start = 0xFFFFFFFF;       /* lowest target address of the image */
+static FILE_TYPE image_format = BIN_FILE;       /* BIN_FILE, HEX_FILE or SREC_FILE, from the first byte */
+static volatile MSC_STATE msc_state = MSC_IDLE;
+static const MSC_BACKEND *backend = NULL;       /* backend of the last page programmed */
+static uint8_t backend_ready = 0;               /* backends initialized, bit per msc_backends entry */
+static uint8_t record[RECORD_MAX];              /* HEX / SREC record being decoded, binary */
+static uint32_t record_len = 0;                 /* bytes in record */
+static RECORD_STATE record_state = RECORD_IDLE;
+static uint8_t record_type = 0;                 /* S-record type digit */
+static uint8_t record_nibble = 0;               /* high nibble of record[record_len] received */
+static uint32_t record_base = 0;                /* HEX extended segment / linear address */
+static uint8_t elf_header[MBR_BYTES_PER_SECTOR];  /* first sector: ELF header and program headers */
+static ELF_SEGMENT elf_segment[ELF_SEGMENT_MAX];
+static uint32_t elf_segment_num = 0;
+static uint8_t lz_ring[LZ_RING_SIZE];           /* decompressed data, free running index lz_out */
+static uint8_t lz_header[LZ_HEADER_SIZE];       /* file or block header being received */
+static uint32_t lz_header_len = 0;
+static LZ_STATE lz_state = LZ_HEADER;
+static uint32_t lz_out = 0;                     /* bytes decompressed */
+static uint32_t lz_block_start = 0;             /* lz_out at the start of the block */
+static uint32_t lz_block_in = 0;                /* compressed bytes left in the block */
+static uint32_t lz_block_size = 0;              /* uncompressed size of the block */
+static uint32_t lz_block_check = 0;             /* Adler-32 of the uncompressed block */
+static uint32_t lz_len = 0;                     /* literal or match length */
+static uint32_t lz_offset = 0;                  /* match offset */
+static uint32_t lz_match = 0;                   /* match length of the token */
+static uint32_t lz_addr = 0;                    /* target address of the next block */
+static uint32_t lz_size = 0;                    /* uncompressed image size */
+static uint32_t image_sector = 0;               /* disk sector holding the first image sector */
+static uint32_t image_sectors = 0;              /* sectors of the image file */
+static uint32_t next_sector = 0;                /* next image sector to queue for programming */
+#if defined(FLASH_REORDER_SDRAM)
+#define reorder_buffer ((uint8_t (*)[FLASH_PROGRAM_PAGE_SIZE])FLASH_REORDER_SDRAM)
+#else
+static uint8_t reorder_buffer[FLASH_REORDER_PAGES][FLASH_PROGRAM_PAGE_SIZE];
+#endif
+static uint32_t reorder_sector[FLASH_REORDER_PAGES];  /* disk sector + 1 held in a slot, 0 if unused */
+static uint8_t read_ahead[READ_AHEAD_SECTORS * MBR_BYTES_PER_SECTOR];
+static uint32_t read_ahead_addr = 0;            /* target address of read_ahead */
+static uint32_t read_ahead_len = 0;             /* valid bytes in read_ahead */
+static uint8_t read_ahead_connected = 0;        /* debug port powered up for read back */
 uint8_t USB_DISConnect_Flag = 0;
 
 static const FILE_TYPE_MAPPING file_type_infos[] = {
@@ -494,6 +393,21 @@ static const FILE_TYPE_MAPPING file_type_infos[] = {
     { PAR_FILE, {'P', 'A', 'R'}, 0x00000000 },//strange extension on win IE 9...
     { DOW_FILE, {'D', 'O', 'W'}, 0x00000000 },//strange extension on mac...
     { CRD_FILE, {'C', 'R', 'D'}, 0x00000000 },//strange extension on linux...
+    { HEX_FILE, {'H', 'E', 'X'}, 0x00000000 },
+    { HEX_FILE, {'h', 'e', 'x'}, 0x00000000 },
+    { SREC_FILE, {'S', 'R', 'E'}, 0x00000000 },//.srec
+    { SREC_FILE, {'S', '1', '9'}, 0x00000000 },
+    { SREC_FILE, {'S', '2', '8'}, 0x00000000 },
+    { SREC_FILE, {'S', '3', '7'}, 0x00000000 },
+    { SREC_FILE, {'M', 'O', 'T'}, 0x00000000 },
+    { ELF_FILE, {'E', 'L', 'F'}, 0x00000000 },
+    { ELF_FILE, {'e', 'l', 'f'}, 0x00000000 },
+    { ELF_FILE, {'A', 'X', 'F'}, 0x00000000 },//Keil / ARM Compiler
+    { ELF_FILE, {'a', 'x', 'f'}, 0x00000000 },
+    { LZ_FILE, {'D', 'P', 'Z'}, 0x00000000 },
+    { LZ_FILE, {'d', 'p', 'z'}, 0x00000000 },
+    { BIN_FILE, {'R', 'A', 'M'}, TARGET_RAM_START },//binary loaded into RAM and run
+    { BIN_FILE, {'r', 'a', 'm'}, TARGET_RAM_START },
     { UNSUP_FILE, {0,0,0},     0            },//end of table marker
 };
 static FILE_TYPE get_file_type(const FatDirectoryEntry_t* pDirEnt, uint32_t* pAddrOffset) {
@@ -534,9 +448,8 @@ int search_bin_file(uint8_t * root, uint8_t sector) {
     int idx = 0;
     uint8_t found = 0;
     uint32_t i = 0;
-    uint32_t move_sector_start = 0, nb_sector_to_move = 0;
     FILE_TYPE file_type;
-    uint8_t hidden_file = 0, adapt_th_sector = 0;
+    uint8_t hidden_file = 0;
     uint32_t offset = 0;
 
     FatDirectoryEntry_t* pDirEnts = (FatDirectoryEntry_t*)root;
@@ -553,16 +466,36 @@ int search_bin_file(uint8_t * root, uint8_t sector) {
     }
 
     // now do the real search for a valid .bin file
-    for (i = 0; i < 2; i++) {
+    // (the root directory also lists FLASH.BIN and RAM.BIN)
+    for (i = 0; i < (MBR_BYTES_PER_SECTOR / sizeof(FatDirectoryEntry_t)); i++) {
+
+        // end of directory
+        if (pDirEnts[i].filename[0] == 0x00) {
+            break;
+        }
+        // deleted entries and the read back files
+        if ((pDirEnts[i].filename[0] == 0xE5) ||
+            (memcmp(pDirEnts[i].filename, flash_bin.name, 11) == 0) ||
+            (memcmp(pDirEnts[i].filename, ram_bin.name, 11) == 0) ||
+            (memcmp(pDirEnts[i].filename, fail_txt.name, 11) == 0)) {
+            continue;
+        }
 
         // Determine file type and get the flash offset
         file_type = get_file_type(&pDirEnts[i], &offset);
 
         if (file_type == BIN_FILE || file_type == PAR_FILE ||
-            file_type == DOW_FILE || file_type == CRD_FILE || file_type == SPI_FILE) {
+            file_type == DOW_FILE || file_type == CRD_FILE || file_type == SPI_FILE ||
+            file_type == HEX_FILE || file_type == SREC_FILE || file_type == ELF_FILE ||
+            file_type == LZ_FILE) {
 
             hidden_file = (pDirEnts[i].attributes & 0x02) ? 1 : 0;
 
+            // hidden companions of the image, e.g. the "._" files written by macOS
+            if (hidden_file) {
+                continue;
+            }
+
             // compute the size of the file
             size = pDirEnts[i].filesize;
 
@@ -571,14 +504,14 @@ int search_bin_file(uint8_t * root, uint8_t sector) {
                 continue;
             }
 
-            // read the cluster number where data are stored (ignoring the
-            // two high bytes in the cluster number)
+            // read the cluster number where data are stored (the two high
+            // bytes are only used by FAT32 and are 0 otherwise)
             //
             // Convert cluster number to sector number by moving past the root
             // dir and fat tables.
             //
             // The cluster numbers start at 2 (0 and 1 are never used).
-            begin_sector = (pDirEnts[i].first_cluster_low_16 - 2) * WANTED_SECTORS_PER_CLUSTER + SECTORS_FIRST_FILE_IDX;
+            begin_sector = (((uint32_t)pDirEnts[i].first_cluster_high_16 << 16) + pDirEnts[i].first_cluster_low_16 - 2) * SECTORS_PER_CLUSTER + SECTORS_FIRST_FILE_IDX;
 
             // compute the number of sectors
             nb_sector = (size + MBR_BYTES_PER_SECTOR - 1) / MBR_BYTES_PER_SECTOR;
@@ -666,7 +599,7 @@ int search_bin_file(uint8_t * root, uint8_t sector) {
 //extern const unsigned char data[1148];
 
 
-static init(int i)
+static void init(int i)
 {
    reason = 0;
    size = 0;
@@ -674,12 +607,26 @@ static init(int i)
    nb_sector = 0;
    good_file =0;
    flash_addr_offset = 0;
-   sector_received_first=0;
-   root_dir_received_first=0;
-   erase_chip = 0;
-   usb_buffer_len = 0;
-   flash_flag = 0;
-   flash_offset = 0;
+   image_known = 0;
+   image_guessed = 0;
+   guess_offset = 0;
+   ring_init(&flash_pages, FLASH_PAGE_BUFFERS);
+   page_open = 0;
+   image_start = 0xFFFFFFFF;
+   image_format = BIN_FILE;
+   msc_state = MSC_IDLE;
+   backend = NULL;
+   backend_ready = 0;
+   record_state = RECORD_IDLE;
+   record_base = 0;
+   lz_state = LZ_HEADER;
+   lz_header_len = 0;
+   lz_out = 0;
+   image_sector = 0;
+   image_sectors = 0;
+   next_sector = 0;
+   memset(reorder_sector, 0, sizeof(reorder_sector));
+   read_ahead_len = 0;
    USB_DISConnect_Flag = 0;
 
 }
@@ -701,7 +648,10 @@ static void initDisconnect(uint8_t success) {
     if (autorst)
         swd_set_target_state(RESET_RUN);
     //main_blink_msd_led(0);
+    // the drive comes back with FAIL.TXT telling why the image was rejected
+    fail_reason = success ? 0xFF : reason;
     init(1);
+    msc_vfs_build();
     //isr_evt_set(MSC_TIMEOUT_STOP_EVENT, msc_valid_file_timeout_task_id);
     if (!autorst)
     {
@@ -713,79 +663,980 @@ static void initDisconnect(uint8_t success) {
     semihost_enable();
 }
 
+// Read target memory for FLASH.BIN and RAM.BIN
+//   Reads are served from read_ahead, which is refilled with up to READ_AHEAD_SECTORS
+//   sectors on a miss so that sequential reads keep the bulk IN pipe busy.
+//   The read fails (read_status) while a debugger is connected or a file is programmed.
+//   Called from the main loop only (see usbd_msc_read_deferred), between the DAP
+//   commands and the semihost poll which use the debug port as well.
+static void target_read(uint32_t addr, uint32_t end, uint8_t *buf, uint32_t len)
+{
+  uint32_t n;
+
+  if (ring_count(&flash_pages) || (DAP_Data.debug_port != DAP_PORT_DISABLED)) {
+      read_status = MSC_READ_BUSY;
+      return;
+  }
+
+  if ((addr < read_ahead_addr) || ((addr - read_ahead_addr + len) > read_ahead_len)) {
+      read_ahead_len = 0;
+      if (!read_ahead_connected) {
+          if (!swd_init_debug()) {
+              read_status = MSC_READ_FAILED;
+              return;
+          }
+          read_ahead_connected = 1;
+      }
+      n = end - addr;
+      if (n > sizeof(read_ahead)) {
+          n = sizeof(read_ahead);
+      }
+      // a debugger may have changed SELECT/CSW since the last read
+      swd_select_session(FLASH_AP);
+      swd_clear_state();
+      if (!swd_read_memory(addr, read_ahead, n)) {
+          read_ahead_connected = 0;
+          read_status = MSC_READ_FAILED;
+          return;
+      }
+      read_ahead_addr = addr;
+      read_ahead_len = n;
+  }
+  memcpy(buf, &read_ahead[addr - read_ahead_addr], len);
+}
+
+static void flash_bin_read(uint32_t offset, uint8_t *buf, uint32_t len)
+{
+  // a new dump starts with fresh data
+  if (offset == 0) {
+      read_ahead_len = 0;
+  }
+  target_read(TARGET_FLASH_START + offset, TARGET_FLASH_START + TARGET_FLASH_SIZE, buf, len);
+}
+
+static void ram_bin_read(uint32_t offset, uint8_t *buf, uint32_t len)
+{
+  if (offset == 0) {
+      read_ahead_len = 0;
+  }
+  target_read(TARGET_RAM_START + offset, TARGET_RAM_START + TARGET_RAM_SIZE, buf, len);
+}
+
+// Take the target over for programming, fails while a debugger is connected
+static uint8_t target_take(void)
+{
+  if (DAP_Data.debug_port != DAP_PORT_DISABLED) {
+      reason = SWD_PORT_IN_USE;
+      return 0;
+  }
+  semihost_disable();
+  read_ahead_connected = 0;
+  if (!swd_set_target_state(RESET_PROGRAM)) {
+      reason = SWD_ERROR;
+      return 0;
+  }
+  return 1;
+}
+
+// Target flash: the flash algorithm is loaded and the chip erased before the first page
+static uint8_t flash_backend_init(void)
+{
+  if (!target_take()) {
+      return 0;
+  }
+  if (!target_flash_init(SystemCoreClock) || !target_flash_erase_chip()) {
+      reason = SWD_ERROR;
+      return 0;
+  }
+  return 1;
+}
+
+static uint8_t flash_backend_program(uint32_t addr, uint8_t *buf, uint32_t size)
+{
+  return target_flash_program_page(addr, buf, size);
+}
+
+// Target RAM: written through the debug port, the core is held halted
+static uint8_t ram_backend_program(uint32_t addr, uint8_t *buf, uint32_t size)
+{
+  return swd_write_memory(addr, buf, size);
+}
+
+// An image starting in RAM is run from there: its vector table gives SP and PC
+static uint8_t ram_backend_finish(void)
+{
+  if ((image_start < TARGET_RAM_START) || ((image_start - TARGET_RAM_START) >= TARGET_RAM_SIZE)) {
+      return 1;
+  }
+  return swd_run_image(image_start);
+}
+
+static const MSC_BACKEND msc_backends[] = {
+    { TARGET_FLASH_START, TARGET_FLASH_SIZE, flash_backend_init, flash_backend_program, NULL },
+    { TARGET_RAM_START,   TARGET_RAM_SIZE,   target_take,        ram_backend_program,   ram_backend_finish },
+};
+
+#define MSC_BACKEND_NUM (sizeof(msc_backends) / sizeof(msc_backends[0]))
+
+// Backend for a page, initialized on first use
+//   return NULL and set reason if there is none or it fails
+static const MSC_BACKEND *backend_get(uint32_t addr)
+{
+  uint32_t i;
+
+  for (i = 0; i < MSC_BACKEND_NUM; i++) {
+      if ((addr >= msc_backends[i].start) && ((addr - msc_backends[i].start) < msc_backends[i].size)) {
+          break;
+      }
+  }
+  if (i == MSC_BACKEND_NUM) {
+      reason = BAD_ADDRESS;
+      return NULL;
+  }
+  if (!(backend_ready & (1 << i))) {
+      if (!msc_backends[i].init()) {
+          return NULL;
+      }
+      backend_ready |= 1 << i;
+  }
+  return &msc_backends[i];
+}
+
+// Program the queued pages into the target
+static void flash_program_pages(void)
+{
+  uint32_t addr, i;
+
+  swd_select_session(FLASH_AP);
+
+  while (ring_peek(&flash_pages, &i) && (msc_state != MSC_ERROR)) {
+      addr = flash_page_addr[i];
+      if ((backend == NULL) || (addr < backend->start) || ((addr - backend->start) >= backend->size)) {
+          backend = backend_get(addr);
+      }
+      if ((backend == NULL) ||
+          !backend->program(addr, flash_buffer[i], FLASH_PROGRAM_PAGE_SIZE)) {
+          if (backend != NULL) {
+              reason = SWD_ERROR;
+          }
+          msc_state = MSC_ERROR;
+          break;
+      }
+      ring_release(&flash_pages, 1);
+      read_ahead_len = 0;
+  }
+}
+
+// Finish the backends used by the image
+static uint8_t backend_finish(void)
+{
+  uint32_t i;
+
+  for (i = 0; i < MSC_BACKEND_NUM; i++) {
+      if ((backend_ready & (1 << i)) && (msc_backends[i].finish != NULL) && !msc_backends[i].finish()) {
+          reason = SWD_ERROR;
+          return 0;
+      }
+  }
+  return 1;
+}
+
 /********************************************************************************************************//**
- * @brief     MSC_Flash_Writev : write data to memory
- * @param[in] dev  : flash device
- *            addr : flash address
- *            wbuf : buffer for write
- *            wlen : length for write
+ * @brief     MSC_Flash_Process : program the pages buffered by MSC_Flash_Write into the target
+ *            Called from the main loop. Disconnects when the image is complete or has failed.
  * @return    None
 ************************************************************************************************************/
-uint32_t MSC_Flash_Write(void *dev, uint32_t addr, uint8_t *rbuf, uint32_t rlen)
+void MSC_Flash_Process(void)
 {
-  USBHID_Dev* devs = (USBHID_Dev*) dev;
-  uint32_t block = addr/512;
-  uint32_t offset = addr%512;
-  int idx_size = 0;
-//  if (rlen !=64) {
-//      GPIOSetValue(LED_RED_PORT,LED_RED_PIN,0);
-//  }
-  if ((block == SECTORS_ROOT_IDX) || (block == (SECTORS_ROOT_IDX+1))) {
-//    if (!(offset%64 == 0)) {
-//        GPIOSetValue(LED_RED_PORT,LED_RED_PIN,0);
-//    }
-      idx_size = search_bin_file(rbuf, block);
-      if (idx_size != -1) {
-          if (sector_received_first == 0) {
-              root_dir_received_first = 1;
-//              GPIOSetValue(LED_RED_PORT,LED_RED_PIN,0);
-              erase_chip = 1;
+  flash_program_pages();
+
+  switch (msc_state) {
+      case MSC_DONE:
+          if (ring_count(&flash_pages) == 0) {
+              initDisconnect(backend_finish());
           }
-      }
+          break;
+      case MSC_ERROR:
+          initDisconnect(0);
+          break;
+      default:
+          break;
+  }
+}
+
+/********************************************************************************************************//**
+ * @brief     MSC_Flash_State : state of the drag-and-drop engine
+ * @return    MSC_STATE
+************************************************************************************************************/
+MSC_STATE MSC_Flash_State(void)
+{
+  return msc_state;
+}
+
+// Queue the page at page_index for programming
+static void page_close(void)
+{
+  if (page_open) {
+      flash_page_addr[page_index] = page_addr;
+      ring_commit(&flash_pages, 1);
+      page_open = 0;
+  }
+}
 
+// Write image data to its target address
+//   Data is coalesced into page buffers by address, gaps in a page read as erased (0xFF).
+//   A page is queued when its last byte is written or data for another page arrives.
+static void flash_program(uint32_t addr, const uint8_t *buf, uint32_t len)
+{
+  uint32_t offset, n;
+
+  if ((len != 0) && (addr < image_start)) {
+      image_start = addr;
   }
-  if (block >= SECTORS_FIRST_FILE_IDX) {
-      if (root_dir_received_first == 0) {
-          sector_received_first = 1;
-//          GPIOSetValue(LED_RED_PORT,LED_RED_PIN,0);
+  while (len) {
+      if (page_open && ((addr & ~(FLASH_PROGRAM_PAGE_SIZE - 1)) != page_addr)) {
+          page_close();
       }
-      if (block >= begin_sector) {
-          if(erase_chip == 1)
-          {
-              erase_chip = 0;
-              target_set_state(RESET_PROGRAM);
-              target_flash_init(50000000);
-              target_flash_erase_chip();
-//              target_flash_program_page(0, data, 1148);
-//              GPIOSetValue(LED_RED_PORT,LED_RED_PIN,1);
+      if (!page_open) {
+          // all pages in use: back-pressure until one is programmed
+          // (MSC_Flash_Write is called from the main loop as well, never from an interrupt)
+          while (!ring_reserve(&flash_pages, &page_index)) {
+              flash_program_pages();
+              if (msc_state == MSC_ERROR) {
+                  return;
+              }
           }
-//          target_flash_program_page(flash_offset, rbuf, rlen);
-//          flash_offset += rlen;
-          if(usb_buffer_len < 512)
-          {
-            memcpy(&usb_buffer[usb_buffer_len], rbuf, rlen);
-
-            usb_buffer_len += rlen;
-
-            if (usb_buffer_len >= 512) {
-              flash_flag = 1;
-              usb_buffer_len = 0;
-//              GPIOSetValue(LED_RED_PORT,LED_RED_PIN,1);
-            }
+          memset(flash_buffer[page_index], 0xFF, FLASH_PROGRAM_PAGE_SIZE);
+          page_addr = addr & ~(FLASH_PROGRAM_PAGE_SIZE - 1);
+          page_open = 1;
+      }
+
+      offset = addr - page_addr;
+      n = FLASH_PROGRAM_PAGE_SIZE - offset;
+      if (n > len) {
+          n = len;
+      }
+      memcpy(&flash_buffer[page_index][offset], buf, n);
+      addr += n;
+      buf += n;
+      len -= n;
+
+      if ((offset + n) == FLASH_PROGRAM_PAGE_SIZE) {
+          page_close();
+      }
+  }
+}
+
+// Last image data received: queue the open page, MSC_Flash_Process disconnects when it is programmed
+static void image_end(void)
+{
+  page_close();
+  msc_state = MSC_DONE;
+}
+
+static int hex_digit(uint8_t c)
+{
+  if ((c >= '0') && (c <= '9')) {
+      return c - '0';
+  }
+  if ((c >= 'A') && (c <= 'F')) {
+      return c - 'A' + 10;
+  }
+  if ((c >= 'a') && (c <= 'f')) {
+      return c - 'a' + 10;
+  }
+  return -1;
+}
+
+// Handle a complete Intel HEX record: count, address (2), type, data, checksum
+static void hex_record(void)
+{
+  uint32_t addr = (record[1] << 8) | record[2];
+  uint8_t sum = 0;
+  uint32_t i;
+
+  for (i = 0; i < record_len; i++) {
+      sum += record[i];
+  }
+  if (sum != 0) {
+      record_state = RECORD_ERROR;
+      return;
+  }
+
+  switch (record[3]) {
+      case 0x00:      // data
+          flash_program(record_base + addr, &record[4], record[0]);
+          break;
+      case 0x01:      // end of file
+          image_end();
+          record_state = RECORD_END;
+          return;
+      case 0x02:      // extended segment address
+      case 0x04:      // extended linear address
+          if (record[0] != 2) {
+              record_state = RECORD_ERROR;
+              return;
           }
-          if(flash_flag == 1)
-          {
-            target_flash_program_page(flash_offset, usb_buffer, 512);
+          record_base = ((record[4] << 8) | record[5]) << ((record[3] == 0x02) ? 4 : 16);
+          break;
+      default:        // start addresses
+          break;
+  }
+  record_state = RECORD_IDLE;
+}
+
+// Handle a complete Motorola S-record: count, address (2, 3 or 4), data, checksum
+static void srec_record(void)
+{
+  uint32_t addr = 0;
+  uint32_t addr_len;
+  uint8_t sum = 0;
+  uint32_t i;
 
-            flash_flag = 0;
-            flash_offset += 512;
-//            GPIOSetValue(LED_RED_PORT,LED_RED_PIN,0);
+  for (i = 0; i < record_len; i++) {
+      sum += record[i];
+  }
+  if (sum != 0xFF) {
+      record_state = RECORD_ERROR;
+      return;
+  }
+
+  switch (record_type) {
+      case 1:
+      case 2:
+      case 3:         // data, 16, 24 or 32 bit address
+          addr_len = record_type + 1;
+          if (record[0] < (addr_len + 1)) {
+              record_state = RECORD_ERROR;
+              return;
           }
+          for (i = 0; i < addr_len; i++) {
+              addr = (addr << 8) | record[1 + i];
+          }
+          flash_program(addr, &record[1 + addr_len], record[0] - addr_len - 1);
+          break;
+      case 7:
+      case 8:
+      case 9:         // termination
+          image_end();
+          record_state = RECORD_END;
+          return;
+      default:        // header and record counts
+          break;
+  }
+  record_state = RECORD_IDLE;
+}
+
+// Decode HEX / SREC text, records may be split anywhere across calls
+static void record_decode(const uint8_t *buf, uint32_t len)
+{
+  uint8_t c;
+  int v;
+
+  while (len--) {
+      c = *buf++;
+      switch (record_state) {
+          case RECORD_IDLE:
+              if ((c == ':') && (image_format == HEX_FILE)) {
+                  record_len = 0;
+                  record_nibble = 0;
+                  record_state = RECORD_DATA;
+              } else if ((c == 'S') && (image_format == SREC_FILE)) {
+                  record_state = RECORD_TYPE;
+              } else if ((c == 0x1A) || (c == 0x00)) {
+                  // padding after the last record (EOF character, unused part of the sector)
+                  record_state = RECORD_END;
+                  return;
+              } else if ((c != '\r') && (c != '\n') && (c != ' ') && (c != '\t')) {
+                  record_state = RECORD_ERROR;
+                  return;
+              }
+              break;
+
+          case RECORD_TYPE:
+              if ((c < '0') || (c > '9')) {
+                  record_state = RECORD_ERROR;
+                  return;
+              }
+              record_type = c - '0';
+              record_len = 0;
+              record_nibble = 0;
+              record_state = RECORD_DATA;
+              break;
+
+          case RECORD_DATA:
+              v = hex_digit(c);
+              if (v < 0) {
+                  record_state = RECORD_ERROR;
+                  return;
+              }
+              if (!record_nibble) {
+                  record[record_len] = v << 4;
+                  record_nibble = 1;
+                  break;
+              }
+              record[record_len++] |= v;
+              record_nibble = 0;
+              // the first byte is the count of the bytes that follow
+              if (record_len == ((image_format == HEX_FILE) ? (record[0] + 5U) : (record[0] + 1U))) {
+                  if (image_format == HEX_FILE) {
+                      hex_record();
+                  } else {
+                      srec_record();
+                  }
+                  if (record_state != RECORD_IDLE) {
+                      return;
+                  }
+              }
+              break;
+
+          default:
+              return;
       }
-      if ((block >= nb_sector) && (flash_offset >= size))
-      {
-          initDisconnect(0);
+  }
+}
+
+static uint32_t get16(const uint8_t *p)
+{
+  return p[0] | (p[1] << 8);
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Collect the PT_LOAD segments with data from the program headers
+//   len: bytes of the file in elf_header, a sector or the whole of a shorter file
+//   return 0 if the file is not ELF32 little endian or the headers are not within
+//   those bytes. Program headers placed behind the sections are not supported, the
+//   segment data before them would be gone by the time they arrive.
+static int elf_parse(uint32_t len)
+{
+  uint32_t phoff, phentsize, phnum, i;
+  const uint8_t *ph;
+
+  if ((len < 52) || (elf_header[4] != 1) || (elf_header[5] != 1)) {    // ELFCLASS32, ELFDATA2LSB
+      return 0;
+  }
+  phoff = get32(&elf_header[28]);
+  phentsize = get16(&elf_header[42]);
+  phnum = get16(&elf_header[44]);
+  if ((phentsize < 32) || (phoff > len) ||
+      (phnum > ((len - phoff) / phentsize))) {
+      return 0;
+  }
+
+  elf_segment_num = 0;
+  for (i = 0; i < phnum; i++) {
+      ph = &elf_header[phoff + i * phentsize];
+      // PT_LOAD with file data, .bss has none
+      if ((get32(&ph[0]) != 1) || (get32(&ph[16]) == 0)) {
+          continue;
       }
+      if (elf_segment_num == ELF_SEGMENT_MAX) {
+          return 0;
+      }
+      elf_segment[elf_segment_num].offset = get32(&ph[4]);
+      elf_segment[elf_segment_num].addr = get32(&ph[12]);
+      elf_segment[elf_segment_num].size = get32(&ph[16]);
+      elf_segment_num++;
   }
-        return 0;
+  return 1;
+}
+
+// Program the parts of the PT_LOAD segments in the file data at pos
+//   Everything else (section headers, debug information) is dropped.
+static void elf_data(uint32_t pos, const uint8_t *buf, uint32_t len)
+{
+  uint32_t start, end, i;
+
+  if (pos < sizeof(elf_header)) {
+      memcpy(&elf_header[pos], buf, len);
+      len += pos;
+      // a file shorter than a sector ends here (size is 0 before the directory
+      // entry, the whole sector is handed over then)
+      if ((len < sizeof(elf_header)) && ((size == 0) || (len < size))) {
+          return;
+      }
+      if (!elf_parse(len)) {
+          reason = BAD_ELF_FILE;
+          msc_state = MSC_ERROR;
+          return;
+      }
+      // segment data may start in the first sector as well
+      pos = 0;
+      buf = elf_header;
+  }
+
+  for (i = 0; i < elf_segment_num; i++) {
+      start = (pos > elf_segment[i].offset) ? pos : elf_segment[i].offset;
+      end = elf_segment[i].offset + elf_segment[i].size;
+      if (end > (pos + len)) {
+          end = pos + len;
+      }
+      if (start < end) {
+          flash_program(elf_segment[i].addr + (start - elf_segment[i].offset), buf + (start - pos), end - start);
+      }
+  }
+}
+
+// Adler-32 of len bytes in lz_ring from index start
+//   len <= LZ_BLOCK_MAX, small enough to reduce the sums only once
+static uint32_t lz_adler32(uint32_t start, uint32_t len)
+{
+  uint32_t a = 1, b = 0;
+
+  while (len--) {
+      a += lz_ring[start++ & (LZ_RING_SIZE - 1)];
+      b += a;
+  }
+  return ((b % 65521) << 16) | (a % 65521);
+}
+
+// Block complete: verify and program it
+static void lz_block_end(void)
+{
+  uint32_t start, n;
+
+  if (((lz_out - lz_block_start) != lz_block_size) ||
+      (lz_adler32(lz_block_start, lz_block_size) != lz_block_check)) {
+      lz_state = LZ_ERROR;
+      return;
+  }
+
+  // the block may wrap around the end of the ring
+  start = lz_block_start & (LZ_RING_SIZE - 1);
+  n = LZ_RING_SIZE - start;
+  if (n > lz_block_size) {
+      n = lz_block_size;
+  }
+  flash_program(lz_addr, &lz_ring[start], n);
+  flash_program(lz_addr + n, lz_ring, lz_block_size - n);
+  lz_addr += lz_block_size;
+
+  lz_header_len = 0;
+  lz_state = LZ_BLOCK;
+}
+
+// Literals of a sequence done: a match follows unless the block ends
+static void lz_literals_end(void)
+{
+  if (lz_block_in == 0) {
+      lz_block_end();
+  } else {
+      lz_state = LZ_OFFSET_LO;
+  }
+}
+
+// Copy a match from the history
+static void lz_copy_match(void)
+{
+  if ((lz_offset == 0) || (lz_offset > LZ_WINDOW) || (lz_offset > lz_out) ||
+      ((lz_out - lz_block_start + lz_len) > lz_block_size)) {
+      lz_state = LZ_ERROR;
+      return;
+  }
+  while (lz_len--) {
+      lz_ring[lz_out & (LZ_RING_SIZE - 1)] = lz_ring[(lz_out - lz_offset) & (LZ_RING_SIZE - 1)];
+      lz_out++;
+  }
+  lz_state = LZ_TOKEN;
+}
+
+// Decompress DPZ data, a block may be split anywhere across calls
+//
+// File header (16 bytes, little endian): "DAPZ", version 1, 3 reserved bytes,
+// target address (4), uncompressed size (4). Then blocks, each with a header of
+// compressed size (2), uncompressed size (2, at most LZ_BLOCK_MAX), Adler-32 of
+// the uncompressed data (4), followed by LZ4 block format sequences. Matches may
+// reach LZ_WINDOW bytes back, also into previous blocks. A block header with both
+// sizes 0 ends the image. A block is programmed after its checksum is verified.
+static void lz_decode(const uint8_t *buf, uint32_t len)
+{
+  uint8_t c;
+
+  while (len--) {
+      c = *buf++;
+      if ((lz_state != LZ_HEADER) && (lz_state != LZ_BLOCK)) {
+          lz_block_in--;
+      }
+
+      switch (lz_state) {
+          case LZ_HEADER:
+              lz_header[lz_header_len++] = c;
+              if (lz_header_len < LZ_HEADER_SIZE) {
+                  break;
+              }
+              if (lz_header[4] != 1) {
+                  lz_state = LZ_ERROR;
+                  return;
+              }
+              lz_addr = get32(&lz_header[8]);
+              lz_size = get32(&lz_header[12]);
+              lz_header_len = 0;
+              lz_state = LZ_BLOCK;
+              break;
+
+          case LZ_BLOCK:
+              lz_header[lz_header_len++] = c;
+              if (lz_header_len < LZ_BLOCK_HEADER_SIZE) {
+                  break;
+              }
+              lz_block_in = get16(&lz_header[0]);
+              lz_block_size = get16(&lz_header[2]);
+              lz_block_check = get32(&lz_header[4]);
+              if ((lz_block_in == 0) && (lz_block_size == 0)) {
+                  lz_state = (lz_out == lz_size) ? LZ_END : LZ_ERROR;
+                  if (lz_state == LZ_END) {
+                      image_end();
+                  }
+                  return;
+              }
+              if ((lz_block_in == 0) || (lz_block_size > LZ_BLOCK_MAX)) {
+                  lz_state = LZ_ERROR;
+                  return;
+              }
+              lz_block_start = lz_out;
+              lz_state = LZ_TOKEN;
+              break;
+
+          case LZ_TOKEN:
+              lz_len = c >> 4;
+              lz_match = (c & 0x0F) + 4;
+              if (lz_len == 15) {
+                  lz_state = LZ_LITERAL_LEN;
+              } else if (lz_len) {
+                  lz_state = LZ_LITERAL;
+              } else {
+                  lz_literals_end();
+              }
+              break;
+
+          case LZ_LITERAL_LEN:
+              lz_len += c;
+              if (c != 255) {
+                  lz_state = LZ_LITERAL;
+              }
+              break;
+
+          case LZ_LITERAL:
+              if ((lz_out - lz_block_start) == lz_block_size) {
+                  lz_state = LZ_ERROR;
+                  return;
+              }
+              lz_ring[lz_out++ & (LZ_RING_SIZE - 1)] = c;
+              if (--lz_len == 0) {
+                  lz_literals_end();
+              }
+              break;
+
+          case LZ_OFFSET_LO:
+              lz_offset = c;
+              lz_state = LZ_OFFSET_HI;
+              break;
+
+          case LZ_OFFSET_HI:
+              lz_offset |= c << 8;
+              lz_len = lz_match;
+              if (lz_match == (15 + 4)) {
+                  lz_state = LZ_MATCH_LEN;
+              } else {
+                  lz_copy_match();
+              }
+              break;
+
+          case LZ_MATCH_LEN:
+              lz_len += c;
+              if (c != 255) {
+                  lz_copy_match();
+              }
+              break;
+
+          default:
+              return;
+      }
+
+      if (lz_state == LZ_ERROR) {
+          return;
+      }
+      // a block ends with literals, its compressed size must match the sequences
+      if ((lz_state != LZ_BLOCK) && (lz_state != LZ_HEADER) && (lz_block_in == 0)) {
+          lz_state = LZ_ERROR;
+          return;
+      }
+  }
+}
+
+// Hand image data over in file order
+//   The format is taken from the first bytes: HEX and SREC files start with ':' and 'S',
+//   ELF files with 0x7F 'E' 'L' 'F', compressed files with "DAPZ", a binary with the
+//   (word aligned) initial stack pointer. So it is known even when the data is written
+//   before the directory entry.
+static void image_data(uint32_t sector, uint32_t offset, const uint8_t *buf, uint32_t len)
+{
+  if ((msc_state == MSC_DONE) || (msc_state == MSC_ERROR)) {
+      return;
+  }
+  msc_state = MSC_RECEIVING;
+  if ((sector == 0) && (offset == 0)) {
+      if (buf[0] == ':') {
+          image_format = HEX_FILE;
+      } else if (buf[0] == 'S') {
+          image_format = SREC_FILE;
+      } else if ((len >= 4) && (memcmp(buf, "\x7F" "ELF", 4) == 0)) {
+          image_format = ELF_FILE;
+      } else if ((len >= 4) && (memcmp(buf, "DAPZ", 4) == 0)) {
+          image_format = LZ_FILE;
+      } else {
+          image_format = BIN_FILE;
+      }
+  }
+
+  if (image_format == BIN_FILE) {
+      flash_program(flash_addr_offset + sector * MBR_BYTES_PER_SECTOR + offset, buf, len);
+      return;
+  }
+
+  // the end of the last sector is not part of the file
+  offset += sector * MBR_BYTES_PER_SECTOR;
+  if ((size != 0) && ((offset + len) > size)) {
+      len = (offset < size) ? (size - offset) : 0;
+  }
+
+  if (image_format == ELF_FILE) {
+      elf_data(offset, buf, len);
+      return;
+  }
+
+  if (image_format == LZ_FILE) {
+      lz_decode(buf, len);
+      if (lz_state == LZ_ERROR) {
+          reason = BAD_COMPRESSED_FILE;
+          msc_state = MSC_ERROR;
+      }
+      return;
+  }
+
+  record_decode(buf, len);
+  if (record_state == RECORD_ERROR) {
+      reason = BAD_RECORD;
+      msc_state = MSC_ERROR;
+  }
+}
+
+// All sectors of the file received: HEX and SREC files may lack the end record
+static void image_check_end(void)
+{
+  if ((msc_state == MSC_RECEIVING) && (size != 0) && ((next_sector * MBR_BYTES_PER_SECTOR) >= size)) {
+      image_end();
+  }
+}
+
+// Reorder slot of a data sector
+static uint32_t reorder_slot(uint32_t block)
+{
+  return (block - SECTORS_FIRST_FILE_IDX) % FLASH_REORDER_PAGES;
+}
+
+// Queue the held back image sectors that follow next_sector without gap
+static void image_drain(void)
+{
+  uint32_t block, slot;
+
+  while ((next_sector < image_sectors) && (msc_state != MSC_ERROR)) {
+      block = image_sector + next_sector;
+      slot = reorder_slot(block);
+      if (reorder_sector[slot] != (block + 1)) {
+          break;
+      }
+      image_data(next_sector, 0, reorder_buffer[slot], FLASH_PROGRAM_PAGE_SIZE);
+      reorder_sector[slot] = 0;
+      next_sector++;
+  }
+  image_check_end();
+}
+
+// The directory entry of the image is known (begin_sector, nb_sector)
+static void image_found(void)
+{
+  if ((next_sector != 0) &&
+      ((begin_sector != image_sector) ||
+       (image_guessed && (image_format == BIN_FILE) && (flash_addr_offset != guess_offset)))) {
+      // programming started at another sector or address space (data written
+      // before the directory entry)
+      reason = BAD_START_SECTOR;
+      msc_state = MSC_ERROR;
+      return;
+  }
+  image_sector = begin_sector;
+  image_sectors = nb_sector;
+  image_known = 1;
+  image_drain();
+}
+
+// First sector of an image written before its directory entry
+//   HEX, SREC, ELF and DPZ files give the target addresses themselves. A binary
+//   needs a vector table, the initial SP in RAM and a Thumb reset vector, whose
+//   address space (flash or RAM) is the one of the image (*offset).
+//   return 0 if the sector does not start an image
+static uint8_t image_start_check(const uint8_t *buf, uint32_t *offset)
+{
+  uint32_t sp, pc;
+
+  *offset = 0;
+  if (((buf[0] == ':') && (hex_digit(buf[1]) >= 0)) ||
+      ((buf[0] == 'S') && (buf[1] >= '0') && (buf[1] <= '9')) ||
+      (memcmp(buf, "\x7F" "ELF", 4) == 0) ||
+      (memcmp(buf, "DAPZ", 4) == 0)) {
+      return 1;
+  }
+  sp = get32(&buf[0]);
+  pc = get32(&buf[4]);
+  if ((sp & 3) || (sp <= TARGET_RAM_START) || ((sp - TARGET_RAM_START) > TARGET_RAM_SIZE) || !(pc & 1)) {
+      return 0;
+  }
+  if ((pc - TARGET_FLASH_START) < TARGET_FLASH_SIZE) {
+      *offset = TARGET_FLASH_START;
+  } else if ((pc - TARGET_RAM_START) < TARGET_RAM_SIZE) {
+      *offset = TARGET_RAM_START;
+  } else {
+      return 0;
+  }
+  return 1;
+}
+
+// Data written before the directory entry fills the reorder slots: the image
+// starts with the lowest sector, held back or just written (block), that looks
+// like the start of an image, it is programmed from there. Held back sectors in
+// front of it are of other files (e.g. the "._" companions of macOS) and are
+// dropped. If there is none the image fails before anything is erased or
+// programmed: the sectors may be of another file or the image may not be meant
+// for the target flash.
+static void image_guess(uint32_t block, uint32_t offset, const uint8_t *buf, uint32_t len)
+{
+  uint32_t start, held, space, i;
+
+  start = 0xFFFFFFFF;
+  if ((offset == 0) && (len == MBR_BYTES_PER_SECTOR) && image_start_check(buf, &space)) {
+      start = block;
+      guess_offset = space;
+  }
+  for (i = 0; i < FLASH_REORDER_PAGES; i++) {
+      held = reorder_sector[i];
+      if ((held != 0) && ((held - 1) < start) && image_start_check(reorder_buffer[i], &space)) {
+          start = held - 1;
+          guess_offset = space;
+      }
+  }
+  if (start == 0xFFFFFFFF) {
+      reason = NOT_CONSECUTIVE_SECTORS;
+      msc_state = MSC_ERROR;
+      return;
+  }
+  flash_addr_offset = guess_offset;
+  image_sector = start;
+  image_sectors = MBR_NUM_NEEDED_SECTORS;
+  image_guessed = 1;
+  image_drain();
+}
+
+// Write part of a data sector
+//   Image sectors are programmed in image order. Sectors arriving ahead of next_sector
+//   are held back in the reorder slot of their data region offset and queued as soon
+//   as the gap is filled. Before the directory entry names the image every data sector
+//   is held back, the sectors of other files are dropped once it is known. (The MSC
+//   class writes whole sectors, a slot is not tracked per byte.)
+static void flash_write_sector(uint32_t block, uint32_t offset, const uint8_t *buf, uint32_t len)
+{
+  uint32_t slot, held;
+
+  if (image_known || image_guessed) {
+      // another file
+      if ((block < image_sector) || ((block - image_sector) >= image_sectors)) {
+          return;
+      }
+      // programmed before, can not be changed any more
+      if ((block - image_sector) < next_sector) {
+          reason = SECTOR_REWRITTEN;
+          msc_state = MSC_ERROR;
+          return;
+      }
+      if ((block - image_sector) == next_sector) {
+          image_data(next_sector, offset, buf, len);
+          if ((offset + len) == MBR_BYTES_PER_SECTOR) {
+              next_sector++;
+              image_drain();
+          }
+          return;
+      }
+  }
+
+  // hold back, a slot still held for another pending sector is in use
+  slot = reorder_slot(block);
+  held = reorder_sector[slot];
+  if ((held != 0) && (held != (block + 1)) &&
+      (!(image_known || image_guessed) ||
+       (((held - 1) >= (image_sector + next_sector)) && ((held - 1 - image_sector) < image_sectors)))) {
+      if (image_known || image_guessed) {
+          // more sectors out of order than can be held back
+          reason = NOT_CONSECUTIVE_SECTORS;
+          msc_state = MSC_ERROR;
+          return;
+      }
+      image_guess(block, offset, buf, len);
+      if (msc_state != MSC_ERROR) {
+          flash_write_sector(block, offset, buf, len);
+      }
+      return;
+  }
+  // a rewrite of a held back sector replaces it
+  reorder_sector[slot] = block + 1;
+  memcpy(&reorder_buffer[slot][offset], buf, len);
+}
+
+// Handle part of one written sector: the root directory is searched for the
+// image file, data sectors are handed to flash_write_sector
+static void msc_write_sector(uint32_t block, uint32_t offset, uint8_t *buf, uint32_t len)
+{
+  if ((block == SECTORS_ROOT_IDX) || (block == (SECTORS_ROOT_IDX+1))) {
+      if (search_bin_file(buf, block) != -1) {
+          // the data may have been written before the directory entry
+          image_found();
+      }
+
+  } else if (block >= SECTORS_FIRST_FILE_IDX) {
+      // (with FAT32 the root directory is in the data region as well)
+      flash_write_sector(block, offset, buf, len);
+  }
+}
+
+/********************************************************************************************************//**
+ * @brief     MSC_Flash_Writev : write data to memory
+ * @param[in] dev  : flash device
+ *            addr : flash address
+ *            wbuf : buffer for write
+ *            wlen : length for write
+ *            Called from the main loop, it programs pages when the page buffers are full.
+ * @return    None
+************************************************************************************************************/
+uint32_t MSC_Flash_Write(void *dev, uint32_t addr, uint8_t *rbuf, uint32_t rlen)
+{
+  uint32_t block = addr/512;
+  uint32_t offset = addr%512;
+  uint32_t n;
+
+  // a block group may hold FAT, root directory and data sectors at once
+  while (rlen) {
+      n = MBR_BYTES_PER_SECTOR - offset;
+      if (n > rlen) {
+          n = rlen;
+      }
+      msc_write_sector(block, offset, rbuf, n);
+      rbuf += n;
+      rlen -= n;
+      block++;
+      offset = 0;
+  }
+  return 0;
 }
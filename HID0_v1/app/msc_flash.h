@@ -0,0 +1,57 @@
+/* CMSIS-DAP Interface Firmware
+ * Copyright (c) 2009-2013 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef MSC_FLASH_H
+#define MSC_FLASH_H
+
+#include <stdint.h>
+
+// Drag-and-drop engine behind the MSC drive. The USB stack glue
+// (usbd_user_msc.c for RL-USB) forwards sector reads and writes and calls
+// MSC_Flash_Process to program the buffered pages, all from the main loop
+// (programming and target reads use the debug port, never from an
+// interrupt). It reconnects the drive when USB_DISConnect_Flag is set.
+
+typedef enum {
+    MSC_IDLE,       /* no image data received */
+    MSC_RECEIVING,  /* image data is queued and programmed */
+    MSC_DONE,       /* last page queued, disconnect when it is programmed */
+    MSC_ERROR,      /* bad file or programming error, disconnect */
+} MSC_STATE;
+
+// MSC_Flash_Read result
+#define MSC_READ_OK         (0)
+#define MSC_READ_BUSY       (1)     /* target used by a debugger or being programmed */
+#define MSC_READ_FAILED     (2)     /* target memory could not be read */
+
+// Storage backend, the pages of an image go to the backend covering their address
+typedef struct {
+    uint32_t start;                                             // first target address
+    uint32_t size;                                              // size in bytes
+    uint8_t (*init)(void);                                      // before the first page, 0 on error
+    uint8_t (*program)(uint32_t addr, uint8_t *buf, uint32_t size);  // one page, 0 on error
+    uint8_t (*finish)(void);                                    // after the last page, NULL if none
+} MSC_BACKEND;
+
+uint32_t MSC_Flash_Init(void *dev);
+uint32_t MSC_Flash_Read(void *dev, uint32_t addr, uint8_t *rbuf, uint32_t rlen);
+uint32_t MSC_Flash_Write(void *dev, uint32_t addr, uint8_t *rbuf, uint32_t rlen);
+void MSC_Flash_Process(void);
+MSC_STATE MSC_Flash_State(void);
+uint32_t MSC_Flash_SectorCount(void);
+
+extern uint8_t USB_DISConnect_Flag;
+
+#endif
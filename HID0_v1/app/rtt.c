@@ -0,0 +1,239 @@
+/* CMSIS-DAP Interface Firmware
+ * Copyright (c) 2009-2013 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <string.h>
+#include <RTL.h>
+#include <rl_usb.h>
+
+#include "swd_host.h"
+#include "rtt.h"
+
+// Real time transfer: the target writes into ring buffers of a SEGGER RTT
+// compatible control block in its RAM, the probe drains them with memory
+// accesses while the core keeps running. Up buffer 0 goes to the virtual COM
+// port, what the terminal sends goes to down buffer 0.
+//
+// Control block: char id[16] ("SEGGER RTT"), int up count, int down count,
+// then the up and the down buffer descriptors.
+// Buffer descriptor: name, buffer, size, write offset, read offset, flags.
+// The writer of a buffer owns the write offset, the reader the read offset.
+
+#define RTT_CB_ADDRESS          (0)             /* Control block address, 0 to scan for it */
+#define RTT_SCAN_START          (0x10000000)    /* Target RAM scanned for the control block */
+#define RTT_SCAN_SIZE           (32*1024)
+#define RTT_SCAN_CHUNK          (256)           /* Bytes scanned per rtt_process call */
+#define RTT_CHUNK               (256)           /* Bytes moved per rtt_process call and direction */
+#define RTT_BUFFERS_MAX         (16)            /* Sanity limit of the buffer counts */
+
+#define RTT_ID_SIZE             (16)
+#define RTT_DESC_SIZE           (24)
+#define RTT_DESC_BUFFER         (1)             /* Descriptor word index */
+#define RTT_DESC_SIZE_OF_BUFFER (2)
+#define RTT_DESC_WR_OFF         (3)
+#define RTT_DESC_RD_OFF         (4)
+
+static const uint8_t rtt_id[] = "SEGGER RTT";
+
+static uint32_t rtt_up_desc;                    /* up buffer 0 descriptor, 0 if not found */
+static uint32_t rtt_down_desc;                  /* down buffer 0 descriptor, 0 if none */
+static uint32_t rtt_scan;                       /* next address scanned */
+static uint8_t rtt_buf[RTT_SCAN_CHUNK + RTT_ID_SIZE];
+
+extern BOOL usbd_cdc_acm_console_open(void);
+
+// Check a control block candidate and take its buffer descriptors
+static uint8_t rtt_open(uint32_t cb) {
+    uint32_t head[(RTT_ID_SIZE + 8) / 4];
+
+    if (!swd_read_memory(cb, (uint8_t *)head, sizeof(head))) {
+        return 0;
+    }
+    if ((memcmp(head, rtt_id, sizeof(rtt_id)) != 0) ||
+        (head[4] == 0) || (head[4] > RTT_BUFFERS_MAX) || (head[5] > RTT_BUFFERS_MAX)) {
+        return 0;
+    }
+
+    rtt_up_desc = cb + RTT_ID_SIZE + 8;
+    rtt_down_desc = head[5] ? (rtt_up_desc + head[4] * RTT_DESC_SIZE) : 0;
+    return 1;
+}
+
+// Scan the next part of target RAM for the control block
+static void rtt_find(void) {
+    uint32_t n, i;
+
+    if (RTT_CB_ADDRESS != 0) {
+        rtt_open(RTT_CB_ADDRESS);
+        return;
+    }
+
+    // chunks overlap by the id size, so an id across their border is seen
+    n = RTT_SCAN_START + RTT_SCAN_SIZE - rtt_scan;
+    if (n > sizeof(rtt_buf)) {
+        n = sizeof(rtt_buf);
+    }
+    if (swd_read_memory(rtt_scan, rtt_buf, n)) {
+        for (i = 0; (i + sizeof(rtt_id)) <= n; i += 4) {
+            if ((memcmp(&rtt_buf[i], rtt_id, sizeof(rtt_id)) == 0) && rtt_open(rtt_scan + i)) {
+                return;
+            }
+        }
+    }
+
+    rtt_scan += RTT_SCAN_CHUNK;
+    if (rtt_scan >= (RTT_SCAN_START + RTT_SCAN_SIZE)) {
+        rtt_scan = RTT_SCAN_START;
+    }
+}
+
+// Read a buffer descriptor, 0 if it is not valid
+static uint8_t rtt_read_desc(uint32_t desc, uint32_t *val) {
+    if (!swd_read_memory(desc, (uint8_t *)val, RTT_DESC_SIZE)) {
+        return 0;
+    }
+    return (val[RTT_DESC_SIZE_OF_BUFFER] != 0) &&
+           (val[RTT_DESC_WR_OFF] < val[RTT_DESC_SIZE_OF_BUFFER]) &&
+           (val[RTT_DESC_RD_OFF] < val[RTT_DESC_SIZE_OF_BUFFER]);
+}
+
+// Target to host: up buffer 0 to the virtual COM port
+//   return number of bytes moved, -1 if the control block is gone
+static int32_t rtt_up(void) {
+    uint32_t desc[RTT_DESC_SIZE / 4];
+    uint32_t rd, n;
+    int32_t room;
+
+    if (!rtt_read_desc(rtt_up_desc, desc)) {
+        return -1;
+    }
+
+    // contiguous data up to the write offset or the end of the buffer
+    rd = desc[RTT_DESC_RD_OFF];
+    if (desc[RTT_DESC_WR_OFF] >= rd) {
+        n = desc[RTT_DESC_WR_OFF] - rd;
+    } else {
+        n = desc[RTT_DESC_SIZE_OF_BUFFER] - rd;
+    }
+    if (n > RTT_CHUNK) {
+        n = RTT_CHUNK;
+    }
+    room = USBD_CDC_ACM_DataFree();
+    if ((int32_t)n > room) {
+        n = room;
+    }
+    if (n == 0) {
+        return 0;
+    }
+
+    if (!swd_read_memory(desc[RTT_DESC_BUFFER] + rd, rtt_buf, n)) {
+        return -1;
+    }
+    n = USBD_CDC_ACM_DataSend(rtt_buf, n);
+
+    rd += n;
+    if (rd == desc[RTT_DESC_SIZE_OF_BUFFER]) {
+        rd = 0;
+    }
+    if (!swd_write_memory(rtt_up_desc + RTT_DESC_RD_OFF * 4, (uint8_t *)&rd, 4)) {
+        return -1;
+    }
+    return n;
+}
+
+// Host to target: virtual COM port to down buffer 0
+//   return number of bytes moved, -1 if the control block is gone
+static int32_t rtt_down(void) {
+    uint32_t desc[RTT_DESC_SIZE / 4];
+    uint32_t wr, n;
+
+    if ((rtt_down_desc == 0) || (USBD_CDC_ACM_DataAvailable() == 0)) {
+        return 0;
+    }
+    if (!rtt_read_desc(rtt_down_desc, desc)) {
+        return -1;
+    }
+
+    // contiguous space up to the read offset or the end of the buffer,
+    // one byte stays free so a full buffer is told from an empty one
+    wr = desc[RTT_DESC_WR_OFF];
+    if (desc[RTT_DESC_RD_OFF] > wr) {
+        n = desc[RTT_DESC_RD_OFF] - wr - 1;
+    } else {
+        n = desc[RTT_DESC_SIZE_OF_BUFFER] - wr - ((desc[RTT_DESC_RD_OFF] == 0) ? 1 : 0);
+    }
+    if (n > RTT_CHUNK) {
+        n = RTT_CHUNK;
+    }
+    if (n == 0) {
+        return 0;
+    }
+
+    n = USBD_CDC_ACM_DataRead(rtt_buf, n);
+    if (!swd_write_memory(desc[RTT_DESC_BUFFER] + wr, rtt_buf, n)) {
+        return -1;
+    }
+
+    wr += n;
+    if (wr == desc[RTT_DESC_SIZE_OF_BUFFER]) {
+        wr = 0;
+    }
+    if (!swd_write_memory(rtt_down_desc + RTT_DESC_WR_OFF * 4, (uint8_t *)&wr, 4)) {
+        return -1;
+    }
+    return n;
+}
+
+// Forget the control block, it is looked for again
+void rtt_init(void) {
+    rtt_up_desc = 0;
+    rtt_down_desc = 0;
+    rtt_scan = RTT_SCAN_START;
+}
+
+// Move data between the RTT buffers and the virtual COM port
+//   Called periodically while the target runs, the core is not halted.
+//   Data is left in the target while no terminal is connected or the port
+//   is bridged to the target UART (see CONSOLE_BAUDRATE).
+//   return number of bytes moved
+uint32_t rtt_process(void) {
+    int32_t up, down;
+
+    if (!usbd_cdc_acm_console_open()) {
+        return 0;
+    }
+
+    // a debugger may use SELECT/CSW/TAR across its commands
+    if (!swd_save_state()) {
+        return 0;
+    }
+
+    up = 0;
+    down = 0;
+    if (rtt_up_desc == 0) {
+        rtt_find();
+    } else {
+        up = rtt_up();
+        down = (up < 0) ? -1 : rtt_down();
+        if ((up < 0) || (down < 0)) {
+            // the target was reset or reprogrammed
+            rtt_init();
+            up = 0;
+            down = 0;
+        }
+    }
+
+    swd_restore_state();
+    return up + down;
+}
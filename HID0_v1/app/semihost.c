@@ -13,33 +13,79 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
-#ifdef SEMIHOST
-
-
 #include <string.h>
+#include <RTL.h>
+#include <rl_usb.h>
 
-#include "tasks.h"
-#include "main.h"
-
+#include "DAP_config.h"
+#include "DAP.h"
 #include "target_reset.h"
-#include "version.h"
 #include "swd_host.h"
 #include "semihost.h"
+#include "rtt.h"
+
+#if (SEMIHOST != 0)
+
+#define SYS_OPEN                        (0x01)
+#define SYS_CLOSE                       (0x02)
+#define SYS_WRITEC                      (0x03)
+#define SYS_WRITE0                      (0x04)
+#define SYS_WRITE                       (0x05)
+#define SYS_READ                        (0x06)
+#define SYS_READC                       (0x07)
+#define SYS_ISERROR                     (0x08)
+#define SYS_ISTTY                       (0x09)
+#define SYS_FLEN                        (0x0C)
+#define SYS_ERRNO                       (0x13)
 
 #define RESERVED_FOR_USER_APPLICATIONS  (0x100) /* 0x100 - 0x1ff */
-#define USR_UID                         (RESERVED_FOR_USER_APPLICATIONS + 1)
 #define USR_RESET                       (RESERVED_FOR_USER_APPLICATIONS + 2)
-#define USR_POWERDOWN                   (RESERVED_FOR_USER_APPLICATIONS + 4)
-#define USR_DISABLEDEBUG                (RESERVED_FOR_USER_APPLICATIONS + 5)
 #define angel_SWIreason_ReportException (0x18)
 
-#define FLAGS_SH_START                  (1)
-#define FLAGS_SH_STOP                   (2)
+/* Poll interval in ms: none after a semihost call, doubled up to the
+   maximum while the target is quiet, the maximum after DAP requests */
+#define SH_DELAY_MAX                    (16)
+#define SH_ATTACH_DELAY                 (256)   /* Retry interval to enable debug in the target */
+
+/* AP of the core whose semihost calls and RTT buffers are serviced */
+#define SH_AP                           (0)
+
+/* Console handles returned by SYS_OPEN of ":tt" (there is no file system) */
+#define SH_HANDLE_STDIN                 (1)
+#define SH_HANDLE_STDOUT                (2)
+#define SH_HANDLE_STDERR                (3)
+
+#define SH_ENOENT                       (2)
+#define SH_EBADF                        (9)
+
+#define SH_BUF_SIZE                     (64)    /* Bytes moved per SWD block access, power of 2 */
+#define SH_NAME_MAX                     (16)    /* Longest file name read from the target */
+
+extern BOOL usbd_cdc_acm_console_open(void);
 
-static OS_TID semihostTask;
-static OS_SEM semihostStoppedSem;
 static uint8_t semihostEnabled;
+static uint8_t shAttached;                      /* Debug enabled in the target by us */
+static uint32_t shPollStart;                    /* DWT cycle count of the last poll */
+static uint32_t shDelay;                        /* Time to the next poll in ms */
 static uint32_t r0, r1;
+static volatile uint32_t shDapRequests;
+static uint32_t shDapSeen;
+static uint32_t shErrno;
+static uint32_t shCall, shCallArg;              /* Pending call: R0 and R1 */
+static uint32_t shDone;                         /* Bytes of the pending call sent to the console */
+static uint8_t shBuf[SH_BUF_SIZE];
+
+// Time the next poll with the DWT cycle counter of the probe
+static void shPollAfter(uint32_t ms) {
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL        |= DWT_CTRL_CYCCNTENA_Msk;
+    shPollStart = DWT->CYCCNT;
+    shDelay = ms;
+}
+
+static int shPollDue(void) {
+    return (DWT->CYCCNT - shPollStart) >= (shDelay * (CPU_CLOCK / 1000));
+}
 
 static int shReadWord(uint32_t address, uint32_t *ptr) {
     return swd_read_memory(address, (uint8_t *)ptr, sizeof(uint32_t));
@@ -49,46 +95,197 @@ static int shWriteBytes(uint32_t address, uint8_t *ptr, uint32_t count) {
     return swd_write_memory(address, ptr, count);
 }
 
-static int sh_usr_uid(uint32_t *r0, uint32_t r1) {
-    uint32_t p1, p2;
-    uint32_t uidSize;
-    uint32_t i;
-    uint8_t null = '\0';
-    uint8_t * id_str;
+// Nothing here waits for the console: a call that can not be completed yet
+// fails, the core stays halted on it and it is taken up again on a later poll.
+
+// Check that the virtual COM port takes count bytes of console output
+//   Output is dropped while no terminal is connected.
+static int shConsoleReady(uint32_t count) {
+    if (!usbd_cdc_acm_console_open())
+        return 1;
+    return (USBD_CDC_ACM_DataFree() >= (int32_t)count);
+}
+
+// Send console output to the virtual COM port, see shConsoleReady
+static void shConsoleWrite(uint8_t *buf, uint32_t count) {
+    if (usbd_cdc_acm_console_open()) {
+        USBD_CDC_ACM_DataSend(buf, count);
+    }
+}
 
-    // Read parameter block
-    if (!shReadWord(r1, &p1))
+// Receive console input from the virtual COM port
+//   return number of bytes read, 0 if the terminal has sent nothing yet
+static uint32_t shConsoleRead(uint8_t *buf, uint32_t count) {
+    if (!usbd_cdc_acm_console_open())
         return 0;
+    return USBD_CDC_ACM_DataRead(buf, count);
+}
 
-    if (!shReadWord(r1+4, &p2))
+// Copy target memory to the console
+//   The target buffer is read with block accesses of up to SH_BUF_SIZE bytes.
+//   shDone keeps the bytes already sent when the call has to be retried.
+static int shWriteFromTarget(uint32_t address, uint32_t count) {
+    uint32_t n;
+
+    while (shDone < count) {
+        n = count - shDone;
+        if (n > SH_BUF_SIZE)
+            n = SH_BUF_SIZE;
+        if (!shConsoleReady(n))
+            return 0;
+        if (!swd_read_memory(address + shDone, shBuf, n))
+            return 0;
+        shConsoleWrite(shBuf, n);
+        shDone += n;
+    }
+    return 1;
+}
+
+static int sh_open(uint32_t *r0, uint32_t r1) {
+    uint32_t name, mode, len;
+
+    // Parameter block: name, mode, name length
+    if (!shReadWord(r1, &name)) return 0;
+    if (!shReadWord(r1+4, &mode)) return 0;
+    if (!shReadWord(r1+8, &len)) return 0;
+
+    if (len >= SH_NAME_MAX) {
+        shErrno = SH_ENOENT;
+        return 1;
+    }
+    if (!swd_read_memory(name, shBuf, len + 1))
         return 0;
 
-    id_str = get_uid_string();
-    uidSize = strlen((const char *)id_str) - 4;
+    // Only the console is there: ":tt" opened for reading, writing or appending
+    if ((len != 3) || (memcmp(shBuf, ":tt", 3) != 0)) {
+        shErrno = SH_ENOENT;
+        return 1;
+    }
+    if (mode < 4) {
+        *r0 = SH_HANDLE_STDIN;
+    } else if (mode < 8) {
+        *r0 = SH_HANDLE_STDOUT;
+    } else {
+        *r0 = SH_HANDLE_STDERR;
+    }
+    return 1;
+}
+
+static int sh_close(uint32_t *r0, uint32_t r1) {
+    uint32_t handle;
+
+    if (!shReadWord(r1, &handle)) return 0;
+
+    if ((handle < SH_HANDLE_STDIN) || (handle > SH_HANDLE_STDERR)) {
+        shErrno = SH_EBADF;
+        return 1;
+    }
+    *r0 = 0;
+    return 1;
+}
+
+static int sh_writec(uint32_t *r0, uint32_t r1) {
+    // R1 points to the character, R0 is not changed
+    *r0 = SYS_WRITEC;
+    return shWriteFromTarget(r1, 1);
+}
 
-    // Validate parameters
-    if (p1 == NULL) return 1;
-    if (p2 != (uidSize+1)) return 1; // +1 for null string terminator
+static int sh_write0(uint32_t *r0, uint32_t r1) {
+    uint8_t *end;
+    uint32_t n;
 
-    // skip " $ $ $ length"
-    id_str += 4;
+    // R1 points to a null terminated string, R0 is not changed
+    *r0 = SYS_WRITE0;
 
-    // Write data to target
-    for (i = 0; i < uidSize; i++) {
-        if (!shWriteBytes(p1++, id_str, 1))
+    // Read up to the end of an SH_BUF_SIZE block, so reads do not
+    // go further past the terminator than the block holding it
+    while (1) {
+        n = SH_BUF_SIZE - ((r1 + shDone) & (SH_BUF_SIZE - 1));
+        if (!shConsoleReady(n))
             return 0;
-        id_str++;
+        if (!swd_read_memory(r1 + shDone, shBuf, n))
+            return 0;
+        end = memchr(shBuf, '\0', n);
+        if (end != NULL) {
+            shConsoleWrite(shBuf, end - shBuf);
+            return 1;
+        }
+        shConsoleWrite(shBuf, n);
+        shDone += n;
+    }
+}
+
+static int sh_write(uint32_t *r0, uint32_t r1) {
+    uint32_t handle, buf, count;
+
+    // Parameter block: handle, buffer, length
+    if (!shReadWord(r1, &handle)) return 0;
+    if (!shReadWord(r1+4, &buf)) return 0;
+    if (!shReadWord(r1+8, &count)) return 0;
+
+    if ((handle != SH_HANDLE_STDOUT) && (handle != SH_HANDLE_STDERR)) {
+        shErrno = SH_EBADF;
+        *r0 = count;
+        return 1;
+    }
+    if (!shWriteFromTarget(buf, count))
+        return 0;
+
+    // Number of bytes not written
+    *r0 = 0;
+    return 1;
+}
+
+static int sh_read(uint32_t *r0, uint32_t r1) {
+    uint32_t handle, buf, count, n;
+
+    // Parameter block: handle, buffer, length
+    if (!shReadWord(r1, &handle)) return 0;
+    if (!shReadWord(r1+4, &buf)) return 0;
+    if (!shReadWord(r1+8, &count)) return 0;
+
+    if (handle != SH_HANDLE_STDIN) {
+        shErrno = SH_EBADF;
+        *r0 = count;
+        return 1;
     }
-    // Write null terminator to target
-    if (!shWriteBytes(p1, &null, 1))
+    if (count == 0) {
+        *r0 = 0;
+        return 1;
+    }
+
+    // Return what the terminal has sent so far, at least one byte
+    n = shConsoleRead(shBuf, (count > SH_BUF_SIZE) ? SH_BUF_SIZE : count);
+    if (n == 0)
         return 0;
+    if (!shWriteBytes(buf, shBuf, n))
+        return 0;
+
+    // Number of bytes not read
+    *r0 = count - n;
+    return 1;
+}
+
+static int sh_readc(uint32_t *r0, uint32_t r1) {
+    if (shConsoleRead(shBuf, 1) == 0)
+        return 0;
+
+    *r0 = shBuf[0];
+    return 1;
+}
 
-    *r0 = 0; // Successful
+static int sh_istty(uint32_t *r0, uint32_t r1) {
+    uint32_t handle;
+
+    if (!shReadWord(r1, &handle)) return 0;
+
+    *r0 = ((handle >= SH_HANDLE_STDIN) && (handle <= SH_HANDLE_STDERR)) ? 1 : 0;
     return 1;
 }
 
 static int sh_usr_reset(uint32_t *r0, uint32_t r1) {
-    main_reset_target(0);
+    // Debug stays enabled, so semihost calls still halt the core after reset
+    target_set_state(RESET_RUN_WITH_DEBUG);
 
     // Don't restart target as the target will be resetted
     return 0;
@@ -106,22 +303,6 @@ static int sh_report_exception(uint32_t *r0, uint32_t r1) {
 }
 
 
-static int sh_usr_powerdown(uint32_t *r0, uint32_t r1) {
-    main_powerdown_event();
-
-    // successful
-    *r0 = 0;
-    return 1;
-}
-
-static int sh_usr_disabledebug(uint32_t *r0, uint32_t r1) {
-    main_disable_debug_event();
-
-    // successful
-    *r0 = 0;
-    return 1;
-}
-
 static int process_event(void) {
     // Returns TRUE if successful, FALSE if an error occurs
     uint32_t svc;
@@ -132,17 +313,44 @@ static int process_event(void) {
     r0 = 0xffffffff;
 
     switch(svc) {
-        case USR_UID:
-            if (!sh_usr_uid(&r0,r1)) return 0;
+        case SYS_OPEN:
+            if (!sh_open(&r0,r1)) return 0;
             break;
-        case USR_RESET:
-            if (!sh_usr_reset(&r0,r1)) return 0;
+        case SYS_CLOSE:
+            if (!sh_close(&r0,r1)) return 0;
+            break;
+        case SYS_WRITEC:
+            if (!sh_writec(&r0,r1)) return 0;
+            break;
+        case SYS_WRITE0:
+            if (!sh_write0(&r0,r1)) return 0;
+            break;
+        case SYS_WRITE:
+            if (!sh_write(&r0,r1)) return 0;
+            break;
+        case SYS_READ:
+            if (!sh_read(&r0,r1)) return 0;
+            break;
+        case SYS_READC:
+            if (!sh_readc(&r0,r1)) return 0;
+            break;
+        case SYS_ISERROR:
+            // R1 points to the status word, negative values are errors
+            if (!shReadWord(r1, &r0)) return 0;
+            r0 = ((int32_t)r0 < 0) ? 1 : 0;
             break;
-        case USR_POWERDOWN:
-            if (!sh_usr_powerdown(&r0,r1)) return 0;
+        case SYS_ISTTY:
+            if (!sh_istty(&r0,r1)) return 0;
             break;
-        case USR_DISABLEDEBUG:
-            if (!sh_usr_disabledebug(&r0,r1)) return 0;
+        case SYS_FLEN:
+            // the console has no length
+            shErrno = SH_EBADF;
+            break;
+        case SYS_ERRNO:
+            r0 = shErrno;
+            break;
+        case USR_RESET:
+            if (!sh_usr_reset(&r0,r1)) return 0;
             break;
         case angel_SWIreason_ReportException:
             if (!sh_report_exception(&r0,r1)) return 0;
@@ -154,52 +362,97 @@ static int process_event(void) {
     return 1;
 }
 
-static void sh_main(void) {
-    while(1) {
-        // Wait for start flag
-        os_evt_wait_or(FLAGS_SH_START, NO_TIMEOUT);
+// Service semihost calls and the RTT buffers of the target
+//   Called from the main loop. Only DHCSR is read while the core runs, a call
+//   that is not complete leaves the core halted and is retried on the next call.
+void Semihost_Process(void) {
+    if (!semihostEnabled) return;
+
+    if (!shPollDue()) return;
 
-        do {
-            if (swd_is_semihost_event(&r0, &r1)) {
-                if (process_event()) {
-                    swd_semihost_restart(r0);
-                }
+    // Keep off the SWD port while a debugger is busy with it
+    if (shDapSeen != shDapRequests) {
+        shDapSeen = shDapRequests;
+        shPollAfter(SH_DELAY_MAX);
+        return;
+    }
+
+    if (DAP_Data.debug_port == DAP_PORT_DISABLED) {
+        // the target may be connected or powered later
+        if (!shAttached) {
+            if (!target_set_state(DEBUG)) {
+                shPollAfter(SH_ATTACH_DELAY);
+                return;
+            }
+            shAttached = 1;
+            rtt_init();
+        }
+
+        // the MSC drive may have used the SWD port for a different core
+        swd_select_session(SH_AP);
+        if (swd_is_semihost_event(&r0, &r1)) {
+            // a pending call is dropped when the target is reset
+            if ((r0 != shCall) || (r1 != shCallArg)) {
+                shCall = r0;
+                shCallArg = r1;
+                shDone = 0;
+            }
+            if (process_event()) {
+                swd_semihost_restart(r0);
+                shDone = 0;
+                // More calls are likely to follow
+                shPollAfter(0);
             } else {
-                // Wait for 2 scheduler tick; the serial task may run at this point
-                    os_dly_wait(2);
+                // Waiting for the console
+                shPollAfter(1);
             }
-        // Loop until stop flag is set
-        } while (os_evt_wait_or(FLAGS_SH_STOP, 0 )==OS_R_TMO);
+            return;
+        }
+    } else {
+        // A debugger owns the port from DAP_Connect to DAP_Disconnect: its
+        // halts are left alone and debug is enabled again once it has left.
+        // RTT goes on between its commands.
+        shAttached = 0;
+        if (DAP_Data.debug_port != DAP_PORT_SWD) {
+            shPollAfter(SH_DELAY_MAX);
+            return;
+        }
+        swd_select_session(SH_AP);
+    }
 
-        // Stopped
-        os_sem_send(semihostStoppedSem);
+    if (rtt_process() != 0) {
+        // The target is logging, keep draining its buffers
+        shPollAfter(0);
+    } else if (shDelay == 0) {
+        shPollAfter(1);
+    } else if (shDelay < SH_DELAY_MAX) {
+        shPollAfter(shDelay * 2);
+    } else {
+        shPollAfter(SH_DELAY_MAX);
     }
 }
 
 void semihost_init(void) {
-    // Called from main task
+    // Called from main when the interface firmware starts
 
     semihostEnabled = 0;
-    os_sem_init(semihostStoppedSem,0);
-
-    // Create semihost task
-    semihostTask = os_tsk_create(sh_main, SEMIHOST_TASK_PRIORITY);
+    shAttached = 0;
+    shDapSeen = shDapRequests;
+    shPollAfter(0);
     return;
 }
 
 void semihost_enable(void) {
     // Called from:
-    //   - main task when the interface firmware starts
-    //   - cmsis-dap when a debugger closes the swd port
+    //   - main when the interface firmware starts
     //   - drag n drop when a binary has been flashed
 
     if (semihostEnabled) return;
-    if (semihostTask==0) return;
-
-    // enable debug
-    target_set_state(DEBUG);
 
-    os_evt_set(FLAGS_SH_START, semihostTask);
+    // enable debug on the next poll
+    shAttached = 0;
+    shDone = 0;
+    shPollAfter(0);
 
     semihostEnabled = 1;
 
@@ -207,24 +460,22 @@ void semihost_enable(void) {
 }
 
 void semihost_disable(void) {
-    // Called from:
-    //   - main task when the the interface receives the POWERDOWN semihost call
-    //   - cmsis-dap when a debugger opens the swd port
-    //   - drag n drop when a binary will be flashed
-
-    if (!semihostEnabled) return;
-    if (semihostTask==0) return;
+    // Called from drag n drop when a binary will be flashed
+    //   Semihost_Process runs in the same loop, so it is not in the middle
+    //   of a call here.
 
-    os_evt_set(FLAGS_SH_STOP, semihostTask);
-
-    // Wait for semihost task to stop
-    os_sem_wait(semihostStoppedSem, NO_TIMEOUT);
     semihostEnabled = 0;
     return;
 }
 
-#else /* #ifndef SEMIHOST */
+void semihost_dap_request(void) {
+    // Called from the USB interrupt when a CMSIS-DAP request arrives
+    shDapRequests++;
+}
+
+#else /* (SEMIHOST == 0) */
 void semihost_init(void) { }
 void semihost_enable(void) { }
 void semihost_disable(void){ }
+void semihost_dap_request(void) { }
 #endif
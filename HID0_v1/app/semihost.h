@@ -19,5 +19,7 @@
 void semihost_init(void);
 void semihost_enable(void);
 void semihost_disable(void);
+void semihost_dap_request(void);
+void Semihost_Process(void);
 
 #endif
@@ -41,8 +41,14 @@
 #define DHCSR 0xE000EDF0
 #define REGWnR (1 << 16)
 
-#define MAX_SWD_RETRY 10
 #define MAX_TIMEOUT   10000  // Timeout for syscalls on target
+#define HALT_POLLS    8      // DHCSR reads per semihost event check
+#define BKPT_SEMIHOST 0xBEAB // BKPT 0xAB
+#define AP_SESSIONS   4      // MEM-APs with a debug session, AP 0 .. AP_SESSIONS-1
+#define POWERUP_TIMEOUT 100  // Debug and system power-up acknowledge timeout in ms
+#define HALT_TIMEOUT  500    // Core halt timeout after a halt request or reset in ms
+
+#define AP_UNKNOWN    0xffffffff  // cached AP register value not known
 
 // Some targets require a soft reset for flash programming (RESET_PROGRAM).
 // Otherwise a hardware reset is the default. This will not affect
@@ -67,15 +73,29 @@
 
 typedef struct {
     uint32_t select;
-    uint32_t csw;
 } DAP_STATE;
 
+// Debug session of the core behind a MEM-AP: the AP registers written last
+// are cached per AP, so switching between cores costs one SELECT write and
+// no CSW or TAR rewrites.
+typedef struct {
+    uint32_t csw;
+    uint32_t tar;
+} SWD_SESSION;
+
 typedef struct {
     uint32_t r[16];
     uint32_t xpsr;
 } DEBUG_STATE;
 
 static DAP_STATE dap_state;
+static DAP_STATE host_state;                     // SELECT of the host, saved by swd_save_state
+static SWD_SESSION host_session;                 // CSW and TAR of its AP
+static uint8_t host_session_saved;
+static SWD_SESSION swd_sessions[AP_SESSIONS];
+static SWD_SESSION *session = &swd_sessions[0];  // session used for memory accesses
+static uint32_t session_apsel = 0;               // its AP in DP SELECT format
+static uint32_t link_idcode = 0;                 // IDCODE of the target connected last, 0 = none
 
 static uint8_t swd_read_core_register(uint32_t n, uint32_t *val);
 static uint8_t swd_write_core_register(uint32_t n, uint32_t val);
@@ -88,15 +108,8 @@ static void int2array(uint8_t * res, uint32_t data, uint8_t len) {
 }
 
 static uint8_t swd_transfer_retry(uint32_t req, uint32_t * data) {
-    uint8_t i, ack;
-    for (i = 0; i < MAX_SWD_RETRY; i++) {
-        ack = SWD_Transfer(req, data);
-        // if ack != WAIT
-        if (ack != 0x02) {
-            return ack;
-        }
-    }
-    return ack;
+    // WAIT handling is shared with the CMSIS-DAP commands
+    return SWD_TransferRetry(req, data);
 }
 
 
@@ -106,6 +119,28 @@ uint8_t swd_init(void) {
     return 1;
 }
 
+// Session of an AP, NULL if the AP has none
+static SWD_SESSION *swd_ap_session(uint32_t apsel) {
+    apsel >>= 24;
+    return (apsel < AP_SESSIONS) ? &swd_sessions[apsel] : NULL;
+}
+
+// Use the core behind AP ap for the memory and core register accesses.
+// Nothing is sent to the target, SELECT follows with the next AP access.
+uint8_t swd_select_session(uint8_t ap) {
+    if (ap >= AP_SESSIONS) {
+        return 0;
+    }
+    session = &swd_sessions[ap];
+    session_apsel = (uint32_t)ap << 24;
+    return 1;
+}
+
+// AP of the current session
+uint8_t swd_get_session(void) {
+    return (uint8_t)(session_apsel >> 24);
+}
+
 // Read debug port register.
 uint8_t swd_read_dp(uint8_t adr, uint32_t *val) {
     uint32_t tmp_in;
@@ -151,11 +186,17 @@ uint8_t swd_read_ap(uint32_t adr, uint32_t *val) {
 
     uint32_t apsel = adr & 0xff000000;
     uint32_t bank_sel = adr & APBANKSEL;
+    SWD_SESSION *s;
 
     if (!swd_write_dp(DP_SELECT, apsel | bank_sel)) {
         return 0;
     }
 
+    s = swd_ap_session(apsel);
+    if ((s != NULL) && ((adr & ~APSEL) == AP_DRW)) {
+        s->tar = AP_UNKNOWN;    // TAR may move on
+    }
+
     tmp_in = SWD_REG_AP | SWD_REG_R | SWD_REG_ADR(adr);
 
     // first dummy read
@@ -173,19 +214,35 @@ uint8_t swd_write_ap(uint32_t adr, uint32_t val) {
     uint8_t req, ack;
     uint32_t apsel = adr & 0xff000000;
     uint32_t bank_sel = adr & APBANKSEL;
+    uint32_t *cache = NULL;
+    SWD_SESSION *s;
 
     if (!swd_write_dp(DP_SELECT, apsel | bank_sel)) {
         return 0;
     }
 
-    switch(adr) {
-        case AP_CSW:
-            if (dap_state.csw == val)
-                return 1;
-            dap_state.csw = val;
-            break;
-        default:
-            break;
+    s = swd_ap_session(apsel);
+    if (s != NULL) {
+        switch(adr & ~APSEL) {
+            case AP_CSW:
+                if (s->csw == val)
+                    return 1;
+                cache = &s->csw;
+                break;
+            case AP_TAR:
+                cache = &s->tar;
+                break;
+            case AP_DRW:
+                s->tar = AP_UNKNOWN;    // TAR may move on
+                break;
+            default:
+                break;
+        }
+    }
+
+    // only a completed write is cached
+    if (cache != NULL) {
+        *cache = AP_UNKNOWN;
     }
 
     req = SWD_REG_AP | SWD_REG_W | SWD_REG_ADR(adr);
@@ -198,14 +255,49 @@ uint8_t swd_write_ap(uint32_t adr, uint32_t val) {
     req = SWD_REG_DP | SWD_REG_R | SWD_REG_ADR(DP_RDBUFF);
     ack = swd_transfer_retry(req, NULL);
 
+    if ((ack == 0x01) && (cache != NULL)) {
+        *cache = val;
+    }
+
     return (ack == 0x01);
 }
 
+// Set TAR of the current session to address before DRW accesses.
+// TAR is only written if the AP does not hold the address already, it is
+// unknown until swd_drw_done accounts for the accesses.
+static uint8_t swd_drw_start(uint32_t address) {
+    uint8_t tmp_in[4], req;
+
+    if (session->tar != address) {
+        session->tar = AP_UNKNOWN;
+        req = SWD_REG_AP | SWD_REG_W | SWD_REG_ADR(AP_TAR);
+        int2array(tmp_in, address, 4);
+        if (swd_transfer_retry(req, (uint32_t *)tmp_in) != 0x01) {
+            return 0;
+        }
+    }
+    session->tar = AP_UNKNOWN;
+    return 1;
+}
+
+// Record TAR after count DRW accesses starting at address completed.
+// Auto-increment is only defined within 1KB, TAR is unknown past it.
+static void swd_drw_done(uint32_t address, uint32_t count) {
+    uint32_t next;
+
+    if ((session->csw & CSW_ADDRINC) == CSW_NADDRINC) {
+        session->tar = address;
+        return;
+    }
+    next = address + (count << (session->csw & CSW_SIZE));
+    session->tar = ((next ^ address) & ~0x3FF) ? AP_UNKNOWN : next;
+}
+
 
 // Write 32-bit word aligned values to target memory using address auto-increment.
 // size is in bytes.
 static uint8_t swd_write_block(uint32_t address, uint8_t *data, uint32_t size) {
-    uint8_t tmp_in[4], req;
+    uint8_t req;
     uint32_t size_in_words;
     uint32_t i, ack;
 
@@ -214,14 +306,11 @@ static uint8_t swd_write_block(uint32_t address, uint8_t *data, uint32_t size) {
 
     size_in_words = size/4;
 
-    if (!swd_write_ap(AP_CSW, CSW_VALUE | CSW_SIZE32)) {
+    if (!swd_write_ap(session_apsel | AP_CSW, CSW_VALUE | CSW_SIZE32)) {
         return 0;
     }
 
-    // TAR write
-    req = SWD_REG_AP | SWD_REG_W | (1 << 2);
-    int2array(tmp_in, address, 4);
-    if (swd_transfer_retry(req, (uint32_t *)tmp_in) != 0x01) {
+    if (!swd_drw_start(address)) {
         return 0;
     }
 
@@ -237,14 +326,18 @@ static uint8_t swd_write_block(uint32_t address, uint8_t *data, uint32_t size) {
     // dummy read
     req = SWD_REG_DP | SWD_REG_R | SWD_REG_ADR(DP_RDBUFF);
     ack = swd_transfer_retry(req, NULL);
+    if (ack != 0x01) {
+        return 0;
+    }
 
-    return (ack == 0x01);
+    swd_drw_done(address, size_in_words);
+    return 1;
 }
 
 // Read 32-bit word aligned values from target memory using address auto-increment.
 // size is in bytes.
 static uint8_t swd_read_block(uint32_t address, uint8_t *data, uint32_t size) {
-    uint8_t tmp_in[4], req, ack;
+    uint8_t req, ack;
     uint32_t size_in_words;
     uint32_t i;
 
@@ -254,14 +347,11 @@ static uint8_t swd_read_block(uint32_t address, uint8_t *data, uint32_t size) {
 
     size_in_words = size/4;
 
-    if (!swd_write_ap(AP_CSW, CSW_VALUE | CSW_SIZE32)) {
+    if (!swd_write_ap(session_apsel | AP_CSW, CSW_VALUE | CSW_SIZE32)) {
         return 0;
     }
 
-    // TAR write
-    req = SWD_REG_AP | SWD_REG_W | (1 << 2);
-    int2array(tmp_in, address, 4);
-    if (swd_transfer_retry(req, (uint32_t *)tmp_in) != 0x01) {
+    if (!swd_drw_start(address)) {
         return 0;
     }
 
@@ -282,20 +372,22 @@ static uint8_t swd_read_block(uint32_t address, uint8_t *data, uint32_t size) {
     // dummy read
     req = SWD_REG_DP | SWD_REG_R | SWD_REG_ADR(DP_RDBUFF);
     ack = swd_transfer_retry(req, NULL);
+    if (ack != 0x01) {
+        return 0;
+    }
 
-    return (ack == 0x01);
+    // the posted reads ran one word ahead
+    swd_drw_done(address, size_in_words + 1);
+    return 1;
 }
 
 // Read target memory.
 static uint8_t swd_read_data(uint32_t addr, uint32_t *val) {
-    uint8_t tmp_in[4];
     uint8_t tmp_out[4];
     uint8_t req, ack;
 
     // put addr in TAR register
-    int2array(tmp_in, addr, 4);
-    req = SWD_REG_AP | SWD_REG_W | (1 << 2);
-    if (swd_transfer_retry(req, (uint32_t *)tmp_in) != 0x01) {
+    if (!swd_drw_start(addr)) {
         return 0;
     }
 
@@ -310,8 +402,12 @@ static uint8_t swd_read_data(uint32_t addr, uint32_t *val) {
     ack = swd_transfer_retry(req, (uint32_t *)tmp_out);
 
     *val = (tmp_out[3] << 24) | (tmp_out[2] << 16) | (tmp_out[1] << 8) | tmp_out[0];
+    if (ack != 0x01) {
+        return 0;
+    }
 
-    return (ack == 0x01);
+    swd_drw_done(addr, 1);
+    return 1;
 }
 
 // Write target memory.
@@ -320,9 +416,7 @@ static uint8_t swd_write_data(uint32_t address, uint32_t data) {
     uint8_t req, ack;
 
     // put addr in TAR register
-    int2array(tmp_in, address, 4);
-    req = SWD_REG_AP | SWD_REG_W | (1 << 2);
-    if (swd_transfer_retry(req, (uint32_t *)tmp_in) != 0x01) {
+    if (!swd_drw_start(address)) {
         return 0;
     }
 
@@ -336,13 +430,17 @@ static uint8_t swd_write_data(uint32_t address, uint32_t data) {
     // dummy read
     req = SWD_REG_DP | SWD_REG_R | SWD_REG_ADR(DP_RDBUFF);
     ack = swd_transfer_retry(req, NULL);
+    if (ack != 0x01) {
+        return 0;
+    }
 
-    return (ack == 0x01) ? 1 : 0;
+    swd_drw_done(address, 1);
+    return 1;
 }
 
 // Read 32-bit word from target memory.
 static uint8_t swd_read_word(uint32_t addr, uint32_t *val) {
-    if (!swd_write_ap(AP_CSW, CSW_VALUE | CSW_SIZE32)) {
+    if (!swd_write_ap(session_apsel | AP_CSW, CSW_VALUE | CSW_SIZE32)) {
         return 0;
     }
 
@@ -355,7 +453,7 @@ static uint8_t swd_read_word(uint32_t addr, uint32_t *val) {
 
 // Write 32-bit word to target memory.
 static uint8_t swd_write_word(uint32_t addr, uint32_t val) {
-    if (!swd_write_ap(AP_CSW, CSW_VALUE | CSW_SIZE32)) {
+    if (!swd_write_ap(session_apsel | AP_CSW, CSW_VALUE | CSW_SIZE32)) {
         return 0;
     }
 
@@ -369,7 +467,7 @@ static uint8_t swd_write_word(uint32_t addr, uint32_t val) {
 // Read 8-bit byte from target memory.
 static uint8_t swd_read_byte(uint32_t addr, uint8_t *val) {
     uint32_t tmp;
-    if (!swd_write_ap(AP_CSW, CSW_VALUE | CSW_SIZE8)) {
+    if (!swd_write_ap(session_apsel | AP_CSW, CSW_VALUE | CSW_SIZE8)) {
         return 0;
     }
 
@@ -385,7 +483,7 @@ static uint8_t swd_read_byte(uint32_t addr, uint8_t *val) {
 static uint8_t swd_write_byte(uint32_t addr, uint8_t val) {
     uint32_t tmp;
 
-    if (!swd_write_ap(AP_CSW, CSW_VALUE | CSW_SIZE8)) {
+    if (!swd_write_ap(session_apsel | AP_CSW, CSW_VALUE | CSW_SIZE8)) {
         return 0;
     }
 
@@ -397,6 +495,37 @@ static uint8_t swd_write_byte(uint32_t addr, uint8_t val) {
     return 1;
 }
 
+// Read 16-bit halfword from target memory.
+static uint8_t swd_read_halfword(uint32_t addr, uint16_t *val) {
+    uint32_t tmp;
+    if (!swd_write_ap(session_apsel | AP_CSW, CSW_VALUE | CSW_SIZE16)) {
+        return 0;
+    }
+
+    if (!swd_read_data(addr, &tmp)) {
+        return 0;
+    }
+
+    *val = (uint16_t)(tmp >> ((addr & 0x02) << 3));
+    return 1;
+}
+
+// Write 16-bit halfword to target memory.
+static uint8_t swd_write_halfword(uint32_t addr, uint16_t val) {
+    uint32_t tmp;
+
+    if (!swd_write_ap(session_apsel | AP_CSW, CSW_VALUE | CSW_SIZE16)) {
+        return 0;
+    }
+
+    tmp = val << ((addr & 0x02) << 3);
+    if (!swd_write_data(addr, tmp)) {
+        return 0;
+    }
+
+    return 1;
+}
+
 // Read unaligned data from target memory.
 // size is in bytes.
 uint8_t swd_read_memory(uint32_t address, uint8_t *data, uint32_t size) {
@@ -486,11 +615,194 @@ uint8_t swd_write_memory(uint32_t address, uint8_t *data, uint32_t size) {
     return 1;
 }
 
+// Read target memory with a fixed access size (1, 2 or 4 bytes).
+// Access size 4 allows unaligned address and size, the edges are read
+// bytewise. For access size 2, address and size must be halfword aligned.
+uint8_t swd_read_memory_access(uint32_t address, uint8_t *data, uint32_t size, uint8_t access) {
+    uint16_t val;
+
+    switch (access) {
+        case 1:
+            while (size > 0) {
+                if (!swd_read_byte(address, data)) {
+                    return 0;
+                }
+                address++;
+                data++;
+                size--;
+            }
+            return 1;
+
+        case 2:
+            if ((address | size) & 0x1) {
+                return 0;
+            }
+            while (size > 0) {
+                if (!swd_read_halfword(address, &val)) {
+                    return 0;
+                }
+                int2array(data, val, 2);
+                address += 2;
+                data += 2;
+                size -= 2;
+            }
+            return 1;
+
+        case 4:
+            return swd_read_memory(address, data, size);
+
+        default:
+            return 0;
+    }
+}
+
+// Write target memory with a fixed access size (1, 2 or 4 bytes).
+// Same alignment rules as swd_read_memory_access.
+uint8_t swd_write_memory_access(uint32_t address, uint8_t *data, uint32_t size, uint8_t access) {
+    switch (access) {
+        case 1:
+            while (size > 0) {
+                if (!swd_write_byte(address, *data)) {
+                    return 0;
+                }
+                address++;
+                data++;
+                size--;
+            }
+            return 1;
+
+        case 2:
+            if ((address | size) & 0x1) {
+                return 0;
+            }
+            while (size > 0) {
+                if (!swd_write_halfword(address, data[0] | (data[1] << 8))) {
+                    return 0;
+                }
+                address += 2;
+                data += 2;
+                size -= 2;
+            }
+            return 1;
+
+        case 4:
+            return swd_write_memory(address, data, size);
+
+        default:
+            return 0;
+    }
+}
+
+// Read the word at address count times with back to back reads, for registers
+// that change on every read such as DWT_PCSR. CSW and TAR are written if needed,
+// then DRW is read count times. Each read returns the value of the previous one
+// (posted reads), the last one comes from RDBUFF.
+uint8_t swd_read_word_repeat(uint32_t address, uint32_t *data, uint32_t count) {
+    uint8_t req;
+    uint32_t i;
+
+    if (count == 0) {
+        return 1;
+    }
+
+    // TAR must not move between the reads
+    if (!swd_write_ap(session_apsel | AP_CSW, (CSW_VALUE & ~CSW_ADDRINC) | CSW_SIZE32)) {
+        return 0;
+    }
+
+    if (!swd_drw_start(address)) {
+        return 0;
+    }
+
+    // read data
+    req = SWD_REG_AP | SWD_REG_R | SWD_REG_ADR(AP_DRW);
+    // dummy read
+    if (swd_transfer_retry(req, NULL) != 0x01) {
+        return 0;
+    }
+
+    for (i = 1; i < count; i++) {
+        if (swd_transfer_retry(req, data++) != 0x01) {
+            return 0;
+        }
+    }
+
+    req = SWD_REG_DP | SWD_REG_R | SWD_REG_ADR(DP_RDBUFF);
+    if (swd_transfer_retry(req, data) != 0x01) {
+        return 0;
+    }
+
+    swd_drw_done(address, 0);
+    return 1;
+}
+
+// Forget the cached DP SELECT and the AP CSW and TAR values of all sessions.
+// Must be called when another agent (e.g. the host through DAP_Transfer)
+// may have changed them behind our back.
+void swd_clear_state(void) {
+    uint32_t i;
+
+    dap_state.select = 0xffffffff;
+    for (i = 0; i < AP_SESSIONS; i++) {
+        swd_sessions[i].csw = AP_UNKNOWN;
+        swd_sessions[i].tar = AP_UNKNOWN;
+    }
+}
+
+// Save the DP SELECT, AP CSW and AP TAR values the host has set up through
+// DAP_Transfer before the probe accesses the target between host commands,
+// so that swd_restore_state can put them back. The cached values are
+// forgotten as in swd_clear_state.
+uint8_t swd_save_state(void) {
+    uint32_t apsel;
+
+    swd_clear_state();
+    host_session_saved = 0;
+    host_state.select = DAP_Select;
+    if (host_state.select == DAP_SELECT_UNKNOWN) {
+        // the host has not selected an AP, nothing to keep
+        return 1;
+    }
+    dap_state.select = host_state.select;
+
+    apsel = host_state.select & APSEL;
+    if (!swd_read_ap(apsel | AP_CSW, &host_session.csw)) {
+        return 0;
+    }
+    if (!swd_read_ap(apsel | AP_TAR, &host_session.tar)) {
+        return 0;
+    }
+    host_session_saved = 1;
+    return 1;
+}
+
+// Restore the DP SELECT, AP CSW and AP TAR values saved by swd_save_state
+uint8_t swd_restore_state(void) {
+    uint32_t apsel;
+
+    if (host_state.select == DAP_SELECT_UNKNOWN) {
+        return 1;
+    }
+
+    if (host_session_saved) {
+        apsel = host_state.select & APSEL;
+        if (!swd_write_ap(apsel | AP_CSW, host_session.csw)) {
+            return 0;
+        }
+        if (!swd_write_ap(apsel | AP_TAR, host_session.tar)) {
+            return 0;
+        }
+    }
+
+    return swd_write_dp(DP_SELECT, host_state.select);
+}
+
 // Execute system call.
 static uint8_t swd_write_debug_state(DEBUG_STATE *state) {
     uint32_t i, status;
 
-    if (!swd_write_dp(DP_SELECT, 0)) {
+    // AP of the session, DP bank 0 for CTRL/STAT below
+    if (!swd_write_dp(DP_SELECT, session_apsel)) {
         return 0;
     }
 
@@ -587,19 +899,68 @@ static uint8_t swd_write_core_register(uint32_t n, uint32_t val) {
     return 0;
 }
 
-uint8_t swd_is_semihost_event(uint32_t *r0, uint32_t *r1) {
-    uint32_t val;
+// Poll DHCSR for a halted core with back to back reads: CSW and TAR are
+// written if needed, then DRW is read up to count times. Each read returns the
+// value of the previous one (posted reads), the last one comes from RDBUFF.
+static uint8_t swd_poll_halt(uint32_t count) {
+    uint8_t req;
+    uint32_t val, i;
+
+    // TAR must not move between the reads
+    if (!swd_write_ap(session_apsel | AP_CSW, (CSW_VALUE & ~CSW_ADDRINC) | CSW_SIZE32)) {
+        return 0;
+    }
+
+    if (!swd_drw_start(DBG_HCSR)) {
+        return 0;
+    }
+
+    // read data
+    req = SWD_REG_AP | SWD_REG_R | (3 << 2);
+    // dummy read
+    if (swd_transfer_retry(req, NULL) != 0x01) {
+        return 0;
+    }
+
+    for (i = 1; i < count; i++) {
+        if (swd_transfer_retry(req, &val) != 0x01) {
+            return 0;
+        }
+        if (val & S_HALT) {
+            break;
+        }
+    }
 
-    if (!swd_read_word(DBG_HCSR, &val)) {
+    req = SWD_REG_DP | SWD_REG_R | SWD_REG_ADR(DP_RDBUFF);
+    if (swd_transfer_retry(req, &val) != 0x01) {
         return 0;
     }
 
+    swd_drw_done(DBG_HCSR, 0);
+    return (val & S_HALT) ? 1 : 0;
+}
+
+// Check for a semihost call: only DHCSR is read while the core runs,
+// R0 and R1 once it has halted.
+uint8_t swd_is_semihost_event(uint32_t *r0, uint32_t *r1) {
+    uint32_t pc;
+    uint16_t op = 0;
+
     // Not hit breakpoint
-    if ((val & S_HALT) == 0) {
+    if (!swd_poll_halt(HALT_POLLS)) {
+        return 0;
+    }
+
+    // Has hit breakpoint, a semihost call halts on BKPT 0xAB
+    // rather than on a debugger request or a fault
+    if (!swd_read_core_register(15, &pc)) {
+        return 0;
+    }
+
+    if (!swd_read_memory(pc, (uint8_t *)&op, 2) || (op != BKPT_SEMIHOST)) {
         return 0;
     }
 
-    // Has hit breakpoint
     // Read r0 and r1
     if (!swd_read_core_register(0, r0)) {
         return 0;
@@ -690,6 +1051,46 @@ uint8_t swd_flash_syscall_exec(const FLASH_SYSCALL *sysCallParam, uint32_t entry
     return 1;
 }
 
+// Start an image loaded into RAM on the halted core: SP and PC are taken
+// from its vector table, which also becomes the active one.
+uint8_t swd_run_image(uint32_t vector_table) {
+    DEBUG_STATE state;
+    uint32_t demcr;
+
+    if (!swd_read_word(vector_table + 0, &state.r[13])) {
+        return 0;
+    }
+
+    if (!swd_read_word(vector_table + 4, &state.r[15])) {
+        return 0;
+    }
+
+    // Registers as after reset, PC without the Thumb bit
+    state.xpsr     = 0x01000000;          // xPSR: T = 1, ISR = 0
+    state.r[0]     = 0;
+    state.r[1]     = 0;
+    state.r[2]     = 0;
+    state.r[3]     = 0;
+    state.r[9]     = 0;
+    state.r[14]    = 0xFFFFFFFF;          // LR: no return
+    state.r[15]   &= ~1;
+
+    if (!swd_write_word(NVIC_VTOR, vector_table)) {
+        return 0;
+    }
+
+    // No vector catch left over from RESET_PROGRAM, TRCENA stays for the DWT
+    if (!swd_read_word(DBG_EMCR, &demcr)) {
+        return 0;
+    }
+
+    if (!swd_write_word(DBG_EMCR, demcr & ~VC_CORERESET)) {
+        return 0;
+    }
+
+    return swd_write_debug_state(&state);
+}
+
 // SWD Reset
 static uint8_t swd_reset(void) {
     uint8_t tmp_in[8];
@@ -734,9 +1135,7 @@ static uint8_t swd_read_idcode(uint32_t *id) {
 }
 
 
-static uint8_t JTAG2SWD() {
-    uint32_t tmp = 0;
-
+static uint8_t JTAG2SWD(uint32_t *id) {
     if (!swd_reset()) {
         return 0;
     }
@@ -749,29 +1148,119 @@ static uint8_t JTAG2SWD() {
         return 0;
     }
 
-    if (!swd_read_idcode(&tmp)) {
+    if (!swd_read_idcode(id)) {
         return 0;
     }
 
     return 1;
 }
 
-static uint8_t swd_init_debug(void) {
-    uint32_t tmp = 0;
+// Handshakes with the target are timed with the DWT cycle counter of the
+// probe, so that a dead target cannot hang the probe.
+static uint32_t swd_timer_start(void) {
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL        |= DWT_CTRL_CYCCNTENA_Msk;
+    return DWT->CYCCNT;
+}
 
-    // init dap state with fake values
-    dap_state.select = 0xffffffff;
-    dap_state.csw = 0xffffffff;
+static uint8_t swd_timer_expired(uint32_t start, uint32_t ms) {
+    return (DWT->CYCCNT - start) >= (ms * (CPU_CLOCK / 1000));
+}
 
-    DAP_Setup();
-    PORT_SWD_SETUP();
+// Wait for the debug and system power-up acknowledges
+static uint8_t swd_wait_powerup(void) {
+    uint32_t start, status;
 
-    // call a target dependant function
-    // this function can do several stuff before really
-    // initing the debug
-    target_before_init_debug();
+    start = swd_timer_start();
 
-    if (!JTAG2SWD()) {
+    do {
+        if (!swd_read_dp(DP_CTRL_STAT, &status)) {
+            return 0;
+        }
+
+        if ((status & (CDBGPWRUPACK | CSYSPWRUPACK)) == (CDBGPWRUPACK | CSYSPWRUPACK)) {
+            return 1;
+        }
+    } while (!swd_timer_expired(start, POWERUP_TIMEOUT));
+
+    return 0;
+}
+
+// Wait for the core to halt after a halt request or a reset with vector catch
+static uint8_t swd_wait_reset_halt(void) {
+    uint32_t start, val;
+
+    start = swd_timer_start();
+
+    do {
+        if (!swd_read_word(DBG_HCSR, &val)) {
+            return 0;
+        }
+
+        if (val & S_HALT) {
+            return 1;
+        }
+    } while (!swd_timer_expired(start, HALT_TIMEOUT));
+
+    return 0;
+}
+
+// Fast path for the target connected last: a line reset and an IDCODE read
+// instead of the JTAG-to-SWD switch, and no power-up when the DP still is.
+// A power cycled or different target fails the IDCODE or power-up check.
+static uint8_t swd_reconnect(void) {
+    uint32_t id, status;
+
+    if (link_idcode == 0) {
+        return 0;
+    }
+
+    // the host may have moved SELECT through DAP_Transfer
+    swd_clear_state();
+
+    if (!swd_reset()) {
+        return 0;
+    }
+
+    if (!swd_read_idcode(&id) || (id != link_idcode)) {
+        return 0;
+    }
+
+    // Ensure CTRL/STAT register selected in DPBANKSEL
+    if (!swd_write_dp(DP_SELECT, session_apsel)) {
+        return 0;
+    }
+
+    if (!swd_read_dp(DP_CTRL_STAT, &status)) {
+        return 0;
+    }
+
+    if ((status & (CDBGPWRUPACK | CSYSPWRUPACK)) != (CDBGPWRUPACK | CSYSPWRUPACK)) {
+        return 0;
+    }
+
+    if (status & (STICKYORUN | STICKYCMP | STICKYERR | WDATAERR)) {
+        if (!swd_write_dp(DP_ABORT, STKCMPCLR | STKERRCLR | WDERRCLR | ORUNERRCLR)) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+// Switch the target to SWD and power up its debug port
+static uint8_t swd_connect(void) {
+    uint32_t id = 0;
+
+    if (swd_reconnect()) {
+        return 1;
+    }
+
+    link_idcode = 0;
+    // the fast path may have left SELECT unknown
+    dap_state.select = 0xffffffff;
+
+    if (!JTAG2SWD(&id)) {
         return 0;
     }
 
@@ -780,7 +1269,7 @@ static uint8_t swd_init_debug(void) {
     }
 
     // Ensure CTRL/STAT register selected in DPBANKSEL
-    if (!swd_write_dp(DP_SELECT, 0)) {
+    if (!swd_write_dp(DP_SELECT, session_apsel)) {
         return 0;
     }
 
@@ -789,22 +1278,40 @@ static uint8_t swd_init_debug(void) {
         return 0;
     }
 
-    do {
-        if (!swd_read_dp(DP_CTRL_STAT, &tmp)) {
-            return 0;
-        }
-    } while ((tmp & (CDBGPWRUPACK | CSYSPWRUPACK)) != (CDBGPWRUPACK | CSYSPWRUPACK));
+    if (!swd_wait_powerup()) {
+        return 0;
+    }
 
     if (!swd_write_dp(DP_CTRL_STAT, CSYSPWRUPREQ | CDBGPWRUPREQ | TRNNORMAL | MASKLANE)) {
         return 0;
     }
 
+    link_idcode = id;
+    return 1;
+}
+
+uint8_t swd_init_debug(void) {
+    // init dap state with fake values
+    swd_clear_state();
+
+    DAP_Setup();
+    PORT_SWD_SETUP();
+
+    // call a target dependant function
+    // this function can do several stuff before really
+    // initing the debug
+    target_before_init_debug();
+
+    if (!swd_connect()) {
+        return 0;
+    }
+
     // call a target dependant function:
     // some target can enter in a lock state
     // this function can unlock these targets
     target_unlock_sequence();
 
-    if (!swd_write_dp(DP_SELECT, 0)) {
+    if (!swd_write_dp(DP_SELECT, session_apsel)) {
         return 0;
     }
 
@@ -821,7 +1328,6 @@ void swd_set_target_reset(uint8_t asserted) {
 }
 
 uint8_t swd_set_target_state(TARGET_RESET_STATE state) {
-    uint32_t val;
     switch (state) {
         case RESET_HOLD:
             swd_set_target_reset(1);
@@ -900,11 +1406,9 @@ uint8_t swd_set_target_state(TARGET_RESET_STATE state) {
             }
             
             // Wait until core is halted
-            do {
-                if (!swd_read_word(DBG_HCSR, &val)) {
-                    return 0;
-                }
-            } while((val & S_HALT) == 0);
+            if (!swd_wait_reset_halt()) {
+                return 0;
+            }
 
             // Enable halt on reset
             if (!swd_write_word(DBG_EMCR, VC_CORERESET)) {
@@ -918,11 +1422,9 @@ uint8_t swd_set_target_state(TARGET_RESET_STATE state) {
 #endif
             Delayms(2);
 
-            do {
-                if (!swd_read_word(DBG_HCSR, &val)) {
-                    return 0;
-                }
-            } while((val & S_HALT) == 0);
+            if (!swd_wait_reset_halt()) {
+                return 0;
+            }
 
             // Disable halt on reset
             if (!swd_write_word(DBG_EMCR, 0)) {
@@ -941,21 +1443,7 @@ uint8_t swd_set_target_state(TARGET_RESET_STATE state) {
             DAP_Setup();
             PORT_SWD_SETUP();
 
-            if (!JTAG2SWD()) {
-                return 0;
-            }
-
-            if (!swd_write_dp(DP_ABORT, STKCMPCLR | STKERRCLR | WDERRCLR | ORUNERRCLR)) {
-                return 0;
-            }
-
-            // Ensure CTRL/STAT register selected in DPBANKSEL
-            if (!swd_write_dp(DP_SELECT, 0)) {
-                return 0;
-            }
-
-            // Power up
-            if (!swd_write_dp(DP_CTRL_STAT, CSYSPWRUPREQ | CDBGPWRUPREQ)) {
+            if (!swd_connect()) {
                 return 0;
             }
 
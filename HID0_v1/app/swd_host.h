@@ -19,16 +19,26 @@
 #include "target_struct.h"
 
 uint8_t swd_init(void);
+uint8_t swd_init_debug(void);
+uint8_t swd_select_session(uint8_t ap);
+uint8_t swd_get_session(void);
 uint8_t swd_read_dp(uint8_t adr, uint32_t *val);
 uint8_t swd_write_dp(uint8_t adr, uint32_t val);
 uint8_t swd_read_ap(uint32_t adr, uint32_t *val);
 uint8_t swd_write_ap(uint32_t adr, uint32_t val);
 uint8_t swd_read_memory(uint32_t address, uint8_t *data, uint32_t size);
 uint8_t swd_write_memory(uint32_t address, uint8_t *data, uint32_t size);
+uint8_t swd_read_memory_access(uint32_t address, uint8_t *data, uint32_t size, uint8_t access);
+uint8_t swd_write_memory_access(uint32_t address, uint8_t *data, uint32_t size, uint8_t access);
+uint8_t swd_read_word_repeat(uint32_t address, uint32_t *data, uint32_t count);
+void swd_clear_state(void);
+uint8_t swd_save_state(void);
+uint8_t swd_restore_state(void);
 void swd_set_target_reset(uint8_t asserted);
 uint8_t swd_is_semihost_event(uint32_t *r0, uint32_t *r1);
 uint8_t swd_semihost_restart(uint32_t r0);
 uint8_t swd_flash_syscall_exec(const FLASH_SYSCALL *sysCallParam, uint32_t entry, uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4);
+uint8_t swd_run_image(uint32_t vector_table);
 
 uint8_t swd_set_target_state(TARGET_RESET_STATE state);
 
@@ -0,0 +1,120 @@
+/*----------------------------------------------------------------------------
+ *      RL-ARM - USB
+ *----------------------------------------------------------------------------
+ *      Name:    usbd_user_cdc_acm.c
+ *      Purpose: Communication Device Class User module
+ *      Rev.:    V4.70
+ *----------------------------------------------------------------------------
+ *      This code is part of the RealView Run-Time Library.
+ *      Copyright (c) 2004-2013 KEIL - An ARM Company. All rights reserved.
+ *---------------------------------------------------------------------------*/
+
+#include <RTL.h>
+#include <rl_usb.h>
+#include "DAP_config.h"
+#include "UART.h"
+
+#if (UART_BRIDGE != 0)
+// The virtual COM port is bridged to the UART of the target (UART.c), line
+// coding set by the host is applied to it. Setting CONSOLE_BAUDRATE instead
+// stops the bridge and connects the port to the semihosting console and RTT
+// of the target, until the host sets any other baud rate or the bus is reset.
+#else
+// The virtual COM port carries the semihosting console of the target. It has
+// no UART behind it, so any line coding is accepted and kept as set.
+#endif
+
+static volatile uint8_t CDC_PortOpen;           // Terminal connected (DTR set)
+#if (UART_BRIDGE != 0)
+static volatile uint8_t CDC_Console;            // Console selected instead of the bridge
+static CDC_LINE_CODING  CDC_ConsoleLineCoding;  // Line coding set with the console selected
+#endif
+
+
+// USB CDC ACM Callback: when system initializes
+int32_t USBD_CDC_ACM_PortInitialize (void) {
+  CDC_PortOpen = 0;
+#if (UART_BRIDGE != 0)
+  CDC_Console  = 0;
+  return (UART_Initialize());
+#else
+  return (1);
+#endif
+}
+
+// USB CDC ACM Callback: when system uninitializes
+int32_t USBD_CDC_ACM_PortUninitialize (void) {
+  CDC_PortOpen = 0;
+#if (UART_BRIDGE != 0)
+  CDC_Console  = 0;
+  return (UART_Uninitialize());
+#else
+  return (1);
+#endif
+}
+
+// USB CDC ACM Callback: when USB Bus Reset occurs
+int32_t USBD_CDC_ACM_PortReset (void) {
+  CDC_PortOpen = 0;
+#if (UART_BRIDGE != 0)
+  CDC_Console  = 0;
+  return (UART_Reset());
+#else
+  return (1);
+#endif
+}
+
+// USB CDC ACM Callback: when host sets the communication settings
+//   CONSOLE_BAUDRATE selects the console, the stopped UART drops its data.
+int32_t USBD_CDC_ACM_PortSetLineCoding (CDC_LINE_CODING *line_coding) {
+#if (UART_BRIDGE != 0)
+  if (line_coding->dwDTERate == CONSOLE_BAUDRATE) {
+    UART_Reset();
+    CDC_ConsoleLineCoding = *line_coding;
+    CDC_Console = 1;
+    return (1);
+  }
+  CDC_Console = 0;
+  return (UART_SetConfiguration(line_coding));
+#else
+  return (1);
+#endif
+}
+
+// USB CDC ACM Callback: when host reads the communication settings
+//   Without the UART line_coding still holds the settings last set.
+int32_t USBD_CDC_ACM_PortGetLineCoding (CDC_LINE_CODING *line_coding) {
+#if (UART_BRIDGE != 0)
+  if (CDC_Console) {
+    *line_coding = CDC_ConsoleLineCoding;
+    return (1);
+  }
+  return (UART_GetConfiguration(line_coding));
+#else
+  return (1);
+#endif
+}
+
+// USB CDC ACM Callback: when host sets DTR/RTS
+//   A terminal sets DTR when it opens the port and clears it when it closes it.
+int32_t USBD_CDC_ACM_PortSetControlLineState (uint16_t ctrl_bmp) {
+  CDC_PortOpen = (ctrl_bmp & 0x01) ? 1 : 0;
+  return (1);
+}
+
+
+// Check if a terminal has the virtual COM port open
+//   Output is dropped while it is not, so the target does not block on it.
+BOOL usbd_cdc_acm_port_open (void) {
+  return (usbd_configured() && CDC_PortOpen);
+}
+
+// Check if the semihosting console and RTT may use the virtual COM port
+//   They stay off it while it is bridged to the target UART, see CONSOLE_BAUDRATE.
+BOOL usbd_cdc_acm_console_open (void) {
+#if (UART_BRIDGE != 0)
+  return (CDC_Console && usbd_cdc_acm_port_open());
+#else
+  return (usbd_cdc_acm_port_open());
+#endif
+}
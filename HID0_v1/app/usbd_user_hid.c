@@ -19,6 +19,9 @@
 //#include "KBD.h"
 #include "DAP_config.h"
 #include "DAP.h"
+#include "DAP_perf.h"
+#include "semihost.h"
+#include "ring.h"
 
 
 
@@ -29,32 +32,34 @@
 //#error "USB HID Input Report Size must match DAP Packet Size"
 //#endif
 
-static volatile uint8_t  USB_RequestFlag;       // Request  Buffer Usage Flag
-static volatile uint32_t USB_RequestIn;         // Request  Buffer In  Index
-static volatile uint32_t USB_RequestOut;        // Request  Buffer Out Index
+#if ((DAP_PACKET_COUNT & (DAP_PACKET_COUNT - 1)) != 0)
+#error "DAP Packet Count must be a power of 2"
+#endif
 
+// The request ring is filled by the USB interrupt and emptied by
+// usbd_hid_process, the response ring the other way round (ring.h).
+static          ring_t   USB_RequestRing;       // Request  Buffer Indexes
+static          ring_t   USB_ResponseRing;      // Response Buffer Indexes
 static volatile uint8_t  USB_ResponseIdle;      // Response Buffer Idle  Flag
-static volatile uint8_t  USB_ResponseFlag;      // Response Buffer Usage Flag
-static volatile uint32_t USB_ResponseIn;        // Response Buffer In  Index
-static volatile uint32_t USB_ResponseOut;       // Response Buffer Out Index
+static          uint32_t USB_ResponseLen;       // Response Buffer Fill Level (queued commands)
 
 static          uint8_t  USB_Request [DAP_PACKET_COUNT][DAP_PACKET_SIZE];  // Request  Buffer
 static          uint8_t  USB_Response[DAP_PACKET_COUNT][DAP_PACKET_SIZE];  // Response Buffer
+static          uint8_t  USB_ResponseQueued[DAP_PACKET_SIZE];              // Queued Command Response
 
 
 // USB HID Callback: when system initializes
 void usbd_hid_init (void) {
-  USB_RequestFlag   = 0;
-  USB_RequestIn     = 0;
-  USB_RequestOut    = 0;
+  PERF_INIT();                          // once per probe start, not per target connect
+  ring_init(&USB_RequestRing,  DAP_PACKET_COUNT);
+  ring_init(&USB_ResponseRing, DAP_PACKET_COUNT);
   USB_ResponseIdle  = 1;
-  USB_ResponseFlag  = 0;
-  USB_ResponseIn    = 0;
-  USB_ResponseOut   = 0;
+  USB_ResponseLen   = 0;
 }
 
 // USB HID Callback: when data needs to be prepared for the host
 int usbd_hid_get_report (uint8_t rtype, uint8_t rid, uint8_t *buf, uint8_t req) {
+  uint32_t i;
 
   switch (rtype) {
     case HID_REPORT_INPUT:
@@ -64,15 +69,9 @@ int usbd_hid_get_report (uint8_t rtype, uint8_t rid, uint8_t *buf, uint8_t req)
           break;
         case USBD_HID_REQ_EP_INT:
 
-          if ((USB_ResponseOut != USB_ResponseIn) || USB_ResponseFlag) {
-            memcpy(buf, USB_Response[USB_ResponseOut], DAP_PACKET_SIZE);
-            USB_ResponseOut++;
-            if (USB_ResponseOut == DAP_PACKET_COUNT) {
-              USB_ResponseOut = 0;
-            }
-            if (USB_ResponseOut == USB_ResponseIn) {
-              USB_ResponseFlag = 0;
-            }
+          if (ring_peek(&USB_ResponseRing, &i)) {
+            memcpy(buf, USB_Response[i], DAP_PACKET_SIZE);
+            ring_release(&USB_ResponseRing, 1);
             return (DAP_PACKET_SIZE);
           } else {
             USB_ResponseIdle = 1;
@@ -88,65 +87,88 @@ int usbd_hid_get_report (uint8_t rtype, uint8_t rid, uint8_t *buf, uint8_t req)
 
 // USB HID Callback: when data is received from the host
 void usbd_hid_set_report (uint8_t rtype, uint8_t rid, uint8_t *buf, int len, uint8_t req) {
+  uint32_t i;
 
   switch (rtype) {
     case HID_REPORT_OUTPUT:
 
       if (len == 0) break;
+      PERF_COUNT(PERF_CNT_USB_REPORT);
+      semihost_dap_request();
       if (buf[0] == ID_DAP_TransferAbort) {
         DAP_TransferAbort = 1;
         break;
       }
-      if (USB_RequestFlag && (USB_RequestIn == USB_RequestOut)) {
+      if (!ring_reserve(&USB_RequestRing, &i)) {
+        PERF_USB_DROP(buf[0], len);
         break;  // Discard packet when buffer is full
       }
       // Store data into request packet buffer
-      memcpy(USB_Request[USB_RequestIn], buf, len);
-
-      USB_RequestIn++;
-      if (USB_RequestIn == DAP_PACKET_COUNT) {
-        USB_RequestIn = 0;
-      }
-      if (USB_RequestIn == USB_RequestOut) {
-        USB_RequestFlag = 1;
-      }
+      memcpy(USB_Request[i], buf, len);
+      ring_commit(&USB_RequestRing, 1);
       break;
     case HID_REPORT_FEATURE:
       break;
   }
 }
 
+// Send current response packet to host or queue it behind pending ones
+//   The packet is always queued. While the endpoint is idle no IN report is
+//   requested from usbd_hid_get_report, so the packet is taken here and sent.
+static void usbd_hid_send_response (void) {
+  uint32_t i;
+
+  USB_ResponseLen = 0;
+  PERF_COUNT(PERF_CNT_USB_RESPONSE);
+
+  ring_commit(&USB_ResponseRing, 1);
+  if (USB_ResponseIdle) {
+      // Request that data is send back to host
+      USB_ResponseIdle = 0;
+      ring_peek(&USB_ResponseRing, &i);
+      ring_release(&USB_ResponseRing, 1);   // the packet is copied right away
+      usbd_hid_get_report_trigger(0, USB_Response[i], DAP_PACKET_SIZE);
+  }
+}
+
 // Process USB HID Data
+//   Responses of ID_DAP_QueueCommands requests are not sent on their own.
+//   They are packed back to back into the current response packet, which is
+//   only sent when it is full or when the next unqueued request completes.
+//   The current response packet is the reserved element of the response ring.
 void usbd_hid_process (void) {
-  uint32_t n;
+  uint8_t *request;
+  uint32_t queued;
+  uint32_t n, i, o;
 //  usbd_hid_init();
 
-  // Process pending requests
-  while ((USB_RequestOut != USB_RequestIn) || USB_RequestFlag) { /*USB_RequestOut != USB_RequestIn˵δɵ󣬻ߵUSB_RequestFlag=1ʱδɵ*/
+  // Process pending requests while there is room for the response
+  while (ring_peek(&USB_RequestRing, &i) && ring_reserve(&USB_ResponseRing, &o)) {
       // Process DAP Command and prepare response
 
-      DAP_ProcessCommand(USB_Request[USB_RequestOut], USB_Response[USB_ResponseIn]);
-
-      // Update request index and flag
-      USB_RequestOut = (USB_RequestOut +1) % DAP_PACKET_COUNT;
-      if (USB_RequestOut == USB_RequestIn) {
-          USB_RequestFlag = 0;
+      request = USB_Request[i];
+      queued  = (request[0] == ID_DAP_QueueCommands);
+
+      PERF_COMMAND_BEGIN();
+      if (queued || USB_ResponseLen) {
+          // Append response to the packet being assembled
+          n = DAP_ProcessCommand(request, USB_ResponseQueued);
+          if ((USB_ResponseLen + n) > DAP_PACKET_SIZE) {
+              usbd_hid_send_response();
+              // wait for the host to take a response if all packets are queued
+              while (!ring_reserve(&USB_ResponseRing, &o));
+          }
+          memcpy(&USB_Response[o][USB_ResponseLen], USB_ResponseQueued, n);
+          USB_ResponseLen += n;
+      } else {
+          DAP_ProcessCommand(request, USB_Response[o]);
       }
+      PERF_COMMAND_END(request[0]);
 
-      if (USB_ResponseIdle) {
-          // Request that data is send back to host
-          USB_ResponseIdle = 0;
-          usbd_hid_get_report_trigger(0, USB_Response[USB_ResponseIn], DAP_PACKET_SIZE);
-      } else {
-          // Update response index and flag
-          n = USB_ResponseIn + 1;
-          if (n == DAP_PACKET_COUNT) {
-              n = 0;
-          }
-          USB_ResponseIn = n;
-          if (USB_ResponseIn == USB_ResponseOut) {
-              USB_ResponseFlag = 1;
-          }
+      ring_release(&USB_RequestRing, 1);
+
+      if (!queued) {
+          usbd_hid_send_response();
       }
   }
 }
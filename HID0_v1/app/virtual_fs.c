@@ -0,0 +1,387 @@
+/* CMSIS-DAP Interface Firmware
+ * Copyright (c) 2009-2013 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <string.h>
+
+#include "virtual_fs.h"
+
+// The virtual disk is described by its size and a short file list. Every
+// sector (boot sector, FATs, root directory and file data) is computed when
+// it is read, there are no sector images in flash or RAM.
+//
+// Layout: boot sector, FAT1, FAT2, root directory, data. The files occupy
+// contiguous clusters from cluster 2 on, the rest of the data region is free
+// for the files written by the host. FAT12 is used below 4085 clusters,
+// FAT16 above (the FAT type is defined by the cluster count only).
+//
+// FAT32 is used when FAT16 runs out of clusters at 32 KB per cluster. The
+// reserved area then also holds the FSInfo sector and a backup of both, the
+// root directory is the first cluster of the data region.
+//
+// The cluster chains are kept in a small table in cluster order. A FAT sector
+// looks up its first chain once and then produces every entry in constant
+// time, the file list is not scanned per entry.
+
+#define MEDIA_DESCRIPTOR        (0xF0)
+#define FAT12_CLUSTERS_MAX      (4084)
+#define FAT16_CLUSTERS_MAX      (65524)
+#define FAT16_CLUSTER_SIZE_MAX  (64)        // sectors per cluster
+#define FAT32_CLUSTER_SIZE      (8)         // sectors per cluster (4 KB)
+#define FAT32_RESERVED_SECTORS  (8)
+#define FAT32_FSINFO_SECTOR     (1)
+#define FAT32_BACKUP_SECTOR     (6)         // backup of boot sector and FSInfo
+#define ROOT_SECTORS            ((VFS_ROOT_ENTRIES * 32) / VFS_SECTOR_SIZE)
+
+#define DIR_TIME                (0x7585)
+#define DIR_DATE                (0x418E)
+
+typedef struct {
+    vfs_file_t file;
+    uint32_t first_cluster;
+    uint32_t last_cluster;      // first_cluster - 1 for empty files
+} vfs_entry_t;
+
+typedef struct {
+    uint32_t first;
+    uint32_t last;
+} vfs_chain_t;
+
+// Consecutive FAT entries from n on
+typedef struct {
+    uint32_t n;                 // next entry
+    uint32_t chain;             // first chain that does not end before n
+} fat_cursor_t;
+
+static char volume_label[11];
+static uint32_t volume_data_size;
+static vfs_entry_t files[VFS_FILE_MAX];
+static uint32_t file_count;
+
+// cluster chains of the root directory (FAT32) and the files, ascending
+static vfs_chain_t chains[VFS_FILE_MAX + 1];
+static uint32_t chain_count;
+
+// geometry
+static uint8_t fat_bits;        // 12, 16 or 32
+static uint32_t fat_eoc;        // end of chain mark
+static uint32_t reserved_sectors;
+static uint32_t sectors_per_cluster;
+static uint32_t cluster_count;
+static uint32_t fat_sectors;
+static uint32_t root_sector;
+static uint32_t data_sector;
+static uint32_t sector_count;
+
+static void put16(uint8_t *buf, uint32_t value) {
+    buf[0] = (uint8_t)(value >> 0);
+    buf[1] = (uint8_t)(value >> 8);
+}
+
+static void put32(uint8_t *buf, uint32_t value) {
+    buf[0] = (uint8_t)(value >> 0);
+    buf[1] = (uint8_t)(value >> 8);
+    buf[2] = (uint8_t)(value >> 16);
+    buf[3] = (uint8_t)(value >> 24);
+}
+
+// Compute geometry and file placement from the description
+static void vfs_layout(void) {
+    uint32_t data_sectors, file_sectors, cluster, i;
+
+    data_sectors = (volume_data_size + VFS_SECTOR_SIZE - 1) / VFS_SECTOR_SIZE;
+    file_sectors = 0;
+    for (i = 0; i < file_count; i++) {
+        file_sectors += (files[i].file.size + VFS_SECTOR_SIZE - 1) / VFS_SECTOR_SIZE;
+    }
+
+    // smallest cluster that keeps the cluster count in FAT16 range, FAT32 above
+    sectors_per_cluster = 1;
+    while (((data_sectors + file_sectors) / sectors_per_cluster > (FAT16_CLUSTERS_MAX - VFS_FILE_MAX)) &&
+           (sectors_per_cluster < FAT16_CLUSTER_SIZE_MAX)) {
+        sectors_per_cluster *= 2;
+    }
+    fat_bits = 16;
+    if ((data_sectors + file_sectors) / sectors_per_cluster > (FAT16_CLUSTERS_MAX - VFS_FILE_MAX)) {
+        fat_bits = 32;
+        sectors_per_cluster = FAT32_CLUSTER_SIZE;
+    }
+
+    cluster = 2;
+    chain_count = 0;
+    if (fat_bits == 32) {
+        chains[0].first = cluster;
+        cluster += (ROOT_SECTORS + sectors_per_cluster - 1) / sectors_per_cluster;
+        chains[0].last = cluster - 1;
+        chain_count = 1;
+    }
+    for (i = 0; i < file_count; i++) {
+        files[i].first_cluster = cluster;
+        cluster += (files[i].file.size + sectors_per_cluster * VFS_SECTOR_SIZE - 1) / (sectors_per_cluster * VFS_SECTOR_SIZE);
+        files[i].last_cluster = cluster - 1;
+        if (files[i].file.size) {
+            chains[chain_count].first = files[i].first_cluster;
+            chains[chain_count].last = files[i].last_cluster;
+            chain_count++;
+        }
+    }
+    cluster_count = (cluster - 2) + (data_sectors + sectors_per_cluster - 1) / sectors_per_cluster;
+
+    if (fat_bits == 32) {
+        fat_eoc = 0x0FFFFFFF;
+        fat_sectors = ((cluster_count + 2) * 4 + VFS_SECTOR_SIZE - 1) / VFS_SECTOR_SIZE;
+        reserved_sectors = FAT32_RESERVED_SECTORS;
+        data_sector = reserved_sectors + 2 * fat_sectors;
+        root_sector = data_sector;
+    } else {
+        if (cluster_count > FAT16_CLUSTERS_MAX) {
+            cluster_count = FAT16_CLUSTERS_MAX;
+        }
+        if (cluster_count > FAT12_CLUSTERS_MAX) {
+            fat_eoc = 0xFFFF;
+            fat_sectors = ((cluster_count + 2) * 2 + VFS_SECTOR_SIZE - 1) / VFS_SECTOR_SIZE;
+        } else {
+            fat_bits = 12;
+            fat_eoc = 0xFFF;
+            fat_sectors = (((cluster_count + 2) * 3 + 1) / 2 + VFS_SECTOR_SIZE - 1) / VFS_SECTOR_SIZE;
+        }
+        reserved_sectors = 1;
+        root_sector = reserved_sectors + 2 * fat_sectors;
+        data_sector = root_sector + ROOT_SECTORS;
+    }
+    sector_count = data_sector + cluster_count * sectors_per_cluster;
+}
+
+void vfs_init(const char label[11], uint32_t data_size) {
+    memcpy(volume_label, label, sizeof(volume_label));
+    volume_data_size = data_size;
+    file_count = 0;
+    vfs_layout();
+}
+
+// Add a file, return 0 if the file list is full
+int vfs_add_file(const vfs_file_t *file) {
+    if (file_count == VFS_FILE_MAX) {
+        return 0;
+    }
+    files[file_count].file = *file;
+    file_count++;
+    vfs_layout();
+    return 1;
+}
+
+uint32_t vfs_sector_count(void) {
+    return sector_count;
+}
+
+uint32_t vfs_root_sector(void) {
+    return root_sector;
+}
+
+uint32_t vfs_data_sector(void) {
+    return data_sector;
+}
+
+uint32_t vfs_sectors_per_cluster(void) {
+    return sectors_per_cluster;
+}
+
+// Position the cursor at FAT entry n
+static void fat_seek(fat_cursor_t *c, uint32_t n) {
+    c->n = n;
+    c->chain = 0;
+    while ((c->chain < chain_count) && (chains[c->chain].last < n)) {
+        c->chain++;
+    }
+}
+
+// FAT entry at the cursor, then advance: chains of the files, everything else free
+static uint32_t fat_next(fat_cursor_t *c) {
+    uint32_t n = c->n++;
+
+    if (n < 2) {
+        return (n == 0) ? ((fat_eoc & ~0xFF) | MEDIA_DESCRIPTOR) : fat_eoc;
+    }
+    if ((c->chain == chain_count) || (n < chains[c->chain].first)) {
+        return 0;
+    }
+    if (n == chains[c->chain].last) {
+        c->chain++;
+        return fat_eoc;
+    }
+    return n + 1;
+}
+
+static void read_boot_sector(uint8_t *buf) {
+    static const uint8_t jump[11] = {0xEB, 0x3C, 0x90, 'M','S','W','I','N','4','.','1'};
+
+    // the jump goes past the BPB, which is longer for FAT32
+    memcpy(&buf[0], jump, sizeof(jump));
+    if (fat_bits == 32) {
+        buf[1] = 0x58;
+    }
+    put16(&buf[11], VFS_SECTOR_SIZE);                   // bytes per sector
+    buf[13] = (uint8_t)sectors_per_cluster;
+    put16(&buf[14], reserved_sectors);
+    buf[16] = 2;                                        // number of FATs
+    buf[21] = MEDIA_DESCRIPTOR;
+    put16(&buf[24], 1);                                 // sectors per track
+    put16(&buf[26], 1);                                 // heads
+    put32(&buf[28], 0);                                 // hidden sectors
+    put16(&buf[510], 0xAA55);
+
+    if (fat_bits == 32) {
+        put32(&buf[32], sector_count);
+        put32(&buf[36], fat_sectors);
+        put32(&buf[44], chains[0].first);               // root directory cluster
+        put16(&buf[48], FAT32_FSINFO_SECTOR);
+        put16(&buf[50], FAT32_BACKUP_SECTOR);
+        buf[64] = 0;                                    // drive number
+        buf[66] = 0x29;                                 // extended boot signature
+        put32(&buf[67], 0x27021974);                    // volume id
+        memcpy(&buf[71], volume_label, sizeof(volume_label));
+        memcpy(&buf[82], "FAT32   ", 8);
+        return;
+    }
+
+    put16(&buf[17], VFS_ROOT_ENTRIES);
+    put16(&buf[19], (sector_count > 0xFFFF) ? 0 : sector_count);
+    put16(&buf[22], fat_sectors);
+    put32(&buf[32], (sector_count > 0xFFFF) ? sector_count : 0);
+    buf[36] = 0;                                        // drive number
+    buf[38] = 0x29;                                     // extended boot signature
+    put32(&buf[39], 0x27021974);                        // volume id
+    memcpy(&buf[43], volume_label, sizeof(volume_label));
+    memcpy(&buf[54], (fat_bits == 16) ? "FAT16   " : "FAT12   ", 8);
+}
+
+// FAT32 FSInfo sector: free cluster count and next free cluster unknown
+static void read_fsinfo_sector(uint8_t *buf) {
+    put32(&buf[0], 0x41615252);
+    put32(&buf[484], 0x61417272);
+    put32(&buf[488], 0xFFFFFFFF);
+    put32(&buf[492], 0xFFFFFFFF);
+    put16(&buf[510], 0xAA55);
+}
+
+// FAT sector s of one FAT copy
+static void read_fat_sector(uint32_t s, uint8_t *buf) {
+    fat_cursor_t c;
+    uint32_t i, pos, v0, v1;
+
+    if (fat_bits == 32) {
+        fat_seek(&c, s * (VFS_SECTOR_SIZE / 4));
+        for (i = 0; i < VFS_SECTOR_SIZE / 4; i++) {
+            put32(&buf[i * 4], fat_next(&c));
+        }
+        return;
+    }
+
+    if (fat_bits == 16) {
+        fat_seek(&c, s * (VFS_SECTOR_SIZE / 2));
+        for (i = 0; i < VFS_SECTOR_SIZE / 2; i++) {
+            put16(&buf[i * 2], fat_next(&c));
+        }
+        return;
+    }
+
+    // FAT12: two entries share three bytes, a sector may start inside a pair
+    pos = s * VFS_SECTOR_SIZE;
+    fat_seek(&c, (pos / 3) * 2);
+    v0 = fat_next(&c);
+    v1 = fat_next(&c);
+    for (i = 0; i < VFS_SECTOR_SIZE; i++, pos++) {
+        switch (pos % 3) {
+            case 0:
+                buf[i] = (uint8_t)v0;
+                break;
+            case 1:
+                buf[i] = (uint8_t)(((v0 >> 8) & 0x0F) | ((v1 & 0x0F) << 4));
+                break;
+            default:
+                buf[i] = (uint8_t)(v1 >> 4);
+                v0 = fat_next(&c);
+                v1 = fat_next(&c);
+                break;
+        }
+    }
+}
+
+// Root directory sector s: volume label, then the files
+static void read_root_sector(uint32_t s, uint8_t *buf) {
+    uint8_t *entry;
+    uint32_t i, n;
+
+    for (i = 0; i < VFS_SECTOR_SIZE / 32; i++) {
+        n = s * (VFS_SECTOR_SIZE / 32) + i;
+        entry = &buf[i * 32];
+        if (n == 0) {
+            memcpy(&entry[0], volume_label, 11);
+            entry[11] = 0x08;                           // volume label
+            put16(&entry[22], DIR_TIME);
+            put16(&entry[24], DIR_DATE);
+        } else if (n <= file_count) {
+            memcpy(&entry[0], files[n - 1].file.name, 11);
+            entry[11] = files[n - 1].file.attributes;
+            put16(&entry[14], DIR_TIME);
+            put16(&entry[16], DIR_DATE);
+            put16(&entry[18], DIR_DATE);
+            put16(&entry[22], DIR_TIME);
+            put16(&entry[24], DIR_DATE);
+            put16(&entry[20], files[n - 1].file.size ? files[n - 1].first_cluster >> 16 : 0);
+            put16(&entry[26], files[n - 1].file.size ? files[n - 1].first_cluster : 0);
+            put32(&entry[28], files[n - 1].file.size);
+        }
+    }
+}
+
+// Data sector s (relative to the data region)
+static void read_data_sector(uint32_t s, uint8_t *buf) {
+    uint32_t cluster = s / sectors_per_cluster + 2;
+    uint32_t offset, len, i;
+
+    for (i = 0; i < file_count; i++) {
+        if ((cluster >= files[i].first_cluster) && (cluster <= files[i].last_cluster)) {
+            offset = (s - (files[i].first_cluster - 2) * sectors_per_cluster) * VFS_SECTOR_SIZE;
+            if ((files[i].file.read == NULL) || (offset >= files[i].file.size)) {
+                return;
+            }
+            len = files[i].file.size - offset;
+            if (len > VFS_SECTOR_SIZE) {
+                len = VFS_SECTOR_SIZE;
+            }
+            files[i].file.read(offset, buf, len);
+            return;
+        }
+    }
+}
+
+// Compute the content of a sector of the virtual disk
+void vfs_read_sector(uint32_t sector, uint8_t *buf) {
+    memset(buf, 0, VFS_SECTOR_SIZE);
+
+    if ((sector == 0) || ((fat_bits == 32) && (sector == FAT32_BACKUP_SECTOR))) {
+        read_boot_sector(buf);
+    } else if ((fat_bits == 32) && ((sector == FAT32_FSINFO_SECTOR) || (sector == FAT32_BACKUP_SECTOR + 1))) {
+        read_fsinfo_sector(buf);
+    } else if (sector < reserved_sectors) {
+        return;
+    } else if (sector < reserved_sectors + 2 * fat_sectors) {
+        read_fat_sector((sector - reserved_sectors) % fat_sectors, buf);
+    } else if ((sector >= root_sector) && (sector < root_sector + ROOT_SECTORS)) {
+        read_root_sector(sector - root_sector, buf);
+    } else if ((sector >= data_sector) && (sector < sector_count)) {
+        read_data_sector(sector - data_sector, buf);
+    }
+}
@@ -0,0 +1,44 @@
+/* CMSIS-DAP Interface Firmware
+ * Copyright (c) 2009-2013 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef VIRTUAL_FS_H
+#define VIRTUAL_FS_H
+
+#include <stdint.h>
+
+#define VFS_SECTOR_SIZE         (512)
+#define VFS_ROOT_ENTRIES        (32)
+#define VFS_FILE_MAX            (8)
+
+// Read file data: offset and len stay within the file size
+typedef void (*vfs_read_t)(uint32_t offset, uint8_t *buf, uint32_t len);
+
+typedef struct {
+    char name[11];              // 8.3 name, space padded, e.g. "FLASH   BIN"
+    uint8_t attributes;         // FAT attributes (0x01 read only, 0x02 hidden)
+    uint32_t size;              // file size in bytes
+    vfs_read_t read;            // data source, NULL for zeros
+} vfs_file_t;
+
+void vfs_init(const char label[11], uint32_t data_size);
+int vfs_add_file(const vfs_file_t *file);
+void vfs_read_sector(uint32_t sector, uint8_t *buf);
+
+uint32_t vfs_sector_count(void);
+uint32_t vfs_root_sector(void);
+uint32_t vfs_data_sector(void);
+uint32_t vfs_sectors_per_cluster(void);
+
+#endif
@@ -0,0 +1,65 @@
+/* CMSIS-DAP Interface Firmware
+ * Copyright (c) 2009-2013 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef LPC18XX_H
+#define LPC18XX_H
+
+#include <stdint.h>
+
+// Host stand-in for the device header: just what DAP_config.h refers to,
+// so firmware sources that include it build for the host tests, and the
+// DWT cycle counter and interrupt mask other sources use. The pin functions
+// are never called there, the tests move the cycle counter on themselves.
+
+typedef struct {
+    volatile uint32_t SFSP2_3, SFSP2_4;
+} LPC_SCU_Type;
+
+typedef struct {
+    volatile uint32_t CLK_M3_GPIO_CFG, CLK_M3_GPIO_STAT;
+} LPC_CCU1_Type;
+
+typedef struct {
+    volatile uint32_t PIN[8], SET[8], CLR[8], DIR[8];
+} LPC_GPIO_PORT_Type;
+
+typedef struct {
+    volatile uint32_t CTRL, CYCCNT;
+} DWT_Type;
+
+typedef struct {
+    volatile uint32_t DEMCR;
+} CoreDebug_Type;
+
+extern LPC_SCU_Type       *LPC_SCU;
+extern LPC_CCU1_Type      *LPC_CCU1;
+extern LPC_GPIO_PORT_Type *LPC_GPIO_PORT;
+extern DWT_Type           *DWT;
+extern CoreDebug_Type     *CoreDebug;
+
+#define CoreDebug_DEMCR_TRCENA_Msk  (1UL << 24)
+#define DWT_CTRL_CYCCNTENA_Msk      (1UL << 0)
+
+#define __DMB()     __sync_synchronize()
+
+// Interrupt mask of the simulated core, defined by the tests that use it
+extern volatile uint32_t stub_primask;
+
+#define __get_PRIMASK()     (stub_primask)
+#define __set_PRIMASK(x)    (stub_primask = (x))
+#define __disable_irq()     (stub_primask = 1)
+#define __enable_irq()      (stub_primask = 0)
+
+#endif
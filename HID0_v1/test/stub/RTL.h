@@ -0,0 +1,40 @@
+/* CMSIS-DAP Interface Firmware
+ * Copyright (c) 2009-2013 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef RTL_H
+#define RTL_H
+
+#include <stdint.h>
+
+// Host stand-in for the RL-ARM header: the basic types and keywords the
+// firmware sources under test and the USB headers use, of the RTX kernel
+// just its task id type. The USB descriptor structures are not packed,
+// the tests never send them.
+
+typedef uint8_t   U8;
+typedef uint16_t  U16;
+typedef uint32_t  U32;
+typedef int32_t   S32;
+typedef int       BOOL;
+typedef void     *OS_TID;
+
+#define __TRUE    1
+#define __FALSE   0
+
+#define __packed
+#define __task
+#define __weak    __attribute__((weak))
+
+#endif
@@ -0,0 +1,108 @@
+/* CMSIS-DAP Interface Firmware
+ * Copyright (c) 2009-2013 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <string.h>
+
+#include "DAP_config.h"
+#include "DAP.h"
+#include "target_flash.h"
+#include "semihost.h"
+#include "stub_target.h"
+
+// target_flash.h holds the flash algorithm of the target, its entry points
+// tell the calls of swd_flash_syscall_exec apart
+
+DAP_Data_t DAP_Data;
+uint32_t   SystemCoreClock = CPU_CLOCK;
+
+uint8_t  stub_flash[STUB_FLASH_SIZE];
+uint32_t stub_erase_count;
+uint32_t stub_page_count;
+uint32_t stub_fail_page;
+uint32_t stub_run_address;
+uint8_t  stub_ram[STUB_RAM_SIZE];
+
+void stub_target_reset(void) {
+    memset(stub_flash, 0xA5, sizeof(stub_flash));
+    memset(stub_ram, 0, sizeof(stub_ram));
+    stub_erase_count = 0;
+    stub_page_count = 0;
+    stub_fail_page = 0;
+    stub_run_address = 0xFFFFFFFF;
+    DAP_Data.debug_port = DAP_PORT_DISABLED;
+}
+
+static uint8_t *stub_mem(uint32_t address, uint32_t size) {
+    if (((address - STUB_FLASH_START) < STUB_FLASH_SIZE) && ((address - STUB_FLASH_START) + size <= STUB_FLASH_SIZE)) {
+        return &stub_flash[address - STUB_FLASH_START];
+    }
+    if ((address >= STUB_RAM_START) && ((address - STUB_RAM_START) + size <= STUB_RAM_SIZE)) {
+        return &stub_ram[address - STUB_RAM_START];
+    }
+    return NULL;
+}
+
+uint8_t swd_read_memory(uint32_t address, uint8_t *data, uint32_t size) {
+    uint8_t *mem = stub_mem(address, size);
+
+    if (mem == NULL) return 0;
+    memcpy(data, mem, size);
+    return 1;
+}
+
+uint8_t swd_write_memory(uint32_t address, uint8_t *data, uint32_t size) {
+    uint8_t *mem = stub_mem(address, size);
+
+    // flash is written by the algorithm only
+    if ((mem == NULL) || (address < STUB_RAM_START)) return 0;
+    memcpy(mem, data, size);
+    return 1;
+}
+
+uint8_t swd_flash_syscall_exec(const FLASH_SYSCALL *sysCallParam, uint32_t entry, uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4) {
+    uint8_t *dst, *src;
+
+    if (entry == flash.erase_chip) {
+        memset(stub_flash, 0xFF, sizeof(stub_flash));
+        stub_erase_count++;
+        return 1;
+    }
+    if (entry == flash.program_page) {
+        // arg1: flash address, arg2: size, arg3: RAM buffer
+        stub_page_count++;
+        if (stub_page_count == stub_fail_page) return 0;
+        dst = stub_mem(arg1, arg2);
+        src = stub_mem(arg3, arg2);
+        if ((dst == NULL) || (src == NULL) || ((arg1 - STUB_FLASH_START) >= STUB_FLASH_SIZE)) return 0;
+        // programming only clears bits
+        while (arg2--) {
+            *dst++ &= *src++;
+        }
+        return 1;
+    }
+    return (entry == flash.init);
+}
+
+uint8_t swd_set_target_state(TARGET_RESET_STATE state) { return 1; }
+uint8_t swd_init_debug(void) { return 1; }
+uint8_t swd_select_session(uint8_t ap) { return 1; }
+void swd_clear_state(void) { }
+uint8_t swd_run_image(uint32_t vector_table) {
+    stub_run_address = vector_table;
+    return 1;
+}
+
+void semihost_enable(void) { }
+void semihost_disable(void) { }
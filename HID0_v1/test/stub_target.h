@@ -0,0 +1,39 @@
+/* CMSIS-DAP Interface Firmware
+ * Copyright (c) 2009-2013 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef STUB_TARGET_H
+#define STUB_TARGET_H
+
+#include <stdint.h>
+
+// Simulated target behind the swd_host.c functions used by msc_flash.c:
+// RAM for the flash algorithm and its page buffer, and a flash array that
+// the algorithm entry points (chip erase, program page) act on.
+
+#define STUB_FLASH_START    0x00000000
+#define STUB_FLASH_SIZE     (512 * 1024)
+#define STUB_RAM_START      0x10000000
+#define STUB_RAM_SIZE       (64 * 1024)
+
+extern uint8_t  stub_flash[STUB_FLASH_SIZE];
+extern uint8_t  stub_ram[STUB_RAM_SIZE];
+extern uint32_t stub_erase_count;           // chip erases
+extern uint32_t stub_page_count;            // program page calls
+extern uint32_t stub_fail_page;             // program page call that fails (1 = first), 0 = none
+extern uint32_t stub_run_address;           // vector table of the image run, 0xFFFFFFFF = none
+
+void stub_target_reset(void);
+
+#endif
@@ -0,0 +1,43 @@
+/* CMSIS-DAP Interface Firmware
+ * Copyright (c) 2009-2013 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// Minimal host test harness: a failed CHECK reports the condition and
+// ends the test program with exit code 1.
+
+#define CHECK(cond)                                                         \
+    do {                                                                    \
+        if (!(cond)) {                                                      \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n",                    \
+                    __FILE__, __LINE__, #cond);                             \
+            exit(1);                                                        \
+        }                                                                   \
+    } while (0)
+
+#define RUN(test)                                                           \
+    do {                                                                    \
+        test();                                                             \
+        printf("  ok  %s\n", #test);                                        \
+    } while (0)
+
+// Memory barrier used by ring.h, a full fence on the host
+#define __DMB()     __sync_synchronize()
+
+#endif
@@ -0,0 +1,765 @@
+/* CMSIS-DAP Interface Firmware
+ * Copyright (c) 2009-2013 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <string.h>
+
+#include "test.h"
+#include "msc_flash.h"
+#include "virtual_fs.h"
+#include "stub_target.h"
+
+// Drag-and-drop replay: the sector writes a host issues when an image is
+// copied to the drive are fed into MSC_Flash_Write, with MSC_Flash_Process
+// run in between as the main loop would. msc_flash.c and virtual_fs.c are
+// the firmware sources, the target behind them is simulated (stub_target.c).
+//
+// The traces are written by hand, not captured from a host: each transcribes
+// the write order the host is known to use (directory entry before or after
+// the data, transfer size, queued writes out of order) without the writes
+// that do not matter here, such as FSInfo and timestamps.
+//
+// A trace lists the writes in the order the host sends them. Directory and
+// FAT writes carry the sectors the host would write back: what it read from
+// the drive, with the new entry added. Data writes name image sectors, one
+// MSC_Flash_Write call per step as for one USB transfer.
+
+#define SECTOR          512
+#define IMAGE_SECTORS   41                  // 20.5 KB, the last sector partly used
+#define IMAGE_SIZE      (IMAGE_SECTORS * SECTOR - 200)
+#define STEPS_MAX       64
+#define FILE_SECTORS    128                 // 64 KB, HEX, SREC, ELF and DPZ files
+
+typedef enum {
+    T_END,
+    T_DIR_EMPTY,        // root directory with the new entry, size and cluster 0
+    T_DIR_HIDDEN,       // root directory with a hidden "._" companion entry only
+    T_DIR,              // root directory with the complete entry
+    T_FAT,              // first FAT sector, as read back
+    T_DATA,             // image sectors arg .. arg+count-1 in one transfer
+    T_HIDDEN_DATA,      // companion sectors arg .. arg+count-1 in one transfer
+} trace_kind_t;
+
+typedef struct {
+    trace_kind_t kind;
+    uint32_t arg;
+    uint32_t count;
+} trace_step_t;
+
+// Windows: entry created with size 0, data in 4 KB transfers, entry completed
+static const trace_step_t trace_windows[] = {
+    { T_DIR_EMPTY }, { T_FAT },
+    { T_DATA, 0, 8 }, { T_DATA, 8, 8 }, { T_DATA, 16, 8 }, { T_DATA, 24, 8 },
+    { T_DATA, 32, 8 }, { T_DATA, 40, 1 },
+    { T_FAT }, { T_DIR },
+    { T_END }
+};
+
+// macOS: data written before any directory entry, the AppleDouble companion
+// after the image
+static const trace_step_t trace_macos[] = {
+    { T_FAT },
+    { T_DATA, 0, 8 }, { T_DATA, 8, 8 }, { T_DATA, 16, 8 }, { T_DATA, 24, 8 },
+    { T_DATA, 32, 8 }, { T_DATA, 40, 1 },
+    { T_DIR_HIDDEN }, { T_DIR }, { T_HIDDEN_DATA, 0, 8 }, { T_FAT },
+    { T_END }
+};
+
+// macOS with the AppleDouble companion written first, in front of the image
+static const trace_step_t trace_macos_companion[] = {
+    { T_FAT },
+    { T_HIDDEN_DATA, 0, 8 },
+    { T_DATA, 0, 8 }, { T_DATA, 8, 8 }, { T_DATA, 16, 8 }, { T_DATA, 24, 8 },
+    { T_DATA, 32, 8 }, { T_DATA, 40, 1 },
+    { T_DIR_HIDDEN }, { T_DIR }, { T_FAT },
+    { T_END }
+};
+
+// Linux with a queue depth above 1: single sectors out of order within a
+// block group
+static const trace_step_t trace_linux[] = {
+    { T_DIR }, { T_FAT },
+    { T_DATA, 1, 1 }, { T_DATA, 0, 1 }, { T_DATA, 3, 1 }, { T_DATA, 2, 1 },
+    { T_DATA, 7, 1 }, { T_DATA, 6, 1 }, { T_DATA, 5, 1 }, { T_DATA, 4, 1 },
+    { T_DATA, 8, 8 }, { T_DATA, 24, 8 }, { T_DATA, 16, 8 },
+    { T_DATA, 33, 7 }, { T_DATA, 32, 1 }, { T_DATA, 40, 1 },
+    { T_END }
+};
+
+// A sector rewritten after it has been programmed fails the image
+static const trace_step_t trace_rewrite[] = {
+    { T_DIR }, { T_FAT },
+    { T_DATA, 0, 8 }, { T_DATA, 8, 8 }, { T_DATA, 2, 1 },
+    { T_END }
+};
+
+static uint8_t image[IMAGE_SECTORS * SECTOR];
+static uint32_t image_cluster;              // first cluster of the image file
+static uint32_t hidden_cluster;             // first cluster of the companion
+static uint32_t fail_page;                  // program page call that fails, 0 = none
+static const char *image_name = "FIRMWAREBIN";
+static uint32_t companion_first;            // companion clusters in front of the image
+static uint8_t file[FILE_SECTORS * SECTOR]; // image file in another format
+static const uint8_t *file_data = image;    // image file written by the traces
+static uint32_t file_size = IMAGE_SIZE;
+
+static uint32_t get16(const uint8_t *p) {
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t get32(const uint8_t *p) {
+    return get16(p) | (get16(p + 2) << 16);
+}
+
+static void put16(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+    put16(p, v);
+    put16(p + 2, v >> 16);
+}
+
+static void drive_read(uint32_t sector, uint8_t *buf) {
+    CHECK(MSC_Flash_Read(NULL, sector * SECTOR, buf, SECTOR) == MSC_READ_OK);
+}
+
+static void drive_write(uint32_t sector, uint8_t *buf, uint32_t count) {
+    MSC_Flash_Write(NULL, sector * SECTOR, buf, count * SECTOR);
+}
+
+static uint32_t data_lba(uint32_t cluster, uint32_t sector) {
+    return vfs_data_sector() + (cluster - 2) * vfs_sectors_per_cluster() + sector;
+}
+
+// A free directory slot in the root directory sector read back
+static uint8_t *dir_free_entry(uint8_t *root) {
+    uint32_t i;
+
+    for (i = 0; i < SECTOR; i += 32) {
+        if ((root[i] == 0x00) || (root[i] == 0xE5)) {
+            return &root[i];
+        }
+    }
+    CHECK(0);
+    return NULL;
+}
+
+static void dir_entry(uint8_t *e, const char *name, uint8_t attributes, uint32_t cluster, uint32_t size) {
+    memset(e, 0, 32);
+    memcpy(e, name, 11);
+    e[11] = attributes;
+    put16(e + 20, cluster >> 16);
+    put16(e + 26, cluster);
+    put32(e + 28, size);
+}
+
+// Place the new files behind the clusters of the files on the drive
+static void drive_allocate(void) {
+    uint8_t root[SECTOR];
+    uint32_t i, cluster_bytes, end, last;
+
+    drive_read(vfs_root_sector(), root);
+    cluster_bytes = vfs_sectors_per_cluster() * SECTOR;
+    last = 2;
+    for (i = 0; (i < SECTOR) && (root[i] != 0x00); i += 32) {
+        if ((root[i + 11] & 0x08) || (get32(&root[i + 28]) == 0)) continue;
+        end = ((get16(&root[i + 20]) << 16) | get16(&root[i + 26])) +
+              (get32(&root[i + 28]) + cluster_bytes - 1) / cluster_bytes;
+        if (end > last) last = end;
+    }
+    if (companion_first) {
+        hidden_cluster = last;
+        image_cluster = hidden_cluster + (4096 + cluster_bytes - 1) / cluster_bytes;
+        CHECK(data_lba(image_cluster, (file_size + SECTOR - 1) / SECTOR) <= MSC_Flash_SectorCount());
+    } else {
+        image_cluster = last;
+        hidden_cluster = image_cluster + (file_size + cluster_bytes - 1) / cluster_bytes;
+        CHECK(data_lba(hidden_cluster, 8) <= MSC_Flash_SectorCount());
+    }
+}
+
+static void run_step(const trace_step_t *t) {
+    static uint8_t buf[8 * SECTOR];
+    uint8_t *e;
+
+    switch (t->kind) {
+        case T_DIR_EMPTY:
+        case T_DIR_HIDDEN:
+        case T_DIR:
+            drive_read(vfs_root_sector(), buf);
+            e = dir_free_entry(buf);
+            if (t->kind != T_DIR_EMPTY) {
+                dir_entry(e, "_FIRMW~1BIN", 0x22, hidden_cluster, 4096);
+                e = dir_free_entry(buf);
+            }
+            if (t->kind == T_DIR_EMPTY) {
+                dir_entry(e, image_name, 0x20, 0, 0);
+            } else if (t->kind == T_DIR) {
+                dir_entry(e, image_name, 0x20, image_cluster, file_size);
+            }
+            drive_write(vfs_root_sector(), buf, 1);
+            break;
+        case T_FAT:
+            drive_read(1, buf);
+            drive_write(1, buf, 1);
+            break;
+        case T_DATA:
+            CHECK(t->count <= 8);
+            memcpy(buf, &file_data[t->arg * SECTOR], t->count * SECTOR);
+            drive_write(data_lba(image_cluster, t->arg), buf, t->count);
+            break;
+        case T_HIDDEN_DATA:
+            CHECK(t->count <= 8);
+            memset(buf, 0x00, t->count * SECTOR);
+            if (t->arg == 0) {
+                memcpy(buf, "\x00\x05\x16\x07\x00\x02\x00\x00Mac OS X", 16);
+            }
+            drive_write(data_lba(hidden_cluster, t->arg), buf, t->count);
+            break;
+        default:
+            CHECK(0);
+    }
+}
+
+// Replay a trace, the main loop runs every process_every steps (0: at the end only)
+static void replay(const trace_step_t *trace, uint32_t process_every) {
+    uint32_t i, n;
+
+    stub_target_reset();
+    stub_fail_page = fail_page;
+    MSC_Flash_Init(NULL);
+    USB_DISConnect_Flag = 0;
+    drive_allocate();
+
+    // the host is gone once the drive disconnects
+    for (i = 0; (trace[i].kind != T_END) && !USB_DISConnect_Flag; i++) {
+        run_step(&trace[i]);
+        if (process_every && ((i % process_every) == 0)) {
+            MSC_Flash_Process();
+        }
+    }
+    for (n = 0; (n < 100) && !USB_DISConnect_Flag; n++) {
+        MSC_Flash_Process();
+    }
+}
+
+// Replay file[] as written by Linux: the complete directory entry first,
+// then the data in 4 KB transfers. The end of the last sector is zero.
+static void replay_file(const char *name, uint32_t size) {
+    static trace_step_t trace[STEPS_MAX];
+    uint32_t sectors, n, i;
+
+    CHECK(size <= sizeof(file));
+    memset(&file[size], 0, sizeof(file) - size);
+    sectors = (size + SECTOR - 1) / SECTOR;
+    n = 0;
+    trace[n].kind = T_DIR;
+    n++;
+    trace[n].kind = T_FAT;
+    n++;
+    for (i = 0; i < sectors; i += 8) {
+        trace[n].kind = T_DATA;
+        trace[n].arg = i;
+        trace[n].count = ((sectors - i) < 8) ? (sectors - i) : 8;
+        n++;
+    }
+    trace[n].kind = T_END;
+    CHECK(n < STEPS_MAX);
+
+    file_data = file;
+    file_size = size;
+    image_name = name;
+    replay(trace, 1);
+    file_data = image;
+    file_size = IMAGE_SIZE;
+    image_name = "FIRMWAREBIN";
+}
+
+// The drive offers FAIL.TXT after a failed image
+static uint32_t fail_txt_shown(void) {
+    uint8_t root[SECTOR];
+    uint32_t i;
+
+    drive_read(vfs_root_sector(), root);
+    for (i = 0; i < SECTOR; i += 32) {
+        if (memcmp(&root[i], "FAIL    TXT", 11) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void check_programmed(void) {
+    uint32_t i;
+
+    CHECK(USB_DISConnect_Flag == 1);
+    CHECK(MSC_Flash_State() == MSC_IDLE);
+    CHECK(!fail_txt_shown());
+    CHECK(stub_erase_count == 1);
+    CHECK(memcmp(stub_flash, image, IMAGE_SIZE) == 0);
+    // the rest of the last page is the rest of the last sector written
+    for (i = IMAGE_SECTORS * SECTOR; i < IMAGE_SECTORS * SECTOR + 4096; i++) {
+        CHECK(stub_flash[i] == 0xFF);
+    }
+}
+
+static void test_windows(void) {
+    replay(trace_windows, 1);
+    check_programmed();
+}
+
+static void test_windows_backpressure(void) {
+    // all pages are programmed from within MSC_Flash_Write when the buffers fill
+    replay(trace_windows, 0);
+    check_programmed();
+}
+
+static void test_macos(void) {
+    replay(trace_macos, 1);
+    check_programmed();
+}
+
+static void test_linux(void) {
+    replay(trace_linux, 1);
+    check_programmed();
+    replay(trace_linux, 3);
+    check_programmed();
+}
+
+static void test_rewrite(void) {
+    replay(trace_rewrite, 1);
+    CHECK(USB_DISConnect_Flag == 1);
+    CHECK(fail_txt_shown());
+}
+
+static void test_program_error(void) {
+    fail_page = 3;
+    replay(trace_windows, 1);
+    fail_page = 0;
+    CHECK(USB_DISConnect_Flag == 1);
+    CHECK(fail_txt_shown());
+}
+
+// A RAM image written before its directory entry goes to RAM and is run,
+// the target flash is left alone
+static void test_macos_ram(void) {
+    put32(&image[4], STUB_RAM_START + 0x101);
+    image_name = "FIRMWARERAM";
+    replay(trace_macos, 1);
+    image_name = "FIRMWAREBIN";
+
+    CHECK(USB_DISConnect_Flag == 1);
+    CHECK(!fail_txt_shown());
+    CHECK(stub_erase_count == 0);
+    CHECK(stub_page_count == 0);
+    CHECK(stub_flash[0] == 0xA5);
+    CHECK(memcmp(stub_ram, image, IMAGE_SIZE) == 0);
+    CHECK(stub_run_address == STUB_RAM_START);
+    put32(&image[4], 0x000000C1);
+}
+
+// Sectors of another file filling the reorder slots before any directory
+// entry are not taken for the start of the image
+static void test_macos_companion_first(void) {
+    companion_first = 1;
+    replay(trace_macos_companion, 1);
+    companion_first = 0;
+    check_programmed();
+}
+
+// Without a sector that starts an image the image fails, flash is not erased
+static void test_macos_no_image_start(void) {
+    put32(&image[0], 0);
+    companion_first = 1;
+    replay(trace_macos_companion, 1);
+    companion_first = 0;
+    put32(&image[0], 0x10008000);
+
+    CHECK(USB_DISConnect_Flag == 1);
+    CHECK(fail_txt_shown());
+    CHECK(stub_erase_count == 0);
+    CHECK(stub_page_count == 0);
+}
+
+// The drive has room for an image as large as the target flash, next to
+// FLASH.BIN and RAM.BIN; the boot sector jumps past the BPB of its FAT type
+static void test_volume(void) {
+    uint8_t buf[SECTOR];
+
+    stub_target_reset();
+    MSC_Flash_Init(NULL);
+    CHECK((vfs_sector_count() - vfs_data_sector()) * SECTOR >=
+          2 * STUB_FLASH_SIZE + 32 * 1024);
+    drive_read(0, buf);
+    CHECK((buf[0] == 0xEB) && (buf[1] == 0x3C) && (buf[2] == 0x90));
+
+    vfs_init("FAT32      ", 3UL * 1024 * 1024 * 1024);
+    vfs_read_sector(0, buf);
+    CHECK(memcmp(&buf[82], "FAT32   ", 8) == 0);
+    CHECK((buf[0] == 0xEB) && (buf[1] == 0x58) && (buf[2] == 0x90));
+    vfs_read_sector(6, buf);
+    CHECK((buf[0] == 0xEB) && (buf[1] == 0x58) && (buf[2] == 0x90));
+}
+
+// Intel HEX record, returns its length
+static uint32_t hex_line(char *p, uint8_t type, uint32_t addr, const uint8_t *data, uint32_t count) {
+    uint8_t sum;
+    uint32_t n, i;
+
+    n = sprintf(p, ":%02X%04X%02X", count, addr & 0xFFFF, type);
+    sum = (uint8_t)(count + (addr >> 8) + addr + type);
+    for (i = 0; i < count; i++) {
+        n += sprintf(p + n, "%02X", data[i]);
+        sum += data[i];
+    }
+    n += sprintf(p + n, "%02X\r\n", (uint8_t)-sum);
+    return n;
+}
+
+// Motorola S-record with an address of 2, 3 or 4 bytes (S1, S2, S3 and the
+// terminations S9, S8, S7), returns its length
+static uint32_t srec_line(char *p, uint32_t type, uint32_t addr, const uint8_t *data, uint32_t count) {
+    uint32_t addr_len, n, i;
+    uint8_t sum;
+
+    addr_len = ((type == 0) || (type == 1) || (type == 5) || (type == 9)) ? 2 : ((type == 2) || (type == 8)) ? 3 : 4;
+    n = sprintf(p, "S%u%02X", type, addr_len + count + 1);
+    sum = (uint8_t)(addr_len + count + 1);
+    for (i = addr_len; i > 0; i--) {
+        n += sprintf(p + n, "%02X", (addr >> ((i - 1) * 8)) & 0xFF);
+        sum += (uint8_t)(addr >> ((i - 1) * 8));
+    }
+    for (i = 0; i < count; i++) {
+        n += sprintf(p + n, "%02X", data[i]);
+        sum += data[i];
+    }
+    n += sprintf(p + n, "%02X\n", (uint8_t)~sum);
+    return n;
+}
+
+// Records of image[from..to) at addr, 32 bytes each
+static uint32_t hex_data(char *p, uint32_t addr, uint32_t from, uint32_t to) {
+    uint32_t n = 0;
+
+    for (; from < to; from += 32, addr += 32) {
+        n += hex_line(p + n, 0x00, addr, &image[from], 32);
+    }
+    return n;
+}
+
+static uint32_t srec_data(char *p, uint32_t type, uint32_t addr, uint32_t from, uint32_t to) {
+    uint32_t n = 0;
+
+    for (; from < to; from += 32, addr += 32) {
+        n += srec_line(p + n, type, addr, &image[from], 32);
+    }
+    return n;
+}
+
+// HEX file of image[0..4096): flash 0, after an extended segment address
+// flash 0x10000, after an extended linear address flash 0x20000. The
+// checksum of the record at bad_line (counted from 1) is wrong, 0 = none.
+static uint32_t hex_file(uint32_t bad_line) {
+    static const uint8_t segment[2] = { 0x10, 0x00 };
+    static const uint8_t linear[2] = { 0x00, 0x02 };
+    static const uint8_t zero[2] = { 0x00, 0x00 };
+    char *p = (char *)file;
+    uint32_t n = 0;
+
+    n += hex_line(p + n, 0x04, 0, zero, 2);
+    n += hex_data(p + n, 0x0000, 0, 2048);
+    n += hex_line(p + n, 0x02, 0, segment, 2);
+    n += hex_data(p + n, 0x0000, 2048, 3072);
+    n += hex_line(p + n, 0x04, 0, linear, 2);
+    n += hex_data(p + n, 0x0000, 3072, 4096);
+    n += hex_line(p + n, 0x05, 0, image + 4, 4);
+    n += hex_line(p + n, 0x01, 0, NULL, 0);
+    if (bad_line) {
+        // each data record is 77 characters, its checksum starts 4 before the next one
+        p = (char *)file + 17 + (bad_line - 1) * 77 + 73;
+        *p = (*p == '0') ? '1' : '0';
+    }
+    return n;
+}
+
+// The same image as S-records: S1 to flash 0, S2 to 0x10000, S3 to 0x20000
+static uint32_t srec_file(uint32_t bad_line) {
+    char *p = (char *)file;
+    uint32_t n = 0;
+
+    n += srec_line(p + n, 0, 0, (const uint8_t *)"test", 4);
+    n += srec_data(p + n, 1, 0x000000, 0, 2048);
+    n += srec_data(p + n, 2, 0x010000, 2048, 3072);
+    n += srec_data(p + n, 3, 0x00020000, 3072, 4096);
+    n += srec_line(p + n, 5, 128, NULL, 0);
+    n += srec_line(p + n, 7, 0x000000C1, NULL, 0);
+    if (bad_line) {
+        // S0 is 19 characters, each S1 record 75, its checksum starts 3 before the next one
+        p = (char *)file + 19 + (bad_line - 1) * 75 + 72;
+        *p = (*p == '0') ? '1' : '0';
+    }
+    return n;
+}
+
+static void check_records_programmed(void) {
+    CHECK(USB_DISConnect_Flag == 1);
+    CHECK(MSC_Flash_State() == MSC_IDLE);
+    CHECK(!fail_txt_shown());
+    CHECK(stub_erase_count == 1);
+    CHECK(memcmp(&stub_flash[0x00000], &image[0], 2048) == 0);
+    CHECK(memcmp(&stub_flash[0x10000], &image[2048], 1024) == 0);
+    CHECK(memcmp(&stub_flash[0x20000], &image[3072], 1024) == 0);
+    CHECK(stub_flash[2048] == 0xFF);
+    CHECK(stub_flash[0x10000 + 1024] == 0xFF);
+    CHECK(stub_flash[0x20000 + 1024] == 0xFF);
+}
+
+// Extended segment and linear address records move the data that follows
+static void test_hex(void) {
+    replay_file("FIRMWAREHEX", hex_file(0));
+    check_records_programmed();
+}
+
+// A record with a wrong checksum fails the image, the records behind it are
+// not programmed
+static void test_hex_checksum(void) {
+    replay_file("FIRMWAREHEX", hex_file(40));
+    CHECK(USB_DISConnect_Flag == 1);
+    CHECK(fail_txt_shown());
+    CHECK(memcmp(&stub_flash[0x10000], &image[2048], 1024) != 0);
+}
+
+// 16, 24 and 32 bit addresses
+static void test_srec(void) {
+    replay_file("FIRMWARES19", srec_file(0));
+    check_records_programmed();
+}
+
+static void test_srec_checksum(void) {
+    replay_file("FIRMWARES19", srec_file(40));
+    CHECK(USB_DISConnect_Flag == 1);
+    CHECK(fail_txt_shown());
+    CHECK(memcmp(&stub_flash[0x10000], &image[2048], 1024) != 0);
+}
+
+// ELF32 file: header, the program headers at phoff, a PT_LOAD segment with
+// image[0..data_size) at data_offset for flash 0 and a .bss segment without
+// file data, returns the file size
+static uint32_t elf_file(uint32_t phoff, uint32_t data_offset, uint32_t data_size) {
+    uint8_t *ph;
+    uint32_t size;
+
+    memset(file, 0, sizeof(file));
+    memcpy(file, "\x7F" "ELF\x01\x01\x01", 7);
+    put16(&file[16], 2);                    // ET_EXEC
+    put16(&file[18], 40);                   // EM_ARM
+    put32(&file[20], 1);
+    put32(&file[24], 0x000000C1);
+    put32(&file[28], phoff);
+    put16(&file[40], 52);
+    put16(&file[42], 32);
+    put16(&file[44], 2);
+
+    ph = &file[phoff];
+    put32(&ph[0], 1);                       // PT_LOAD
+    put32(&ph[4], data_offset);
+    put32(&ph[12], 0x00000000);
+    put32(&ph[16], data_size);
+    put32(&ph[20], data_size);
+    ph += 32;
+    put32(&ph[0], 1);                       // .bss
+    put32(&ph[4], data_offset + data_size);
+    put32(&ph[12], 0x10000000);
+    put32(&ph[20], 0x400);
+
+    memcpy(&file[data_offset], image, data_size);
+    size = data_offset + data_size;
+    if ((phoff + 64) > size) {
+        size = phoff + 64;
+    }
+    return size;
+}
+
+// Segment data starting in the sector of the headers and spanning the file
+static void test_elf(void) {
+    replay_file("FIRMWAREAXF", elf_file(52, 0x100, IMAGE_SIZE));
+    check_programmed();
+}
+
+// A file shorter than a sector ends before the header buffer is full
+static void test_elf_small(void) {
+    uint32_t i;
+
+    replay_file("FIRMWAREELF", elf_file(52, 116, 256));
+    CHECK(USB_DISConnect_Flag == 1);
+    CHECK(!fail_txt_shown());
+    CHECK(stub_erase_count == 1);
+    CHECK(memcmp(stub_flash, image, 256) == 0);
+    for (i = 256; i < 512; i++) {
+        CHECK(stub_flash[i] == 0xFF);
+    }
+}
+
+// Program headers behind the first sector (placed after the sections) are
+// not supported: the image fails before anything is programmed
+static void test_elf_headers_late(void) {
+    replay_file("FIRMWAREELF", elf_file(0x100 + IMAGE_SIZE, 0x100, IMAGE_SIZE));
+    CHECK(USB_DISConnect_Flag == 1);
+    CHECK(fail_txt_shown());
+    CHECK(stub_page_count == 0);
+    replay_file("FIRMWAREELF", elf_file(500, 0x300, 1024));
+    CHECK(USB_DISConnect_Flag == 1);
+    CHECK(fail_txt_shown());
+    CHECK(stub_page_count == 0);
+}
+
+static uint8_t lz_expect[8192];             // data of the DPZ file built
+static uint32_t lz_expect_len;
+
+static uint8_t *lz_length(uint8_t *p, uint32_t n) {
+    while (n >= 255) {
+        *p++ = 255;
+        n -= 255;
+    }
+    *p++ = (uint8_t)n;
+    return p;
+}
+
+// LZ4 sequence: literals, then a match unless match is 0 (the last sequence)
+static uint8_t *lz_sequence(uint8_t *p, const uint8_t *literals, uint32_t count, uint32_t offset, uint32_t match) {
+    uint32_t i;
+
+    *p++ = (uint8_t)((((count < 15) ? count : 15) << 4) | (match ? (((match - 4) < 15) ? (match - 4) : 15) : 0));
+    if (count >= 15) {
+        p = lz_length(p, count - 15);
+    }
+    memcpy(p, literals, count);
+    memcpy(&lz_expect[lz_expect_len], literals, count);
+    p += count;
+    lz_expect_len += count;
+    if (match) {
+        put16(p, offset);
+        p += 2;
+        if ((match - 4) >= 15) {
+            p = lz_length(p, match - 4 - 15);
+        }
+        for (i = 0; i < match; i++, lz_expect_len++) {
+            lz_expect[lz_expect_len] = lz_expect[lz_expect_len - offset];
+        }
+    }
+    return p;
+}
+
+// Fill in the header of the block whose sequences follow it up to end
+static void lz_block(uint8_t *header, uint8_t *end, uint32_t start) {
+    uint32_t a = 1, b = 0, i;
+
+    for (i = start; i < lz_expect_len; i++) {
+        a = (a + lz_expect[i]) % 65521;
+        b = (b + a) % 65521;
+    }
+    put16(&header[0], end - (header + 8));
+    put16(&header[2], lz_expect_len - start);
+    put32(&header[4], (b << 16) | a);
+}
+
+// DPZ file of three blocks for flash 0, returns its size. Block 2 copies a
+// match from across the 2 KB block and flash page boundary, overlapping its
+// own output. Block 3 starts at the end of the 4 KB history ring and copies
+// from across its wrap.
+static uint32_t dpz_file(void) {
+    uint8_t *p, *header;
+    uint32_t start;
+
+    memset(file, 0, sizeof(file));
+    memcpy(file, "DAPZ\x01", 5);
+    put32(&file[8], 0x00000000);
+    p = &file[16];
+    lz_expect_len = 0;
+
+    header = p;
+    p += 8;
+    p = lz_sequence(p, image, 2048, 0, 0);
+    lz_block(header, p, 0);
+
+    header = p;
+    p += 8;
+    start = lz_expect_len;
+    p = lz_sequence(p, &image[2048], 10, 300, 600);
+    p = lz_sequence(p, &image[2658], 1438, 0, 0);
+    lz_block(header, p, start);
+
+    header = p;
+    p += 8;
+    start = lz_expect_len;
+    CHECK(start == 4096);
+    p = lz_sequence(p, NULL, 0, 100, 200);
+    p = lz_sequence(p, &image[4096], 800, 0, 0);
+    lz_block(header, p, start);
+
+    put32(&file[12], lz_expect_len);
+    memset(p, 0, 8);
+    p += 8;
+    return p - file;
+}
+
+// Matches are copied from the history whatever boundary they cross
+static void test_dpz(void) {
+    uint32_t i;
+
+    replay_file("FIRMWAREDPZ", dpz_file());
+    CHECK(USB_DISConnect_Flag == 1);
+    CHECK(!fail_txt_shown());
+    CHECK(stub_erase_count == 1);
+    CHECK(lz_expect_len == 5096);
+    CHECK(memcmp(stub_flash, lz_expect, lz_expect_len) == 0);
+    for (i = lz_expect_len; i < 6144; i++) {
+        CHECK(stub_flash[i] == 0xFF);
+    }
+}
+
+int main(void) {
+    uint32_t i;
+
+    // a binary image: initial SP and reset vector, then a pattern
+    for (i = 0; i < sizeof(image); i++) {
+        image[i] = (uint8_t)((i * 7) ^ (i >> 8));
+    }
+    put32(&image[0], 0x10008000);
+    put32(&image[4], 0x000000C1);
+    memset(&image[IMAGE_SIZE], 0xFF, sizeof(image) - IMAGE_SIZE);
+
+    printf("test_msc_trace\n");
+    RUN(test_windows);
+    RUN(test_windows_backpressure);
+    RUN(test_macos);
+    RUN(test_macos_ram);
+    RUN(test_macos_companion_first);
+    RUN(test_macos_no_image_start);
+    RUN(test_linux);
+    RUN(test_rewrite);
+    RUN(test_program_error);
+    RUN(test_volume);
+    RUN(test_hex);
+    RUN(test_hex_checksum);
+    RUN(test_srec);
+    RUN(test_srec_checksum);
+    RUN(test_elf);
+    RUN(test_elf_small);
+    RUN(test_elf_headers_late);
+    RUN(test_dpz);
+    return 0;
+}
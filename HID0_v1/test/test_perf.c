@@ -0,0 +1,165 @@
+/* CMSIS-DAP Interface Firmware
+ * Copyright (c) 2009-2013 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <string.h>
+
+#include "test.h"
+#include "DAP_config.h"
+#include "DAP.h"
+#include "DAP_perf.h"
+#include "perf_decode.h"
+
+// Performance counters: DAP_perf.c is the firmware source, its tables are
+// dumped with ID_DAP_PerfDump requests as the host sends them, logged in the
+// input format of the host decoder (tools/perf_decode.c) and decoded.
+
+static DWT_Type       sim_dwt;
+static CoreDebug_Type sim_core_debug;
+DWT_Type              *DWT = &sim_dwt;
+CoreDebug_Type        *CoreDebug = &sim_core_debug;
+volatile uint32_t     stub_primask;
+
+static char   log_buf[16 * 1024];
+static FILE  *log_file;
+
+// Send a Perf Dump request and log it with the response
+//   return number of entries in the response
+static uint32_t dump(uint8_t table, uint8_t first, uint8_t flags) {
+    uint8_t request[4] = { ID_DAP_PerfDump, table, first, flags };
+    uint8_t response[DAP_PACKET_SIZE];
+    uint32_t n, len;
+
+    response[0] = ID_DAP_PerfDump;
+    len = 1 + Perf_Dump(&request[1], &response[1]);
+    CHECK(len <= DAP_PACKET_SIZE);
+    CHECK(response[1] == DAP_OK);
+
+    fprintf(log_file, "> %02X %02X %02X %02X\n", request[0], request[1], request[2], request[3]);
+    fprintf(log_file, "<");
+    for (n = 0; n < len; n++) {
+        fprintf(log_file, " %02X", response[n]);
+    }
+    fprintf(log_file, "\n");
+    return response[2];
+}
+
+// Read a whole table as the host does, up to an empty response
+static void dump_table(uint8_t table, uint8_t flags) {
+    uint32_t first = 0, n;
+
+    do {
+        n = dump(table, first, 0);
+        first += n;
+    } while (n != 0);
+    if (flags) {
+        dump(table, first, flags);
+    }
+}
+
+static char *decode(void) {
+    static char out[32 * 1024];
+    FILE *in, *dec;
+
+    fflush(log_file);
+    in  = fmemopen(log_buf, strlen(log_buf), "r");
+    dec = fmemopen(out, sizeof(out), "w");
+    CHECK((in != NULL) && (dec != NULL));
+    CHECK(perf_decode(in, dec) == 0);
+    fclose(in);
+    fclose(dec);
+    return out;
+}
+
+static void setup(void) {
+    memset(log_buf, 0, sizeof(log_buf));
+    log_file = fmemopen(log_buf, sizeof(log_buf), "w");
+    CHECK(log_file != NULL);
+    stub_primask = 0;
+    sim_dwt.CYCCNT = 1000;
+    Perf_Init();
+}
+
+// Counters from the main loop and the USB interrupt, the interrupt mask is
+// restored as it was
+static void test_counters(void) {
+    char *out;
+    uint32_t n;
+
+    setup();
+    for (n = 0; n < 3; n++) {
+        PERF_COUNT(PERF_CNT_USB_REPORT);
+    }
+    CHECK(stub_primask == 0);
+    stub_primask = 1;                       // from a section with interrupts masked
+    PERF_COUNT(PERF_CNT_USB_RESPONSE);
+    CHECK(stub_primask == 1);
+    stub_primask = 0;
+    PERF_SWD_TRANSFER(0x02, DAP_TRANSFER_WAIT);
+    PERF_SWD_TRANSFER(0x02, DAP_TRANSFER_OK);
+    PERF_USB_DROP(0x05, 64);
+    CHECK(stub_primask == 0);
+
+    dump_table(PERF_TABLE_COUNTER, 0x01);
+    fclose(log_file);
+    out = decode();
+    CHECK(strstr(out, "counter usb_report              3\n") != NULL);
+    CHECK(strstr(out, "counter usb_response            1\n") != NULL);
+    CHECK(strstr(out, "counter swd_transfer            2\n") != NULL);
+    CHECK(strstr(out, "counter swd_wait                1\n") != NULL);
+    CHECK(strstr(out, "counter usb_drop                1\n") != NULL);
+
+    // cleared with the last request
+    setup();
+    dump_table(PERF_TABLE_COUNTER, 0);
+    fclose(log_file);
+    CHECK(strstr(decode(), "counter usb_report              0\n") != NULL);
+}
+
+// Commands: histogram, per command statistics and trace, the trace read in
+// several responses
+static void test_commands(void) {
+    char *out;
+    uint32_t n;
+
+    setup();
+    for (n = 0; n < 10; n++) {
+        PERF_COMMAND_BEGIN();
+        sim_dwt.CYCCNT += 180;              // 1 us
+        PERF_COMMAND_END(ID_DAP_Transfer);
+    }
+    PERF_COMMAND_BEGIN();
+    sim_dwt.CYCCNT += 1800;
+    PERF_COMMAND_END(ID_DAP_ReadMemory);
+
+    dump_table(PERF_TABLE_HISTOGRAM, 0);
+    dump_table(PERF_TABLE_COMMAND, 0);
+    dump_table(PERF_TABLE_TRACE, 0);
+    fclose(log_file);
+    out = decode();
+    CHECK(strstr(out, "histogram <256        cycles         10\n") != NULL);
+    CHECK(strstr(out, "histogram <2048       cycles          1\n") != NULL);
+    CHECK(strstr(out, "command 0x05         10         1800 cycles        1.0 us avg\n") != NULL);
+    CHECK(strstr(out, "command 0x82          1         1800 cycles       10.0 us avg\n") != NULL);
+    CHECK(strstr(out, "command 0x00") == NULL);
+    CHECK(strstr(out, "trace       1180 cycles          6.6 us command    arg 0x05 value 0x000000B4\n") != NULL);
+    CHECK(strstr(out, "trace       4600 cycles         25.6 us command    arg 0x82 value 0x00000708\n") != NULL);
+}
+
+int main(void) {
+    printf("test_perf\n");
+    RUN(test_counters);
+    RUN(test_commands);
+    return 0;
+}
@@ -0,0 +1,165 @@
+/* CMSIS-DAP Interface Firmware
+ * Copyright (c) 2009-2013 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "test.h"
+#include "ring.h"
+
+#define SIZE    16
+
+static ring_t ring;
+static uint8_t buf[SIZE];
+
+// Start the ring with both indexes at start, as if start elements had passed
+static void ring_start(uint32_t start) {
+    ring_init(&ring, SIZE);
+    ring.in = start;
+    ring.out = start;
+    memset(buf, 0, sizeof(buf));
+}
+
+static void fill(uint8_t *data, uint32_t len, uint8_t first) {
+    uint32_t i;
+
+    for (i = 0; i < len; i++) {
+        data[i] = (uint8_t)(first + i);
+    }
+}
+
+// An empty ring has nothing to peek and all elements to reserve
+static void test_empty(void) {
+    uint32_t index;
+
+    ring_start(0);
+    CHECK(ring_count(&ring) == 0);
+    CHECK(ring_space(&ring) == SIZE);
+    CHECK(ring_peek(&ring, &index) == 0);
+    CHECK(ring_reserve(&ring, &index) == SIZE);
+    CHECK(index == 0);
+}
+
+// A full ring has nothing to reserve, and is told from an empty one
+static void test_full(void) {
+    uint8_t data[SIZE + 1];
+    uint32_t index;
+
+    ring_start(0);
+    fill(data, sizeof(data), 1);
+    CHECK(ring_write(&ring, buf, data, sizeof(data)) == SIZE);
+    CHECK(ring_count(&ring) == SIZE);
+    CHECK(ring_space(&ring) == 0);
+    CHECK(ring_reserve(&ring, &index) == 0);
+    CHECK(ring_write(&ring, buf, data, 1) == 0);
+    CHECK(ring_peek(&ring, &index) == SIZE);
+    CHECK(index == 0);
+
+    // one element out makes one free again
+    ring_release(&ring, 1);
+    CHECK(ring_count(&ring) == SIZE - 1);
+    CHECK(ring_space(&ring) == 1);
+    CHECK(ring_reserve(&ring, &index) == 1);
+    CHECK(index == 0);
+}
+
+// Reserve and peek stop at the end of the storage, the rest follows from
+// its start
+static void test_split_pieces(void) {
+    uint32_t index;
+
+    ring_start(SIZE - 3);
+    CHECK(ring_reserve(&ring, &index) == 3);
+    CHECK(index == SIZE - 3);
+    ring_commit(&ring, 3);
+    CHECK(ring_reserve(&ring, &index) == SIZE - 3);
+    CHECK(index == 0);
+    ring_commit(&ring, 5);
+
+    CHECK(ring_count(&ring) == 8);
+    CHECK(ring_peek(&ring, &index) == 3);
+    CHECK(index == SIZE - 3);
+    ring_release(&ring, 3);
+    CHECK(ring_peek(&ring, &index) == 5);
+    CHECK(index == 0);
+    ring_release(&ring, 5);
+    CHECK(ring_count(&ring) == 0);
+}
+
+// ring_write and ring_read copy across the end of the storage
+static void test_split_copy(void) {
+    uint8_t data[SIZE], out[SIZE];
+    uint32_t start;
+
+    for (start = 0; start < SIZE; start++) {
+        ring_start(start);
+        fill(data, SIZE, 0x40);
+        memset(out, 0, sizeof(out));
+        CHECK(ring_write(&ring, buf, data, SIZE) == SIZE);
+        CHECK(buf[start] == 0x40);
+        CHECK(buf[(start + SIZE - 1) & (SIZE - 1)] == 0x40 + SIZE - 1);
+        CHECK(ring_read(&ring, buf, out, SIZE) == SIZE);
+        CHECK(memcmp(data, out, SIZE) == 0);
+        CHECK(ring_count(&ring) == 0);
+    }
+}
+
+// ring_read copies no more than is there, ring_write no more than fits
+static void test_partial_copy(void) {
+    uint8_t data[SIZE], out[SIZE];
+
+    ring_start(SIZE - 2);
+    fill(data, SIZE, 1);
+    CHECK(ring_write(&ring, buf, data, 5) == 5);
+    CHECK(ring_read(&ring, buf, out, SIZE) == 5);
+    CHECK(memcmp(data, out, 5) == 0);
+    CHECK(ring_read(&ring, buf, out, SIZE) == 0);
+
+    CHECK(ring_write(&ring, buf, data, 10) == 10);
+    CHECK(ring_write(&ring, buf, data + 10, SIZE) == SIZE - 10);
+    CHECK(ring_read(&ring, buf, out, 3) == 3);
+    CHECK(ring_read(&ring, buf, out + 3, SIZE) == SIZE - 3);
+    CHECK(memcmp(data, out, SIZE) == 0);
+}
+
+// The free running indexes wrap around at 2^32
+static void test_index_wrap(void) {
+    uint8_t data[SIZE], out[SIZE];
+    uint32_t index;
+
+    ring_start(0xFFFFFFFF - 5);
+    fill(data, SIZE, 0x80);
+    CHECK(ring_write(&ring, buf, data, SIZE) == SIZE);
+    CHECK(ring.in < ring.out);
+    CHECK(ring_count(&ring) == SIZE);
+    CHECK(ring_space(&ring) == 0);
+    CHECK(ring_reserve(&ring, &index) == 0);
+
+    CHECK(ring_read(&ring, buf, out, 7) == 7);
+    CHECK(ring_count(&ring) == SIZE - 7);
+    CHECK(ring_space(&ring) == 7);
+    CHECK(ring_read(&ring, buf, out + 7, SIZE) == SIZE - 7);
+    CHECK(memcmp(data, out, SIZE) == 0);
+    CHECK(ring_count(&ring) == 0);
+    CHECK(ring_space(&ring) == SIZE);
+}
+
+int main(void) {
+    printf("test_ring\n");
+    RUN(test_empty);
+    RUN(test_full);
+    RUN(test_split_pieces);
+    RUN(test_split_copy);
+    RUN(test_partial_copy);
+    RUN(test_index_wrap);
+    return 0;
+}
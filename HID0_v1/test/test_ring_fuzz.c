@@ -0,0 +1,247 @@
+/* CMSIS-DAP Interface Firmware
+ * Copyright (c) 2009-2013 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <pthread.h>
+#include <sched.h>
+
+#include "test.h"
+#include "ring.h"
+
+// Producer and consumer of a byte ring are cut into the steps between which
+// an interrupt may run the other side: reserve, write one element, commit,
+// and peek, check one element, release. A seeded random schedule picks the
+// side that takes the next step. The producer writes a running byte
+// sequence, the consumer checks it, so data seen before its commit or
+// overwritten before its release shows up as a sequence error.
+//
+// The threaded test then runs ring_write and ring_read at the same time.
+//
+//   test_ring_fuzz [seed]
+
+#define SIZE_MAX_LOG2   6
+#define STEPS           200000
+#define SCHEDULES       64
+#define THREAD_BYTES    (4u * 1024 * 1024)
+
+static uint32_t rand_state;
+
+static uint32_t rand_next(void) {
+    // xorshift32
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 17;
+    rand_state ^= rand_state << 5;
+    return rand_state;
+}
+
+typedef struct {
+    uint32_t index;                     // storage index of the piece
+    uint32_t count;                     // elements in the piece
+    uint32_t done;                      // elements written or checked so far
+    uint8_t  seq;                       // next byte of the sequence
+    uint32_t total;                     // bytes committed or released
+} side_t;
+
+static ring_t ring;
+static uint8_t buf[1 << SIZE_MAX_LOG2];
+
+// One step of the producer
+static void producer_step(side_t *p) {
+    uint32_t n;
+
+    if (p->count == 0) {
+        n = ring_reserve(&ring, &p->index);
+        CHECK(n <= ring.size);
+        if (n == 0) return;
+        // commit a part of the piece at times
+        p->count = 1 + rand_next() % n;
+        p->done = 0;
+    } else if (p->done < p->count) {
+        buf[p->index + p->done] = p->seq++;
+        p->done++;
+    } else {
+        ring_commit(&ring, p->count);
+        p->total += p->count;
+        p->count = 0;
+    }
+}
+
+// One step of the consumer
+static void consumer_step(side_t *c) {
+    uint32_t n;
+
+    if (c->count == 0) {
+        n = ring_peek(&ring, &c->index);
+        CHECK(n <= ring.size);
+        if (n == 0) return;
+        c->count = 1 + rand_next() % n;
+        c->done = 0;
+    } else if (c->done < c->count) {
+        CHECK(buf[c->index + c->done] == c->seq);
+        c->seq++;
+        c->done++;
+    } else {
+        ring_release(&ring, c->count);
+        c->total += c->count;
+        c->count = 0;
+    }
+}
+
+// Whole ring_write and ring_read calls of random length
+static void producer_copy(side_t *p) {
+    uint8_t data[(1 << SIZE_MAX_LOG2) + 8];
+    uint32_t len, n, i;
+
+    len = rand_next() % sizeof(data);
+    for (i = 0; i < len; i++) {
+        data[i] = (uint8_t)(p->seq + i);
+    }
+    n = ring_write(&ring, buf, data, len);
+    CHECK(n <= len);
+    p->seq += n;
+    p->total += n;
+}
+
+static void consumer_copy(side_t *c) {
+    uint8_t data[(1 << SIZE_MAX_LOG2) + 8];
+    uint32_t len, n, i;
+
+    len = rand_next() % sizeof(data);
+    n = ring_read(&ring, buf, data, len);
+    CHECK(n <= len);
+    for (i = 0; i < n; i++) {
+        CHECK(data[i] == c->seq);
+        c->seq++;
+    }
+    c->total += n;
+}
+
+// Run one random schedule on a ring of 2^size_log2 elements whose indexes
+// start at start
+static void run_schedule(uint32_t size_log2, uint32_t start, uint32_t copies) {
+    side_t p, c;
+    uint32_t step, r;
+
+    ring_init(&ring, 1u << size_log2);
+    ring.in = start;
+    ring.out = start;
+    memset(&p, 0, sizeof(p));
+    memset(&c, 0, sizeof(c));
+
+    for (step = 0; step < STEPS; step++) {
+        r = rand_next();
+        // the side that runs in the interrupt often takes several steps in a row
+        if (r & 1) {
+            if (copies && ((r & 0x70) == 0)) {
+                if (p.count == 0) producer_copy(&p);
+            } else {
+                producer_step(&p);
+            }
+        } else {
+            if (copies && ((r & 0x70) == 0)) {
+                if (c.count == 0) consumer_copy(&c);
+            } else {
+                consumer_step(&c);
+            }
+        }
+        CHECK(ring_count(&ring) <= ring.size);
+        CHECK(ring_count(&ring) + ring_space(&ring) == ring.size);
+        CHECK(ring_count(&ring) == p.total - c.total);
+    }
+
+    // drain what is left
+    while (p.count) producer_step(&p);
+    while (ring_count(&ring) || c.count) consumer_step(&c);
+    CHECK(c.total == p.total);
+    CHECK(c.seq == p.seq);
+    CHECK(p.total > 0);
+}
+
+static void test_interleaved_steps(void) {
+    uint32_t i;
+
+    for (i = 0; i < SCHEDULES; i++) {
+        run_schedule(i % (SIZE_MAX_LOG2 + 1), rand_next(), 0);
+    }
+}
+
+static void test_interleaved_copies(void) {
+    uint32_t i;
+
+    for (i = 0; i < SCHEDULES; i++) {
+        run_schedule(i % (SIZE_MAX_LOG2 + 1), 0xFFFFFFFF - (rand_next() % 256), 1);
+    }
+}
+
+static uint32_t thread_seed;
+
+static void *producer_thread(void *arg) {
+    uint8_t data[97];
+    uint32_t seq, sent, len, n, i, r;
+
+    r = thread_seed | 1;
+    seq = 0;
+    for (sent = 0; sent < THREAD_BYTES; sent += n) {
+        r ^= r << 13; r ^= r >> 17; r ^= r << 5;
+        len = 1 + r % sizeof(data);
+        if (len > THREAD_BYTES - sent) len = THREAD_BYTES - sent;
+        for (i = 0; i < len; i++) {
+            data[i] = (uint8_t)(seq + i);
+        }
+        n = ring_write(&ring, buf, data, len);
+        seq += n;
+        if (n < len) {
+            // the ring is full, let the consumer run on a single CPU
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+// ring_write and ring_read running at the same time on two threads
+static void test_threads(void) {
+    pthread_t producer;
+    uint8_t data[61];
+    uint32_t seq, got, n, i;
+
+    ring_init(&ring, 1u << SIZE_MAX_LOG2);
+    ring.in = 0xFFFFFF00;
+    ring.out = 0xFFFFFF00;
+    thread_seed = rand_next();
+    CHECK(pthread_create(&producer, NULL, producer_thread, NULL) == 0);
+
+    seq = 0;
+    for (got = 0; got < THREAD_BYTES; got += n) {
+        n = ring_read(&ring, buf, data, 1 + (got % sizeof(data)));
+        if (n == 0) {
+            sched_yield();
+        }
+        for (i = 0; i < n; i++) {
+            CHECK(data[i] == (uint8_t)seq);
+            seq++;
+        }
+    }
+    CHECK(pthread_join(producer, NULL) == 0);
+    CHECK(ring_count(&ring) == 0);
+}
+
+int main(int argc, char *argv[]) {
+    rand_state = (argc > 1) ? (uint32_t)strtoul(argv[1], NULL, 0) : 0x2545F491;
+    if (rand_state == 0) rand_state = 1;
+    printf("test_ring_fuzz (seed 0x%08X)\n", (unsigned)rand_state);
+    RUN(test_interleaved_steps);
+    RUN(test_interleaved_copies);
+    RUN(test_threads);
+    return 0;
+}
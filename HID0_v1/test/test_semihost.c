@@ -0,0 +1,426 @@
+/* CMSIS-DAP Interface Firmware
+ * Copyright (c) 2009-2013 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <string.h>
+
+#include <RTL.h>
+#include <rl_usb.h>
+
+#include "test.h"
+#include "DAP_config.h"
+#include "DAP.h"
+#include "target_reset.h"
+#include "swd_host.h"
+#include "semihost.h"
+#include "rtt.h"
+#include "UART.h"
+
+// Semihosting console and RTT on the virtual COM port: semihost.c, rtt.c and
+// the CDC user module usbd_user_cdc_acm.c are the firmware sources. The core
+// behind them is simulated: a semihost call halts it at BKPT 0xAB with the
+// operation in R0 and the parameter in R1 until swd_semihost_restart hands
+// back the result, RTT buffers are read and written in its RAM while it runs.
+// The CDC buffers are simulated as well, the terminal takes the output and
+// sends the input.
+
+#define SYS_WRITEC      (0x03)
+#define SYS_WRITE0      (0x04)
+#define SYS_WRITE       (0x05)
+#define SYS_READC       (0x07)
+
+#define SIM_RAM_START   (0x10000000)
+#define SIM_RAM_SIZE    (32*1024)
+#define SIM_STRING      (SIM_RAM_START + 0x100)
+#define SIM_PARAM       (SIM_RAM_START + 0x200)
+#define SIM_BUFFER      (SIM_RAM_START + 0x300)
+#define SIM_RTT_CB      (SIM_RAM_START + 0x1000)    // found after some scan passes
+#define SIM_RTT_UP      (SIM_RAM_START + 0x2000)
+#define SIM_RTT_DOWN    (SIM_RAM_START + 0x2100)
+#define SIM_RTT_SIZE    (128)
+
+#define RTT_UP_DESC     (SIM_RTT_CB + 24)
+#define RTT_DOWN_DESC   (SIM_RTT_CB + 24 + 24)
+#define RTT_WR_OFF      (12)
+#define RTT_RD_OFF      (16)
+
+#define TERM_SIZE       1024
+
+DAP_Data_t DAP_Data;
+
+static DWT_Type       sim_dwt;
+static CoreDebug_Type sim_core_debug;
+DWT_Type              *DWT = &sim_dwt;
+CoreDebug_Type        *CoreDebug = &sim_core_debug;
+
+// Simulated core
+static uint8_t  sim_ram[SIM_RAM_SIZE];
+static uint8_t  sim_halted;                     // halted at BKPT 0xAB
+static uint32_t sim_r0, sim_r1;
+static uint32_t sim_result;                     // R0 handed back on restart
+static uint32_t sim_restarts;
+
+// Simulated CDC buffers and terminal
+static uint8_t  term_out[TERM_SIZE];            // received by the terminal
+static uint32_t term_out_count;
+static int32_t  cdc_free;                       // free space of the send buffer
+static uint8_t  term_in[TERM_SIZE];             // sent by the terminal
+static uint32_t term_in_count, term_in_read;
+
+// UART bridge behind the port
+static uint32_t uart_baudrate;                  // applied baudrate, 0 if stopped
+
+static uint8_t *sim_mem(uint32_t address, uint32_t size) {
+    if ((address < SIM_RAM_START) || ((address - SIM_RAM_START) + size > SIM_RAM_SIZE)) {
+        return NULL;
+    }
+    return &sim_ram[address - SIM_RAM_START];
+}
+
+uint8_t swd_read_memory(uint32_t address, uint8_t *data, uint32_t size) {
+    uint8_t *mem = sim_mem(address, size);
+
+    if (mem == NULL) return 0;
+    memcpy(data, mem, size);
+    return 1;
+}
+
+uint8_t swd_write_memory(uint32_t address, uint8_t *data, uint32_t size) {
+    uint8_t *mem = sim_mem(address, size);
+
+    if (mem == NULL) return 0;
+    memcpy(mem, data, size);
+    return 1;
+}
+
+uint8_t swd_is_semihost_event(uint32_t *r0, uint32_t *r1) {
+    if (!sim_halted) return 0;
+    *r0 = sim_r0;
+    *r1 = sim_r1;
+    return 1;
+}
+
+uint8_t swd_semihost_restart(uint32_t r0) {
+    CHECK(sim_halted);
+    sim_halted = 0;
+    sim_result = r0;
+    sim_restarts++;
+    return 1;
+}
+
+uint8_t swd_select_session(uint8_t ap) { return 1; }
+uint8_t swd_save_state(void) { return 1; }
+uint8_t swd_restore_state(void) { return 1; }
+uint8_t target_set_state(TARGET_RESET_STATE state) { return 1; }
+
+BOOL usbd_configured(void) { return __TRUE; }
+
+int32_t USBD_CDC_ACM_DataSend(const uint8_t *buf, int32_t len) {
+    CHECK(len <= cdc_free);
+    CHECK(term_out_count + len <= TERM_SIZE);
+    memcpy(&term_out[term_out_count], buf, len);
+    term_out_count += len;
+    cdc_free -= len;
+    return len;
+}
+
+int32_t USBD_CDC_ACM_DataFree(void) {
+    return cdc_free;
+}
+
+int32_t USBD_CDC_ACM_DataAvailable(void) {
+    return term_in_count - term_in_read;
+}
+
+int32_t USBD_CDC_ACM_DataRead(uint8_t *buf, int32_t len) {
+    int32_t n = term_in_count - term_in_read;
+
+    if (n > len) n = len;
+    memcpy(buf, &term_in[term_in_read], n);
+    term_in_read += n;
+    return n;
+}
+
+int32_t UART_Initialize(void) {
+    uart_baudrate = 0;
+    return 1;
+}
+
+int32_t UART_Uninitialize(void) {
+    uart_baudrate = 0;
+    return 1;
+}
+
+int32_t UART_Reset(void) {
+    uart_baudrate = 0;
+    return 1;
+}
+
+int32_t UART_SetConfiguration(CDC_LINE_CODING *line_coding) {
+    uart_baudrate = line_coding->dwDTERate;
+    return 1;
+}
+
+int32_t UART_GetConfiguration(CDC_LINE_CODING *line_coding) {
+    line_coding->dwDTERate = uart_baudrate;
+    return 1;
+}
+
+static void put32(uint32_t address, uint32_t value) {
+    CHECK(swd_write_memory(address, (uint8_t *)&value, 4));
+}
+
+static uint32_t get32(uint32_t address) {
+    uint32_t value;
+
+    CHECK(swd_read_memory(address, (uint8_t *)&value, 4));
+    return value;
+}
+
+// Probe started and the terminal connected with the baudrate given
+static void setup(uint32_t baudrate) {
+    CDC_LINE_CODING line_coding = { 0 };
+
+    memset(sim_ram, 0, sizeof(sim_ram));
+    sim_halted = 0;
+    sim_restarts = 0;
+    term_out_count = 0;
+    cdc_free = 64;
+    term_in_count = 0;
+    term_in_read = 0;
+    DAP_Data.debug_port = DAP_PORT_DISABLED;
+
+    USBD_CDC_ACM_PortInitialize();
+    line_coding.dwDTERate = baudrate;
+    line_coding.bDataBits = 8;
+    CHECK(USBD_CDC_ACM_PortSetLineCoding(&line_coding));
+    USBD_CDC_ACM_PortSetControlLineState(0x03);
+
+    semihost_init();
+    semihost_enable();
+}
+
+// The core executes BKPT 0xAB
+static void sim_call(uint32_t op, uint32_t param) {
+    CHECK(!sim_halted);
+    sim_r0 = op;
+    sim_r1 = param;
+    sim_halted = 1;
+}
+
+// Main loop passes, each one after the longest poll interval
+static void run(uint32_t passes) {
+    while (passes--) {
+        DWT->CYCCNT += 256 * (CPU_CLOCK / 1000);
+        Semihost_Process();
+    }
+}
+
+// printf of the target with the console selected
+static void test_console_write0(void) {
+    static const char text[] = "Hello from the target\n";
+
+    setup(CONSOLE_BAUDRATE);
+    CHECK(uart_baudrate == 0);
+    CHECK(swd_write_memory(SIM_STRING, (uint8_t *)text, sizeof(text)));
+
+    sim_call(SYS_WRITE0, SIM_STRING);
+    run(1);
+    CHECK(sim_restarts == 1);
+    CHECK(sim_result == SYS_WRITE0);
+    CHECK(term_out_count == sizeof(text) - 1);
+    CHECK(memcmp(term_out, text, sizeof(text) - 1) == 0);
+}
+
+// Output larger than the free send buffer: the core stays halted on the
+// call until the terminal has taken enough, nothing is sent twice
+static void test_console_write_wait(void) {
+    uint32_t n;
+
+    setup(CONSOLE_BAUDRATE);
+    for (n = 0; n < 100; n++) {
+        sim_ram[SIM_BUFFER - SIM_RAM_START + n] = (uint8_t)n;
+    }
+    put32(SIM_PARAM + 0, 2);                    // stdout
+    put32(SIM_PARAM + 4, SIM_BUFFER);
+    put32(SIM_PARAM + 8, 100);
+
+    sim_call(SYS_WRITE, SIM_PARAM);
+    run(3);
+    CHECK(sim_restarts == 0);
+    CHECK(term_out_count == 64);
+
+    cdc_free = 64;
+    run(1);
+    CHECK(sim_restarts == 1);
+    CHECK(sim_result == 0);                     // all bytes written
+    CHECK(term_out_count == 100);
+    for (n = 0; n < 100; n++) {
+        CHECK(term_out[n] == n);
+    }
+
+    sim_ram[SIM_STRING - SIM_RAM_START] = '!';
+    sim_call(SYS_WRITEC, SIM_STRING);
+    run(1);
+    CHECK(sim_restarts == 2);
+    CHECK(term_out_count == 101);
+    CHECK(term_out[100] == '!');
+}
+
+// getchar of the target waits for the terminal
+static void test_console_readc(void) {
+    setup(CONSOLE_BAUDRATE);
+
+    sim_call(SYS_READC, 0);
+    run(3);
+    CHECK(sim_restarts == 0);
+
+    term_in[term_in_count++] = 'x';
+    run(1);
+    CHECK(sim_restarts == 1);
+    CHECK(sim_result == 'x');
+}
+
+// Any other baudrate bridges the port to the target UART: semihost calls
+// complete, their output is dropped and the input is left to the bridge
+static void test_bridge(void) {
+    static const char text[] = "dropped\n";
+    CDC_LINE_CODING line_coding;
+
+    setup(115200);
+    CHECK(uart_baudrate == 115200);
+    CHECK(swd_write_memory(SIM_STRING, (uint8_t *)text, sizeof(text)));
+
+    sim_call(SYS_WRITE0, SIM_STRING);
+    run(1);
+    CHECK(sim_restarts == 1);
+    CHECK(term_out_count == 0);
+
+    term_in[term_in_count++] = 'x';
+    sim_call(SYS_READC, 0);
+    run(3);
+    CHECK(sim_restarts == 1);
+    CHECK(term_in_read == 0);
+
+    // the console is selected and deselected again while the port is open
+    line_coding.dwDTERate = CONSOLE_BAUDRATE;
+    line_coding.bDataBits = 8;
+    CHECK(USBD_CDC_ACM_PortSetLineCoding(&line_coding));
+    CHECK(uart_baudrate == 0);
+    memset(&line_coding, 0, sizeof(line_coding));
+    CHECK(USBD_CDC_ACM_PortGetLineCoding(&line_coding));
+    CHECK(line_coding.dwDTERate == CONSOLE_BAUDRATE);
+    run(1);
+    CHECK(sim_restarts == 2);
+    CHECK(sim_result == 'x');
+
+    line_coding.dwDTERate = 9600;
+    CHECK(USBD_CDC_ACM_PortSetLineCoding(&line_coding));
+    CHECK(uart_baudrate == 9600);
+    sim_call(SYS_WRITE0, SIM_STRING);
+    run(1);
+    CHECK(sim_restarts == 3);
+    CHECK(term_out_count == 0);
+}
+
+// A bus reset returns to the bridge, a closed terminal gets no output
+static void test_console_closed(void) {
+    static const char text[] = "dropped\n";
+
+    setup(CONSOLE_BAUDRATE);
+    CHECK(swd_write_memory(SIM_STRING, (uint8_t *)text, sizeof(text)));
+
+    USBD_CDC_ACM_PortSetControlLineState(0x00);
+    sim_call(SYS_WRITE0, SIM_STRING);
+    run(1);
+    CHECK(sim_restarts == 1);
+    CHECK(term_out_count == 0);
+
+    USBD_CDC_ACM_PortReset();
+    USBD_CDC_ACM_PortSetControlLineState(0x03);
+    sim_call(SYS_WRITE0, SIM_STRING);
+    run(1);
+    CHECK(sim_restarts == 2);
+    CHECK(term_out_count == 0);
+}
+
+// The target logs through RTT: an up and a down buffer of 128 bytes, with
+// text in the up buffer
+static void sim_rtt(const char *text) {
+    memcpy(&sim_ram[SIM_RTT_CB - SIM_RAM_START], "SEGGER RTT", 11);
+    put32(SIM_RTT_CB + 16, 1);
+    put32(SIM_RTT_CB + 20, 1);
+    put32(RTT_UP_DESC + 4, SIM_RTT_UP);
+    put32(RTT_UP_DESC + 8, SIM_RTT_SIZE);
+    put32(RTT_DOWN_DESC + 4, SIM_RTT_DOWN);
+    put32(RTT_DOWN_DESC + 8, SIM_RTT_SIZE);
+
+    CHECK(swd_write_memory(SIM_RTT_UP, (uint8_t *)text, strlen(text)));
+    put32(RTT_UP_DESC + RTT_WR_OFF, strlen(text));
+}
+
+// RTT with the console selected: the control block is found in target RAM,
+// up buffer 0 goes to the terminal and what it sends to down buffer 0
+static void test_rtt_console(void) {
+    static const char text[] = "RTT from the target\n";
+
+    setup(CONSOLE_BAUDRATE);
+    sim_rtt(text);
+
+    run(40);
+    CHECK(term_out_count == sizeof(text) - 1);
+    CHECK(memcmp(term_out, text, sizeof(text) - 1) == 0);
+    CHECK(get32(RTT_UP_DESC + RTT_RD_OFF) == sizeof(text) - 1);
+
+    term_in[term_in_count++] = 'k';
+    run(1);
+    CHECK(term_in_read == 1);
+    CHECK(get32(RTT_DOWN_DESC + RTT_WR_OFF) == 1);
+    CHECK(sim_ram[SIM_RTT_DOWN - SIM_RAM_START] == 'k');
+}
+
+// With the bridge the RTT data is left in the target and the terminal input
+// to the UART, until the console is selected
+static void test_rtt_bridge(void) {
+    static const char text[] = "RTT from the target\n";
+    CDC_LINE_CODING line_coding = { 0 };
+
+    setup(115200);
+    sim_rtt(text);
+    term_in[term_in_count++] = 'k';
+
+    run(40);
+    CHECK(term_out_count == 0);
+    CHECK(term_in_read == 0);
+    CHECK(get32(RTT_UP_DESC + RTT_RD_OFF) == 0);
+
+    line_coding.dwDTERate = CONSOLE_BAUDRATE;
+    line_coding.bDataBits = 8;
+    CHECK(USBD_CDC_ACM_PortSetLineCoding(&line_coding));
+    run(40);
+    CHECK(term_out_count == sizeof(text) - 1);
+    CHECK(term_in_read == 1);
+}
+
+int main(void) {
+    printf("test_semihost\n");
+    RUN(test_console_write0);
+    RUN(test_console_write_wait);
+    RUN(test_console_readc);
+    RUN(test_bridge);
+    RUN(test_console_closed);
+    RUN(test_rtt_console);
+    RUN(test_rtt_bridge);
+    return 0;
+}
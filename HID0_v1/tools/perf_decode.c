@@ -0,0 +1,170 @@
+/* CMSIS-DAP Interface Firmware
+ * Copyright (c) 2009-2013 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "DAP_config.h"
+#include "DAP.h"
+#include "DAP_perf.h"
+#include "perf_decode.h"
+
+// Host decoder of the ID_DAP_PerfDump tables (DAP_perf.c).
+//
+// Input is the log of the vendor commands as a host sent them, one packet
+// per line in hex bytes: "> " and the request, "< " and the response, each
+// starting with the command ID. Other lines are ignored. A response is
+// decoded with the table and first entry of the request in front of it.
+//
+//   > 85 00 00 00
+//   < 85 00 0b 2a 00 00 00 ...
+//
+// Output is one line per entry, cycles also in microseconds of CPU_CLOCK.
+
+#define PACKET_MAX      1024
+
+static const char *counter_name[PERF_CNT_NUM] = {
+    "dap_command", "swd_transfer", "swd_wait", "swd_fault", "swd_error",
+    "usb_report", "usb_drop", "usb_response", "msc_read", "msc_write",
+    "msc_cycles",
+};
+
+static const char *event_name[] = {
+    "?", "command", "swd_fault", "usb_drop", "msc_read", "msc_write",
+};
+
+static uint32_t get32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static double us(uint32_t cycles) {
+    return cycles / (CPU_CLOCK / 1e6);
+}
+
+// Parse the hex bytes of a packet line
+//   return number of bytes, -1 on a malformed line
+static int parse_packet(const char *line, uint8_t *buf) {
+    char *end;
+    unsigned long v;
+    int n = 0;
+
+    while (1) {
+        v = strtoul(line, &end, 16);
+        if (end == line) break;
+        if ((v > 0xFF) || (n == PACKET_MAX)) return -1;
+        buf[n++] = (uint8_t)v;
+        line = end;
+    }
+    while ((*line == ' ') || (*line == '\t') || (*line == '\r') || (*line == '\n')) line++;
+    return (*line == '\0') ? n : -1;
+}
+
+// Decode the entries of one response
+//   return 0 if the response does not match the table
+static int decode_response(FILE *out, uint32_t table, uint32_t first, const uint8_t *rsp, int len) {
+    uint32_t num, n, size, event;
+    const uint8_t *p;
+
+    if ((len < 3) || (rsp[0] != ID_DAP_PerfDump) || (rsp[1] != DAP_OK)) return 0;
+    num = rsp[2];
+
+    switch (table) {
+        case PERF_TABLE_COUNTER:
+        case PERF_TABLE_HISTOGRAM:  size = 4;  break;
+        case PERF_TABLE_COMMAND:    size = 8;  break;
+        case PERF_TABLE_TRACE:      size = 10; break;
+        default:                    return 0;
+    }
+    if ((uint32_t)len < 3 + num * size) return 0;
+
+    for (n = first, p = &rsp[3]; n < first + num; n++, p += size) {
+        switch (table) {
+            case PERF_TABLE_COUNTER:
+                if (n < PERF_CNT_NUM) {
+                    fprintf(out, "counter %-14s %10u\n", counter_name[n], get32(p));
+                } else {
+                    fprintf(out, "counter %-14u %10u\n", n, get32(p));
+                }
+                break;
+            case PERF_TABLE_HISTOGRAM:
+                if (n < PERF_HISTOGRAM_NUM - 1) {
+                    fprintf(out, "histogram <%-10u cycles %10u\n", 2u << n, get32(p));
+                } else {
+                    fprintf(out, "histogram >=%-9u cycles %10u\n", 1u << n, get32(p));
+                }
+                break;
+            case PERF_TABLE_COMMAND:
+                if (get32(p) == 0) break;
+                fprintf(out, "command 0x%02X %10u %12u cycles %10.1f us avg\n",
+                        (n < 0x20) ? n : ID_DAP_Vendor0 + n - 0x20,
+                        get32(p), get32(p + 4), us(get32(p + 4) / get32(p)));
+                break;
+            case PERF_TABLE_TRACE:
+                event = p[8];
+                fprintf(out, "trace %10u cycles %12.1f us %-10s arg 0x%02X value 0x%08X\n",
+                        get32(p), us(get32(p)),
+                        (event < sizeof(event_name) / sizeof(event_name[0])) ? event_name[event] : "?",
+                        p[9], get32(p + 4));
+                break;
+        }
+    }
+    return 1;
+}
+
+// Decode a command log
+//   return number of responses that did not match their request
+int perf_decode(FILE *in, FILE *out) {
+    static char line[8 * PACKET_MAX];
+    uint8_t  buf[PACKET_MAX];
+    uint32_t table = 0xFF, first = 0;
+    int      len, errors = 0;
+
+    while (fgets(line, sizeof(line), in) != NULL) {
+        if ((line[0] != '>') && (line[0] != '<')) continue;
+        len = parse_packet(&line[1], buf);
+        if (line[0] == '>') {
+            // a request of another command leaves no table to decode with
+            table = 0xFF;
+            if ((len >= 3) && (buf[0] == ID_DAP_PerfDump)) {
+                table = buf[1];
+                first = buf[2];
+            }
+        } else if (table != 0xFF) {
+            if (!decode_response(out, table, first, buf, len)) {
+                fprintf(out, "bad response to table %u entry %u\n", table, first);
+                errors++;
+            }
+            table = 0xFF;
+        }
+    }
+    return errors;
+}
+
+#ifndef PERF_DECODE_NO_MAIN
+int main(int argc, char *argv[]) {
+    FILE *in = stdin;
+
+    if (argc > 2) {
+        fprintf(stderr, "usage: %s [command log]\n", argv[0]);
+        return 2;
+    }
+    if ((argc == 2) && ((in = fopen(argv[1], "r")) == NULL)) {
+        perror(argv[1]);
+        return 2;
+    }
+    return perf_decode(in, stdout) ? 1 : 0;
+}
+#endif
@@ -205,11 +205,11 @@
 //         </h>
 //       </h>
 //     </e>
-#define USBD_MSC_ENABLE             0
+#define USBD_MSC_ENABLE             1
 #define USBD_MSC_EP_BULKIN          2
 #define USBD_MSC_EP_BULKOUT         2
 #define USBD_MSC_WMAXPACKETSIZE     64
-#define USBD_MSC_HS_ENABLE          0
+#define USBD_MSC_HS_ENABLE          1
 #define USBD_MSC_HS_WMAXPACKETSIZE  512
 #define USBD_MSC_HS_BINTERVAL       0
 #define USBD_MSC_STRDESC            L"USB_MSC"
@@ -309,14 +309,16 @@
 //         <s1.126> Data Class Interface String
 //         <o13> Maximum Communication Device Send Buffer Size
 //            <8=>     8 Bytes <16=>   16 Bytes <32=>     32 Bytes <64=>  64 Bytes <128=> 128 Bytes 
-//            <256=> 256 Bytes <512=> 512 Bytes <1024=> 1024 Bytes
+//            <256=> 256 Bytes <512=> 512 Bytes <1024=> 1024 Bytes <2048=> 2048 Bytes <4096=> 4096 Bytes
+//            <8192=> 8192 Bytes
 //         <o14> Maximum Communication Device Receive Buffer Size
 //            <i> Minimum size must be as big as maximum packet size for Bulk Out Endpoint
 //            <8=>     8 Bytes <16=>   16 Bytes <32=>     32 Bytes <64=>  64 Bytes <128=> 128 Bytes 
-//            <256=> 256 Bytes <512=> 512 Bytes <1024=> 1024 Bytes
+//            <256=> 256 Bytes <512=> 512 Bytes <1024=> 1024 Bytes <2048=> 2048 Bytes <4096=> 4096 Bytes
+//            <8192=> 8192 Bytes
 //       </h>
 //     </e>
-#define USBD_CDC_ACM_ENABLE             0
+#define USBD_CDC_ACM_ENABLE             1
 #define USBD_CDC_ACM_EP_INTIN           3
 #define USBD_CDC_ACM_WMAXPACKETSIZE     16
 #define USBD_CDC_ACM_BINTERVAL          32
@@ -326,13 +328,16 @@
 #define USBD_CDC_ACM_EP_BULKIN          4
 #define USBD_CDC_ACM_EP_BULKOUT         4
 #define USBD_CDC_ACM_WMAXPACKETSIZE1    64
-#define USBD_CDC_ACM_HS_ENABLE1         0
-#define USBD_CDC_ACM_HS_WMAXPACKETSIZE1 64
+#define USBD_CDC_ACM_HS_ENABLE1         1
+#define USBD_CDC_ACM_HS_WMAXPACKETSIZE1 512
 #define USBD_CDC_ACM_HS_BINTERVAL1      0
 #define USBD_CDC_ACM_CIF_STRDESC        L"USB_CDC"
 #define USBD_CDC_ACM_DIF_STRDESC        L"USB_CDC1"
-#define USBD_CDC_ACM_SENDBUF_SIZE       128
-#define USBD_CDC_ACM_RECEIVEBUF_SIZE    128
+#define USBD_CDC_ACM_SENDBUF_SIZE       4096
+#define USBD_CDC_ACM_RECEIVEBUF_SIZE    4096
+#if ((USBD_CDC_ACM_SENDBUF_SIZE & (USBD_CDC_ACM_SENDBUF_SIZE - 1)) || (USBD_CDC_ACM_RECEIVEBUF_SIZE & (USBD_CDC_ACM_RECEIVEBUF_SIZE - 1)))
+#error "Send and Receive Buffer sizes must be a power of 2!"
+#endif
 #if (((USBD_CDC_ACM_HS_ENABLE1) && (USBD_CDC_ACM_SENDBUF_SIZE    < USBD_CDC_ACM_HS_WMAXPACKETSIZE1)) || (USBD_CDC_ACM_SENDBUF_SIZE    < USBD_CDC_ACM_WMAXPACKETSIZE1))
 #error "Send Buffer size must be larger or equal to Bulk In maximum packet size!"
 #endif
@@ -340,6 +345,55 @@
 #error "Receive Buffer size must be larger or equal to Bulk Out maximum packet size!"
 #endif
 
+//     <e0> SWO Trace Stream (Vendor Class)
+//       <i> Enable the vendor interface that streams SWO trace data and data watch samples (see Stream.c)
+//       <h> Bulk Endpoint Settings
+//         <o1.0..4> Bulk In Endpoint Number                  <1=>   1 <2=>   2 <3=>   3
+//                                            <4=>   4        <5=>   5 <6=>   6 <7=>   7
+//                                            <8=>   8        <9=>   9 <10=> 10 <11=> 11
+//                                            <12=>  12       <13=> 13 <14=> 14 <15=> 15
+//         <h> Endpoint Settings
+//           <o2> Maximum Packet Size <1-1024>
+//           <e3> High-speed
+//             <i> If high-speed is enabled set endpoint settings for it
+//             <o4> Maximum Packet Size <1-1024>
+//           </e>
+//         </h>
+//       </h>
+//       <s5.126> SWO Interface String
+//     </e>
+#define USBD_SWO_ENABLE             1
+#define USBD_SWO_EP_BULKIN          5
+#define USBD_SWO_WMAXPACKETSIZE     64
+#define USBD_SWO_HS_ENABLE          1
+#define USBD_SWO_HS_WMAXPACKETSIZE  512
+#define USBD_SWO_STRDESC            L"CMSIS-DAP SWO"
+
+//     <e0> Data Watch Stream (Vendor Class)
+//       <i> Enable the vendor interface that streams sampled target memory (see Watch.c)
+//       <i> Not used on USB0: its endpoints are taken, the samples share the SWO endpoint (see Stream.c)
+//       <h> Bulk Endpoint Settings
+//         <o1.0..4> Bulk In Endpoint Number                  <1=>   1 <2=>   2 <3=>   3
+//                                            <4=>   4        <5=>   5 <6=>   6 <7=>   7
+//                                            <8=>   8        <9=>   9 <10=> 10 <11=> 11
+//                                            <12=>  12       <13=> 13 <14=> 14 <15=> 15
+//         <h> Endpoint Settings
+//           <o2> Maximum Packet Size <1-1024>
+//           <e3> High-speed
+//             <i> If high-speed is enabled set endpoint settings for it
+//             <o4> Maximum Packet Size <1-1024>
+//           </e>
+//         </h>
+//       </h>
+//       <s5.126> Data Watch Interface String
+//     </e>
+#define USBD_WATCH_ENABLE             0
+#define USBD_WATCH_EP_BULKIN          2
+#define USBD_WATCH_WMAXPACKETSIZE     64
+#define USBD_WATCH_HS_ENABLE          1
+#define USBD_WATCH_HS_WMAXPACKETSIZE  512
+#define USBD_WATCH_STRDESC            L"CMSIS-DAP Data Watch"
+
 //     <e0> Custom Class Device
 //       <i> Enables USB Custom Class Requests
 //       <i> Class IDs:
@@ -364,8 +418,8 @@
 
 /* USB Device Calculations ---------------------------------------------------*/
 
-#define USBD_IF_NUM                (USBD_HID_ENABLE+USBD_MSC_ENABLE+(USBD_ADC_ENABLE*2)+(USBD_CDC_ACM_ENABLE*2)+USBD_CLS_ENABLE)
-#define USBD_MULTI_IF              (0)//USBD_CDC_ACM_ENABLE*(USBD_HID_ENABLE|USBD_MSC_ENABLE|USBD_ADC_ENABLE))
+#define USBD_IF_NUM                (USBD_HID_ENABLE+USBD_MSC_ENABLE+(USBD_ADC_ENABLE*2)+(USBD_CDC_ACM_ENABLE*2)+USBD_SWO_ENABLE+USBD_WATCH_ENABLE+USBD_CLS_ENABLE)
+#define USBD_MULTI_IF              (USBD_CDC_ACM_ENABLE*(USBD_HID_ENABLE|USBD_MSC_ENABLE|USBD_ADC_ENABLE))
 #define MAX(x, y)                (((x) < (y)) ? (y) : (x))
 #define USBD_EP_NUM_CALC0           MAX((USBD_HID_ENABLE    *(USBD_HID_EP_INTIN     )), (USBD_HID_ENABLE    *(USBD_HID_EP_INTOUT!=0)*(USBD_HID_EP_INTOUT)))
 #define USBD_EP_NUM_CALC1           MAX((USBD_MSC_ENABLE    *(USBD_MSC_EP_BULKIN    )), (USBD_MSC_ENABLE    *(USBD_MSC_EP_BULKOUT)))
@@ -374,7 +428,8 @@
 #define USBD_EP_NUM_CALC4           MAX(USBD_EP_NUM_CALC0, USBD_EP_NUM_CALC1)
 #define USBD_EP_NUM_CALC5           MAX(USBD_EP_NUM_CALC2, USBD_EP_NUM_CALC3)
 #define USBD_EP_NUM_CALC6           MAX(USBD_EP_NUM_CALC4, USBD_EP_NUM_CALC5)
-#define USBD_EP_NUM                (USBD_EP_NUM_CALC6)
+#define USBD_EP_NUM_CALC7           MAX((USBD_SWO_ENABLE    *(USBD_SWO_EP_BULKIN    )), (USBD_WATCH_ENABLE  *(USBD_WATCH_EP_BULKIN)))
+#define USBD_EP_NUM                 MAX(USBD_EP_NUM_CALC6, USBD_EP_NUM_CALC7)
 
 #if    (USBD_HID_ENABLE)
 #if    (USBD_MSC_ENABLE)
@@ -435,6 +490,25 @@
 #endif
 #endif
 
+#if    (USBD_SWO_ENABLE)
+#if   ((USBD_HID_ENABLE     && (USBD_SWO_EP_BULKIN == USBD_HID_EP_INTIN))      || \
+       (USBD_MSC_ENABLE     && (USBD_SWO_EP_BULKIN == USBD_MSC_EP_BULKIN))     || \
+       (USBD_CDC_ACM_ENABLE && (USBD_SWO_EP_BULKIN == USBD_CDC_ACM_EP_INTIN))  || \
+       (USBD_CDC_ACM_ENABLE && (USBD_SWO_EP_BULKIN == USBD_CDC_ACM_EP_BULKIN)))
+#error "SWO Trace Stream can not use the same Endpoint as another Interface!"
+#endif
+#endif
+
+#if    (USBD_WATCH_ENABLE)
+#if   ((USBD_HID_ENABLE     && (USBD_WATCH_EP_BULKIN == USBD_HID_EP_INTIN))      || \
+       (USBD_MSC_ENABLE     && (USBD_WATCH_EP_BULKIN == USBD_MSC_EP_BULKIN))     || \
+       (USBD_CDC_ACM_ENABLE && (USBD_WATCH_EP_BULKIN == USBD_CDC_ACM_EP_INTIN))  || \
+       (USBD_CDC_ACM_ENABLE && (USBD_WATCH_EP_BULKIN == USBD_CDC_ACM_EP_BULKIN)) || \
+       (USBD_SWO_ENABLE     && (USBD_WATCH_EP_BULKIN == USBD_SWO_EP_BULKIN)))
+#error "Data Watch Stream can not use the same Endpoint as another Interface!"
+#endif
+#endif
+
 #define USBD_ADC_CIF_NUM           (0)
 #define USBD_ADC_SIF1_NUM          (1)
 #define USBD_ADC_SIF2_NUM          (2)
@@ -442,6 +516,8 @@
 #define USBD_CDC_ACM_CIF_NUM       (USBD_ADC_ENABLE*2+USBD_MSC_ENABLE*1+0)
 #define USBD_CDC_ACM_DIF_NUM       (USBD_ADC_ENABLE*2+USBD_MSC_ENABLE*1+1)
 #define USBD_HID_IF_NUM            (USBD_ADC_ENABLE*2+USBD_MSC_ENABLE*1+USBD_CDC_ACM_ENABLE*2+0)
+#define USBD_SWO_IF_NUM            (USBD_ADC_ENABLE*2+USBD_MSC_ENABLE*1+USBD_CDC_ACM_ENABLE*2+USBD_HID_ENABLE)
+#define USBD_WATCH_IF_NUM          (USBD_ADC_ENABLE*2+USBD_MSC_ENABLE*1+USBD_CDC_ACM_ENABLE*2+USBD_HID_ENABLE+USBD_SWO_ENABLE)
 
 #define USBD_ADC_CIF_STR_NUM       (3+USBD_STRDESC_SER_ENABLE+0)
 #define USBD_ADC_SIF1_STR_NUM      (3+USBD_STRDESC_SER_ENABLE+1)
@@ -450,6 +526,8 @@
 #define USBD_CDC_ACM_DIF_STR_NUM   (3+USBD_STRDESC_SER_ENABLE+USBD_ADC_ENABLE*3+1)
 #define USBD_HID_IF_STR_NUM        (3+USBD_STRDESC_SER_ENABLE+USBD_ADC_ENABLE*3+USBD_CDC_ACM_ENABLE*2)
 #define USBD_MSC_IF_STR_NUM        (3+USBD_STRDESC_SER_ENABLE+USBD_ADC_ENABLE*3+USBD_CDC_ACM_ENABLE*2+USBD_HID_ENABLE)
+#define USBD_SWO_IF_STR_NUM        (3+USBD_STRDESC_SER_ENABLE+USBD_ADC_ENABLE*3+USBD_CDC_ACM_ENABLE*2+USBD_HID_ENABLE+USBD_MSC_ENABLE)
+#define USBD_WATCH_IF_STR_NUM      (3+USBD_STRDESC_SER_ENABLE+USBD_ADC_ENABLE*3+USBD_CDC_ACM_ENABLE*2+USBD_HID_ENABLE+USBD_MSC_ENABLE+USBD_SWO_ENABLE)
 
 #if    (USBD_HID_ENABLE)
 #if    (USBD_HID_HS_ENABLE)
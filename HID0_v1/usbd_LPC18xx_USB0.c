@@ -9,6 +9,7 @@
  *      Copyright (c) 2004-2013 KEIL - An ARM Company. All rights reserved.
  *---------------------------------------------------------------------------*/
 
+#include <string.h>
 #include <RTL.h>
 #include <rl_usb.h>
 #include <..\..\RL\USB\INC\usb.h>
@@ -52,6 +53,8 @@ EP        Ep[(USBD_EP_NUM + 1) * 2];
 uint32_t  BufUsed;
 
 uint32_t  IsoEp;
+uint32_t  DblBufEp;                     /* bulk OUT endpoints with two buffers */
+uint8_t  *DblBuf[USBD_EP_NUM + 1];      /* first of the two buffers           */
 
 uint32_t  cmpl_pnd;
 
@@ -73,10 +76,12 @@ uint8_t __align(4096) EPBufPool[EP_BUF_POOL_SIZE]
 uint8_t __align(4096) EPBufPool[              
                                 USBD_MAX_PACKET0                                                                                                     * 2 + 
                                 USBD_HID_ENABLE     *  (HS(USBD_HID_HS_ENABLE)     ? USBD_HID_HS_WMAXPACKETSIZE      : USBD_HID_WMAXPACKETSIZE)      * 2 + 
-                                USBD_MSC_ENABLE     *  (HS(USBD_MSC_HS_ENABLE)     ? USBD_MSC_HS_WMAXPACKETSIZE      : USBD_MSC_WMAXPACKETSIZE)      * 2 + 
+                                USBD_MSC_ENABLE     *  (HS(USBD_MSC_HS_ENABLE)     ? USBD_MSC_HS_WMAXPACKETSIZE      : USBD_MSC_WMAXPACKETSIZE)      * 3 + 
+                                USBD_SWO_ENABLE     *  (HS(USBD_SWO_HS_ENABLE)     ? USBD_SWO_HS_WMAXPACKETSIZE      : USBD_SWO_WMAXPACKETSIZE)          + 
+                                USBD_WATCH_ENABLE   *  (HS(USBD_WATCH_HS_ENABLE)   ? USBD_WATCH_HS_WMAXPACKETSIZE    : USBD_WATCH_WMAXPACKETSIZE)        + 
                                 USBD_ADC_ENABLE     *  (HS(USBD_ADC_HS_ENABLE)     ? USBD_ADC_HS_WMAXPACKETSIZE      : USBD_ADC_WMAXPACKETSIZE)          + 
-                                USBD_CDC_ACM_ENABLE * ((HS(USBD_CDC_ACM_HS_ENABLE) ? USBD_CDC_ACM_HS_WMAXPACKETSIZE  : USBD_CDC_ACM_WMAXPACKETSIZE)      + 
-                                                       (HS(USBD_CDC_ACM_HS_ENABLE) ? USBD_CDC_ACM_HS_WMAXPACKETSIZE1 : USBD_CDC_ACM_WMAXPACKETSIZE1) * 2 )];
+                                USBD_CDC_ACM_ENABLE * ((HS(USBD_CDC_ACM_HS_ENABLE)  ? USBD_CDC_ACM_HS_WMAXPACKETSIZE  : USBD_CDC_ACM_WMAXPACKETSIZE)      + 
+                                                       (HS(USBD_CDC_ACM_HS_ENABLE1) ? USBD_CDC_ACM_HS_WMAXPACKETSIZE1 : USBD_CDC_ACM_WMAXPACKETSIZE1) * 3 )];
 #endif
 
 void USBD_PrimeEp     (uint32_t EPNum, uint32_t cnt);
@@ -325,6 +330,7 @@ void USBD_Configure (uint32_t cfg) {
       Ep[i].maxPacket = 0;
     }
     BufUsed           = 2 * USBD_MAX_PACKET0;
+    DblBufEp          = 0;
   }
 }
 
@@ -360,6 +366,16 @@ void USBD_ConfigEP (USB_ENDPOINT_DESCRIPTOR *pEPD) {
     if (type == USB_ENDPOINT_TYPE_ISOCHRONOUS) {
       IsoEp |= (1UL << (num + val));
     }
+
+    /* MSC and CDC bulk OUT endpoint: second buffer, primed while the first
+       is read                                                                */
+    if ((type == USB_ENDPOINT_TYPE_BULK) && !val &&
+        ((USBD_MSC_ENABLE     && (num == USBD_MSC_EP_BULKOUT)) ||
+         (USBD_CDC_ACM_ENABLE && (num == USBD_CDC_ACM_EP_BULKOUT)))) {
+      DblBufEp    |= (1UL << num);
+      DblBuf[num]  =  Ep[idx].buf;
+      BufUsed     +=  pEPD->wMaxPacketSize;
+    }
   }
 
   dTDx[idx].buf[0]    = (uint32_t)(Ep[idx].buf);
@@ -568,6 +584,7 @@ void USBD_PrimeEp (uint32_t EPNum, uint32_t cnt) {
 uint32_t USBD_ReadEP (uint32_t EPNum, uint8_t *pData) {
   uint32_t cnt  = 0;
   uint32_t i;
+  uint8_t *buf;
 
   /* Setup packet                                                             */
   if ((LPC_USBx->ENDPTSETUPSTAT & 1) && (!EPNum)) {
@@ -586,6 +603,25 @@ uint32_t USBD_ReadEP (uint32_t EPNum, uint8_t *pData) {
     USBD_PrimeEp(EPNum, Ep[EP_OUT_IDX(EPNum)].maxPacket);
   }
 
+  /* OUT Packet, double buffered                                              */
+  else if (DblBufEp & (1UL << EPNum)) {
+    buf = Ep[EP_OUT_IDX(EPNum)].buf;
+    cnt = Ep[EP_OUT_IDX(EPNum)].maxPacket - 
+         ((dTDx[EP_OUT_IDX(EPNum)].dTD_token >> 16) & 0x7FFF);
+
+    /* the next packet is received into the other buffer while copying        */
+    if (buf == DblBuf[EPNum]) {
+      Ep[EP_OUT_IDX(EPNum)].buf = buf + Ep[EP_OUT_IDX(EPNum)].maxPacket;
+    } else {
+      Ep[EP_OUT_IDX(EPNum)].buf = DblBuf[EPNum];
+    }
+    LPC_USBx->ENDPTCOMPLETE = (1UL << EPNum);
+    cmpl_pnd &= ~(1UL << EPNum);
+    USBD_PrimeEp(EPNum, Ep[EP_OUT_IDX(EPNum)].maxPacket);
+
+    memcpy(pData, buf, cnt);
+  }
+
   /* OUT Packet                                                               */
   else {
     if (Ep[EP_OUT_IDX(EPNum)].buf) {